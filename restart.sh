@@ -30,8 +30,17 @@ if [ -r $1.db.new ]; then
 	mv $1.db.new $1.db
 	rm -f $1.db.old.Z
 	compress $1.db.old &
+	rm -f $1.db.delta.*
 fi
 
+# Checkpoint deltas written by the last run follow on from $1.db and
+# any deltas it already has.
+n=`ls $1.db.delta.* 2>/dev/null | sed 's/.*\.delta\.//' | sort -n | tail -1`
+for i in `ls $1.db.new.delta.* 2>/dev/null | sed 's/.*\.delta\.//' | sort -n`; do
+	n=$((${n:-0} + 1))
+	mv $1.db.new.delta.$i $1.db.delta.$n
+done
+
 if [ -f $1.log ]; then
 	cat $1.log >> $1.log.old
 	rm $1.log
@@ -18,6 +18,8 @@
 #endif
 
 #include "ansi24.h"
+#include "ansi_tags.h"
+#include "streams.h"
 
 #if MOO_BUILTINS
 #include "functions.h"
@@ -816,160 +818,47 @@ create_ansi24_string (ansi_string &string,
 // -----------------------------------------------------------------------------
 
 // -----------------------------------------------------------------------------
-// This private function is used to implement both
-// replace_color_tags_with_ansi() and remove_color_tags().
+// The tag_resolver given to translate_tags() by translate_color_tags().
 // Note that we can not find one tag and then use replace_substring() to replace
 // all occurences. An earlier tag may change a state (color bits,
 // foreground/background) that will cause a different escape sequence to be
-// generated later.
-// Returns: true  Any existing tags were replaced or removed
-//          false Error
-static bool
-replace_remove_color_tags(char       *replacement,
-                          size_t     size,
-                          const char *original,
-                          bool       remove)
-{
-    bool successful = false;
-    
-    // Make sure we have both strings and that the replacemnt buffer
-    // is at least the size of the original with termination.
-    // That's propbably not large enough if substitutions are made
-    // but if there are none and the string is just a copy it will fit.
-    if (   original    != nullptr
-        && replacement != nullptr
-        && size         > strlen(original)) {
-        do {
-            const char  *bracket_open, *bracket_close, *bracket;
-            size_t      name_length;
-            ansi_string name, ansi;
-
-            // Search for a pair of brackets that will enclose a name
-            if ((bracket_open  = strchr(original,         '[')) == nullptr)
-                break;
-            if ((bracket_close = strchr(bracket_open + 1, ']')) == nullptr)
-                break;
-            // If we have consecutive open brackets skip the first one
-            while (   (bracket = strchr(bracket_open + 1, '[')) != nullptr
-                   &&  bracket < bracket_close)
-                bracket_open = bracket;
-            
-            // A name should be at most length 8 given our uint64_t hack
-            // but a dotted tripple in an RGB value could be longer
-            name_length = bracket_close - bracket_open - 1;
-            if (name_length <= strlen("0xFF.0xFF.0xFF")) {
-                // Extract the possible name
-                // and "test" it by attempting a conversions to ansi
-                memcpy(name.buf, bracket_open + 1, name_length);
-                name.buf[name_length] = 0;
-                if (create_ansi_string(ansi, name.buf)) {
-                    // Copy any leading characters and then
-                    // replace the bracketed name with ansi.
-                    // Unless the remove flag is set then
-                    // do not insert ansi, we are really just
-                    // stripping the tags from the original.
-                    if (copy_substring(replacement,
-                                       size,
-                                       original,
-                                       bracket_open - original)) {
-                        if (! remove) {
-                            if (copy_substring(replacement,
-                                               size,
-                                               ansi.buf,
-                                               strlen(ansi.buf))) {
-                            }
-                            // Buffer too small
-                            else
-                                break;
-                        }
-                    }
-                    // Buffer too small
-                    else
-                        break;
-                }
-                else {
-                    // Copy any leading characters and the mismatch
-                    if (copy_substring(replacement,
-                                       size,
-                                       original,
-                                       bracket_close - original + 1)) {
-                    }
-                    // Buffer too small
-                    else
-                        break;
-                }
-            }
-            else {
-                // Copy any leading characters and the mismatch
-                if (copy_substring(replacement,
-                                   size,
-                                   original,
-                                   bracket_close - original + 1)) {
-                }
-                // Buffer too small
-                else
-                    break;
-            }
-
-            // Continue the search after the closing bracket
-            original = bracket_close + 1;
-        } while(1);
-        
-        // Copy any remaining characters
-        successful = copy_substring(replacement,
-                                    size,
-                                    original,
-                                    strlen(original));
-    }
-    
-    return successful;
-}
+// generated later, so each tag is converted as the scan reaches it.
+// Returns: != nullptr Ansi escape sequence, or "" when removing
+//          == nullptr Not a tag
+struct color_tag_state {
+    ansi_string ansi;
+    bool        remove;
+};
 
-// -----------------------------------------------------------------------------
-// Replace tags with ansi escape sequqnces
-// Returns: true  Any existing tags were replaced
-//          false Error
-bool
-replace_color_tags_with_ansi(char       *replacement,
-                             size_t     size,
-                             const char *original)
+static const char *
+color_tag(const char *name, int length, void *data)
 {
-    bool successful = false;
-    
-    // Buffers are the same so create a temporary.
-    // Escape sequences can be longer than tags so there is
-    // an overwrite hazard for in place replacement.
-    if (replacement == original) {
-        char *buffer = new char[size];
-        
-        successful = replace_remove_color_tags(buffer,
-                                               size,
-                                               original,
-                                               false);
-        strncpy(replacement, buffer, size);
-        replacement[size - 1] = 0;
-        
-        delete[] buffer;
-    }
-    else
-        successful = replace_remove_color_tags(replacement,
-                                               size,
-                                               original,
-                                               false);
-    
-    return successful;
+    color_tag_state *state = (color_tag_state *) data;
+    ansi_string     tag;
+
+    // translate_tags() never passes a name longer than we asked for
+    memcpy(tag.buf, name, length);
+    tag.buf[length] = 0;
+    if (! create_ansi_string(state->ansi, tag.buf))
+        return nullptr;
+
+    // Unless the remove flag is set then
+    // do not insert ansi, we are really just
+    // stripping the tags from the original.
+    return state->remove ? "" : state->ansi.buf;
 }
 
 // -----------------------------------------------------------------------------
-// Remove tags
-// Returns: true  Any existing tags were removed
-//          false Error
-bool
-remove_color_tags(char       *replacement,
-                  size_t     size,
-                  const char *original)
+// Replace or remove the tags in original, appending the result to out
+void
+translate_color_tags(Stream *out, const char *original, bool remove)
 {
-    return replace_remove_color_tags(replacement, size, original, true);
+    color_tag_state state;
+
+    state.remove = remove;
+    // A name should be at most length 8 given our uint64_t hack
+    // but a dotted tripple in an RGB value could be longer
+    translate_tags(out, original, strlen("0xFF.0xFF.0xFF"), color_tag, &state);
 }
 
 // -----------------------------------------------------------------------------
@@ -1811,30 +1700,47 @@ replace_remove_tags(Var arglist, Byte next, void *vdata, Objid progr,
     return make_var_pack(rv);
 }
 
+// -----------------------------------------------------------------------------
+// The tag functions differ only by the remove flag,
+// implement them with common code. The result goes into a single
+// stream sized for the original, so there is no limit on its length.
+// Arguments: TYPE_STR string to translate
+// Returns:   TYPE_STR translated string
+static package
+translate_tags_package(Var arglist, bool remove) {
+    Var    rv;
+    Stream *s = new_stream(memo_strlen(arglist.v.list[1].v.str) * 2 + 1);
+
+    translate_color_tags(s, arglist.v.list[1].v.str, remove);
+    free_var(arglist);
+
+    rv.type  = TYPE_STR;
+    rv.v.str = str_dup(stream_contents(s));
+    free_stream(s);
+
+    return make_var_pack(rv);
+}
+
 // -----------------------------------------------------------------------------
 // Replace tags with ansi escape sequqnces
 // Arguments: TYPE_STR string with color tags
 // Returns:   TYPE_STR string with ansi escape sequences
-//            TYPE_ERR E_RANGE
 // Testing:   ;player:tell(ansi24_replace_tags("The [red]red dog[normal] [bright][blink]barks[normal]."))
 static package
 bf_ansi24_replace_tags(Var arglist, Byte next, void *vdata, Objid progr)
 {
-    return replace_remove_tags(arglist, next, vdata, progr,
-                               replace_color_tags_with_ansi);
+    return translate_tags_package(arglist, false);
 }
 
 // -----------------------------------------------------------------------------
 // Remove tags
 // Arguments: TYPE_STR string with color tags
 // Returns:   TYPE_STR string with no color tags
-//            TYPE_ERR E_RANGE
 // Testing:   ;player:tell(ansi24_remove_tags("The [red]red dog[normal] [bright][blink]barks[normal]."))
 static package
 bf_ansi24_remove_tags(Var arglist, Byte next, void *vdata, Objid progr)
 {
-    return replace_remove_tags(arglist, next, vdata, progr,
-                               remove_color_tags);
+    return translate_tags_package(arglist, true);
 }
 
 // -----------------------------------------------------------------------------
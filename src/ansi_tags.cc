@@ -0,0 +1,230 @@
+/******************************************************************************
+  Copyright (c) 1992, 1995, 1996 Xerox Corporation.  All rights reserved.
+  Portions of this code were written by Stephen White, aka ghond.
+  Use and copying of this software and preparation of derivative works based
+  upon this software are permitted.  Any distribution of this software or
+  derivative works must comply with all applicable United States export
+  control laws.  This software is made available AS IS, and Xerox Corporation
+  makes no warranty about the software, its performance or its conformity to
+  any specification.  Any person obtaining a copy of this software is requested
+  to send their name and post office or electronic mail address to:
+    Pavel Curtis
+    Xerox PARC
+    3333 Coyote Hill Rd.
+    Palo Alto, CA 94304
+    Pavel@Xerox.Com
+ *****************************************************************************/
+
+/* The fixed tag set of parse_ansi() and remove_ansi().
+ *
+ * Both built-ins used to make a pass over the whole string for every tag.
+ * Now translate_tags() finds each candidate `[...]' in a single scan, and
+ * the name is looked up in a case-insensitive trie built the first time it
+ * is needed.  ansi24.cc uses translate_tags() too, with its own resolver.
+ */
+
+#include <ctype.h>
+#include <string.h>
+
+#include "ansi_tags.h"
+#include "random.h"
+#include "streams.h"
+
+static const struct {
+    const char *name;
+    const char *code;		/* nullptr for `[random]' */
+} ansi_tags[] = {
+    {"red",       "\e[31m"},
+    {"green",     "\e[32m"},
+    {"yellow",    "\e[33m"},
+    {"blue",      "\e[34m"},
+    {"purple",    "\e[35m"},
+    {"cyan",      "\e[36m"},
+    {"normal",    "\e[0m"},
+    {"inverse",   "\e[7m"},
+    {"underline", "\e[4m"},
+    {"bold",      "\e[1m"},
+    {"bright",    "\e[1m"},
+    {"unbold",    "\e[22m"},
+    {"blink",     "\e[5m"},
+    {"unblink",   "\e[25m"},
+    {"magenta",   "\e[35m"},
+    {"unbright",  "\e[22m"},
+    {"white",     "\e[37m"},
+    {"gray",      "\e[1;30m"},
+    {"grey",      "\e[1;30m"},
+    {"beep",      "\a"},
+    {"black",     "\e[30m"},
+    {"b:black",   "\e[40m"},
+    {"b:red",     "\e[41m"},
+    {"b:green",   "\e[42m"},
+    {"b:yellow",  "\e[43m"},
+    {"b:blue",    "\e[44m"},
+    {"b:magenta", "\e[45m"},
+    {"b:purple",  "\e[45m"},
+    {"b:cyan",    "\e[46m"},
+    {"b:white",   "\e[47m"},
+    {"random",    nullptr},
+    {"null",      ""},
+};
+
+#define TAG_COUNT	(sizeof(ansi_tags) / sizeof(ansi_tags[0]))
+#define TAG_NULL	(TAG_COUNT - 1)
+
+/* The `[random]' colours; as before, cyan is never picked. */
+static const char *random_codes[] = {
+    "\e[31m", "\e[32m", "\e[33m", "\e[34m", "\e[35m", "\e[35m", "\e[36m"
+};
+
+#define MAX_TRIE_NODES	512
+
+typedef struct {
+    char ch;			/* lower case */
+    short child;		/* first child, or 0 */
+    short sibling;		/* next child of the same parent, or 0 */
+    short tag;			/* 1 + index in ansi_tags[] of the tag that
+				 * ends here, or 0 */
+} trie_node;
+
+static trie_node trie[MAX_TRIE_NODES];	/* trie[0] is the root */
+static int trie_size = 0;
+static int max_tag_length = 0;
+
+static void
+build_trie(void)
+{
+    unsigned i;
+    int n, c;
+    const char *p;
+
+    trie_size = 1;
+    for (i = 0; i < TAG_COUNT; i++) {
+	n = 0;
+	for (p = ansi_tags[i].name; *p; p++) {
+	    for (c = trie[n].child; c && trie[c].ch != *p; c = trie[c].sibling)
+		;
+	    if (!c) {
+		c = trie_size++;
+		trie[c].ch = *p;
+		trie[c].child = 0;
+		trie[c].sibling = trie[n].child;
+		trie[c].tag = 0;
+		trie[n].child = c;
+	    }
+	    n = c;
+	}
+	trie[n].tag = i + 1;
+	if (p - ansi_tags[i].name > max_tag_length)
+	    max_tag_length = p - ansi_tags[i].name;
+    }
+}
+
+/* Returns the index in ansi_tags[] of NAME, or -1. */
+static int
+find_tag(const char *name, int length)
+{
+    int n = 0, c, i;
+
+    if (!trie_size)
+	build_trie();
+
+    for (i = 0; i < length; i++) {
+	char ch = tolower((unsigned char) name[i]);
+
+	for (c = trie[n].child; c && trie[c].ch != ch; c = trie[c].sibling)
+	    ;
+	if (!c)
+	    return -1;
+	n = c;
+    }
+
+    return trie[n].tag - 1;
+}
+
+void
+translate_tags(Stream *out, const char *text, int max_length,
+	       tag_resolver resolve, void *data)
+{
+    const char *open, *close, *r;
+
+    while ((open = strchr(text, '['))) {
+	stream_add_bytes(out, text, open - text);
+	for (close = open + 1;
+	     *close && *close != ']' && *close != '['
+		 && close - open <= max_length;
+	     close++)
+	    ;
+	if (*close == ']' && (r = resolve(open + 1, close - open - 1, data))) {
+	    stream_add_string(out, r);
+	    text = close + 1;
+	} else {
+	    stream_add_char(out, '[');
+	    text = open + 1;
+	}
+    }
+    stream_add_string(out, text);
+}
+
+struct parse_state {
+    bool remove;
+    bool nulls;			/* a `[null]' was removed */
+};
+
+static const char *
+ansi_tag(const char *name, int length, void *data)
+{
+    parse_state *state = (parse_state *) data;
+    int i = find_tag(name, length);
+
+    if (i < 0)
+	return nullptr;
+    else if (state->remove)
+	return "";
+    else if (i == (int) TAG_NULL)
+	state->nulls = true;
+    else if (!ansi_tags[i].code)
+	return random_codes[RANDOM() % 6];
+
+    return ansi_tags[i].code;
+}
+
+static const char *
+null_tag(const char *name, int length, void *data)
+{
+    return find_tag(name, length) == (int) TAG_NULL ? "" : nullptr;
+}
+
+void
+parse_ansi_tags(Stream *out, const char *text)
+{
+    parse_state state = {false, false};
+
+    if (!trie_size)
+	build_trie();
+
+    translate_tags(out, text, max_tag_length, ansi_tag, &state);
+
+    /* parse_ansi() has always removed `[null]' twice, so that `[nu[null]ll]'
+     * comes out empty.  A second `[null]' can only be left where one was
+     * removed.
+     */
+    if (state.nulls) {
+	Stream *tmp = new_stream(stream_length(out) + 1);
+
+	stream_add_string(tmp, reset_stream(out));
+	translate_tags(out, stream_contents(tmp), max_tag_length, null_tag,
+		       nullptr);
+	free_stream(tmp);
+    }
+}
+
+void
+remove_ansi_tags(Stream *out, const char *text)
+{
+    parse_state state = {true, false};
+
+    if (!trie_size)
+	build_trie();
+
+    translate_tags(out, text, max_tag_length, ansi_tag, &state);
+}
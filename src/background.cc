@@ -1,6 +1,14 @@
 #include "background.h"
 #include "bf_register.h"
 #include <unistd.h>                     // sleep()
+#include <fcntl.h>                      // O_NONBLOCK
+#include <pthread.h>                    // snapshot gate
+#include <signal.h>                     // pthread_sigmask
+#include <atomic>                       // completion queue
+#include "config.h"                     // HAVE_EVENTFD
+#if HAVE_EVENTFD
+#include <sys/eventfd.h>
+#endif
 #include "storage.h"                    // myfree, mymalloc
 #include "tasks.h"                      // TEA
 #include "utils.h"                      // var_dup
@@ -31,6 +39,24 @@ static threadpool background_pool;
 static std::map <int, background_waiter*> background_process_table;
 static int next_background_handle = 1;
 
+/* Finished jobs are pushed onto a lock-free stack by the worker threads and drained all at once by the
+ * main loop. The first push onto an empty stack signals the wake fd (an eventfd, or a pipe where that's
+ * unavailable), which is registered with the network layer exactly once. */
+static std::atomic<background_waiter*> completed_waiters(nullptr);
+static int wake_fd[2] = {-1, -1};
+
+thread_local bool in_background_thread = false;
+
+/* The snapshot gate. The main thread owns the database except while it's blocked waiting for network
+ * activity. During that window, waiting background threads are let in one at a time. */
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t snapshot_cond = PTHREAD_COND_INITIALIZER;
+static bool snapshots_open = false;         // The main thread is waiting and snapshots may be granted.
+static bool snapshot_held = false;          // A background thread currently holds a snapshot.
+static unsigned int snapshots_waiting = 0;  // Background threads waiting for a snapshot.
+static unsigned long snapshots_granted = 0;
+static thread_local int snapshot_depth = 0;
+
 /* @forked will use the enumerator to find relevant tasks in your external queue, so everything we've spawned
  * will need to return TEA_CONTINUE to get counted. The enumerator handles cases where you kill_task from inside the MOO. */
 static task_enum_action
@@ -58,28 +84,65 @@ background_enumerator(task_closure closure, void *data)
 }
 
 /* The default thread callback function: Responsible for calling the function specified in the original
- * background function call and then passing it off to the network callback to resume the MOO task. */
+ * background function call and then passing it off to the completion queue to resume the MOO task. */
 void run_callback(void *bw)
 {
     background_waiter *w = (background_waiter*)bw;
 
+    in_background_thread = true;
     w->callback(w->data, &w->return_value);
 
-    // Write to our network pipe to resume the MOO loop
-    write(w->fd[1], "1", 1);
+    // Queue ourselves up and, if the queue was empty, wake the MOO loop
+    background_waiter *head = completed_waiters.load(std::memory_order_relaxed);
+    do {
+        w->next = head;
+    } while (!completed_waiters.compare_exchange_weak(head, w, std::memory_order_release, std::memory_order_relaxed));
+
+    if (head == nullptr) {
+#if HAVE_EVENTFD
+        uint64_t one = 1;
+        write(wake_fd[1], &one, sizeof(one));
+#else
+        write(wake_fd[1], "1", 1);
+#endif
+    }
 }
 
-/* The function called by the network when data has been read. This is the final stage and
- * is responsible for actually resuming the task and cleaning up the associated mess. */
-void network_callback(int fd, void *data)
+/* The function called by the network when the wake fd is readable. This is the final stage and
+ * is responsible for actually resuming the finished tasks and cleaning up the associated mess. */
+static void network_callback(int fd, void *data)
 {
-    background_waiter *w = (background_waiter*)data;
+    // Clear the wakeup before draining so that anything queued after this point wakes us again.
+#if HAVE_EVENTFD
+    uint64_t count;
+    read(fd, &count, sizeof(count));
+#else
+    char buf[128];
+    while (read(fd, buf, sizeof(buf)) > 0)
+        continue;
+#endif
+
+    background_waiter *head = completed_waiters.exchange(nullptr, std::memory_order_acquire);
+
+    // The stack is newest first; resume tasks in the order they finished.
+    background_waiter *ordered = nullptr;
+    while (head != nullptr) {
+        background_waiter *next = head->next;
+        head->next = ordered;
+        ordered = head;
+        head = next;
+    }
+
+    while (ordered != nullptr) {
+        background_waiter *w = ordered;
+        ordered = w->next;
 
-    /* Resume the MOO task if it hasn't already been killed. */
-    if (w->active)
-        resume_task(w->the_vm, var_ref(w->return_value));
+        /* Resume the MOO task if it hasn't already been killed. */
+        if (w->active)
+            resume_task(w->the_vm, var_ref(w->return_value));
 
-    deallocate_background_waiter(w);
+        deallocate_background_waiter(w);
+    }
 }
 
 /* Creates the background_waiter struct and starts the worker thread. */
@@ -90,21 +153,18 @@ background_suspender(vm the_vm, void *data)
     w->the_vm = the_vm;
     w->active = true;
 
-    // Register so we can write to the pipe and resume the main loop if the MOO is idle
-    network_register_fd(w->fd[0], network_callback, nullptr, data);
-
     thpool_add_work(*(w->pool), run_callback, data);
 
     return E_NONE;
 }
 
 /* Create a new background thread, supplying a callback function, a Var of data, and a string of explanatory text for what the thread is.
- * If threading has been disabled for the current verb, this function will invoke the callback immediately. */
+ * If threading has been disabled for the current verb, or the task can't suspend, this function will invoke the callback immediately. */
 package
 background_thread(void (*callback)(Var, Var*), Var* data, char *human_title, threadpool *the_pool)
 {
-    bool threading_enabled = get_thread_mode();
-    if (threading_enabled && !can_create_thread())
+    bool threading_enabled = get_thread_mode() && !suspension_forbidden;
+    if (threading_enabled && (wake_fd[0] == -1 || !can_create_thread()))
     {
         errlog("Can't create a new thread\n");
         return make_error_pack(E_QUOTA);
@@ -124,12 +184,7 @@ background_thread(void (*callback)(Var, Var*), Var* data, char *human_title, thr
         w->data = *data;
         w->human_title = human_title;
         w->pool = (the_pool == nullptr ? &background_pool : the_pool);
-        if (pipe(w->fd) == -1)
-        {
-            errlog("Failed to create pipe for background thread\n");
-            deallocate_background_waiter(w);
-            return make_error_pack(E_QUOTA);
-        }
+        w->next = nullptr;
 
         return make_suspend_pack(background_suspender, (void*)w);
     }
@@ -160,9 +215,6 @@ void initialize_background_waiter(background_waiter *waiter)
 void deallocate_background_waiter(background_waiter *waiter)
 {
     int handle = waiter->handle;
-    network_unregister_fd(waiter->fd[0]);
-    close(waiter->fd[0]);
-    close(waiter->fd[1]);
     free_var(waiter->return_value);
     free_var(waiter->data);
     free(waiter->human_title);
@@ -173,21 +225,79 @@ void deallocate_background_waiter(background_waiter *waiter)
         next_background_handle = 1;
 }
 
+/* The number of background threads that haven't been cleaned up yet. */
+size_t
+background_thread_count()
+{
+    return background_process_table.size();
+}
+
 /* Since threaded functions can only return Vars, not packages, we instead
  * create and return an 'error map'. Which is just a map with the keys:
- * error, which is an error type, and message, which is the error string. */
+ * error, which is an error type, and message, which is the error string.
+ * The keys are created fresh each time because this is called from background
+ * threads, which can't share references with the main thread. */
 void make_error_map(enum error error_type, const char *msg, Var *ret)
 {
-    static Var error_key = str_dup_to_var("error");
-    static Var message_key = str_dup_to_var("message");
-
     Var err;
     err.type = TYPE_ERR;
     err.v.err = error_type;
 
     *ret = new_map();
-    *ret = mapinsert(*ret, var_ref(error_key), err);
-    *ret = mapinsert(*ret, var_ref(message_key), str_dup_to_var(msg));
+    *ret = mapinsert(*ret, str_dup_to_var("error"), err);
+    *ret = mapinsert(*ret, str_dup_to_var("message"), str_dup_to_var(msg));
+}
+
+/* Wait until the main thread is idle and nobody else holds a snapshot. */
+void background_snapshot_begin()
+{
+    if (!in_background_thread || snapshot_depth++ > 0)
+        return;
+
+    pthread_mutex_lock(&snapshot_mutex);
+    snapshots_waiting++;
+    while (!snapshots_open || snapshot_held)
+        pthread_cond_wait(&snapshot_cond, &snapshot_mutex);
+    snapshots_waiting--;
+    snapshots_granted++;
+    snapshot_held = true;
+    pthread_cond_broadcast(&snapshot_cond);
+    pthread_mutex_unlock(&snapshot_mutex);
+}
+
+void background_snapshot_end()
+{
+    if (!in_background_thread || --snapshot_depth > 0)
+        return;
+
+    pthread_mutex_lock(&snapshot_mutex);
+    snapshot_held = false;
+    pthread_cond_broadcast(&snapshot_cond);
+    pthread_mutex_unlock(&snapshot_mutex);
+}
+
+static unsigned long granted_when_opened = 0;
+
+void background_open_snapshots()
+{
+    pthread_mutex_lock(&snapshot_mutex);
+    snapshots_open = true;
+    granted_when_opened = snapshots_granted;
+    pthread_cond_broadcast(&snapshot_cond);
+    pthread_mutex_unlock(&snapshot_mutex);
+}
+
+/* Take the database back. If threads were waiting, make sure at least one of them got a turn
+ * first; otherwise a busy main loop, which never really waits, would starve them forever. */
+void background_close_snapshots()
+{
+    pthread_mutex_lock(&snapshot_mutex);
+    while (snapshots_waiting > 0 && snapshots_granted == granted_when_opened)
+        pthread_cond_wait(&snapshot_cond, &snapshot_mutex);
+    snapshots_open = false;
+    while (snapshot_held)
+        pthread_cond_wait(&snapshot_cond, &snapshot_mutex);
+    pthread_mutex_unlock(&snapshot_mutex);
 }
 /********************************************************************************************************/
 
@@ -238,6 +348,24 @@ static threadpool *thread_pool_by_name(const char* pool)
     return nullptr;
 }
 
+/* Start a pool whose threads never take SIGCHLD.  exec() blocks it in the main
+ * thread until it has recorded a new child's pid; a pool thread could otherwise
+ * run the handler, and reap the child, before then. */
+static threadpool
+new_thread_pool(int num_threads)
+{
+    sigset_t sigchld, old_mask;
+    threadpool pool;
+
+    sigemptyset(&sigchld);
+    sigaddset(&sigchld, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &sigchld, &old_mask);
+    pool = thpool_init(num_threads);
+    pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+
+    return pool;
+}
+
 /* Allows the database to control the thread pools. It's entirely possible
  * that this function is intentionally obtuse to discourage casual usage.
  * bf_thread_pool(STR <function>, STR <pool> [, INT value])
@@ -266,7 +394,7 @@ static package bf_thread_pool(Var arglist, Byte next, void *vdata, Objid progr)
         if (value <= 0)
             *the_pool = nullptr;
         else
-            *the_pool = thpool_init(value);
+            *the_pool = new_thread_pool(value);
         return make_var_pack(Var::new_int(1));
     } else {
         return make_raise_pack(E_INVARG, "Invalid function", str_dup_to_var(func));
@@ -305,11 +433,35 @@ void background_test_callback(Var args, Var *ret)
 }
 #endif
 
+/* Create the fd that worker threads use to wake the main loop when they finish. */
+static bool
+open_wake_fd()
+{
+#if HAVE_EVENTFD
+    wake_fd[0] = wake_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd[0] == -1)
+        return false;
+#else
+    if (pipe(wake_fd) == -1)
+        return false;
+    for (int i = 0; i < 2; i++) {
+        fcntl(wake_fd[i], F_SETFL, fcntl(wake_fd[i], F_GETFL) | O_NONBLOCK);
+        fcntl(wake_fd[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    network_register_fd(wake_fd[0], network_callback, nullptr, nullptr);
+    return true;
+}
+
 void
 register_background()
 {
     register_task_queue(background_enumerator);
-    background_pool = thpool_init(TOTAL_BACKGROUND_THREADS);
+    if (!open_wake_fd()) {
+        log_perror("Failed to create wakeup fd for background threads");
+        wake_fd[0] = wake_fd[1] = -1;
+    }
+    background_pool = new_thread_pool(TOTAL_BACKGROUND_THREADS);
     register_function("threads", 0, 0, bf_threads);
     register_function("thread_info", 1, 1, bf_thread_info, TYPE_INT);
     register_function("thread_pool", 2, 3, bf_thread_pool, TYPE_STR, TYPE_STR, TYPE_INT);
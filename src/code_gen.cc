@@ -19,6 +19,7 @@
 
 #include "ast.h"
 #include "opcode.h"
+#include "optimize.h"
 #include "program.h"
 #include "server.h"
 #include "storage.h"
@@ -1260,6 +1261,7 @@ stmt_to_code(Stmt * stmt, GState * gstate)
     bc.numbytes_stack = ref_size(state.max_stack);
 
     bc.vector = (Byte *)mymalloc(sizeof(Byte) * bc.size, M_BYTECODES);
+    bc.unoptimized = nullptr;
 
 #ifdef BYTECODE_REDUCE_REF
     /*
@@ -1425,5 +1427,9 @@ generate_code(Stmt * stmt, DB_Version version)
 
     free_gstate(gstate);
 
+#ifdef OPTIMIZE_BYTECODE
+    optimize_program(prog);
+#endif /* OPTIMIZE_BYTECODE */
+
     return prog;
 }
@@ -15,13 +15,205 @@
     Pavel@Xerox.Com
  *****************************************************************************/
 
+#include <ctype.h>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+#include <vector>
+
 #include "bf_register.h"
 #include "collection.h"
 #include "functions.h"
 #include "list.h"
 #include "map.h"
+#include "options.h"
+#include "storage.h"
 #include "utils.h"
 
+/* Membership index for large lists.  A list of at least
+ * LIST_INDEX_THRESHOLD elements that has been searched LIST_INDEX_PROBES
+ * times gets an open-addressed hash table of its positions, one table per
+ * kind of string comparison.  Equal values hash to the same chain and are
+ * inserted in list order, so the first match found along a chain is the
+ * one `ismember()' would have found by scanning.  Lists and maps are not
+ * hashed; their positions are kept aside and compared one by one.
+ *
+ * The index hangs off the list allocation (see storage.h).  `listset()'
+ * and in-place `listappend()' drop it, copies never inherit it, and it is
+ * freed along with the list.  Background threads neither build nor use it.
+ */
+struct list_index_table {
+    unsigned mask;
+    std::vector<std::pair<uint32_t, int>> slots;	/* (hash, position) */
+    std::vector<int> collections;
+};
+
+struct list_index {
+    int probes;
+    list_index_table *tables[2];	/* case-insensitive, case-sensitive */
+};
+
+static inline uint32_t
+mix_hash(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (uint32_t) h;
+}
+
+/* Returns false for values that are compared structurally. */
+static bool
+value_hash(Var v, int case_matters, uint32_t *hash)
+{
+    uint64_t h;
+
+    switch (v.type) {
+    case TYPE_INT:
+	h = (uint64_t) v.v.num;
+	break;
+    case TYPE_OBJ:
+	h = (uint64_t) v.v.obj;
+	break;
+    case TYPE_ERR:
+	h = (uint64_t) v.v.err;
+	break;
+    case TYPE_FLOAT:
+	if (v.v.fnum == 0.0)	/* 0.0 == -0.0 */
+	    h = 0;
+	else
+	    memcpy(&h, &v.v.fnum, sizeof(h));
+	break;
+    case TYPE_STR:
+	{
+	    const unsigned char *s = (const unsigned char *) v.v.str;
+
+	    h = 14695981039346656037ULL;
+	    if (case_matters)
+		for (; *s; s++)
+		    h = (h ^ *s) * 1099511628211ULL;
+	    else
+		for (; *s; s++)
+		    h = (h ^ tolower(*s)) * 1099511628211ULL;
+	}
+	break;
+    case TYPE_ANON:
+	h = (uint64_t) (uintptr_t) v.v.anon;
+	break;
+    case TYPE_WAIF:
+	h = (uint64_t) (uintptr_t) v.v.waif;
+	break;
+    case TYPE_LIST:
+    case TYPE_MAP:
+	return false;
+    default:
+	h = 0;
+	break;
+    }
+
+    *hash = mix_hash(h ^ ((uint64_t) v.type << 56));
+    return true;
+}
+
+static list_index_table *
+build_list_index_table(Var list, int case_matters)
+{
+    list_index_table *t = new list_index_table();
+    int i, n = list.v.list[0].v.num;
+    unsigned size = 16;
+    uint32_t h;
+
+    while (size < (unsigned) n * 2)
+	size <<= 1;
+    t->mask = size - 1;
+    t->slots.assign(size, std::make_pair((uint32_t) 0, 0));
+
+    for (i = 1; i <= n; i++) {
+	if (!value_hash(list.v.list[i], case_matters, &h)) {
+	    t->collections.push_back(i);
+	    continue;
+	}
+	unsigned j = h & t->mask;
+	while (t->slots[j].second)
+	    j = (j + 1) & t->mask;
+	t->slots[j] = std::make_pair(h, i);
+    }
+
+    return t;
+}
+
+static int
+list_index_lookup(const list_index_table *t, Var list, Var value,
+		  int case_matters)
+{
+    uint32_t h;
+
+    if (!value_hash(value, case_matters, &h)) {
+	for (int i : t->collections)
+	    if (equality(value, list.v.list[i], case_matters))
+		return i;
+	return 0;
+    }
+
+    for (unsigned j = h & t->mask; t->slots[j].second; j = (j + 1) & t->mask)
+	if (t->slots[j].first == h
+	    && equality(value, list.v.list[t->slots[j].second], case_matters))
+	    return t->slots[j].second;
+
+    return 0;
+}
+
+static void
+destroy_list_index(list_index *index)
+{
+    delete index->tables[0];
+    delete index->tables[1];
+    delete index;
+}
+
+void
+free_list_index(void *list)
+{
+    list_index **slot = list_index_slot(list);
+
+    if (*slot) {
+	destroy_list_index(*slot);
+	*slot = nullptr;
+    }
+}
+
+void
+drop_list_index(Var list)
+{
+    free_list_index(list.v.list);
+}
+
+/* Returns the table to search `list' with, or nullptr if it should
+ * still be scanned.
+ */
+static const list_index_table *
+list_index_for(Var list, int case_matters)
+{
+    list_index **slot = list_index_slot(list.v.list);
+    list_index *index = *slot;
+
+    if (!index) {
+	index = *slot = new list_index();
+	index->probes = 0;
+	index->tables[0] = index->tables[1] = nullptr;
+    }
+
+    if (!index->tables[case_matters]) {
+	if (++index->probes < LIST_INDEX_PROBES)
+	    return nullptr;
+	index->tables[case_matters] = build_list_index_table(list, case_matters);
+    }
+
+    return index->tables[case_matters];
+}
+
 struct ismember_data {
     int i;
     Var value;
@@ -48,6 +240,13 @@ ismember(Var lhs, Var rhs, int case_matters)
     if (rhs.type == TYPE_LIST) {
 	int i;
 
+	if (rhs.v.list[0].v.num >= LIST_INDEX_THRESHOLD && !in_background_thread) {
+	    case_matters = case_matters ? 1 : 0;
+	    const list_index_table *t = list_index_for(rhs, case_matters);
+	    if (t)
+		return list_index_lookup(t, rhs, lhs, case_matters);
+	}
+
 	for (i = 1; i <= rhs.v.list[0].v.num; i++) {
 	    if (equality(lhs, rhs.v.list[i], case_matters)) {
 		return i;
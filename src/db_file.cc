@@ -19,6 +19,12 @@
  * Routines for initializing, loading, dumping, and shutting down the database
  *****************************************************************************/
 
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -43,6 +49,14 @@
 #include "waif.h"
 #include "map.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
 static char *input_db_name, *dump_db_name;
 static int dump_generation = 0;
 static const char *header_format_string
@@ -291,39 +305,13 @@ v4_read_object(void)
     return 1;
 }
 
-static int
-ng_read_object(int anonymous)
+static void
+ng_read_object_fields(Object *o)
 {
-    Objid oid;
-    Object *o;
-    char s[20];
     int i;
     Verbdef *v, **prevv;
     int nprops;
 
-    if (dbio_scanf("#%" SCNdN, &oid) != 1)
-	return 0;
-    dbio_read_line(s, sizeof(s));
-
-    if (strcmp(s, " recycled\n") == 0) {
-	dbpriv_new_recycled_object();
-	return 1;
-    } else if (strcmp(s, "\n") != 0)
-	return 0;
-
-    /* At the point at which we're reading anonymous objects, we know
-     * we've already created all of the anonymous objects (they were
-     * created from references in tasks, other objects or the list
-     * of values pending finalization).
-     */
-    if (anonymous) {
-	o = dbpriv_find_object(oid);
-    }
-    else {
-	o = dbpriv_new_object(-1);
-	dbpriv_assign_nonce(o);
-    }
-
     o->name = dbio_read_string_intern();
     o->flags = dbio_read_num();
 
@@ -380,6 +368,39 @@ ng_read_object(int anonymous)
     for (i = 0; i < nprops; i++) {
 	read_propval(o->propval + i);
     }
+}
+
+static int
+ng_read_object(int anonymous)
+{
+    Objid oid;
+    Object *o;
+    char s[20];
+
+    if (dbio_scanf("#%" SCNdN, &oid) != 1)
+	return 0;
+    dbio_read_line(s, sizeof(s));
+
+    if (strcmp(s, " recycled\n") == 0) {
+	dbpriv_new_recycled_object();
+	return 1;
+    } else if (strcmp(s, "\n") != 0)
+	return 0;
+
+    /* At the point at which we're reading anonymous objects, we know
+     * we've already created all of the anonymous objects (they were
+     * created from references in tasks, other objects or the list
+     * of values pending finalization).
+     */
+    if (anonymous) {
+	o = dbpriv_find_object(oid);
+    }
+    else {
+	o = dbpriv_new_object(-1);
+	dbpriv_assign_nonce(o);
+    }
+
+    ng_read_object_fields(o);
 
     return 1;
 }
@@ -398,7 +419,7 @@ ng_write_object(Objid oid)
     }
     o = dbpriv_find_object(oid);
 
-    dbio_printf("#%" PRIdN "\n", oid);
+    dbio_write_header(oid, -1);
     dbio_write_string(o->name);
     dbio_write_num(o->flags);
 
@@ -431,6 +452,76 @@ ng_write_object(Objid oid)
 
 /*********** File-level Input ***********/
 
+/* A database or delta file being read.  It is mapped into memory, so that
+ * DBIO can scan it in place, or read into memory if it can't be mapped.
+ */
+struct input_file {
+    char *data;
+    size_t size;
+    bool mapped;
+};
+
+static bool
+open_input_file(const char *name, input_file *f)
+{
+    struct stat st;
+    int fd = open(name, O_RDONLY | O_CLOEXEC);
+    ssize_t n = 0;
+    size_t capacity = 0;
+
+    if (fd < 0)
+	return false;
+
+    f->data = nullptr;
+    f->size = 0;
+    f->mapped = false;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+	void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	if (p != MAP_FAILED) {
+	    madvise(p, st.st_size, MADV_SEQUENTIAL);
+	    f->data = (char *) p;
+	    f->size = st.st_size;
+	    f->mapped = true;
+	}
+    }
+    while (!f->mapped) {
+	if (f->size == capacity) {
+	    if (capacity) {
+		capacity *= 2;
+		f->data = (char *) myrealloc(f->data, capacity, M_STRUCT);
+	    } else {
+		capacity = 65536;
+		f->data = (char *) mymalloc(capacity, M_STRUCT);
+	    }
+	}
+	n = read(fd, f->data + f->size, capacity - f->size);
+	if (n < 0 && errno == EINTR)
+	    continue;
+	if (n <= 0)
+	    break;
+	f->size += n;
+    }
+    close(fd);
+    if (n < 0) {
+	myfree(f->data, M_STRUCT);
+	return false;
+    }
+
+    return true;
+}
+
+static void
+close_input_file(input_file *f)
+{
+    if (f->mapped)
+	munmap(f->data, f->size);
+    else if (f->data)
+	myfree(f->data, M_STRUCT);
+    f->data = nullptr;
+    f->size = 0;
+}
+
 static int
 v4_validate_hierarchies(void)
 {
@@ -824,14 +915,215 @@ fmt_verb_name(void *data)
     return reset_stream(s);
 }
 
+/* Verb programs are compiled on up to LOAD_THREADS threads at once (see
+ * options.h) while the main thread reads the ones after them.  They are
+ * installed, and their string literals interned, on the main thread in
+ * the order they appear in the file, and one that has errors or
+ * warnings is compiled again there to report them, so the result and
+ * the log are the same as if they had been compiled one by one.
+ */
+
+#define LOAD_QUEUE_SIZE		4096	/* read but not yet installed */
+#define LOAD_THREADS_MINIMUM	100	/* programs worth starting them for */
+
+struct program_job {
+    Objid oid;
+    Num vnum;
+    const char *text;		/* in the input */
+    size_t text_length;
+    bool complete;		/* the text ended properly */
+    bool quiet;			/* compiled on another thread */
+    bool compiled;
+    Program *program;
+};
+
+static int
+load_threads(void)
+{
+    int n = LOAD_THREADS > 0 ? LOAD_THREADS
+	: (int) std::thread::hardware_concurrency();
+
+    return n > 1 ? n : 1;
+}
+
+/* Reads the header and text of program I into JOB; on failure, leaves
+ * a message in ERROR.
+ */
+static bool
+read_program_job(program_job &job, Num i, char *error, size_t size)
+{
+    if (dbio_scanf("#%" SCNdN ":%" SCNdN "\n", &job.oid, &job.vnum) != 2) {
+	snprintf(error, size, "READ_DB_FILE: Bad program header, i = %" PRIdN ".\n", i);
+	return false;
+    }
+    if (!valid(job.oid)) {
+	snprintf(error, size, "READ_DB_FILE: Verb for non-existant object: #%" PRIdN ":%" PRIdN ".\n", job.oid, job.vnum);
+	return false;
+    }
+    if (!db_find_indexed_verb(Var::new_obj(job.oid), job.vnum + 1).ptr) {	/* DB file is 0-based. */
+	snprintf(error, size, "READ_DB_FILE: Unknown verb index: #%" PRIdN ":%" PRIdN ".\n", job.oid, job.vnum);
+	return false;
+    }
+    job.complete = dbio_read_program_text(&job.text, &job.text_length);
+    job.quiet = false;
+    job.compiled = false;
+    job.program = nullptr;
+
+    return true;
+}
+
+static void
+intern_literals(Program *program)
+{
+    for (unsigned i = 0; i < program->num_literals; i++) {
+	Var *v = &program->literals[i];
+
+	if (v->type == TYPE_STR) {
+	    const char *s = str_intern(v->v.str);
+
+	    free_str(v->v.str);
+	    v->v.str = s;
+	}
+    }
+}
+
+static bool
+install_program_job(program_job &job)
+{
+    Program *program = job.program;
+    /* Found again here: handles are only good until the next lookup, and
+     * later programs may have been read since this one was. */
+    db_verb_handle h = db_find_indexed_verb(Var::new_obj(job.oid), job.vnum + 1);
+
+    if (!job.quiet)
+	program = dbio_compile_program(dbio_input_version, job.text,
+				       job.text_length, job.complete, false,
+				       fmt_verb_name, &h);
+    else if (!program)		/* report the problems */
+	program = dbio_compile_program(dbio_input_version, job.text,
+				       job.text_length, job.complete, false,
+				       fmt_verb_name, &h);
+    else
+	intern_literals(program);
+    job.program = nullptr;
+
+    if (!program) {
+	errlog("READ_DB_FILE: Unparsable program #%" PRIdN ":%" PRIdN ".\n", job.oid, job.vnum);
+	return false;
+    }
+    db_set_verb_program(h, program);
+
+    return true;
+}
+
+static int
+read_verb_programs(Num nprogs)
+{
+    Num queue_size = std::min<Num>(nprogs, LOAD_QUEUE_SIZE);
+    std::vector<program_job> jobs(queue_size);
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work, done;
+    Num nread = 0, ncompiling = 0, ninstalled = 0, last = nprogs;
+    bool reading = true;
+    char error[200];
+
+    error[0] = '\0';
+    oklog("LOADING: Reading %" PRIdN " MOO verb programs ...\n", nprogs);
+
+    auto compile_jobs = [&]() {
+	std::unique_lock<std::mutex> lock(mutex);
+
+	in_background_thread = true;
+	for (;;) {
+	    work.wait(lock, [&] { return ncompiling < nread || !reading; });
+	    if (ncompiling == nread)
+		return;
+
+	    program_job &job = jobs[ncompiling++ % queue_size];
+
+	    lock.unlock();
+	    job.program = dbio_compile_program(dbio_input_version, job.text,
+					       job.text_length, job.complete, true,
+					       nullptr, nullptr);
+	    lock.lock();
+	    job.compiled = true;
+	    done.notify_one();
+	}
+    };
+
+    if (nprogs >= LOAD_THREADS_MINIMUM && load_threads() > 1)
+	for (int i = load_threads(); i > 0; i--) {
+	    try {
+		workers.emplace_back(compile_jobs);
+	    } catch (const std::system_error &) {
+		break;
+	    }
+	}
+
+    while (ninstalled < last) {
+	program_job &next = jobs[ninstalled % queue_size];
+	bool ready;
+
+	{
+	    std::lock_guard<std::mutex> lock(mutex);
+
+	    ready = ninstalled < nread && (next.compiled || workers.empty());
+	}
+
+	/* Keep the workers busy before installing anything. */
+	if (!ready && nread < last && nread - ninstalled < queue_size) {
+	    program_job &job = jobs[nread % queue_size];
+
+	    if (!read_program_job(job, nread + 1, error, sizeof(error)))
+		last = nread;	/* install the ones before it */
+	    else {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		job.quiet = !workers.empty();
+		nread++;
+		work.notify_one();
+	    }
+	    continue;
+	}
+
+	if (!workers.empty()) {
+	    std::unique_lock<std::mutex> lock(mutex);
+
+	    done.wait(lock, [&] { return next.compiled; });
+	}
+	if (!install_program_job(next)) {
+	    error[0] = '\0';
+	    break;
+	}
+	ninstalled++;
+	if (ninstalled % 5000 == 0 || ninstalled == nprogs)
+	    oklog("LOADING: Done reading %" PRIdN " verb programs ...\n", ninstalled);
+    }
+
+    {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	reading = false;
+	work.notify_all();
+    }
+    for (auto &worker : workers)
+	worker.join();
+    for (auto &job : jobs)
+	if (job.program)
+	    free_program(job.program);
+
+    if (error[0])
+	errlog("%s", error);
+
+    return ninstalled == nprogs;
+}
+
 static int
 read_db_file(void)
 {
-    Objid oid;
     Var user_list;
-    Num i, nobjs, nprogs, nusers, vnum, dummy;
-    db_verb_handle h;
-    Program *program;
+    Num i, nobjs, nprogs, nusers, dummy;
 
     waif_before_loading();
 
@@ -968,30 +1260,8 @@ read_db_file(void)
 	}
     }
 
-    oklog("LOADING: Reading %" PRIdN " MOO verb programs ...\n", nprogs);
-    for (i = 1; i <= nprogs; i++) {
-	if (dbio_scanf("#%" SCNdN ":%" SCNdN "\n", &oid, &vnum) != 2) {
-	    errlog("READ_DB_FILE: Bad program header, i = %" PRIdN ".\n", i);
-	    return 0;
-	}
-	if (!valid(oid)) {
-	    errlog("READ_DB_FILE: Verb for non-existant object: #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
-	    return 0;
-	}
-	h = db_find_indexed_verb(Var::new_obj(oid), vnum + 1);	/* DB file is 0-based. */
-	if (!h.ptr) {
-	    errlog("READ_DB_FILE: Unknown verb index: #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
-	    return 0;
-	}
-	program = dbio_read_program(dbio_input_version, fmt_verb_name, &h);
-	if (!program) {
-	    errlog("READ_DB_FILE: Unparsable program #%" PRIdN ":%" PRIdN ".\n", oid, vnum);
-	    return 0;
-	}
-	db_set_verb_program(h, program);
-	if (i % 5000 == 0 || i == nprogs)
-	    oklog("LOADING: Done reading %" PRIdN " verb programs ...\n", i);
-    }
+    if (!read_verb_programs(nprogs))
+	return 0;
 
     if (DBV_Anon > dbio_input_version) {
 	oklog("LOADING: Reading forked and suspended tasks ...\n");
@@ -1078,7 +1348,7 @@ write_db_file(const char *reason)
 		int vcount = 0;
 		for (v = dbpriv_find_object(oid)->verbdefs; v; v = v->next) {
 		    if (v->program) {
-			dbio_printf("#%" PRIdN ":%" PRIdN "\n", oid, vcount);
+			dbio_write_header(oid, vcount);
 			dbio_write_program(v->program);
 			if (++i % 5000 == 0 || i == nprogs)
 			    oklog("%s: Done writing %" PRIdN " verb programs ...\n",
@@ -1089,14 +1359,827 @@ write_db_file(const char *reason)
 	    }
 	}
 	waif_after_saving();
+	dbpriv_flush_dbio_output();
+    }
+    catch (dbpriv_dbio_failed& exception) {
+	success = 0;
+    }
+
+    return success;
+}
+
+
+/*********** Checkpoint deltas ***********/
+
+/* When the `checkpoint_deltas' server option is positive, a checkpoint
+ * normally doesn't fork.  Instead, the objects changed since the last
+ * checkpoint (see `dbpriv_mark_dirty()'), along with the task queue and
+ * the other global state, are written in-process to a numbered delta
+ * file next to the output database, `<dump_db_name>.delta.N'.  After
+ * that many deltas, or when something has changed that a delta can't
+ * hold (anonymous objects and waifs), the next checkpoint is a full,
+ * forked one as before.
+ *
+ * Just before forking for a full checkpoint, one last delta is written,
+ * so that the old database and its deltas always match what the child
+ * is writing.  Once the new database is in place, the child removes
+ * the deltas up to that one; those written while it runs follow on from
+ * the new database.  A delta holds every object it mentions in full, so
+ * applying deltas that are already part of the database is harmless,
+ * which covers a crash between the rename and the removals.  When there
+ * is no such last delta (a shutdown, or one that couldn't be written),
+ * the old deltas are removed before the rename instead.
+ *
+ * `db_load()' applies the deltas of the input database in order, and
+ * fails if there is a gap in their numbers or one of them is cut short.
+ * The last of them may be a write-ahead log (see below).
+ */
+
+static const char *delta_header_format_string
+  = "** LambdaMOO Database Delta, Format Version %u **\n";
+
+/* Ends every delta, so that one cut short is refused. */
+static const char *delta_end_string = "** End of Delta **\n";
+
+static Num first_delta = 1;	/* the lowest that may be on disk */
+static Num last_delta = 0;	/* the highest written */
+static Num fork_delta = 0;	/* the last one included in the database
+				 * being written by a checkpointer */
+static int deltas_since_full = 0;
+static int fulls_in_progress = 0;
+
+/* True iff the output database and its deltas hold the state as of the
+ * last checkpoint, so that another delta can follow them.
+ */
+static bool delta_chain = false;
+
+/* Returns the numbers of the deltas of DB_NAME on disk, in order. */
+static std::vector<Num>
+find_deltas(const char *db_name)
+{
+    const char *slash = strrchr(db_name, '/');
+    std::string dir = slash ? std::string(db_name, slash - db_name + 1) : ".";
+    const char *base = slash ? slash + 1 : db_name;
+    size_t len = strlen(base);
+    std::vector<Num> found;
+    struct dirent *e;
+    DIR *d;
+
+    if (!(d = opendir(dir.c_str())))
+	return found;
+
+    while ((e = readdir(d))) {
+	const char *suffix = e->d_name + len;
+
+	if (strncmp(e->d_name, base, len) == 0
+	    && strncmp(suffix, ".delta.", 7) == 0
+	    && suffix[7] && strspn(suffix + 7, "0123456789") == strlen(suffix + 7))
+	    found.push_back(strtoll(suffix + 7, nullptr, 10));
+    }
+    closedir(d);
+
+    std::sort(found.begin(), found.end());
+    return found;
+}
+
+static void
+remove_deltas(Num first, Num last)
+{
+    Stream *s = new_stream(100);
+
+    for (Num n = first; n <= last; n++) {
+	stream_printf(s, "%s.delta.%" PRIdN, dump_db_name, n);
+	remove(reset_stream(s));
+    }
+
+    free_stream(s);
+}
+
+/* Flags written before each object in a delta or log record */
+#define CHANGE_RENONCE		1	/* anonymous children are invalidated */
+#define CHANGE_OLD_PROGRAMS	2	/* its verbs keep the programs they had */
+
+/* Log records leave out the programs of objects whose verbs haven't
+ * changed since the previous record; deltas always include them.
+ */
+static bool
+programs_written(Object *o, enum Dirty_Set set)
+{
+    return set == DIRTY_CHECKPOINT || dbpriv_programs_changed(o, set);
+}
+
+/* Log records also hold the property values changed on objects that
+ * are not otherwise dirty, which is what most changes come to.
+ */
+static bool
+value_written(const std::pair<Objid, int> &value)
+{
+    Object *o = dbpriv_find_object(value.first);
+
+    return o && !(o->dirty & DIRTY_LOG) && value.second < o->nval;
+}
+
+static void
+write_changed_values(void)
+{
+    const std::vector<std::pair<Objid, int>> &values = dbpriv_dirty_values();
+
+    dbio_printf("%" PRIdN "\n",
+		(Num) std::count_if(values.begin(), values.end(),
+				    value_written));
+    for (const auto &value : values)
+	if (value_written(value)) {
+	    dbio_write_objid(value.first);
+	    dbio_write_num(value.second);
+	    dbio_write_var(dbpriv_find_object(value.first)
+			   ->propval[value.second].var);
+	}
+}
+
+/* Writes the objects in DIRTY, which came from SET, and whatever else
+ * they may have changed.  Throws `dbpriv_dbio_failed' if they can't
+ * all be written.
+ */
+static void
+write_changes(const std::vector<Objid> &dirty, enum Dirty_Set set)
+{
+    Var user_list;
+    Verbdef *v;
+    Num nprogs = 0;
+    int i;
+
+    dbio_printf("%" PRIdN "\n", db_last_used_objid());
+
+    user_list = db_all_users();
+    dbio_printf("%" PRIdN "\n", listlength(user_list));
+    for (i = 1; i <= user_list.v.list[0].v.num; i++)
+	dbio_write_objid(user_list.v.list[i].v.obj);
+
+    dbio_printf("%" PRIdN "\n", (Num) dirty.size());
+    for (Objid oid : dirty) {
+	Object *o = dbpriv_find_object(oid);
+
+	/* Anonymous children are invalidated by a change of nonce. */
+	dbio_printf("%d\n", !o ? 0
+		    : ((dbpriv_layout_changed(o, set) ? CHANGE_RENONCE : 0)
+		       | (programs_written(o, set) ? 0 : CHANGE_OLD_PROGRAMS)));
+	ng_write_object(oid);
+    }
+
+    for (Objid oid : dirty)
+	if (valid(oid) && programs_written(dbpriv_find_object(oid), set))
+	    for (v = dbpriv_find_object(oid)->verbdefs; v; v = v->next)
+		if (v->program)
+		    nprogs++;
+
+    dbio_printf("%" PRIdN "\n", nprogs);
+    for (Objid oid : dirty)
+	if (valid(oid) && programs_written(dbpriv_find_object(oid), set)) {
+	    int vcount = 0;
+
+	    for (v = dbpriv_find_object(oid)->verbdefs; v; v = v->next) {
+		if (v->program) {
+		    dbio_write_header(oid, vcount);
+		    dbio_write_program(v->program);
+		}
+		vcount++;
+	    }
+	}
+
+    if (set == DIRTY_LOG)
+	write_changed_values();
+}
+
+static int
+write_delta_file(void)
+{
+    volatile int success = 1;
+
+    dbpriv_writing_delta = true;
+
+    try {
+	dbio_printf(delta_header_format_string, current_db_version);
+	write_values_pending_finalization();
+	write_task_queue();
+	write_active_connections();
+	write_changes(dbpriv_dirty_objects(DIRTY_CHECKPOINT), DIRTY_CHECKPOINT);
+	dbio_printf("%s", delta_end_string);
+	dbpriv_flush_dbio_output();
     }
     catch (dbpriv_dbio_failed& exception) {
 	success = 0;
     }
 
+    dbpriv_writing_delta = false;
+
     return success;
 }
 
+/* When the `write_ahead_log' server option is true, the objects changed
+ * in each pass through the main loop are appended as one record, at the
+ * end of the pass, to a log that is named as the next delta would be.
+ * A change itself costs no more than marking the object dirty.  When
+ * only property values of an object have changed, a record holds just
+ * those values, so the work done at the end of a pass goes with what
+ * changed during it rather than with the size of the objects; objects
+ * changed in other ways are written in full, but with the verb programs
+ * only of objects whose verbs have been added, removed or reprogrammed
+ * since the previous record.  Writing
+ * that delta replaces the log; otherwise the log is closed, and counted
+ * as a delta in its own right, when a full checkpoint begins or when
+ * something has changed that it can't hold.  In the latter case nothing
+ * more is logged until the delta chain is whole again.
+ *
+ * A separate thread fsync()s the log whenever records have been added,
+ * so one fsync() covers all the records written while the previous one
+ * was in progress, and the main loop never waits for the disk.  Each
+ * record is preceded by its length and checksum, so one cut short by a
+ * crash is ignored.
+ */
+
+static const char *log_header_format_string
+  = "** LambdaMOO Database Log, Format Version %u **\n";
+
+static int log_fd = -1;		/* the log being written, if any */
+
+static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_cond = PTHREAD_COND_INITIALIZER;
+static bool log_sync_requested = false;
+static bool log_syncer_running = false;
+
+static unsigned
+log_checksum(const char *p, size_t len)
+{
+    unsigned h = 2166136261u;	/* FNV-1a */
+
+    while (len--) {
+	h ^= (unsigned char) *p++;
+	h *= 16777619u;
+    }
+
+    return h;
+}
+
+static void *
+log_syncer(void *)
+{
+    pthread_mutex_lock(&log_mutex);
+    for (;;) {
+	int fd;
+
+	while (!log_sync_requested)
+	    pthread_cond_wait(&log_cond, &log_mutex);
+	log_sync_requested = false;
+	/* The main thread may close the log meanwhile. */
+	fd = log_fd < 0 ? -1 : fcntl(log_fd, F_DUPFD_CLOEXEC, 0);
+	pthread_mutex_unlock(&log_mutex);
+
+	if (fd >= 0) {
+	    fsync(fd);
+	    close(fd);
+	}
+	pthread_mutex_lock(&log_mutex);
+    }
+
+    return nullptr;
+}
+
+static void
+request_log_sync(void)
+{
+    if (!log_syncer_running) {
+	fsync(log_fd);
+	return;
+    }
+    pthread_mutex_lock(&log_mutex);
+    log_sync_requested = true;
+    pthread_cond_signal(&log_cond);
+    pthread_mutex_unlock(&log_mutex);
+}
+
+static bool
+write_fully(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+	ssize_t n = write(fd, p, len);
+
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return false;
+	}
+	p += n;
+	len -= n;
+    }
+
+    return true;
+}
+
+static bool
+open_log(void)
+{
+    Stream *s = new_stream(100);
+    char header[100];
+    int fd;
+
+    stream_printf(s, "%s.delta.%" PRIdN, dump_db_name, last_delta + 1);
+    fd = open(stream_contents(s),
+	      O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0666);
+    if (fd < 0) {
+	log_perror("Opening write-ahead log");
+	free_stream(s);
+	return false;
+    }
+    snprintf(header, sizeof(header), log_header_format_string,
+	     current_db_version);
+    if (!write_fully(fd, header, strlen(header))) {
+	log_perror("Writing write-ahead log");
+	close(fd);
+	remove(stream_contents(s));
+	free_stream(s);
+	return false;
+    }
+    oklog("LOGGING changes on %s\n", stream_contents(s));
+    free_stream(s);
+
+    pthread_mutex_lock(&log_mutex);
+    log_fd = fd;
+    pthread_mutex_unlock(&log_mutex);
+
+    if (!log_syncer_running) {
+	pthread_t thread;
+	sigset_t sigchld, old_mask;
+
+	/* SIGCHLD is for the main thread; see `new_thread_pool()'. */
+	sigemptyset(&sigchld);
+	sigaddset(&sigchld, SIGCHLD);
+	pthread_sigmask(SIG_BLOCK, &sigchld, &old_mask);
+	if (pthread_create(&thread, nullptr, log_syncer, nullptr) == 0) {
+	    pthread_detach(thread);
+	    log_syncer_running = true;
+	} else
+	    errlog("LOGGING: Can't start a thread; syncing in the main loop.\n");
+	pthread_sigmask(SIG_SETMASK, &old_mask, nullptr);
+    }
+
+    return true;
+}
+
+/* Stops writing the log, without counting it as a delta. */
+static void
+end_log(void)
+{
+    if (log_fd < 0)
+	return;
+    pthread_mutex_lock(&log_mutex);
+    close(log_fd);
+    log_fd = -1;
+    pthread_mutex_unlock(&log_mutex);
+}
+
+/* Stops writing the log, which becomes delta LAST_DELTA. */
+static void
+close_log(void)
+{
+    if (log_fd >= 0) {
+	end_log();
+	last_delta++;
+    }
+}
+
+/* Appends a record of the objects changed since the last one.  Returns
+ * false if they can't all be logged.
+ */
+static bool
+write_log_record(void)
+{
+    const std::vector<Objid> &dirty = dbpriv_dirty_objects(DIRTY_LOG);
+    std::string record;
+    bool success = true;
+
+    if (dbpriv_full_checkpoint_needed(DIRTY_LOG))
+	return false;
+    if (dirty.empty() && dbpriv_dirty_values().empty())
+	return true;
+    if (log_fd < 0 && !open_log())
+	return false;
+
+    dbpriv_set_dbio_output(&record);
+    dbpriv_writing_delta = true;
+    try {
+	write_changes(dirty, DIRTY_LOG);
+	dbpriv_flush_dbio_output();
+    }
+    catch (dbpriv_dbio_failed& exception) {
+	success = false;
+    }
+    dbpriv_writing_delta = false;
+
+    if (success) {
+	char frame[50];
+
+	snprintf(frame, sizeof(frame), "%zu %08x\n",
+		 record.size(), log_checksum(record.data(), record.size()));
+	success = (write_fully(log_fd, frame, strlen(frame))
+		   && write_fully(log_fd, record.data(), record.size()));
+	if (!success)
+	    log_perror("Writing write-ahead log");
+    }
+
+    if (success) {
+	dbpriv_clear_dirty(DIRTY_LOG);
+	request_log_sync();
+    }
+
+    return success;
+}
+
+/* Opens NAME to write a database or a delta to, setting aside SIZE bytes
+ * of disk for it if SIZE is positive, so that it is laid out in one piece.
+ * Returns the file descriptor, or -1.
+ */
+static int
+open_dump_file(const char *name, Num size)
+{
+    int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+
+    if (fd < 0)
+	return -1;
+#if HAVE_FALLOCATE
+    if (size > 0)
+	fallocate(fd, 0, 0, size);	/* only a hint */
+#endif
+    dbpriv_set_dbio_output(fd);
+
+    return fd;
+}
+
+/* Closes a file opened by open_dump_file() once it has been written,
+ * trimming what was set aside but not used and, unless the
+ * `sync_checkpoints' server option is false, waiting for it to reach the
+ * disk.  Returns false if any of that fails.
+ */
+static bool
+finish_dump_file(int fd)
+{
+    off_t len = lseek(fd, 0, SEEK_CUR);
+    bool success = (len >= 0 && ftruncate(fd, len) == 0
+		    && (!server_flag_option("sync_checkpoints", 1)
+			|| fsync(fd) == 0));
+
+    if (close(fd) != 0)
+	success = false;
+
+    return success;
+}
+
+static int
+write_delta(void)
+{
+    Stream *s = new_stream(100);
+    char *temp_name, *name;
+    int fd;
+    int success = 0;
+
+    stream_printf(s, "%s.delta.#%" PRIdN "#", dump_db_name, last_delta + 1);
+    temp_name = str_dup(reset_stream(s));
+    stream_printf(s, "%s.delta.%" PRIdN, dump_db_name, last_delta + 1);
+    name = str_dup(reset_stream(s));
+    free_stream(s);
+
+    oklog("CHECKPOINTING changes on %s ...\n", name);
+
+    if ((fd = open_dump_file(temp_name, 0)) >= 0) {
+	if (!write_delta_file()) {
+	    errlog("CHECKPOINTING: Can't write changes alone; "
+		   "anonymous objects, waifs or disk space?\n");
+	    close(fd);
+	} else if (!finish_dump_file(fd))
+	    log_perror("Finishing delta file");
+	else if (rename(temp_name, name) != 0)
+	    log_perror("Renaming temporary delta file");
+	else
+	    success = 1;
+	if (!success)
+	    remove(temp_name);
+    } else
+	log_perror("Opening temporary delta file");
+
+    if (success) {
+	oklog("CHECKPOINTING changes on %s finished\n", name);
+	end_log();		/* now replaced by the delta */
+	last_delta++;
+	dbpriv_clear_dirty(DIRTY_ALL);
+    }
+
+    free_str(temp_name);
+    free_str(name);
+
+    return success;
+}
+
+/* Returns DB_FLUSH_FINISHED if a delta was enough, 0 if no checkpoint
+ * can be taken now, or 1 to go on with a full one.
+ */
+static int
+checkpoint_delta(void)
+{
+    int max_deltas = server_int_option("checkpoint_deltas", 0);
+    bool logging = server_flag_option_cached(SVO_WRITE_AHEAD_LOG);
+    bool can_delta = (max_deltas > 0 && delta_chain
+		      && !dbpriv_full_checkpoint_needed(DIRTY_CHECKPOINT));
+
+    if (can_delta && deltas_since_full < max_deltas) {
+	if (write_delta()) {
+	    deltas_since_full++;
+	    return DB_FLUSH_FINISHED;
+	}
+	dbpriv_need_full_checkpoint();
+	can_delta = false;
+    }
+
+    if ((max_deltas > 0 || logging) && fulls_in_progress > 0) {
+	errlog("CHECKPOINTING: Skipped; the last full checkpoint "
+	       "hasn't finished.\n");
+	return 0;
+    }
+
+    if (can_delta)
+	delta_chain = write_delta();
+    else			/* the log can stand in for the last delta */
+	delta_chain = delta_chain && logging && write_log_record();
+    close_log();
+
+    return 1;
+}
+
+static void
+full_checkpoint_finished(int success)
+{
+    if (success) {
+	first_delta = fork_delta + 1;
+	if (fulls_in_progress == 0)
+	    delta_chain = true;
+    }
+}
+
+static int
+delta_read_object(int flags)
+{
+    Objid oid;
+    char s[20];
+    std::vector<Program *> programs;
+    Object *o;
+    Verbdef *v;
+    size_t i = 0;
+
+    if (dbio_scanf("#%" SCNdN, &oid) != 1)
+	return 0;
+    dbio_read_line(s, sizeof(s));
+
+    if (strcmp(s, " recycled\n") == 0) {
+	dbpriv_forget_object(oid);
+	return 1;
+    } else if (strcmp(s, "\n") != 0 || oid < 0 || oid > db_last_used_objid())
+	return 0;
+
+    if ((flags & CHANGE_OLD_PROGRAMS) && (o = dbpriv_find_object(oid)))
+	for (v = o->verbdefs; v; v = v->next) {
+	    programs.push_back(v->program);
+	    v->program = nullptr;
+	}
+
+    o = dbpriv_replace_object(oid, flags & CHANGE_RENONCE);
+    ng_read_object_fields(o);
+
+    if (flags & CHANGE_OLD_PROGRAMS) {
+	for (v = o->verbdefs; v && i < programs.size(); v = v->next)
+	    v->program = programs[i++];
+	if (v || i < programs.size()) {
+	    errlog("READ_DB_DELTA: #%" PRIdN " has %s verbs than before.\n",
+		   oid, v ? "more" : "fewer");
+	    for (; i < programs.size(); i++)
+		if (programs[i])
+		    free_program(programs[i]);
+	    return 0;
+	}
+    }
+
+    return 1;
+}
+
+static int
+read_changes(void)
+{
+    Var user_list;
+    Num i, last_oid, nusers, nobjs, nprogs;
+    int flags;
+
+    if (dbio_scanf("%" SCNdN "\n%" SCNdN "\n", &last_oid, &nusers) != 2) {
+	errlog("READ_DB_DELTA: Bad object or user count\n");
+	return 0;
+    }
+
+    user_list = new_list(nusers);
+    for (i = 1; i <= nusers; i++) {
+	user_list.v.list[i].type = TYPE_OBJ;
+	user_list.v.list[i].v.obj = dbio_read_objid();
+    }
+    free_var(db_all_users());
+    dbpriv_set_all_users(user_list);
+
+    dbpriv_set_object_count(last_oid + 1);
+
+    if (dbio_scanf("%" SCNdN "\n", &nobjs) != 1) {
+	errlog("READ_DB_DELTA: Bad object count\n");
+	return 0;
+    }
+    for (i = 1; i <= nobjs; i++)
+	if (dbio_scanf("%d\n", &flags) != 1 || !delta_read_object(flags)) {
+	    errlog("READ_DB_DELTA: Bad object, i = %" PRIdN ".\n", i);
+	    return 0;
+	}
+
+    if (dbio_scanf("%" SCNdN "\n", &nprogs) != 1) {
+	errlog("READ_DB_DELTA: Bad verb count\n");
+	return 0;
+    }
+
+    return read_verb_programs(nprogs);
+}
+
+static int
+read_changed_values(void)
+{
+    Num i, nvalues;
+
+    if (dbio_scanf("%" SCNdN "\n", &nvalues) != 1) {
+	errlog("READ_DB_LOG: Bad value count\n");
+	return 0;
+    }
+    for (i = 1; i <= nvalues; i++) {
+	Objid oid = dbio_read_objid();
+	int pos = dbio_read_num();
+	Object *o = dbpriv_find_object(oid);
+	Var value = dbio_read_var();
+
+	if (!o || pos < 0 || pos >= o->nval) {
+	    errlog("READ_DB_LOG: Bad value, i = %" PRIdN ".\n", i);
+	    free_var(value);
+	    return 0;
+	}
+	free_var(o->propval[pos].var);
+	o->propval[pos].var = value;
+    }
+
+    return 1;
+}
+
+static int
+read_db_delta(void)
+{
+    char end[50];
+
+    if (!read_values_pending_finalization()) {
+	errlog("READ_DB_DELTA: Can't read values pending finalization.\n");
+	return 0;
+    }
+
+    discard_task_queue();
+    if (!read_task_queue()) {
+	errlog("READ_DB_DELTA: Can't read task queue.\n");
+	return 0;
+    }
+
+    if (!read_active_connections()) {
+	errlog("READ_DB_DELTA: Can't read active connections.\n");
+	return 0;
+    }
+
+    if (!read_changes())
+	return 0;
+
+    dbio_read_line(end, sizeof(end));
+    if (strcmp(end, delta_end_string) != 0) {
+	errlog("READ_DB_DELTA: Delta is incomplete.\n");
+	return 0;
+    }
+
+    return 1;
+}
+
+/* Applies the complete records of a write-ahead log.  Returns false
+ * only if one of them can't be read.
+ */
+static int
+read_db_log(const char *name)
+{
+    char frame[50];
+    size_t len, remaining;
+    unsigned sum;
+    bool torn = false;
+
+    while (dbpriv_dbio_input(&remaining), remaining > 0) {
+	const char *record;
+	int success;
+
+	dbio_read_line(frame, sizeof(frame));
+	if (sscanf(frame, "%zu %x\n", &len, &sum) != 2) {
+	    torn = true;
+	    break;
+	}
+	record = dbpriv_dbio_input(&remaining);
+	if (len > remaining || log_checksum(record, len) != sum) {
+	    torn = true;
+	    break;
+	}
+	dbpriv_set_dbio_input(record, len);
+	success = read_changes() && read_changed_values();
+	dbpriv_set_dbio_input(record + len, remaining - len);
+	if (!success)
+	    return 0;
+    }
+
+    if (torn)
+	oklog("LOADING: Ignoring an incomplete record at the end of %s\n",
+	      name);
+
+    return 1;
+}
+
+static int
+read_db_deltas(void)
+{
+    std::vector<Num> deltas = find_deltas(input_db_name);
+    Stream *s;
+    char header[100];
+    input_file f;
+    int success;
+
+    /* Each delta holds only what changed since the one before. */
+    for (size_t i = 1; i < deltas.size(); i++)
+	if (deltas[i] != deltas[i - 1] + 1) {
+	    errlog("READ_DB_DELTAS: %s.delta.%" PRIdN " is missing.\n",
+		   input_db_name, deltas[i - 1] + 1);
+	    return 0;
+	}
+
+    s = new_stream(100);
+    for (Num n : deltas) {
+	stream_printf(s, "%s.delta.%" PRIdN, input_db_name, n);
+	oklog("LOADING: Applying %s ...\n", stream_contents(s));
+	if (!open_input_file(stream_contents(s), &f)) {
+	    log_perror("Opening checkpoint delta");
+	    free_stream(s);
+	    return 0;
+	}
+
+	dbpriv_set_dbio_input(f.data, f.size);
+	dbio_read_line(header, sizeof(header));
+	if (sscanf(header, delta_header_format_string, &dbio_input_version) == 1
+	    && check_db_version(dbio_input_version))
+	    success = read_db_delta();
+	else if (sscanf(header, log_header_format_string, &dbio_input_version) == 1
+		 && check_db_version(dbio_input_version))
+	    success = read_db_log(stream_contents(s));
+	else {
+	    errlog("READ_DB_DELTAS: Bad header\n");
+	    success = 0;
+	}
+	close_input_file(&f);
+	reset_stream(s);
+	if (!success) {
+	    free_stream(s);
+	    return 0;
+	}
+    }
+    free_stream(s);
+
+    if (!deltas.empty()) {
+	db_clear_ancestor_cache();
+	dbpriv_clear_match_indexes();
+	db_priv_affected_callable_verb_lookup();
+	if (!ng_validate_hierarchies()) {
+	    errlog("READ_DB_DELTAS: Errors in object hierarchies.\n");
+	    return 0;
+	}
+    }
+
+    /* New deltas follow on from these only if they are the same files. */
+    if (strcmp(input_db_name, dump_db_name) != 0)
+	deltas = find_deltas(dump_db_name);
+    else
+	delta_chain = true;
+    if (!deltas.empty()) {
+	first_delta = deltas.front();
+	last_delta = deltas.back();
+    }
+
+    dbpriv_clear_dirty(DIRTY_ALL);
+
+    return 1;
+}
+
 typedef enum {
     DUMP_SHUTDOWN, DUMP_CHECKPOINT, DUMP_PANIC
 } Dump_Reason;
@@ -1106,11 +2189,24 @@ const char *reason_names[] =
 static int
 dump_database(Dump_Reason reason)
 {
-    Stream *s = new_stream(100);
+    Stream *s;
     char *temp_name;
-    FILE *f;
+    Num size = db_disk_size();
+    int fd;
     int success;
 
+    if (reason == DUMP_CHECKPOINT) {
+	success = checkpoint_delta();
+	if (success != 1)
+	    return success;
+    }
+    if (reason != DUMP_PANIC) {
+	close_log();
+	fork_delta = last_delta;
+    }
+
+    s = new_stream(100);
+
   retryDumping:
 
     stream_printf(s, "%s.#%" PRIdN "#", dump_db_name, dump_generation);
@@ -1133,8 +2229,11 @@ dump_database(Dump_Reason reason)
 	switch (fork_server("checkpointer")) {
 	case FORK_PARENT:
 	    reset_command_history();
+	    fulls_in_progress++;
+	    deltas_since_full = 0;
+	    dbpriv_clear_dirty(DIRTY_ALL);
 	    free_stream(s);
-	    return 1;
+	    return DB_FLUSH_STARTED;
 	case FORK_ERROR:
 	    free_stream(s);
 	    return 0;
@@ -1146,11 +2245,13 @@ dump_database(Dump_Reason reason)
 #endif
 
     success = 1;
-    if ((f = fopen(temp_name, "w")) != nullptr) {
-	dbpriv_set_dbio_output(f);
-	if (!write_db_file(reason_names[reason])) {
+    if ((fd = open_dump_file(temp_name, size)) >= 0) {
+	bool written = write_db_file(reason_names[reason]);
+
+	if (!written)
+	    close(fd);
+	if (!written || !finish_dump_file(fd)) {
 	    log_perror("Trying to dump database");
-	    fclose(f);
 	    remove(temp_name);
 	    if (reason == DUMP_CHECKPOINT) {
 		errlog("Abandoning checkpoint attempt ...\n");
@@ -1164,16 +2265,22 @@ dump_database(Dump_Reason reason)
 		goto retryDumping;
 	    }
 	} else {
-	    fflush(f);
-	    fsync(fileno(f));
-	    fclose(f);
 	    oklog("%s on %s finished\n", reason_names[reason], temp_name);
 	    if (reason != DUMP_PANIC) {
+		/* Only a set of deltas ending just before the fork can be
+		 * applied again to the new database.
+		 */
+		bool deltas_current = (reason == DUMP_CHECKPOINT
+				       && delta_chain);
+
+		if (!deltas_current)
+		    remove_deltas(first_delta, fork_delta);
 		remove(dump_db_name);
 		if (rename(temp_name, dump_db_name) != 0) {
 		    log_perror("Renaming temporary dump file");
 		    success = 0;
-		}
+		} else if (deltas_current)
+		    remove_deltas(first_delta, fork_delta);
 	    }
 	}
     } else {
@@ -1189,6 +2296,14 @@ dump_database(Dump_Reason reason)
 	exit(!success);
 #endif
 
+    if (reason != DUMP_PANIC) {
+	if (success) {
+	    deltas_since_full = 0;
+	    dbpriv_clear_dirty(DIRTY_ALL);
+	}
+	full_checkpoint_finished(success);
+    }
+
     return success;
 }
 
@@ -1201,13 +2316,11 @@ db_usage_string(void)
     return "input-db-file output-db-file";
 }
 
-static FILE *input_db;
+static input_file input_db;
 
 int
 db_initialize(int *pargc, char ***pargv)
 {
-    FILE *f;
-
     if (*pargc < 2)
 	return 0;
 
@@ -1216,12 +2329,11 @@ db_initialize(int *pargc, char ***pargv)
     *pargc -= 2;
     *pargv += 2;
 
-    if (!(f = fopen(input_db_name, "r"))) {
+    if (!open_input_file(input_db_name, &input_db)) {
 	fprintf(stderr, "Cannot open input database file: %s\n",
 		input_db_name);
 	return 0;
     }
-    input_db = f;
     dbpriv_build_prep_table();
 
     return 1;
@@ -1230,7 +2342,7 @@ db_initialize(int *pargc, char ***pargv)
 int
 db_load(void)
 {
-    dbpriv_set_dbio_input(input_db);
+    dbpriv_set_dbio_input(input_db.data, input_db.size);
 
     str_intern_open(0);
 
@@ -1239,15 +2351,44 @@ db_load(void)
 	errlog("DB_LOAD: Cannot load database!\n");
 	return 0;
     }
+    close_input_file(&input_db);
+
+    if (!read_db_deltas()) {
+	errlog("DB_LOAD: Cannot apply checkpoint deltas!\n");
+	return 0;
+    }
     oklog("LOADING: %s done, will dump new database on %s\n",
 	  input_db_name, dump_db_name);
 
     str_intern_close();
 
-    fclose(input_db);
     return 1;
 }
 
+void
+db_log_changes(void)
+{
+    bool logging = server_flag_option_cached(SVO_WRITE_AHEAD_LOG);
+
+    if (!logging)
+	close_log();
+    else if (delta_chain && !write_log_record()) {
+	errlog("LOGGING: Can't log changes; anonymous objects, waifs or "
+	       "disk space?  Waiting for a full checkpoint.\n");
+	close_log();
+	delta_chain = false;
+    }
+    dbpriv_logging_values = logging && delta_chain;
+}
+
+void
+db_checkpoint_finished(int success)
+{
+    if (fulls_in_progress > 0)
+	fulls_in_progress--;
+    full_checkpoint_finished(success);
+}
+
 int
 db_flush(enum db_flush_type type)
 {
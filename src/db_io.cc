@@ -21,10 +21,14 @@
 
 #include "config.h"
 #include <ctype.h>
+#include <errno.h>
 #include <float.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "db.h"
 #include "db_io.h"
@@ -33,6 +37,7 @@
 #include "log.h"
 #include "map.h"
 #include "numbers.h"
+#include "options.h"
 #include "parser.h"
 #include "server.h"
 #include "storage.h"
@@ -46,45 +51,190 @@
 
 /*********** Input ***********/
 
-static FILE *input;
+/* The input is a file mapped into memory (see db_file.cc), or part of one,
+ * scanned in place: numbers are converted straight from it and strings are
+ * copied out of it once, into their final storage.
+ */
+
+static const char *input_start = nullptr;
+static const char *input = nullptr;	/* the next character to read */
+static const char *input_end = nullptr;
 
 void
-dbpriv_set_dbio_input(FILE * f)
+dbpriv_set_dbio_input(const char *data, size_t size)
+{
+    input_start = input = data;
+    input_end = data + size;
+}
+
+const char *
+dbpriv_dbio_input(size_t *remaining)
+{
+    *remaining = input_end - input;
+    return input;
+}
+
+static long
+input_offset(void)
 {
-    input = f;
+    return input - input_start;
+}
+
+/* Returns the length of the line at INPUT, not counting its newline, and
+ * moves INPUT past the newline.
+ */
+static size_t
+next_line(const char **line)
+{
+    const char *nl = (const char *) memchr(input, '\n', input_end - input);
+    size_t len;
+
+    *line = input;
+    if (nl) {
+	len = nl - input;
+	input = nl + 1;
+    } else {
+	len = input_end - input;
+	input = input_end;
+    }
+
+    return len;
+}
+
+/* Like fgets(): copies at most N-1 characters through the next newline
+ * into S, and returns their number; S is left empty at the end of input.
+ */
+static size_t
+read_chunk(char *s, size_t n)
+{
+    size_t len = input_end - input;
+    const char *nl;
+
+    if (len > n - 1)
+	len = n - 1;
+    if ((nl = (const char *) memchr(input, '\n', len)))
+	len = nl + 1 - input;
+    memcpy(s, input, len);
+    s[len] = '\0';
+    input += len;
+
+    return len;
 }
 
 void
 dbio_read_line(char *s, int n)
 {
-    fgets(s, n, input);
+    read_chunk(s, n);
+}
+
+/* Reads an optionally signed decimal number, after any white space, as
+ * scanf()'s `%d' does.  Returns false if there are no digits.
+ */
+static bool
+scan_integer(unsigned long long *result)
+{
+    bool negative = false;
+    unsigned long long n = 0;
+    const char *digits;
+
+    while (input < input_end && isspace((unsigned char) *input))
+	input++;
+    if (input < input_end && (*input == '-' || *input == '+'))
+	negative = (*input++ == '-');
+    digits = input;
+    while (input < input_end && isdigit((unsigned char) *input))
+	n = n * 10 + (*input++ - '0');
+    *result = negative ? -n : n;
+
+    return input > digits;
 }
 
+/* Handles the conversions used in the DB format, namely `%c' and `%d' and
+ * `%u' with or without `l' or `ll', as scanf() would.
+ */
 int
 dbio_scanf(const char *format,...)
 {
     va_list args;
-    int count;
+    const char *f;
+    int count = 0, longs;
+    bool failed = false;	/* at the end of input */
+    unsigned long long n;
 
     va_start(args, format);
-    count = vfscanf(input, format, args);
+    for (f = format; *f; f++) {
+	if (isspace((unsigned char) *f)) {
+	    while (input < input_end && isspace((unsigned char) *input))
+		input++;
+	    continue;
+	}
+	if (*f != '%' || *++f == '%') {
+	    if (input == input_end)
+		failed = true;
+	    else if (*input == *f) {
+		input++;
+		continue;
+	    }
+	    break;
+	}
+
+	for (longs = 0; *f == 'l'; f++)
+	    longs++;
+	if (*f == 'c') {
+	    if (input == input_end) {
+		failed = true;
+		break;
+	    }
+	    *va_arg(args, char *) = *input++;
+	} else if (*f == 'd' || *f == 'u') {
+	    if (!scan_integer(&n)) {
+		failed = (input == input_end);
+		break;
+	    }
+	    if (longs == 0)
+		*va_arg(args, int *) = (int) n;
+	    else if (longs == 1)
+		*va_arg(args, long *) = (long) n;
+	    else
+		*va_arg(args, long long *) = (long long) n;
+	} else {
+	    errlog("DBIO_SCANF: Unsupported conversion in \"%s\"\n", format);
+	    break;
+	}
+	count++;
+    }
     va_end(args);
 
-    return count;
+    return count == 0 && failed ? EOF : count;
 }
 
 Num
 dbio_read_num(void)
 {
     char s[22];
-    char *p;
+    const char *p = input;
+    const char *limit = input_end - p < 21 ? input_end : p + 21;
+    bool negative = (p < limit && *p == '-');
+    unsigned long long n = 0;
+    const char *digits;
+    char *q;
     long long i;
 
-    fgets(s, sizeof(s), input);
-    i = strtoll(s, &p, 10);
-    if (isspace(*s) || *p != '\n')
+    /* The usual case, a short number on a line of its own. */
+    if (negative)
+	p++;
+    for (digits = p; p < limit && isdigit((unsigned char) *p); p++)
+	n = n * 10 + (*p - '0');
+    if (p > digits && p - digits < 19 && p < limit && *p == '\n') {
+	input = p + 1;
+	return negative ? -(long long) n : (long long) n;
+    }
+
+    read_chunk(s, sizeof(s));
+    i = strtoll(s, &q, 10);
+    if (isspace(*s) || *q != '\n')
 	errlog("DBIO_READ_NUM: Bad number: \"%s\" at file pos. %ld\n",
-	       s, ftell(input));
+	       s, input_offset());
     return i;
 }
 
@@ -95,11 +245,11 @@ dbio_read_float(void)
     char *p;
     double d;
 
-    fgets(s, 40, input);
+    read_chunk(s, sizeof(s));
     d = strtod(s, &p);
     if (isspace(*s) || *p != '\n')
 	errlog("DBIO_READ_FLOAT: Bad number: \"%s\" at file pos. %ld\n",
-	       s, ftell(input));
+	       s, input_offset());
     return d;
 }
 
@@ -112,42 +262,22 @@ dbio_read_objid(void)
 const char *
 dbio_read_string(void)
 {
-    static Stream *str = nullptr;
-    static char buffer[1024];
-    int len, used_stream = 0;
+    static std::string buffer;
+    const char *line;
+    size_t len = next_line(&line);
 
-    if (str == nullptr)
-	str = new_stream(1024);
+    buffer.assign(line, len);
 
-  try_again:
-    fgets(buffer, sizeof(buffer), input);
-    len = strlen(buffer);
-    if (len == sizeof(buffer) - 1 && buffer[len - 1] != '\n') {
-	stream_add_string(str, buffer);
-	used_stream = 1;
-	goto try_again;
-    }
-    if (buffer[len - 1] == '\n')
-	buffer[len - 1] = '\0';
-
-    if (used_stream) {
-	stream_add_string(str, buffer);
-	return reset_stream(str);
-    } else
-	return buffer;
+    return buffer.c_str();
 }
 
 const char *
 dbio_read_string_intern(void)
 {
-    const char *s, *r;
-
-    s = dbio_read_string();
-    r = str_intern(s);
+    const char *line;
+    size_t len = next_line(&line);
 
-    /* puts(r); */
-
-    return r;
+    return str_intern(line, strnlen(line, len));
 }
 
 Var
@@ -211,7 +341,7 @@ dbio_read_var(void)
     break;
     default:
 	errlog("DBIO_READ_VAR: Unknown type (%d) at DB file pos. %ld\n",
-	       l, ftell(input));
+	       l, input_offset());
 	r = zero;
 	break;
     }
@@ -253,14 +383,18 @@ my_getc(void *data)
     struct db_state *s = (db_state *)data;
     int c;
 
-    c = fgetc(input);
+    if (input == input_end) {
+	my_error(data, "Unexpected EOF");
+	s->prev_char = EOF;
+	return EOF;
+    }
+    c = (unsigned char) *input++;
     if (c == '.' && s->prev_char == '\n') {
 	/* end-of-verb marker in DB */
-	c = fgetc(input);	/* skip next newline */
+	if (input < input_end)
+	    input++;		/* skip next newline */
 	return EOF;
     }
-    if (c == EOF)
-	my_error(data, "Unexpected EOF");
     s->prev_char = c;
     return c;
 }
@@ -278,33 +412,241 @@ dbio_read_program(DB_Version version, const char *(*fmtr) (void *), void *data)
     s.data = data;
     return parse_program(version, parser_client, &s);
 }
+
+bool
+dbio_read_program_text(const char **text, size_t *length)
+{
+    const char *p = input;
+
+    /* P is at the start of a line. */
+    while (p < input_end && *p != '.') {
+	const char *nl = (const char *) memchr(p, '\n', input_end - p);
+
+	p = nl ? nl + 1 : input_end;
+    }
+    *text = input;
+    *length = p - input;
+    if (p == input_end) {
+	input = input_end;
+	return false;
+    }
+    input = p + 1;
+    if (input < input_end)
+	input++;		/* skip next newline */
+
+    return true;
+}
+
+struct text_state {
+    const char *text;
+    size_t length;
+    size_t pos;
+    bool complete;
+    bool quiet;
+    bool failed;
+    struct db_state db;
+};
+
+static void
+text_error(void *data, const char *msg)
+{
+    struct text_state *s = (text_state *)data;
+
+    if (s->quiet)
+	s->failed = true;
+    else
+	my_error(&s->db, msg);
+}
+
+static void
+text_warning(void *data, const char *msg)
+{
+    struct text_state *s = (text_state *)data;
+
+    if (s->quiet)
+	s->failed = true;
+    else
+	my_warning(&s->db, msg);
+}
+
+static int
+text_getc(void *data)
+{
+    struct text_state *s = (text_state *)data;
+
+    if (s->failed)
+	return EOF;
+    if (s->pos < s->length)
+	return (unsigned char) s->text[s->pos++];
+    if (!s->complete && s->pos++ == s->length)
+	text_error(data, "Unexpected EOF");
+    return EOF;
+}
+
+static Parser_Client text_parser_client =
+{text_error, text_warning, text_getc};
+
+Program *
+dbio_compile_program(DB_Version version, const char *text, size_t length,
+		     bool complete, bool quiet,
+		     const char *(*fmtr) (void *), void *data)
+{
+    struct text_state s;
+    Program *program;
+
+    s.text = text;
+    s.length = length;
+    s.pos = 0;
+    s.complete = complete;
+    s.quiet = quiet;
+    s.failed = false;
+    s.db.prev_char = '\n';
+    s.db.fmtr = fmtr;
+    s.db.data = data;
+
+    program = parse_program(version, text_parser_client, &s);
+    if (program && s.failed) {
+	free_program(program);
+	program = nullptr;
+    }
+
+    return program;
+}
 
 
 /*********** Output ***********/
 
-static FILE *output;
+/* Output is collected in OUTPUT_BUFFER and handed to write(2), or appended
+ * to OUTPUT_STRING, only when the buffer fills or is flushed.  The common
+ * kinds of line (numbers, strings and program text) are copied in directly
+ * rather than through a format string.
+ */
+
+static char output_buffer[DB_OUTPUT_BUFFER_SIZE];
+static size_t output_length = 0;
+static int output_fd = -1;
+static std::string *output_string = nullptr;
+
+bool dbpriv_writing_delta = false;
 
 void
-dbpriv_set_dbio_output(FILE * f)
+dbpriv_set_dbio_output(int fd)
 {
-    output = f;
+    output_fd = fd;
+    output_string = nullptr;
+    output_length = 0;
+}
+
+void
+dbpriv_set_dbio_output(std::string *s)
+{
+    output_fd = -1;
+    output_string = s;
+    output_length = 0;
+}
+
+void
+dbpriv_flush_dbio_output(void)
+{
+    const char *p = output_buffer;
+    size_t len = output_length;
+
+    output_length = 0;
+    if (output_string) {
+	output_string->append(p, len);
+	return;
+    }
+    while (len > 0) {
+	ssize_t n = write(output_fd, p, len);
+
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    throw dbpriv_dbio_failed();
+	}
+	p += n;
+	len -= n;
+    }
+}
+
+static void
+output_chars(const char *s, size_t len)
+{
+    while (len > sizeof(output_buffer) - output_length) {
+	size_t room = sizeof(output_buffer) - output_length;
+
+	memcpy(output_buffer + output_length, s, room);
+	output_length += room;
+	s += room;
+	len -= room;
+	dbpriv_flush_dbio_output();
+    }
+    memcpy(output_buffer + output_length, s, len);
+    output_length += len;
+}
+
+static inline void
+output_char(char c)
+{
+    if (output_length == sizeof(output_buffer))
+	dbpriv_flush_dbio_output();
+    output_buffer[output_length++] = c;
+}
+
+static void
+output_line(const char *s)
+{
+    output_chars(s, strlen(s));
+    output_char('\n');
+}
+
+/* Writes N in decimal, as "%lld" would. */
+static void
+output_num(long long n)
+{
+    char buffer[24];
+    char *p = buffer + sizeof(buffer);
+    unsigned long long u = n < 0 ? -(unsigned long long) n : n;
+
+    do {
+	*--p = '0' + u % 10;
+	u /= 10;
+    } while (u);
+    if (n < 0)
+	*--p = '-';
+    output_chars(p, buffer + sizeof(buffer) - p);
 }
 
 void
 dbio_printf(const char *format,...)
 {
+    char buffer[1000];
     va_list args;
+    int len;
 
     va_start(args, format);
-    if (vfprintf(output, format, args) < 0)
-	throw dbpriv_dbio_failed();
+    len = vsnprintf(buffer, sizeof(buffer), format, args);
     va_end(args);
+    if (len < 0)
+	throw dbpriv_dbio_failed();
+    if ((size_t) len < sizeof(buffer))
+	output_chars(buffer, len);
+    else {
+	char *big = (char *) mymalloc(len + 1, M_STRING);
+
+	va_start(args, format);
+	vsnprintf(big, len + 1, format, args);
+	va_end(args);
+	output_chars(big, len);
+	myfree(big, M_STRING);
+    }
 }
 
 void
 dbio_write_num(Num n)
 {
-    dbio_printf("%" PRIdN "\n", n);
+    output_num(n);
+    output_char('\n');
 }
 
 void
@@ -312,12 +654,20 @@ dbio_write_float(double d)
 {
     static const char *fmt = nullptr;
     static char buffer[10];
+    char out[50];
 
+    /* Integral values are common, and print the same in %g as in %d. */
+    if (fabs(d) < 1e15 && d == (double) (long long) d
+	&& !(d == 0 && signbit(d))) {
+	output_num((long long) d);
+	output_char('\n');
+	return;
+    }
     if (!fmt) {
 	sprintf(buffer, "%%.%dg\n", DBL_DIG + 4);
 	fmt = buffer;
     }
-    dbio_printf(fmt, d);
+    output_chars(out, snprintf(out, sizeof(out), fmt, d));
 }
 
 void
@@ -326,10 +676,22 @@ dbio_write_objid(Objid oid)
     dbio_write_num(oid);
 }
 
+void
+dbio_write_header(Objid oid, int vnum)
+{
+    output_char('#');
+    output_num(oid);
+    if (vnum >= 0) {
+	output_char(':');
+	output_num(vnum);
+    }
+    output_char('\n');
+}
+
 void
 dbio_write_string(const char *s)
 {
-    dbio_printf("%s\n", s ? s : "");
+    output_line(s ? s : "");
 }
 
 static int
@@ -383,9 +745,13 @@ dbio_write_var(Var v)
 	    dbio_write_var(v.v.list[i + 1]);
 	break;
     case TYPE_ANON:
+	if (dbpriv_writing_delta && is_valid(v))
+	    throw dbpriv_dbio_failed();
 	db_write_anonymous(v);
 	break;
     case TYPE_WAIF:
+	if (dbpriv_writing_delta)
+	    throw dbpriv_dbio_failed();
     write_waif(v);
     break;
     default:
@@ -397,19 +763,19 @@ dbio_write_var(Var v)
 static void
 receiver(void *data, const char *line)
 {
-    dbio_printf("%s\n", line);
+    output_line(line);
 }
 
 void
 dbio_write_program(Program * program)
 {
     unparse_program(program, receiver, nullptr, 1, 0, MAIN_VECTOR);
-    dbio_printf(".\n");
+    output_chars(".\n", 2);
 }
 
 void
 dbio_write_forked_program(Program * program, int f_index)
 {
     unparse_program(program, receiver, nullptr, 1, 0, f_index);
-    dbio_printf(".\n");
+    output_chars(".\n", 2);
 }
@@ -19,6 +19,7 @@
  * Routines for manipulating DB objects
  *****************************************************************************/
 
+#include <stdint.h>
 #include <string.h>
 
 #include <ctime>
@@ -32,11 +33,15 @@
 #include "server.h"
 #include "storage.h"
 #include "utils.h"
-#include "dependencies/xtrapbits.h"
 #include "map.h"
-#include <map>
 #include "options.h"
 #include "log.h"
+#include "waif.h"
+
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
 
 static Object **objects;
 static Num num_objects = 0;
@@ -46,13 +51,42 @@ static unsigned int nonce = 0;
 
 static Var all_users;
 
-#ifdef USE_ANCESTOR_CACHE
-static std::map <int, Var> ancestor_cache;
-#endif /* USE_ANCESTOR_CACHE */
+/* Every change to the parent hierarchy starts a new generation.  An
+ * object's cached ancestors are only trusted if they were built during
+ * the current generation, so invalidation is a single increment rather
+ * than a walk over the affected descendants.
+ */
+#define ANCESTORS_STALE		0
+#define ANCESTORS_BUILDING	UINT64_MAX
+
+static uint64_t ancestor_generation = 1;
 
-/* used in graph traversals */
-static unsigned char *bit_array;
-static size_t array_size = 0;
+/* Each graph traversal gets a new epoch; an object has been visited
+ * during the current traversal iff its `visit_epoch' matches.
+ */
+static uint64_t visit_epoch = 0;
+
+/* Permanent objects changed since the last checkpoint, and since the
+ * last write-ahead log record.  An object is listed once while it
+ * exists, but its number can be listed again if it is destroyed and
+ * reused.
+ */
+static struct {
+    std::vector<Objid> objects;
+    bool full_checkpoint_needed;
+    unsigned int nonce;		/* `nonce' when last cleared */
+} dirty_sets[2];
+
+#define DIRTY_INDEX(set)	((set) == DIRTY_CHECKPOINT ? 0 : 1)
+
+/* Property values changed since the last log record, on objects not in
+ * its set, while the log is kept.  A layout change to an object puts it
+ * in the set, so the indexes stay good until the record is written.
+ * Repeated changes are merged whenever the list doubles in length.
+ */
+bool dbpriv_logging_values = false;
+static std::vector<std::pair<Objid, int>> dirty_values;
+static size_t dirty_values_limit = 1024;
 
 /*********** Objects qua objects ***********/
 
@@ -113,19 +147,6 @@ extend(unsigned int new_objects)
 	objects = _new;
 	max_objects = size;
     }
-
-    for (size = 4096; size <= new_objects; size *= 2)
-	;
-
-    if (array_size == 0) {
-	bit_array = (unsigned char *)mymalloc((size / 8) * sizeof(unsigned char), M_ARRAY);
-	array_size = size;
-    }
-    if (size > array_size) {
-	myfree(bit_array, M_ARRAY);
-	bit_array = (unsigned char *)mymalloc((size / 8) * sizeof(unsigned char), M_ARRAY);
-	array_size = size;
-    }
 }
 
 static void
@@ -153,27 +174,184 @@ dbpriv_after_load(void)
     }
 }
 
+/*********** Checkpoint deltas ***********/
+
+void
+dbpriv_mark_dirty(Object *o)
+{
+    if (o->id == NOTHING)
+	dbpriv_need_full_checkpoint();
+    else if (o->dirty != DIRTY_ALL) {
+	if (!(o->dirty & DIRTY_CHECKPOINT))
+	    dirty_sets[0].objects.push_back(o->id);
+	if (!(o->dirty & DIRTY_LOG))
+	    dirty_sets[1].objects.push_back(o->id);
+	o->dirty = DIRTY_ALL;
+    }
+}
+
+void
+dbpriv_mark_value_dirty(Object *o, Pval *p)
+{
+    std::pair<Objid, int> value(o->id, p - o->propval);
+
+    if (!dbpriv_logging_values || o->id == NOTHING || (o->dirty & DIRTY_LOG)) {
+	dbpriv_mark_dirty(o);
+	return;
+    }
+
+    if (!(o->dirty & DIRTY_CHECKPOINT)) {
+	dirty_sets[0].objects.push_back(o->id);
+	o->dirty |= DIRTY_CHECKPOINT;
+    }
+
+    if (!dirty_values.empty() && dirty_values.back() == value)
+	return;
+    dirty_values.push_back(value);
+    if (dirty_values.size() >= dirty_values_limit) {
+	dbpriv_dirty_values();
+	dirty_values_limit = std::max(dirty_values_limit,
+				      2 * dirty_values.size());
+    }
+}
+
+void
+dbpriv_mark_programs_dirty(Object *o)
+{
+    o->programs_dirty = DIRTY_ALL;
+    dbpriv_mark_dirty(o);
+}
+
+void
+dbpriv_mark_dirty_objid(Objid oid)
+{
+    Object *o = dbpriv_find_object(oid);
+
+    if (o)
+	dbpriv_mark_dirty(o);
+    else if (oid >= 0) {
+	dirty_sets[0].objects.push_back(oid);
+	dirty_sets[1].objects.push_back(oid);
+    }
+}
+
+void
+dbpriv_mark_dirty_objids(Var v)
+{
+    Var obj;
+    int i, c;
+
+    if (v.type == TYPE_OBJ)
+	dbpriv_mark_dirty_objid(v.v.obj);
+    else if (v.type == TYPE_LIST)
+	FOR_EACH(obj, v, i, c)
+	    dbpriv_mark_dirty_objid(obj.v.obj);
+}
+
+void
+dbpriv_need_full_checkpoint(void)
+{
+    dirty_sets[0].full_checkpoint_needed = true;
+    dirty_sets[1].full_checkpoint_needed = true;
+}
+
+bool
+dbpriv_full_checkpoint_needed(enum Dirty_Set set)
+{
+    return dirty_sets[DIRTY_INDEX(set)].full_checkpoint_needed;
+}
+
+const std::vector<Objid> &
+dbpriv_dirty_objects(enum Dirty_Set set)
+{
+    std::vector<Objid> &objs = dirty_sets[DIRTY_INDEX(set)].objects;
+
+    std::sort(objs.begin(), objs.end());
+    objs.erase(std::unique(objs.begin(), objs.end()), objs.end());
+
+    return objs;
+}
+
+const std::vector<std::pair<Objid, int>> &
+dbpriv_dirty_values(void)
+{
+    std::sort(dirty_values.begin(), dirty_values.end());
+    dirty_values.erase(std::unique(dirty_values.begin(), dirty_values.end()),
+		       dirty_values.end());
+
+    return dirty_values;
+}
+
+bool
+dbpriv_layout_changed(Object *o, enum Dirty_Set set)
+{
+    return o->nonce >= dirty_sets[DIRTY_INDEX(set)].nonce;
+}
+
+bool
+dbpriv_programs_changed(Object *o, enum Dirty_Set set)
+{
+    return o->programs_dirty & set;
+}
+
+void
+dbpriv_clear_dirty(int sets)
+{
+    for (enum Dirty_Set set : {DIRTY_CHECKPOINT, DIRTY_LOG}) {
+	if (!(sets & set))
+	    continue;
+	for (Objid oid : dirty_sets[DIRTY_INDEX(set)].objects) {
+	    Object *o = dbpriv_find_object(oid);
+
+	    if (o) {
+		o->dirty &= ~set;
+		o->programs_dirty &= ~set;
+	    }
+	}
+	dirty_sets[DIRTY_INDEX(set)].objects.clear();
+	dirty_sets[DIRTY_INDEX(set)].full_checkpoint_needed = false;
+	dirty_sets[DIRTY_INDEX(set)].nonce = nonce;
+    }
+    if (sets & DIRTY_LOG) {
+	dirty_values.clear();
+	dirty_values_limit = 1024;
+    }
+}
+
 /* Both `dbpriv_new_object()' and `dbpriv_new_anonymous_object()'
  * allocate space for an `Object' and put the object into the array of
  * Objects.  The difference is the storage type used.  `M_ANON'
  * includes space for reference counts.
  */
-Object *
-dbpriv_new_object(Num new_objid)
+static Object *
+new_object_at(Objid oid)
 {
     Object *o;
 
+    o = objects[oid] = (Object *)mymalloc(sizeof(Object), M_OBJECT);
+    o->id = oid;
+    o->ancestors = none;
+    o->ancestors_gen = ANCESTORS_STALE;
+    o->visit_epoch = 0;
+    o->command_index = nullptr;
+    o->match_index = nullptr;
+    o->waif_propdefs = nullptr;
+    o->dirty = 0;
+    o->programs_dirty = 0;
+
+    return o;
+}
+
+Object *
+dbpriv_new_object(Num new_objid)
+{
     if (new_objid <= 0 || new_objid >= num_objects) {
         ensure_new_object();
         new_objid = num_objects;
         num_objects++;
     }
 
-    o = objects[new_objid] = (Object *)mymalloc(sizeof(Object), M_OBJECT);
-    o->id = new_objid;
-    o->waif_propdefs = nullptr;
-
-    return o;
+    return new_object_at(new_objid);
 }
 
 Object *
@@ -184,6 +362,13 @@ dbpriv_new_anonymous_object(void)
     ensure_new_object();
     o = objects[num_objects] = (Object *)mymalloc(sizeof(Object), M_ANON);
     o->id = NOTHING;
+    o->ancestors = none;
+    o->ancestors_gen = ANCESTORS_STALE;
+    o->visit_epoch = 0;
+    o->command_index = nullptr;
+    o->match_index = nullptr;
+    o->dirty = 0;
+    o->programs_dirty = 0;
     num_objects++;
 
     return o;
@@ -196,6 +381,84 @@ dbpriv_new_recycled_object(void)
     num_objects++;
 }
 
+static void
+free_object_fields(Object *o)
+{
+    Verbdef *v, *w;
+    int i;
+
+    free_var(o->parents);
+    free_var(o->children);
+    free_var(o->ancestors);
+
+    free_var(o->location);
+    free_var(o->last_move);
+    free_var(o->contents);
+
+    free_str(o->name);
+
+    for (i = 0; i < o->propdefs.cur_length; i++)
+	free_str(o->propdefs.l[i].name);
+    if (o->propdefs.l)
+	myfree(o->propdefs.l, M_PROPDEF);
+    for (i = 0; i < o->nval; i++)
+	free_var(o->propval[i].var);
+    if (o->propval)
+	myfree(o->propval, M_PVAL);
+    o->nval = 0;
+
+    dbpriv_free_command_index(o);
+    dbpriv_free_match_index(o);
+    for (v = o->verbdefs; v; v = w) {
+	if (v->program)
+	    free_program(v->program);
+	free_str(v->name);
+	w = v->next;
+	myfree(v, M_VERBDEF);
+    }
+}
+
+void
+dbpriv_forget_object(Objid oid)
+{
+    Object *o = dbpriv_find_object(oid);
+
+    if (o) {
+	free_object_fields(o);
+	free_waif_propdefs((WaifPropdefs *)o->waif_propdefs);
+	myfree(o, M_OBJECT);
+	objects[oid] = nullptr;
+    }
+}
+
+Object *
+dbpriv_replace_object(Objid oid, bool renonce)
+{
+    Object *o = dbpriv_find_object(oid);
+    bool keep_nonce = o && !renonce;
+    unsigned int old_nonce = o ? o->nonce : 0;
+
+    dbpriv_forget_object(oid);
+    extend(oid + 1);
+    if (oid >= num_objects)
+	num_objects = oid + 1;
+    o = new_object_at(oid);
+
+    if (keep_nonce)
+	o->nonce = old_nonce;
+    else
+	dbpriv_assign_nonce(o);
+
+    return o;
+}
+
+void
+dbpriv_set_object_count(Num count)
+{
+    extend(count);
+    num_objects = count;
+}
+
 void
 db_init_object(Object *o)
 {
@@ -229,6 +492,8 @@ db_create_object(Num new_objid)
 
     o = dbpriv_new_object(new_objid);
     db_init_object(o);
+    /* Whatever had this number before may have had verbs. */
+    dbpriv_mark_programs_dirty(o);
 
     return o->id;
 }
@@ -237,8 +502,6 @@ void
 db_destroy_object(Objid oid)
 {
     Object *o = dbpriv_find_object(oid);
-    Verbdef *v, *w;
-    int i;
 
     db_priv_affected_callable_verb_lookup();
 
@@ -252,13 +515,6 @@ db_destroy_object(Objid oid)
 	o->children.v.list[0].v.num != 0)
 	panic_moo("DB_DESTROY_OBJECT: Not a barren orphan!");
 
-    free_var(o->parents);
-    free_var(o->children);
-
-    free_var(o->location);
-    free_var(o->last_move);
-    free_var(o->contents);
-
     if (is_user(oid)) {
 	Var t;
 
@@ -266,31 +522,16 @@ db_destroy_object(Objid oid)
 	t.v.obj = oid;
 	all_users = setremove(all_users, t);
     }
-    free_str(o->name);
 
-    for (i = 0; i < o->propdefs.cur_length; i++) {
-	/* As an orphan, the only properties on this object are the ones
-	 * defined on it directly, so these two arrays must be the same length.
-	 */
-	free_str(o->propdefs.l[i].name);
-	free_var(o->propval[i].var);
-    }
-    if (o->propdefs.l)
-	myfree(o->propdefs.l, M_PROPDEF);
-    if (o->propval)
-	myfree(o->propval, M_PVAL);
-    o->nval = 0;
-
-    for (v = o->verbdefs; v; v = w) {
-	if (v->program)
-	    free_program(v->program);
-	free_str(v->name);
-	w = v->next;
-	myfree(v, M_VERBDEF);
-    }
+    /* As an orphan, the only properties on this object are the ones
+     * defined on it directly.
+     */
+    free_object_fields(o);
 
     myfree(objects[oid], M_OBJECT);
     objects[oid] = nullptr;
+
+    dbpriv_mark_dirty_objid(oid);
 }
 
 Var
@@ -361,9 +602,11 @@ db_make_anonymous(Objid oid, Objid last)
     else if (old_parents.type == TYPE_LIST)
 	FOR_EACH(parent, old_parents, i, c)
 	    objects[parent.v.obj]->children = setremove(objects[parent.v.obj]->children, me);
+    dbpriv_mark_dirty_objids(old_parents);
 
     objects[oid] = nullptr;
     db_set_last_used_objid(last);
+    dbpriv_mark_dirty_objid(oid);
 
     o->id = NOTHING;
 
@@ -393,6 +636,9 @@ db_destroy_anonymous_object(void *obj)
     o->name = nullptr;
 
     free_var(o->parents);
+    free_var(o->ancestors);
+    o->ancestors = none;
+    o->ancestors_gen = ANCESTORS_STALE;
 
     for (i = 0; i < o->propdefs.cur_length; i++)
 	free_str(o->propdefs.l[i].name);
@@ -404,6 +650,8 @@ db_destroy_anonymous_object(void *obj)
 	myfree(o->propval, M_PVAL);
     o->nval = 0;
 
+    dbpriv_free_command_index(o);
+    dbpriv_free_match_index(o);
     for (v = o->verbdefs; v; v = w) {
 	if (v->program)
 	    free_program(v->program);
@@ -468,10 +716,6 @@ db_renumber_object(Objid old)
     Objid _new;
     Object *o;
 
-#ifdef USE_ANCESTOR_CACHE
-    db_clear_ancestor_cache();
-#endif /* USE_ANCESTOR_CACHE */
-
     for (_new = 0; _new < old; _new++) {
 	if (objects[_new] == nullptr) {
 	    /* Change the identity of the object. */
@@ -491,6 +735,7 @@ db_renumber_object(Objid old)
 		    FOR_EACH(obj2, objects[obj1.v.obj]->down, i2, c2)		\
 			if (obj2.v.obj == old)					\
 			    break;						\
+		    drop_list_index(objects[obj1.v.obj]->down);			\
 		    objects[obj1.v.obj]->down.v.list[i2].v.obj = _new;		\
 		}								\
 	    }									\
@@ -498,6 +743,7 @@ db_renumber_object(Objid old)
 		FOR_EACH(obj1, objects[o->up.v.obj]->down, i2, c2)		\
 		if (obj1.v.obj == old)						\
 		    break;							\
+		drop_list_index(objects[o->up.v.obj]->down);			\
 		objects[o->up.v.obj]->down.v.list[i2].v.obj = _new;		\
 	    }									\
 	    FOR_EACH(obj1, o->down, i1, c1) {					\
@@ -505,6 +751,7 @@ db_renumber_object(Objid old)
 		    FOR_EACH(obj2, objects[obj1.v.obj]->up, i2, c2)		\
 			if (obj2.v.obj == old)					\
 			    break;						\
+		    drop_list_index(objects[obj1.v.obj]->up);			\
 		    objects[obj1.v.obj]->up.v.list[i2].v.obj = _new;		\
 		}								\
 		else {								\
@@ -517,12 +764,19 @@ db_renumber_object(Objid old)
 
 #undef	    FIX
 
+	    /* Cached ancestor lists and match indexes may refer to the old number. */
+	    db_clear_ancestor_cache();
+	    dbpriv_clear_match_indexes();
+
+	    dbpriv_need_full_checkpoint();
+
 	    /* Fix up the list of users, if necessary */
 	    if (is_user(_new)) {
 		int i;
 
 		for (i = 1; i <= all_users.v.list[0].v.num; i++)
 		    if (all_users.v.list[i].v.obj == old) {
+			drop_list_index(all_users);
 			all_users.v.list[i].v.obj = _new;
 			break;
 		    }
@@ -599,101 +853,88 @@ db_object_bytes(Var obj)
 }
 
 
-/* Traverse the tree/graph twice.  First to count the maximal number
- * of members, and then to copy the members.  Use the bit array to
- * mark objects that have been copied, to prevent double copies.
- * Note: the final step forcibly sets the length of the list, which
- * may be less than the allocated length.  It's possible to calculate
- * the correct length, but that would require one more round of bit
- * array bookkeeping.
+/* Returns the objects linked to by `field' (a single object or a list
+ * of objects) as an array, storing the number of them in `count'.
+ */
+static inline const Var *
+object_links(const Var& field, int *count)
+{
+    if (TYPE_LIST == field.type) {
+	*count = field.v.list[0].v.num;
+	return field.v.list + 1;
+    }
+
+    *count = 1;
+    return &field;
+}
+
+/* Walk the tree/graph once, depth-first and left-to-right, collecting
+ * each object the first time it is reached.  Objects are marked with
+ * the current traversal epoch rather than a bit array, so the cost is
+ * proportional to the size of the result instead of the size of the
+ * database, and the result list is allocated once at its final size.
  */
 /* The following implementations depend on the fact that an object
  * cannot appear in its own ancestors, descendants, location/contents
  * hierarchy.  It also depends on the fact that an anonymous object
  * cannot appear in any other object's hierarchies.  Consequently,
- * we don't set a bit for the root object (which may not have an id).
+ * we don't mark the root object (which may not have an id).
  */
+static Var
+traverse(Var obj, bool full, Var Object::*field)
+{
+    Object *o = dbpriv_dereference(obj);
+    const uint64_t epoch = ++visit_epoch;
+    std::vector<Objid> found;
+    std::vector<std::pair<Object *, int>> stack;
+    const Var *links;
+    int i, count;
+
+    stack.emplace_back(o, 0);
+
+    while (!stack.empty()) {
+	o = stack.back().first;
+	i = stack.back().second;
+	links = object_links(o->*field, &count);
 
-#define ARRAY_SIZE_IN_BYTES (array_size / 8)
-#define CLEAR_BIT_ARRAY() memset(bit_array, 0, ARRAY_SIZE_IN_BYTES)
+	if (i >= count) {
+	    stack.pop_back();
+	    continue;
+	}
+	stack.back().second++;
+
+	Object *next = dbpriv_find_object(links[i].v.obj);
+	if (!next || next->visit_epoch == epoch)
+	    continue;
+
+	next->visit_epoch = epoch;
+	found.push_back(links[i].v.obj);
+	stack.emplace_back(next, 0);
+    }
+
+    Var list = new_list(found.size() + (full ? 1 : 0));
+
+    i = 0;
+    if (full)
+	list.v.list[++i] = var_ref(obj);
+    for (auto oid : found)
+	list.v.list[++i] = Var::new_obj(oid);
+
+    return list;
+}
 
 #define DEFUNC(name, field)						\
 									\
-static int								\
-db1_count_##name(Object *o)						\
-{									\
-    int i, c, n = 0;							\
-    Var tmp, field = enlist_var(var_ref(o->field));			\
-    Object *o2;								\
-    Objid oid;								\
-									\
-    FOR_EACH(tmp, field, i, c) {					\
-	if (valid(oid = tmp.v.obj)) {					\
-	    if (bit_is_false(bit_array, oid)) {				\
-		bit_true(bit_array, oid);				\
-		o2 = dbpriv_find_object(oid);				\
-		n += db1_count_##name(o2) + 1;				\
-	    }								\
-	}								\
-    }									\
-									\
-    free_var(field);							\
-									\
-    return n;								\
-}									\
-									\
-static void								\
-db2_add_##name(Object *o, Var *plist, int *px)				\
-{									\
-    int i, c;								\
-    Var tmp, field = enlist_var(var_ref(o->field));			\
-    Object *o2;								\
-    Objid oid;								\
-									\
-    FOR_EACH(tmp, field, i, c) {					\
-	if (valid(oid = tmp.v.obj)) {					\
-	    if (bit_is_false(bit_array, oid)) {				\
-		bit_true(bit_array, oid);				\
-		++(*px);						\
-		plist->v.list[*px].type = TYPE_OBJ;			\
-		plist->v.list[*px].v.obj = oid;				\
-		o2 = dbpriv_find_object(oid);				\
-		db2_add_##name(o2, plist, px);				\
-	    }								\
-	}								\
-    }									\
-									\
-    free_var(field);							\
-}									\
-									\
 Var									\
 db_##name(Var obj, bool full)						\
 {									\
-    Object *o;								\
-    int n, i = 0;							\
-    Var list;								\
+    Object *o = dbpriv_dereference(obj);				\
 									\
-    o = dbpriv_dereference(obj);					\
     if ((o->field.type == TYPE_OBJ && o->field.v.obj == NOTHING) ||	\
 	(o->field.type == TYPE_LIST && listlength(o->field) == 0))	\
 	return full ? enlist_var(var_ref(obj)) : new_list(0);		\
 									\
-    CLEAR_BIT_ARRAY();							\
-									\
-    n = db1_count_##name(o) + (full ? 1 : 0);				\
-									\
-    list = new_list(n);							\
-									\
-    if (full)								\
-	list.v.list[++i] = var_ref(obj);				\
-									\
-    CLEAR_BIT_ARRAY();							\
-									\
-    db2_add_##name(o, &list, &i);					\
-									\
-    list.v.list[0].v.num = i; /* sketchy */				\
-									\
-    return list;							\
+    return traverse(obj, full, &Object::field);				\
 }
 
 DEFUNC(descendants, children);
@@ -702,35 +943,104 @@ DEFUNC(descendants, children);
 DEFUNC(all_locations, location);
 DEFUNC(all_contents, contents);
 
-#ifdef USE_ANCESTOR_CACHE
 DEFUNC(find_ancestors, parents);
 
-Var db_ancestors(Var obj, bool full) {
-    Object *o = dbpriv_dereference(obj);
+#undef DEFUNC
 
-    if (obj.type != TYPE_OBJ || !is_valid(obj) || o->parents.v.obj == NOTHING)
-        return db_find_ancestors(obj, full);
+/* Builds the ancestors of `o' out of the (cached) ancestors of each of
+ * its parents: each parent, followed by its own ancestors, skipping
+ * anything already seen.  This produces exactly the depth-first,
+ * left-to-right order of `db_find_ancestors()'.  Returns 0 without
+ * caching anything if a cycle is found (which only happens while
+ * validating a freshly loaded database).
+ */
+static int
+build_ancestors(Object *o)
+{
+    const Var *parents;
+    int i, j, k, c, n = 0, count = 0;
 
-    if (ancestor_cache.count(o->id) == 0)
-        ancestor_cache[o->id] = db_find_ancestors(obj, false);
+    if (TYPE_LIST == o->parents.type) {
+	parents = o->parents.v.list + 1;
+	count = o->parents.v.list[0].v.num;
+    }
+    else {
+	parents = &o->parents;
+	count = 1;
+    }
 
-    Var ancestors = var_ref(ancestor_cache[o->id]);
+    o->ancestors_gen = ANCESTORS_BUILDING;
 
-    /* The 'full' refcount only needs to be 1 because listinsert will be creating a new list and consuming
-     * the second reference to the cached copy (which we just created directly above this). This leaves us
-     * with a refcount of 1, which is the new list that we WANT to get destroyed.
-     * The non-full list should have a refcount of 2 so that when it gets consumed, the copy in the cache
-     * won't be freed. */
-    if (full)
-        return listinsert(ancestors, var_ref(obj), 1); /* listinsert consumes the list */
-    else
-        return ancestors;
+    for (i = 0; i < count; i++) {
+	Object *p = dbpriv_find_object(parents[i].v.obj);
+
+	if (!p)
+	    continue;
+	if (p->ancestors_gen == ANCESTORS_BUILDING
+	    || (p->ancestors_gen != ancestor_generation && !build_ancestors(p))) {
+	    o->ancestors_gen = ANCESTORS_STALE;
+	    return 0;
+	}
+	n += listlength(p->ancestors) + 1;
+    }
+
+    Var list = new_list(n);
+
+    for (i = 0, n = 0; i < count; i++) {
+	Object *p = dbpriv_find_object(parents[i].v.obj);
+	Objid oid;
+
+	if (!p)
+	    continue;
+
+	c = listlength(p->ancestors);
+	for (j = 0; j <= c; j++) {
+	    oid = j == 0 ? p->id : p->ancestors.v.list[j].v.obj;
+	    for (k = 1; k <= n; k++)
+		if (list.v.list[k].v.obj == oid)
+		    break;
+	    if (k > n)
+		list.v.list[++n] = Var::new_obj(oid);
+	}
+    }
+
+    list.v.list[0].v.num = n; /* sketchy: may be less than allocated */
+
+    free_var(o->ancestors);
+    o->ancestors = list;
+    o->ancestors_gen = ancestor_generation;
+
+    return 1;
 }
-#else
-DEFUNC(ancestors, parents);
+
+Var
+dbpriv_object_ancestors(Object *o)
+{
+#ifdef USE_ANCESTOR_CACHE
+    if (o->ancestors_gen == ancestor_generation || build_ancestors(o))
+	return o->ancestors;
 #endif /* USE_ANCESTOR_CACHE */
 
-#undef DEFUNC
+    Var obj;
+
+    obj.type = TYPE_ANON;	/* only used to find `o' again */
+    obj.v.anon = o;
+
+    free_var(o->ancestors);
+    o->ancestors = db_find_ancestors(obj, false);
+    o->ancestors_gen = ANCESTORS_STALE;
+
+    return o->ancestors;
+}
+
+Var
+db_ancestors(Var obj, bool full)
+{
+    Var ancestors = var_ref(dbpriv_object_ancestors(dbpriv_dereference(obj)));
+
+    return full ? listinsert(ancestors, var_ref(obj), 1) : ancestors;
+}
+
 
 /*********** Object attributes ***********/
 
@@ -769,17 +1079,21 @@ db_object_has_flag2(Var obj, db_object_flag f)
 void
 db_set_object_flag2(Var obj, db_object_flag f)
 {
-    (TYPE_ANON == obj.type) ?
-      dbpriv_set_object_flag(obj.v.anon, f) :
-      db_set_object_flag(obj.v.obj, f);
+    if (TYPE_ANON == obj.type) {
+	dbpriv_set_object_flag(obj.v.anon, f);
+	dbpriv_mark_dirty(obj.v.anon);
+    } else
+	db_set_object_flag(obj.v.obj, f);
 }
 
 void
 db_clear_object_flag2(Var obj, db_object_flag f)
 {
-    (TYPE_ANON == obj.type) ?
-      dbpriv_clear_object_flag(obj.v.anon, f) :
-      db_clear_object_flag(obj.v.obj, f);
+    if (TYPE_ANON == obj.type) {
+	dbpriv_clear_object_flag(obj.v.anon, f);
+	dbpriv_mark_dirty(obj.v.anon);
+    } else
+	db_clear_object_flag(obj.v.obj, f);
 }
 
 Objid
@@ -792,6 +1106,7 @@ void
 dbpriv_set_object_owner(Object *o, Objid owner)
 {
     o->owner = owner;
+    dbpriv_mark_dirty(o);
 }
 
 Objid
@@ -818,6 +1133,10 @@ dbpriv_set_object_name(Object *o, const char *name)
     if (o->name)
 	free_str(o->name);
     o->name = name;
+    dbpriv_mark_dirty(o);
+
+    if (o->location.type == TYPE_OBJ)
+	dbpriv_invalidate_match_index(dbpriv_find_object(o->location.v.obj));
 }
 
 const char *
@@ -962,7 +1281,11 @@ db_change_parents(Var obj, Var new_parents, Var anon_kids)
 	else if (new_parents.type == TYPE_LIST)
 	    FOR_EACH(parent, new_parents, i, c)
 		objects[parent.v.obj]->children = setadd(objects[parent.v.obj]->children, obj);
+
+	dbpriv_mark_dirty_objids(old_parents);
+	dbpriv_mark_dirty_objids(new_parents);
     }
+    dbpriv_mark_dirty(o);
 
     free_var(o->parents);
     o->parents = var_dup(new_parents);
@@ -973,22 +1296,13 @@ db_change_parents(Var obj, Var new_parents, Var anon_kids)
      * the aforementioned call will fix that).
      */
 
-#ifdef USE_ANCESTOR_CACHE
-    /* Invalidate the cache for all descendants of the object that is changing parents. */
-    Var desc;
-    int i, c;
+    /* Invalidate the cached ancestors of this object and all of its
+     * descendants.
+     */
+    db_clear_ancestor_cache();
 
-    Var descendants = db_descendants(obj, true);
-    FOR_EACH(desc, descendants, i, c) {
-        if (ancestor_cache.count(desc.v.obj) > 0) {
-            if (var_refcount(ancestor_cache[desc.v.obj]) > 1)
-                applog(LOG_ERROR, "Refcount too high for ancestor cache invalidation of #%i. Refcount = %i\n", desc.v.obj, var_refcount(ancestor_cache[desc.v.obj]));
-            free_var(ancestor_cache[desc.v.obj]);
-            ancestor_cache.erase(desc.v.obj);
-        }
-    }
-    free_var(descendants);
-#endif /* USE_ANCESTOR_CACHE */
+    /* Inherited aliases may have changed. */
+    dbpriv_clear_match_indexes();
 
     Var new_ancestors = db_ancestors(obj, true);
 
@@ -1042,6 +1356,155 @@ db_for_all_contents(Objid oid, int (*func) (void *, Objid), void *data)
     return 0;
 }
 
+/*
+ * Match indexes.  Matching an object name in a command compares it
+ * against the name and aliases of everything in the player's
+ * inventory and location, which is slow in crowded rooms.  Each
+ * container can have a sorted index of (case-folded name or alias,
+ * object) pairs for its contents, so that the objects with a name
+ * starting with some prefix form a contiguous range.
+ *
+ * An index is kept up to date as objects move in and out, thrown away
+ * when the name or aliases of one of its objects change, and all of
+ * them are made stale at once (by bumping `match_generation') when a
+ * change could affect the aliases of many objects: a change of
+ * parents, or adding, deleting or renaming an `aliases' property.
+ */
+struct match_index {
+    uint64_t generation;
+    std::vector<std::pair<std::string, Objid>> keys;
+};
+
+static uint64_t match_generation = 1;
+
+static std::string
+match_key(const char *name)
+{
+    std::string key(name);
+
+    for (auto &c : key)
+	if (c >= 'A' && c <= 'Z')
+	    c = c - 'A' + 'a';
+
+    return key;
+}
+
+/* Append the keys under which `oid' is filed to `keys'. */
+static void
+add_match_keys(Objid oid, std::vector<std::pair<std::string, Objid>> &keys)
+{
+    Var aliases;
+    db_prop_handle h;
+
+    keys.emplace_back(match_key(db_object_name(oid)), oid);
+
+    h = db_find_property(Var::new_obj(oid), "aliases", &aliases);
+    if (h.ptr && aliases.type == TYPE_LIST) {
+	Var alias;
+	int i, c;
+
+	FOR_EACH(alias, aliases, i, c)
+	    if (alias.type == TYPE_STR)
+		keys.emplace_back(match_key(alias.v.str), oid);
+    }
+}
+
+void
+dbpriv_free_match_index(Object *o)
+{
+    delete o->match_index;
+    o->match_index = nullptr;
+}
+
+void
+dbpriv_invalidate_match_index(Object *o)
+{
+    if (o)
+	dbpriv_free_match_index(o);
+}
+
+void
+dbpriv_clear_match_indexes(void)
+{
+    match_generation++;
+}
+
+/* The object's match index if it's up to date, otherwise nullptr. */
+static match_index *
+current_match_index(Object *o)
+{
+    if (o->match_index && o->match_index->generation != match_generation)
+	dbpriv_free_match_index(o);
+
+    return o->match_index;
+}
+
+static match_index *
+object_match_index(Objid oid)
+{
+    Object *o = objects[oid];
+    match_index *index = current_match_index(o);
+
+    if (index)
+	return index;
+
+    index = o->match_index = new match_index;
+    index->generation = match_generation;
+
+    Var item;
+    int i, c;
+
+    FOR_EACH(item, o->contents, i, c)
+	add_match_keys(item.v.obj, index->keys);
+    std::sort(index->keys.begin(), index->keys.end());
+
+    return index;
+}
+
+int
+db_for_all_matching_contents(Objid oid, const char *prefix,
+			     int (*func) (void *, Objid, int), void *data)
+{
+    const match_index *index = object_match_index(oid);
+    const std::string key = match_key(prefix);
+
+    for (auto it = std::lower_bound(index->keys.begin(), index->keys.end(), std::make_pair(key, MINOBJ));
+	 it != index->keys.end() && it->first.compare(0, key.size(), key) == 0; ++it)
+	if (func(data, it->second, it->first.size() == key.size()))
+	    return 1;
+
+    return 0;
+}
+
+/* Add `oid' to, or remove it from, the match index of `location', if
+ * it has an up-to-date one. */
+static void
+update_match_index(Objid location, Objid oid, bool add)
+{
+    if (!valid(location))
+	return;
+
+    match_index *index = current_match_index(objects[location]);
+    if (!index)
+	return;
+
+    std::vector<std::pair<std::string, Objid>> keys;
+    add_match_keys(oid, keys);
+
+    for (const auto &key : keys) {
+	auto it = std::lower_bound(index->keys.begin(), index->keys.end(), key);
+	if (add)
+	    index->keys.insert(it, key);
+	else if (it != index->keys.end() && *it == key)
+	    index->keys.erase(it);
+	else {
+	    /* Shouldn't happen, but a rebuild will put things right. */
+	    dbpriv_free_match_index(objects[location]);
+	    return;
+	}
+    }
+}
+
 void
 db_change_location(Objid oid, Objid new_location, int position)
 {
@@ -1052,14 +1515,21 @@ db_change_location(Objid oid, Objid new_location, int position)
 
     Objid old_location = objects[oid]->location.v.obj;
 
-    if (valid(old_location))
+    dbpriv_mark_dirty_objid(oid);
+    dbpriv_mark_dirty_objid(old_location);
+    dbpriv_mark_dirty_objid(new_location);
+
+    if (valid(old_location)) {
         objects[old_location]->contents = setremove(objects[old_location]->contents, var_dup(me));
+        update_match_index(old_location, oid, false);
+    }
 
     if (valid(new_location)) {
         if (position <= 0)
             position = objects[new_location]->contents.v.list[0].v.num + 1;
 
         objects[new_location]->contents = listinsert(objects[new_location]->contents, me, position);
+        update_match_index(new_location, oid, true);
     }
 
     free_var(objects[oid]->location);
@@ -1107,6 +1577,7 @@ void
 db_set_object_flag(Objid oid, db_object_flag f)
 {
     dbpriv_set_object_flag(objects[oid], f);
+    dbpriv_mark_dirty(objects[oid]);
 
     if (f == FLAG_USER)
 	all_users = setadd(all_users, Var::new_obj(oid));
@@ -1116,6 +1587,7 @@ void
 db_clear_object_flag(Objid oid, db_object_flag f)
 {
     dbpriv_clear_object_flag(objects[oid], f);
+    dbpriv_mark_dirty(objects[oid]);
     if (f == FLAG_USER)
 	all_users = setremove(all_users, Var::new_obj(oid));
 }
@@ -1164,29 +1636,16 @@ db_object_isa(Var object, Var parent)
     if (equality(object, parent, 0))
 	return 1;
 
-    Object *o, *t;
-
-    o = (TYPE_OBJ == object.type) ?
-        dbpriv_find_object(object.v.obj) :
-        object.v.anon;
-
-    Var ancestor, ancestors = enlist_var(var_ref(o->parents));
-
-    while (listlength(ancestors) > 0) {
-	POP_TOP(ancestor, ancestors);
+    /* Only permanent objects can be parents. */
+    if (TYPE_OBJ != parent.type)
+	return 0;
 
-	if (ancestor.v.obj == NOTHING)
-	    continue;
+    Var ancestors = dbpriv_object_ancestors(dbpriv_dereference(object));
+    int i, c = listlength(ancestors);
 
-	if (equality(ancestor, parent, 0)) {
-	    free_var(ancestors);
+    for (i = 1; i <= c; i++)
+	if (ancestors.v.list[i].v.obj == parent.v.obj)
 	    return 1;
-	}
-
-	t = dbpriv_find_object(ancestor.v.obj);
-
-	ancestors = listconcat(ancestors, enlist_var(var_ref(t->parents)));
-    }
 
     return 0;
 }
@@ -1201,26 +1660,31 @@ db_fixup_owners(const Objid obj)
         if (!o)
             continue;
 
-        if (o->owner == obj)
+        if (o->owner == obj) {
             o->owner = NOTHING;
+            dbpriv_mark_dirty(o);
+        }
 
         for (Verbdef *v = o->verbdefs; v; v = v->next)
-            if (v->owner == obj)
+            if (v->owner == obj) {
                 v->owner = NOTHING;
+                dbpriv_mark_dirty(o);
+            }
 
         p = o->propval;
         for (int i = 0, count = o->nval; i < count; i++)
-            if (p[i].owner == obj)
+            if (p[i].owner == obj) {
                 p[i].owner = NOTHING;
+                dbpriv_mark_dirty(o);
+            }
     }
 }
 
 void
 db_clear_ancestor_cache(void)
 {
-#ifdef USE_ANCESTOR_CACHE /*Just in case */
-    for (auto const& x : ancestor_cache)
-        free_var(x.second);
-    ancestor_cache.clear();
-#endif 
+    /* Stale lists are freed as they are rebuilt or their objects are
+     * destroyed.
+     */
+    ancestor_generation++;
 }
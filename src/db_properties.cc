@@ -49,10 +49,14 @@ static int
 properties_offset(Var target, Var _this)
 {
     Var ancestor, ancestors;
-    int i, c, offset = 0;
-    Object *o;
+    int i, c, offset;
+    Object *o = dbpriv_dereference(_this);
+
+    if (equality(target, _this, 0))
+	return 0;
 
-    ancestors = db_ancestors(_this, true);
+    offset = o->propdefs.cur_length;
+    ancestors = dbpriv_object_ancestors(o);
 
     FOR_EACH(ancestor, ancestors, i, c) {
 	if (equality(target, ancestor, 0))
@@ -61,8 +65,6 @@ properties_offset(Var target, Var _this)
 	offset += o->propdefs.cur_length;
     }
 
-    free_var(ancestors);
-
     return i <= c ? offset : -1;
 }
 
@@ -120,6 +122,8 @@ insert_prop2(Var obj, int pos, Pval pval)
     nprops = ++o->nval;
     new_propval = (Pval *)mymalloc(nprops * sizeof(Pval), M_PVAL);
 
+    dbpriv_mark_dirty(o);
+
 	free_waif_propdefs((WaifPropdefs*)o->waif_propdefs);
 	o->waif_propdefs = nullptr;
 
@@ -172,6 +176,16 @@ insert_prop_recursively(Objid root, int prop_pos, Pval pv)
     free_var(descendants);
 }
 
+/* Objects are matched by their names and aliases, so adding, removing,
+ * renaming or changing the value of an `aliases' property has to keep
+ * match indexes up to date.
+ */
+static bool
+is_aliases(const char *pname)
+{
+    return !strcasecmp(pname, "aliases");
+}
+
 int
 db_add_propdef(Var obj, const char *pname, Var value, Objid owner,
 	       unsigned flags)
@@ -202,6 +216,7 @@ db_add_propdef(Var obj, const char *pname, Var value, Objid owner,
 	    myfree(old_props, M_PROPDEF);
     }
     o->propdefs.l[o->propdefs.cur_length++] = dbpriv_new_propdef(pname);
+    dbpriv_mark_dirty(o);
 
     pval.var = value;
     pval.owner = owner;
@@ -213,6 +228,9 @@ db_add_propdef(Var obj, const char *pname, Var value, Objid owner,
     else
 	insert_prop2(obj, o->propdefs.cur_length - 1, pval);
 
+    if (is_aliases(pname))
+	dbpriv_clear_match_indexes();
+
     return 1;
 }
 
@@ -222,8 +240,11 @@ rename_waif_prop_recursively(Var root, const char *old, const char *_new)
 {
 	Object *o = dbpriv_dereference(root);
 
-	if (o->waif_propdefs)
+	if (o->waif_propdefs) {
 		waif_rename_propdef(o, old, _new);
+		/* Waifs name their properties in the database. */
+		dbpriv_need_full_checkpoint();
+	}
 
     Var descendant, descendants = db_descendants(root, false);
     int i, c = 0;
@@ -259,6 +280,10 @@ db_rename_propdef(Var obj, const char *old, const char *_new)
 	    free_str(props->l[i].name);
 	    props->l[i].name = str_ref(_new);
 	    props->l[i].hash = str_hash(_new);
+	    dbpriv_mark_dirty(o);
+
+	    if (is_aliases(old) || is_aliases(_new))
+		dbpriv_clear_match_indexes();
 
 	    return 1;
 	}
@@ -277,6 +302,7 @@ remove_prop2(Var obj, int pos)
     nprops = --o->nval;
 
     dbpriv_assign_nonce(o);
+    dbpriv_mark_dirty(o);
 
 	free_waif_propdefs((WaifPropdefs *)o->waif_propdefs);
 	o->waif_propdefs = nullptr;
@@ -362,6 +388,7 @@ db_delete_propdef(Var obj, const char *pname)
 		    props->l[j - 1] = props->l[j];
 
 	    props->cur_length--;
+	    dbpriv_mark_dirty(o);
 
 	    /* anonymous objects can't have children */
 	    if (TYPE_OBJ == obj.type)
@@ -369,6 +396,9 @@ db_delete_propdef(Var obj, const char *pname)
 	    else
               remove_prop2(obj, i);
 
+	    if (is_aliases(pname))
+		dbpriv_clear_match_indexes();
+
 	    return 1;
 	}
     }
@@ -507,6 +537,8 @@ db_find_property(Var obj, const char *name, Var *value)
 
     h.definer = nullptr;
     h.ptr = nullptr;
+    h.object = o;
+    h.aliases = false;
 
     for (i = 0; i < Arraysize(ptable); i++) {
 	if (ptable[i].hash == hash && !strcasecmp(name, ptable[i].name)) {
@@ -520,7 +552,7 @@ db_find_property(Var obj, const char *name, Var *value)
 
     h.built_in = BP_NONE;
 
-    Var ancestor, ancestors = db_ancestors(obj, false);
+    Var ancestor, ancestors = dbpriv_object_ancestors(o);
 
     Proplist *props = &(o->propdefs);
     Propdef *defs = props->l;
@@ -560,11 +592,11 @@ db_find_property(Var obj, const char *name, Var *value)
 
  done:
 
-    free_var(ancestors);
-
     if (!h.ptr)
 	return h;
 
+    h.aliases = is_aliases(name);
+
     if (value) {
 	Pval *prop = (Pval *)h.ptr;
 
@@ -632,6 +664,17 @@ db_set_property_value(db_prop_handle h, Var value)
 
 	free_var(prop->var);
 	prop->var = value;
+	dbpriv_mark_value_dirty((Object *)h.object, prop);
+
+	if (h.aliases) {
+	    Object *o = (Object *)h.object;
+
+	    /* Children may inherit the value. */
+	    if (o->children.type == TYPE_LIST && listlength(o->children) > 0)
+		dbpriv_clear_match_indexes();
+	    else if (o->location.type == TYPE_OBJ)
+		dbpriv_invalidate_match_index(dbpriv_find_object(o->location.v.obj));
+	}
     } else {
 	Object *o = (Object *)h.ptr;
 	db_object_flag flag;
@@ -669,6 +712,7 @@ db_set_property_value(db_prop_handle h, Var value)
 		dbpriv_set_object_flag(o, flag);
 	    else
 		dbpriv_clear_object_flag(o, flag);
+	    dbpriv_mark_dirty(o);
 	    free_var(value);
 	    break;
 	case BP_LOCATION:
@@ -705,6 +749,7 @@ db_set_property_owner(db_prop_handle h, Objid oid)
 	Pval *prop = (Pval *)h.ptr;
 
 	prop->owner = oid;
+	dbpriv_mark_dirty((Object *)h.object);
     }
 }
 
@@ -730,6 +775,7 @@ db_set_property_flags(db_prop_handle h, unsigned flags)
 	Pval *prop = (Pval *)h.ptr;
 
 	prop->perms = flags;
+	dbpriv_mark_dirty((Object *)h.object);
     }
 }
 
@@ -981,6 +1027,7 @@ dbpriv_fix_properties_after_chparent(Var obj, Var old_ancestors, Var new_ancesto
     me->nval = new_count;
 
     dbpriv_assign_nonce(me);
+    dbpriv_mark_dirty(me);
 
     myfree(old_offsets, M_INT);
     myfree(new_offsets, M_INT);
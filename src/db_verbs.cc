@@ -24,6 +24,10 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <climits>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "config.h"
 #include "db.h"
@@ -222,6 +226,7 @@ db_add_verb(Var obj, const char *vnames, Objid owner, unsigned flags,
 	o->verbdefs = newv;
 	count = 1;
     }
+    dbpriv_mark_programs_dirty(o);
     return count;
 }
 
@@ -298,45 +303,170 @@ db_delete_verb(db_verb_handle vh)
     if (v->name)
 	free_str(v->name);
     myfree(v, M_VERBDEF);
+    dbpriv_mark_programs_dirty(o);
 }
 
-db_verb_handle
-db_find_command_verb(Objid oid, const char *verb,
-		     db_arg_spec dobj, unsigned prep, db_arg_spec iobj)
+/*
+ * Command verb index.  Matching a command against every verbdef of an
+ * object and all of its ancestors with `verbcasecmp()' is slow when
+ * generics define hundreds of verbs, so each object gets an index of
+ * its own verbdefs, keyed by case-folded name.  A name without a `*'
+ * is filed under the whole name; a name with one is filed under the
+ * part before the first `*', since any word it matches starts with
+ * that prefix.  A lookup checks the entries filed under the word and
+ * under each of its prefixes, and confirms candidates with
+ * `verbcasecmp()'.
+ *
+ * Indexes are per object rather than per ancestor chain, so a change
+ * of parents doesn't affect them; they are rebuilt on demand whenever
+ * `db_priv_affected_callable_verb_lookup()' has been called since they
+ * were built.
+ */
+struct command_index_entry {
+    int position;		/* of the verbdef on the object */
+    bool prefix;		/* the name had a `*' */
+    Verbdef *verbdef;
+};
+
+struct command_index {
+    int generation;
+    std::unordered_map<std::string, std::vector<command_index_entry>> names;
+};
+
+extern int db_verb_generation;
+
+int commandcache_hit = 0;
+int commandcache_miss = 0;
+
+static inline char
+fold_case(char c)
 {
-    Object *o;
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+static command_index *
+build_command_index(Object *o)
+{
+    command_index *index = new command_index;
     Verbdef *v;
-    static handle h;
-    db_verb_handle vh;
+    int position;
 
-    Var ancestors;
-    Var ancestor;
-    int i, c;
+    for (v = o->verbdefs, position = 0; v; v = v->next, position++) {
+	const char *p = v->name;
 
-    ancestors = db_ancestors(Var::new_obj(oid), true);
+	while (*p) {
+	    std::string key;
+	    bool prefix = false;
+
+	    for (; *p && *p != ' '; p++) {
+		if (*p == '*')
+		    prefix = true;
+		else if (!prefix)
+		    key += fold_case(*p);
+	    }
+	    index->names[key].push_back({position, prefix, v});
+	    while (*p == ' ')
+		p++;
+	}
+    }
+
+    return index;
+}
+
+void
+dbpriv_free_command_index(Object *o)
+{
+    delete o->command_index;
+    o->command_index = nullptr;
+}
+
+static command_index *
+object_command_index(Object *o)
+{
+    const int generation = db_verb_generation;
+
+    if (o->command_index && o->command_index->generation == generation) {
+	commandcache_hit++;
+	return o->command_index;
+    }
 
-    FOR_EACH(ancestor, ancestors, i, c) {
-	o = dbpriv_find_object(ancestor.v.obj);
-	for (v = o->verbdefs; v; v = v->next) {
+    commandcache_miss++;
+    dbpriv_free_command_index(o);
+    o->command_index = build_command_index(o);
+    o->command_index->generation = generation;
+
+    return o->command_index;
+}
+
+/* The first verbdef on `o' (in definition order) matching the command. */
+static Verbdef *
+find_command_verbdef(Object *o, const char *verb,
+		     db_arg_spec dobj, unsigned prep, db_arg_spec iobj)
+{
+    command_index *index = object_command_index(o);
+    const size_t length = strlen(verb);
+    Verbdef *best = nullptr;
+    int best_position = INT_MAX;
+    std::string key;
+
+    key.reserve(length);
+    for (size_t k = 0; k <= length; k++) {
+	if (k > 0)
+	    key += fold_case(verb[k - 1]);
+
+	auto it = index->names.find(key);
+	if (it == index->names.end())
+	    continue;
+
+	for (const auto &entry : it->second) {
+	    if (entry.position >= best_position)
+		break;
+	    if (!entry.prefix && k < length)
+		continue;
+
+	    Verbdef *v = entry.verbdef;
 	    db_arg_spec vdobj = (db_arg_spec)((v->perms >> DOBJSHIFT) & OBJMASK);
 	    db_arg_spec viobj = (db_arg_spec)((v->perms >> IOBJSHIFT) & OBJMASK);
 
-	    if (verbcasecmp(v->name, verb)
-		&& (vdobj == ASPEC_ANY || vdobj == dobj)
+	    if ((vdobj == ASPEC_ANY || vdobj == dobj)
 		&& (v->prep == PREP_ANY || v->prep == prep)
-		&& (viobj == ASPEC_ANY || viobj == iobj)) {
-		h.definer = o;
-		h.verbdef = v;
-		vh.ptr = &h;
-
-		free_var(ancestors);
-
-		return vh;
+		&& (viobj == ASPEC_ANY || viobj == iobj)
+		&& verbcasecmp(v->name, verb)) {
+		best = v;
+		best_position = entry.position;
+		break;
 	    }
 	}
     }
 
-    free_var(ancestors);
+    return best;
+}
+
+db_verb_handle
+db_find_command_verb(Objid oid, const char *verb,
+		     db_arg_spec dobj, unsigned prep, db_arg_spec iobj)
+{
+    Object *o = dbpriv_find_object(oid);
+    Verbdef *v;
+    static handle h;
+    db_verb_handle vh;
+
+    Var ancestors = dbpriv_object_ancestors(o);
+    int i, c = listlength(ancestors);
+
+    for (i = 0; i <= c; i++) {
+	if (i > 0)
+	    o = dbpriv_find_object(ancestors.v.list[i].v.obj);
+	if (o->verbdefs == nullptr)
+	    continue;
+	if ((v = find_command_verbdef(o, verb, dobj, prep, iobj)) != nullptr) {
+	    h.definer = o;
+	    h.verbdef = v;
+	    vh.ptr = &h;
+
+	    return vh;
+	}
+    }
 
     vh.ptr = nullptr;
 
@@ -374,11 +504,13 @@ db_priv_affected_callable_verb_lookup(void)
     int i;
     vc_entry *vc, *vc_next;
 
+    /* Command indexes are checked against this even while the verb
+     * cache is off. */
+    db_verb_generation++;
+
     if (vc_table == nullptr)
 	return;
 
-    db_verb_generation++;
-
     for (i = 0; i < vc_size; i++) {
 	vc = vc_table[i];
 	while (vc) {
@@ -425,7 +557,7 @@ db_verb_cache_stats(void)
 	histogram[depth]++;
     }
 
-    v = new_list(5);
+    v = new_list(6);
     v.v.list[1].type = TYPE_INT;
     v.v.list[1].v.num = verbcache_hit;
     v.v.list[2].type = TYPE_INT;
@@ -439,6 +571,9 @@ db_verb_cache_stats(void)
 	vv.v.list[i + 1].type = TYPE_INT;
 	vv.v.list[i + 1].v.num = histogram[i];
     }
+    vv = (v.v.list[6] = new_list(2));
+    vv.v.list[1] = Var::new_int(commandcache_hit);
+    vv.v.list[2] = Var::new_int(commandcache_miss);
     return v;
 }
 
@@ -463,6 +598,8 @@ db_log_cache_stats(void)
 
     oklog("Verb cache stat summary: %d hits, %d misses, %d generations\n",
 	  verbcache_hit, verbcache_miss, db_verb_generation);
+    oklog("Command index: %d hits, %d builds\n",
+	  commandcache_hit, commandcache_miss);
     oklog("Depth   Count\n");
     for (i = 0; i < VC_CACHE_STATS_MAX + 1; i++)
 	oklog("%-5d   %-5d\n", i, histogram[i]);
@@ -484,41 +621,20 @@ struct verbdef_definer_data {
 static struct verbdef_definer_data
 find_callable_verbdef(Object *start, const char *verb)
 {
-    Object *o = nullptr;
+    struct verbdef_definer_data data;
+    Object *o = start;
     Verbdef *v = nullptr;
 
-    if ((v = find_verbdef_by_name(start, verb, 1)) != nullptr) {
-	struct verbdef_definer_data data;
-	data.o = start;
-	data.v = v;
-	return data;
-    }
-
-    Var stack = enlist_var(var_ref(start->parents));
-
-    while (listlength(stack) > 0) {
-	Var top;
-
-	POP_TOP(top, stack);
-
-	o = dbpriv_find_object(top.v.obj);
-	free_var(top);
-
-	if (!o) /* if it's invalid, AKA $nothing */
-	    continue;
+    Var ancestors = dbpriv_object_ancestors(start);
+    int i, c = listlength(ancestors);
 
+    for (i = 0; i <= c; i++) {
+	if (i > 0)
+	    o = dbpriv_find_object(ancestors.v.list[i].v.obj);
 	if ((v = find_verbdef_by_name(o, verb, 1)) != nullptr)
 	    break;
-
-	if (TYPE_OBJ == o->parents.type)
-	    stack = listinsert(stack, var_ref(o->parents), 1);
-	else
-	    stack = listconcat(var_ref(o->parents), stack);
     }
 
-    free_var(stack);
-
-    struct verbdef_definer_data data;
     data.o = o;
     data.v = v;
     return data;
@@ -766,6 +882,7 @@ db_set_verb_names(db_verb_handle vh, const char *names)
 	if (h->verbdef->name)
 	    free_str(h->verbdef->name);
 	h->verbdef->name = names;
+	dbpriv_mark_dirty(h->definer);
     } else
 	panic_moo("DB_SET_VERB_NAMES: Null handle!");
 }
@@ -787,9 +904,10 @@ db_set_verb_owner(db_verb_handle vh, Objid owner)
 {
     handle *h = (handle *) vh.ptr;
 
-    if (h)
+    if (h) {
 	h->verbdef->owner = owner;
-    else
+	dbpriv_mark_dirty(h->definer);
+    } else
 	panic_moo("DB_SET_VERB_OWNER: Null handle!");
 }
 
@@ -815,6 +933,7 @@ db_set_verb_flags(db_verb_handle vh, unsigned flags)
     if (h) {
 	h->verbdef->perms &= ~PERMMASK;
 	h->verbdef->perms |= flags;
+	dbpriv_mark_dirty(h->definer);
     } else
 	panic_moo("DB_SET_VERB_FLAGS: Null handle!");
 }
@@ -842,6 +961,7 @@ db_set_verb_program(db_verb_handle vh, Program * program)
 	if (h->verbdef->program)
 	    free_program(h->verbdef->program);
 	h->verbdef->program = program;
+	dbpriv_mark_programs_dirty(h->definer);
     } else
 	panic_moo("DB_SET_VERB_PROGRAM: Null handle!");
 }
@@ -873,6 +993,7 @@ db_set_verb_arg_specs(db_verb_handle vh,
 			     | (dobj << DOBJSHIFT)
 			     | (iobj << IOBJSHIFT));
 	h->verbdef->prep = prep;
+	dbpriv_mark_dirty(h->definer);
     } else
 	panic_moo("DB_SET_VERB_ARG_SPECS: Null handle!");
 }
@@ -81,7 +81,7 @@ do {				\
 
 #define READ_LABEL()	READ_BYTES(bc.numbytes_label)
 #define READ_LITERAL()	program->literals[READ_BYTES(bc.numbytes_literal)]
-#define READ_FORK()	program->fork_vectors[READ_BYTES(bc.numbytes_fork)]
+#define READ_FORK()	unoptimized_bytecodes(program->fork_vectors[READ_BYTES(bc.numbytes_fork)])
 #define READ_ID()	READ_BYTES(bc.numbytes_var_name)
 #define READ_STACK()	SKIP_BYTES(bc.numbytes_stack)
 
@@ -904,9 +904,9 @@ program_to_tree(Program * prog, int vector, int pc_vector, int pc)
     int i, sum;
 
     program = prog;
-    bc = (pc_vector == MAIN_VECTOR
-	  ? program->main_vector
-	  : program->fork_vectors[pc_vector]);
+    bc = unoptimized_bytecodes(pc_vector == MAIN_VECTOR
+			       ? program->main_vector
+			       : program->fork_vectors[pc_vector]);
 
     if (pc < 0)
 	hot_byte = nullptr;
@@ -924,9 +924,9 @@ program_to_tree(Program * prog, int vector, int pc_vector, int pc)
     expr_stack = (Expr **)mymalloc(sum * sizeof(Expr *), M_DECOMPILE);
     top_expr_stack = 0;
 
-    bc = (vector == MAIN_VECTOR
-	  ? program->main_vector
-	  : program->fork_vectors[vector]);
+    bc = unoptimized_bytecodes(vector == MAIN_VECTOR
+			       ? program->main_vector
+			       : program->fork_vectors[vector]);
 
     begin_code_allocation();
     decompile(bc, bc.vector, bc.vector + bc.size, &result, nullptr);
@@ -44,7 +44,7 @@ struct mapping mappings[] =
     {OP_EIF, "ELSEIF"},
     {OP_FORK, "FORK"},
     {OP_FORK_WITH_ID, "FORK_NAMED"},
-    {OP_FOR_LIST, "FOR_LIST"},
+    {OP_SUPER, "SUPER"},
     {OP_FOR_RANGE, "FOR_RANGE"},
     {OP_INDEXSET, "INDEXSET"},
     {OP_PUSH_GET_PROP, "PUSH_GET_PROP"},
@@ -192,6 +192,57 @@ finish_insn(Stream * s, Stream * insn)
     output(s);
 }
 
+static const char *super_tests[] =
+{
+    "EQ_TEST", "NE_TEST", "LT_TEST", "LE_TEST", "GT_TEST", "GE_TEST"
+};
+
+static void
+add_literal(Stream * insn, Var v)
+{
+    const char *ptr;
+
+    switch (v.type) {
+    case TYPE_OBJ:
+	stream_printf(insn, " #%" PRIdN, v.v.obj);
+	break;
+    case TYPE_INT:
+	stream_printf(insn, " %" PRIdN, v.v.num);
+	break;
+    case TYPE_FLOAT:
+    case TYPE_LIST:
+	stream_add_char(insn, ' ');
+	unparse_value(insn, v);
+	break;
+    case TYPE_STR:
+	stream_add_string(insn, " \"");
+	for (ptr = v.v.str; *ptr; ptr++) {
+	    if (*ptr == '"' || *ptr == '\\')
+		stream_add_char(insn, '\\');
+	    stream_add_char(insn, *ptr);
+	}
+	stream_add_char(insn, '"');
+	break;
+    case TYPE_ERR:
+	stream_printf(insn, " %s", error_name(v.v.err));
+	break;
+    default:
+	stream_printf(insn, " <literal type = %d>", v.type);
+	break;
+    }
+}
+
+/* The PUSH n or PUSH_CLEAR n opcode `o', as part of an OP_SUPER. */
+static void
+add_ready_push(Stream * insn, Program * prog, unsigned o)
+{
+    unsigned i = READY_PUSH_VAR(o);
+
+    stream_printf(insn, " %s %s", IS_PUSH_n(o) ? "PUSH" : "PUSH_CLEAR",
+		  (i < prog->num_var_names ? prog->var_names[i]
+		   : "*** Unknown variable ***"));
+}
+
 static void
 disassemble(Program * prog, Printer p, void *data)
 {
@@ -200,7 +251,6 @@ disassemble(Program * prog, Printer p, void *data)
     int i, l;
     unsigned pc;
     Bytecodes bc;
-    const char *ptr;
     const char **names = prog->var_names;
     unsigned tmp, num_names = prog->num_var_names;
 #   define NAMES(i) (tmp = i, tmp < num_names ? names[tmp] : "*** Unknown variable ***")
@@ -347,7 +397,6 @@ disassemble(Program * prog, Printer p, void *data)
 		    a2 = ADD_BYTES(bc.numbytes_var_name);
 		    stream_printf(insn, " %d %s", a1, NAMES(a2));
 		    break;
-		case OP_FOR_LIST:
 		case OP_FOR_RANGE:
 		    a1 = ADD_BYTES(bc.numbytes_var_name);
 		    a2 = ADD_BYTES(bc.numbytes_label);
@@ -362,38 +411,39 @@ disassemble(Program * prog, Printer p, void *data)
 				  NAMES(ADD_BYTES(bc.numbytes_var_name)));
 		    break;
 		case OP_IMM:
+		    add_literal(insn, literals[ADD_BYTES(bc.numbytes_literal)]);
+		    break;
+		case OP_SUPER:
 		    {
-			Var v;
+			unsigned sop = ADD_BYTES(1);
 
-			v = literals[ADD_BYTES(bc.numbytes_literal)];
-			switch (v.type) {
-			case TYPE_OBJ:
-			    stream_printf(insn, " #%" PRIdN, v.v.obj);
+			if (sop < SOP_REF) {
+			    stream_printf(insn, " PUT_POP %s",
+					  NAMES(sop - SOP_PUT_POP));
 			    break;
-			case TYPE_INT:
-			    stream_printf(insn, " %" PRIdN, v.v.num);
-			    break;
-            case TYPE_FLOAT:
-                stream_add_char(insn, ' ');
-                unparse_value(insn, v);
-                break;
-			case TYPE_STR:
-			    stream_add_string(insn, " \"");
-			    for (ptr = v.v.str; *ptr; ptr++) {
-				if (*ptr == '"' || *ptr == '\\')
-				    stream_add_char(insn, '\\');
-				stream_add_char(insn, *ptr);
-			    }
-			    stream_add_char(insn, '"');
-			    break;
-			case TYPE_ERR:
-			    stream_printf(insn, " %s", error_name(v.v.err));
-			    break;
-			default:
-			    stream_printf(insn, " <literal type = %d>",
-					  v.type);
+			} else if (sop < SOP_GET_PROP) {
+			    stream_add_string(insn, " REF");
+			    add_ready_push(insn, prog,
+					   READY_PUSH_OPCODE(sop - SOP_REF));
+			    add_ready_push(insn, prog, ADD_BYTES(1));
 			    break;
 			}
+
+			stream_printf(insn, " %s", (sop == SOP_GET_PROP
+						    ? "GET_PROP"
+						    : super_tests[sop - SOP_EQ_TEST]));
+			add_ready_push(insn, prog, ADD_BYTES(1));
+			if (sop == SOP_GET_PROP)
+			    add_literal(insn, literals[ADD_BYTES(bc.numbytes_literal)]);
+			else {
+			    if (bc.vector[pc] == OP_IMM) {
+				ADD_BYTES(1);
+				add_literal(insn, literals[ADD_BYTES(bc.numbytes_literal)]);
+			    } else
+				stream_printf(insn, " %d",
+					      OPCODE_TO_OPTIM_NUM(ADD_BYTES(1)));
+			    stream_printf(insn, " %d", ADD_BYTES(bc.numbytes_label));
+			}
 		    }
 		    break;
 		case OP_BI_FUNC_CALL:
@@ -36,6 +36,12 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "config.h"
+
+#if HAVE_POSIX_SPAWN
+#include <spawn.h>
+#endif
+
 #include "net_multi.h"
 
 #include "exec.h"
@@ -218,6 +224,38 @@ fork_and_exec(const char *cmd, const char *const args[], const char *const env[]
 	log_perror("EXEC: Couldn't create pipe - err");
 	goto close_out;
     }
+#if HAVE_POSIX_SPAWN
+    /* fork() has to copy the page tables of the whole server, which can
+     * stall the main loop for a long time when the database is large.
+     * posix_spawn() starts the child without copying them (glibc uses
+     * vfork semantics), and does the child's file descriptor shuffling
+     * for us.
+     */
+    else {
+	posix_spawn_file_actions_t actions;
+	int status;
+
+	if ((status = posix_spawn_file_actions_init(&actions)) != 0) {
+	    errno = status;
+	    log_perror("EXEC: Couldn't set up spawn");
+	    goto close_err;
+	}
+	if ((status = posix_spawn_file_actions_adddup2(&actions, pipeIn[0], STDIN_FILENO)) != 0
+	    || (status = posix_spawn_file_actions_adddup2(&actions, pipeOut[1], STDOUT_FILENO)) != 0
+	    || (status = posix_spawn_file_actions_adddup2(&actions, pipeErr[1], STDERR_FILENO)) != 0
+	    || (status = posix_spawn_file_actions_addclose(&actions, pipeIn[1])) != 0
+	    || (status = posix_spawn_file_actions_addclose(&actions, pipeOut[0])) != 0
+	    || (status = posix_spawn_file_actions_addclose(&actions, pipeErr[0])) != 0
+	    || (status = posix_spawn(&pid, cmd, &actions, nullptr,
+				     (char *const *)args, (char *const *)env)) != 0) {
+	    errno = status;
+	    log_perror("EXEC: Couldn't spawn");
+	    posix_spawn_file_actions_destroy(&actions);
+	    goto close_err;
+	}
+	posix_spawn_file_actions_destroy(&actions);
+    }
+#else
     else if ((pid = fork()) < 0) {
 	log_perror("EXEC: Couldn't fork");
 	goto close_err;
@@ -246,6 +284,7 @@ fork_and_exec(const char *cmd, const char *const args[], const char *const env[]
 	perror("execve");
 	exit(status);
     }
+#endif
 
     close(pipeIn[0]);
     close(pipeOut[1]);
@@ -293,6 +332,11 @@ exec_waiter_suspender(vm the_vm, void *data)
 
     BLOCK_SIGCHLD;
 
+    if (suspension_forbidden) {
+	error = E_PERM;
+	goto free_task_waiting_on_exec;
+    }
+
     int i;
     for (i = 0; i < EXEC_MAX_PROCESSES; i++) {
 	if (process_table[i] == nullptr) {
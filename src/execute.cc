@@ -34,6 +34,7 @@
 #include "opcode.h"
 #include "options.h"
 #include "parse_cmd.h"
+#include "profile.h"
 #include "server.h"
 #include "storage.h"
 #include "streams.h"
@@ -96,6 +97,12 @@ static Var map_time;
 /* macros to ease indexing into activation stack */
 #define RUN_ACTIV     activ_stack[top_activ_stack]
 #define CALLER_ACTIV  activ_stack[top_activ_stack - 1]
+
+/* Labels as values are a GNU extension (also in clang); other compilers get
+   the plain switch in run(). */
+#if defined(COMPUTED_GOTO_DISPATCH) && defined(__GNUC__)
+#define USE_COMPUTED_GOTO
+#endif
 
 /**** error handling ****/
 
@@ -315,6 +322,8 @@ unwind_stack(Finally_Reason why, Var value, enum outcome *outcome)
 	    return 1;
 	}
 	top_activ_stack--;
+	if (profiling)
+	    profile_return(activ_stack, top_activ_stack, ticks_remaining);
 
 	if (bi_func_pc != 0) {	/* Must unwind through a built-in function */
 	    package p;
@@ -745,6 +754,9 @@ call_verb2(Objid recv, const char *vname, Var _this, Var args, int do_pass, bool
     set_rt_env_var(env, SLOT_VERB, v);	/* no var_dup */
     set_rt_env_var(env, SLOT_ARGS, args);	/* no var_dup */
 
+    if (profiling)
+	profile_enter(activ_stack, top_activ_stack, ticks_remaining);
+
     return E_NONE;
 }
 
@@ -754,6 +766,67 @@ call_verb2(Objid recv, const char *vname, Var _this, Var args, int do_pass, bool
 #define bi_prop_protected(prop, progr) ((!is_wizard(progr)) && server_flag_option_cached(prop))
 #endif				/* IGNORE_PROP_PROTECTED */
 
+/* The value of `lhs op rhs' for OP_LT, OP_LE, OP_GT or OP_GE: an integer,
+ * or the error to raise.
+ */
+static Var
+compare_ordered(Opcode op, Var lhs, Var rhs)
+{
+    Var ans;
+    int comparison;
+
+    if ((lhs.type == TYPE_INT || lhs.type == TYPE_FLOAT)
+	&& (rhs.type == TYPE_INT || rhs.type == TYPE_FLOAT)) {
+	ans = compare_numbers(lhs, rhs);
+	if (ans.type == TYPE_ERR)
+	    return ans;
+	comparison = ans.v.num;
+    } else if (rhs.type != lhs.type || rhs.type == TYPE_LIST || rhs.type == TYPE_MAP) {
+	ans.type = TYPE_ERR;
+	ans.v.err = E_TYPE;
+	return ans;
+    } else {
+	switch (rhs.type) {
+	case TYPE_INT:
+	    comparison = compare_integers(lhs.v.num, rhs.v.num);
+	    break;
+	case TYPE_OBJ:
+	    comparison = compare_integers(lhs.v.obj, rhs.v.obj);
+	    break;
+	case TYPE_ERR:
+	    comparison = ((int) lhs.v.err) - ((int) rhs.v.err);
+	    break;
+	case TYPE_STR:
+	    comparison = strcasecmp(lhs.v.str, rhs.v.str);
+	    break;
+	default:
+	    errlog("RUN: Impossible type in comparison: %d\n",
+		   rhs.type);
+	    comparison = 0;
+	}
+    }
+
+    ans.type = TYPE_INT;
+    switch (op) {
+    case OP_LT:
+	ans.v.num = (comparison < 0);
+	break;
+    case OP_LE:
+	ans.v.num = (comparison <= 0);
+	break;
+    case OP_GT:
+	ans.v.num = (comparison > 0);
+	break;
+    case OP_GE:
+	ans.v.num = (comparison >= 0);
+	break;
+    default:
+	errlog("RUN: Imposible opcode in comparison: %d\n", op);
+	break;
+    }
+    return ans;
+}
+
 /**
   the main interpreter -- run()
   everything is just an entry point to it
@@ -852,8 +925,135 @@ do {								\
 
 #define JUMP(label)     (bv = bc.vector + label)
 
+/* PUSH n or PUSH_CLEAR n inside an OP_SUPER.  E_VARNF is raised before the
+   tick that OP_SUPER took was due, so that tick is given back. */
+#define SUPER_PUSH(o)						\
+do {								\
+    Var *vp = &RUN_ACTIV.rt_env[READY_PUSH_VAR(o)];		\
+    if (vp->type == TYPE_NONE) {				\
+	if (RUN_ACTIV.debug)					\
+	    ticks_remaining++;					\
+	PUSH_ERROR(E_VARNF);					\
+    } else if (IS_PUSH_n(o))					\
+	PUSH_REF(*vp);						\
+    else {							\
+	PUSH(*vp);						\
+	vp->type = TYPE_NONE;					\
+    }								\
+} while (0)
+
+#define CHARGE_TICK()						\
+do {								\
+    if (--ticks_remaining <= 0) {				\
+	STORE_STATE_VARIABLES();				\
+	abort_task(ABORT_TICKS);				\
+	return OUTCOME_ABORTED;					\
+    }								\
+    if (task_timed_out) {					\
+	STORE_STATE_VARIABLES();				\
+	abort_task(ABORT_SECONDS);				\
+	return OUTCOME_ABORTED;					\
+    }								\
+} while (0)
+
+/* HANDLER(label) starts the code for a group of opcodes.  With computed
+   gotos, dispatch_table sends ticking opcodes to label_tick, which charges
+   the tick, and the rest straight to label; each handler then fetches and
+   dispatches its successor itself rather than going back through the
+   switch. */
+#ifdef USE_COMPUTED_GOTO
+#define HANDLER(label)						\
+    label##_tick: __attribute__((unused));			\
+	CHARGE_TICK();						\
+    label:
+#define DISPATCH()	goto *dispatch_table[op]
+#define NEXT_OPCODE						\
+    {								\
+	error_bv = bv;						\
+	op = (Opcode)(*bv++);					\
+	DISPATCH();						\
+    }
+#else
+#define HANDLER(label)
+#define NEXT_OPCODE	break
+#endif
+
 /* end of major run() macros */
 
+#ifdef USE_COMPUTED_GOTO
+    static void *dispatch_table[256];
+
+    if (!dispatch_table[0]) {
+	unsigned o;
+
+#define DISPATCH_TO(o, label)					\
+	(dispatch_table[o] = COUNT_TICK(o) ? &&label##_tick : &&label)
+
+	for (o = 0; o < 256; o++)
+	    DISPATCH_TO(o, op_default);
+	DISPATCH_TO(OP_IF_QUES, op_if);
+	DISPATCH_TO(OP_IF, op_if);
+	DISPATCH_TO(OP_WHILE, op_if);
+	DISPATCH_TO(OP_EIF, op_if);
+	DISPATCH_TO(OP_JUMP, op_jump);
+	DISPATCH_TO(OP_FOR_RANGE, op_for_range);
+	DISPATCH_TO(OP_POP, op_pop);
+	DISPATCH_TO(OP_IMM, op_imm);
+	DISPATCH_TO(OP_MAP_CREATE, op_map_create);
+	DISPATCH_TO(OP_MAP_INSERT, op_map_insert);
+	DISPATCH_TO(OP_MAKE_EMPTY_LIST, op_make_empty_list);
+	DISPATCH_TO(OP_LIST_ADD_TAIL, op_list_add_tail);
+	DISPATCH_TO(OP_LIST_APPEND, op_list_append);
+	DISPATCH_TO(OP_INDEXSET, op_indexset);
+	DISPATCH_TO(OP_MAKE_SINGLETON_LIST, op_make_singleton_list);
+	DISPATCH_TO(OP_CHECK_LIST_FOR_SPLICE, op_check_list_for_splice);
+	DISPATCH_TO(OP_PUT_TEMP, op_put_temp);
+	DISPATCH_TO(OP_PUSH_TEMP, op_push_temp);
+	DISPATCH_TO(OP_EQ, op_eq);
+	DISPATCH_TO(OP_NE, op_eq);
+	DISPATCH_TO(OP_GT, op_gt);
+	DISPATCH_TO(OP_LT, op_gt);
+	DISPATCH_TO(OP_GE, op_gt);
+	DISPATCH_TO(OP_LE, op_gt);
+	DISPATCH_TO(OP_IN, op_in);
+	DISPATCH_TO(OP_MULT, op_mult);
+	DISPATCH_TO(OP_MINUS, op_mult);
+	DISPATCH_TO(OP_DIV, op_mult);
+	DISPATCH_TO(OP_MOD, op_mult);
+	DISPATCH_TO(OP_ADD, op_add);
+	DISPATCH_TO(OP_AND, op_and);
+	DISPATCH_TO(OP_OR, op_and);
+	DISPATCH_TO(OP_NOT, op_not);
+	DISPATCH_TO(OP_UNARY_MINUS, op_unary_minus);
+	DISPATCH_TO(OP_REF, op_ref);
+	DISPATCH_TO(OP_PUSH_REF, op_push_ref);
+	DISPATCH_TO(OP_RANGE_REF, op_range_ref);
+	DISPATCH_TO(OP_G_PUT, op_g_put);
+	DISPATCH_TO(OP_G_PUSH, op_g_push);
+	DISPATCH_TO(OP_GET_PROP, op_get_prop);
+	DISPATCH_TO(OP_PUSH_GET_PROP, op_push_get_prop);
+	DISPATCH_TO(OP_PUT_PROP, op_put_prop);
+	DISPATCH_TO(OP_FORK, op_fork);
+	DISPATCH_TO(OP_FORK_WITH_ID, op_fork);
+	DISPATCH_TO(OP_CALL_VERB, op_call_verb);
+	DISPATCH_TO(OP_RETURN, op_return);
+	DISPATCH_TO(OP_RETURN0, op_return);
+	DISPATCH_TO(OP_DONE, op_return);
+	DISPATCH_TO(OP_BI_FUNC_CALL, op_bi_func_call);
+	DISPATCH_TO(OP_SUPER, op_super);
+	DISPATCH_TO(OP_EXTENDED, op_extended);
+	for (o = 0; o < NUM_READY_VARS; o++) {
+	    DISPATCH_TO(OP_PUSH + o, op_push);
+#ifdef BYTECODE_REDUCE_REF
+	    DISPATCH_TO(OP_PUSH_CLEAR + o, op_push_clear);
+#endif
+	    DISPATCH_TO(OP_PUT + o, op_put);
+	}
+
+#undef DISPATCH_TO
+    }
+#endif
+
     LOAD_STATE_VARIABLES();
 
     if (raise) {
@@ -864,21 +1064,15 @@ do {								\
       next_opcode:
 	error_bv = bv;
 	op = (Opcode)(*bv++);
+#ifdef USE_COMPUTED_GOTO
+	DISPATCH();
+#endif
 
-	if (COUNT_TICK(op)) {
-	    if (--ticks_remaining <= 0) {
-		STORE_STATE_VARIABLES();
-		abort_task(ABORT_TICKS);
-		return OUTCOME_ABORTED;
-	    }
-	    if (task_timed_out) {
-		STORE_STATE_VARIABLES();
-		abort_task(ABORT_SECONDS);
-		return OUTCOME_ABORTED;
-	    }
-	}
+	if (COUNT_TICK(op))
+	    CHARGE_TICK();
 	switch (op) {
 
+	HANDLER(op_if)
 	case OP_IF_QUES:
 	case OP_IF:
 	case OP_WHILE:
@@ -897,15 +1091,17 @@ do {								\
 		}
 		free_var(cond);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_jump)
 	case OP_JUMP:
 	    {
 		unsigned lab = READ_BYTES(bv, bc.numbytes_label);
 		JUMP(lab);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_for_range)
 	case OP_FOR_RANGE:
 	    {
 		unsigned id = READ_BYTES(bv, bc.numbytes_var_name);
@@ -948,12 +1144,14 @@ do {								\
 		    }
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_pop)
 	case OP_POP:
 	    free_var(POP());
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_imm)
 	case OP_IMM:
 	    {
 		int slot;
@@ -969,8 +1167,9 @@ do {								\
 		slot = READ_BYTES(bv, bc.numbytes_literal);
 		PUSH_REF(RUN_ACTIV.prog->literals[slot]);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_map_create)
 	case OP_MAP_CREATE:
 	    {
 		Var map;
@@ -978,8 +1177,9 @@ do {								\
 		map = new_map();
 		PUSH(map);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_map_insert)
 	case OP_MAP_INSERT:
 	    {
 		Var r, map, key, value;
@@ -1001,8 +1201,9 @@ do {								\
 		    }
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_make_empty_list)
 	case OP_MAKE_EMPTY_LIST:
 	    {
 		Var list;
@@ -1010,8 +1211,9 @@ do {								\
 		list = new_list(0);
 		PUSH(list);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_list_add_tail)
 	case OP_LIST_ADD_TAIL:
 	    {
 		Var r, tail, list;
@@ -1032,8 +1234,9 @@ do {								\
 		    }
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_list_append)
 	case OP_LIST_APPEND:
 	    {
 		Var r, tail, list;
@@ -1054,12 +1257,13 @@ do {								\
 		    }
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
 	/* This opcode will not increase the length of a string
 	 * but it may increase the size of a list or map, thus the
 	 * check.
 	 */
+	HANDLER(op_indexset)
 	case OP_INDEXSET:
 	    {
 		Var value, index, list;
@@ -1150,8 +1354,9 @@ do {								\
 		    PUSH(list);
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_make_singleton_list)
 	case OP_MAKE_SINGLETON_LIST:
 	    {
 		Var list;
@@ -1160,25 +1365,29 @@ do {								\
 		list.v.list[1] = POP();
 		PUSH(list);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_check_list_for_splice)
 	case OP_CHECK_LIST_FOR_SPLICE:
 	    if (TOP_RT_VALUE.type != TYPE_LIST) {
 		free_var(POP());
 		PUSH_ERROR(E_TYPE);
 	    }
 	    /* no op if top-rt-stack is a list */
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_put_temp)
 	case OP_PUT_TEMP:
 	    RUN_ACTIV.temp = var_ref(TOP_RT_VALUE);
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_push_temp)
 	case OP_PUSH_TEMP:
 	    PUSH(RUN_ACTIV.temp);
 	    RUN_ACTIV.temp.type = TYPE_NONE;
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_eq)
 	case OP_EQ:
 	case OP_NE:
 	    {
@@ -1194,79 +1403,29 @@ do {								\
 		free_var(rhs);
 		free_var(lhs);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_gt)
 	case OP_GT:
 	case OP_LT:
 	case OP_GE:
 	case OP_LE:
 	    {
 		Var rhs, lhs, ans;
-		int comparison;
 
 		rhs = POP();
 		lhs = POP();
-		if ((lhs.type == TYPE_INT || lhs.type == TYPE_FLOAT)
-		    && (rhs.type == TYPE_INT || rhs.type == TYPE_FLOAT)) {
-		    ans = compare_numbers(lhs, rhs);
-		    if (ans.type == TYPE_ERR) {
-			free_var(rhs);
-			free_var(lhs);
-			PUSH_ERROR(ans.v.err);
-		    } else {
-			comparison = ans.v.num;
-			goto finish_comparison;
-		    }
-		} else if (rhs.type != lhs.type || rhs.type == TYPE_LIST || rhs.type == TYPE_MAP) {
-		    free_var(rhs);
-		    free_var(lhs);
-		    PUSH_ERROR(E_TYPE);
-		} else {
-		    switch (rhs.type) {
-		    case TYPE_INT:
-			comparison = compare_integers(lhs.v.num, rhs.v.num);
-			break;
-		    case TYPE_OBJ:
-			comparison = compare_integers(lhs.v.obj, rhs.v.obj);
-			break;
-		    case TYPE_ERR:
-			comparison = ((int) lhs.v.err) - ((int) rhs.v.err);
-			break;
-		    case TYPE_STR:
-			comparison = strcasecmp(lhs.v.str, rhs.v.str);
-			break;
-		    default:
-			errlog("RUN: Impossible type in comparison: %d\n",
-			       rhs.type);
-			comparison = 0;
-		    }
-
-		  finish_comparison:
-		    ans.type = TYPE_INT;
-		    switch (op) {
-		    case OP_LT:
-			ans.v.num = (comparison < 0);
-			break;
-		    case OP_LE:
-			ans.v.num = (comparison <= 0);
-			break;
-		    case OP_GT:
-			ans.v.num = (comparison > 0);
-			break;
-		    case OP_GE:
-			ans.v.num = (comparison >= 0);
-			break;
-		    default:
-			errlog("RUN: Imposible opcode in comparison: %d\n", op);
-			break;
-		    }
+		ans = compare_ordered(op, lhs, rhs);
+		free_var(rhs);
+		free_var(lhs);
+		if (ans.type == TYPE_ERR)
+		    PUSH_ERROR(ans.v.err);
+		else
 		    PUSH(ans);
-		    free_var(rhs);
-		    free_var(lhs);
-		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_in)
 	case OP_IN:
 	    {
 		Var lhs, rhs, ans;
@@ -1291,8 +1450,9 @@ do {								\
 		    free_var(lhs);
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_mult)
 	case OP_MULT:
 	case OP_MINUS:
 	case OP_DIV:
@@ -1332,8 +1492,9 @@ do {								\
 		else
 		    PUSH(ans);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_add)
 	case OP_ADD:
 	    {
 		Var rhs, lhs, ans;
@@ -1371,8 +1532,9 @@ do {								\
 		else
 		    PUSH(ans);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_and)
 	case OP_AND:
 	case OP_OR:
 	    {
@@ -1387,8 +1549,9 @@ do {								\
 		    free_var(POP());
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_not)
 	case OP_NOT:
 	    {
 		Var arg, ans;
@@ -1399,8 +1562,9 @@ do {								\
 		PUSH(ans);
 		free_var(arg);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_unary_minus)
 	case OP_UNARY_MINUS:
 	    {
 		Var arg, ans;
@@ -1421,9 +1585,11 @@ do {								\
 		PUSH(ans);
 		free_var(arg);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_ref)
 	case OP_REF:
+	  do_ref:
 	    {
 		Var index, list;
 
@@ -1502,8 +1668,9 @@ do {								\
 		    }
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_push_ref)
 	case OP_PUSH_REF:
 	    {
 		/* This is about the sketchiest manoeuvre I can
@@ -1556,8 +1723,9 @@ do {								\
 		    PUSH_ERROR(E_TYPE);
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_range_ref)
 	case OP_RANGE_REF:
 	    {
 		Var base, from, to;
@@ -1630,16 +1798,18 @@ do {								\
 		    }
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_g_put)
 	case OP_G_PUT:
 	    {
 		unsigned id = READ_BYTES(bv, bc.numbytes_var_name);
 		free_var(RUN_ACTIV.rt_env[id]);
 		RUN_ACTIV.rt_env[id] = var_ref(TOP_RT_VALUE);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_g_push)
 	case OP_G_PUSH:
 	    {
 		Var value;
@@ -1650,9 +1820,11 @@ do {								\
 		else
 		    PUSH_REF(value);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_get_prop)
 	case OP_GET_PROP:
+	  do_get_prop:
 	    {
 		Var propname, obj, prop;
 
@@ -1698,8 +1870,9 @@ do {								\
 			PUSH_REF(prop);
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_push_get_prop)
 	case OP_PUSH_GET_PROP:
 	    {
 		Var propname, obj, prop;
@@ -1736,8 +1909,9 @@ do {								\
 			PUSH_REF(prop);
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_put_prop)
 	case OP_PUT_PROP:
 	    {
 		Var obj, propname, rhs;
@@ -1851,8 +2025,9 @@ do {								\
 		    }
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_fork)
 	case OP_FORK:
 	case OP_FORK_WITH_ID:
 	    {
@@ -1881,8 +2056,9 @@ do {								\
 			RAISE_ERROR(e);
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_call_verb)
 	case OP_CALL_VERB:
 	    {
 		enum error err;
@@ -1960,8 +2136,9 @@ MATCH_TYPE(OBJ, obj)
 		    PUSH_ERROR(err);
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_return)
 	case OP_RETURN:
 	case OP_RETURN0:
 	case OP_DONE:
@@ -1983,8 +2160,9 @@ MATCH_TYPE(OBJ, obj)
 		}
 		LOAD_STATE_VARIABLES();
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_bi_func_call)
 	case OP_BI_FUNC_CALL:
 	    {
 		unsigned func_id;
@@ -1999,7 +2177,14 @@ MATCH_TYPE(OBJ, obj)
 		    package p;
 
 		    STORE_STATE_VARIABLES();
-		    p = call_bi_func(func_id, args, 1, RUN_ACTIV.progr, nullptr);
+		    if (profiling) {
+			profile_builtin(activ_stack, top_activ_stack,
+					ticks_remaining, func_id);
+			p = call_bi_func(func_id, args, 1, RUN_ACTIV.progr, nullptr);
+			profile_return(activ_stack, top_activ_stack,
+				       ticks_remaining);
+		    } else
+			p = call_bi_func(func_id, args, 1, RUN_ACTIV.progr, nullptr);
 		    LOAD_STATE_VARIABLES();
 
 		    switch (p.kind) {
@@ -2042,8 +2227,100 @@ MATCH_TYPE(OBJ, obj)
 		    }
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
+
+	HANDLER(op_super)
+	case OP_SUPER:
+	    {
+		/* error_bv is moved to each part of the sequence as it runs,
+		   so errors report the pc they would have without fusing. */
+		Byte *start = error_bv;
+		unsigned sop = READ_BYTES(bv, 1);
+
+		if (sop < SOP_REF) {
+		    Var *varp = &RUN_ACTIV.rt_env[sop - SOP_PUT_POP];
+
+		    free_var(*varp);
+		    *varp = POP();
+		} else if (sop < SOP_GET_PROP) {
+		    unsigned first = READY_PUSH_OPCODE(sop - SOP_REF);
+		    unsigned second = READ_BYTES(bv, 1);
+		    Var *lp = &RUN_ACTIV.rt_env[READY_PUSH_VAR(first)];
+		    Var *ip = &RUN_ACTIV.rt_env[READY_PUSH_VAR(second)];
+
+		    /* Indexing a list held in a variable needn't go through
+		       the stack. */
+		    if (lp->type == TYPE_LIST && ip->type == TYPE_INT
+			&& ip->v.num > 0 && ip->v.num <= lp->v.list[0].v.num) {
+			PUSH(var_ref(lp->v.list[ip->v.num]));
+			if (!IS_PUSH_n(second))
+			    ip->type = TYPE_NONE;
+			if (!IS_PUSH_n(first)) {
+			    free_var(*lp);
+			    lp->type = TYPE_NONE;
+			}
+			break;
+		    }
+		    SUPER_PUSH(first);
+		    error_bv = start + 1;
+		    SUPER_PUSH(second);
+		    error_bv = start + 2;
+		    goto do_ref;
+		} else if (sop == SOP_GET_PROP) {
+		    unsigned push = READ_BYTES(bv, 1);
+		    unsigned slot = READ_BYTES(bv, bc.numbytes_literal);
+
+		    SUPER_PUSH(push);
+		    PUSH_REF(RUN_ACTIV.prog->literals[slot]);
+		    error_bv = bv - 1;
+		    goto do_get_prop;
+		} else {
+		    Opcode cmp = (Opcode) (OP_EQ + sop - SOP_EQ_TEST);
+		    unsigned push = READ_BYTES(bv, 1);
+		    Var *vp = &RUN_ACTIV.rt_env[READY_PUSH_VAR(push)];
+		    Var lhs = *vp, rhs, ans;
+		    bool owned = !IS_PUSH_n(push);
+
+		    if (*bv == OP_IMM) {
+			bv++;
+			rhs = RUN_ACTIV.prog->literals[READ_BYTES(bv, bc.numbytes_literal)];
+		    } else
+			rhs = Var::new_int(OPCODE_TO_OPTIM_NUM(*bv++));
+
+		    /* The comparison reads the variable in place. */
+		    if (lhs.type == TYPE_NONE) {
+			if (RUN_ACTIV.debug)
+			    ticks_remaining++;
+			PUSH_ERROR(E_VARNF);
+			lhs = POP();
+		    } else if (owned)
+			vp->type = TYPE_NONE;
+
+		    if (cmp == OP_EQ || cmp == OP_NE) {
+			ans.type = TYPE_INT;
+			ans.v.num = (cmp == OP_EQ
+				     ? equality(rhs, lhs, 0)
+				     : !equality(rhs, lhs, 0));
+		    } else
+			ans = compare_ordered(cmp, lhs, rhs);
+		    if (owned)
+			free_var(lhs);
+
+		    /* bv is now at the label, just past the test */
+		    error_bv = bv - 2;
+		    if (ans.type == TYPE_ERR)
+			PUSH_ERROR(ans.v.err);
+		    else
+			PUSH(ans);
+
+		    error_bv = bv - 1;
+		    CHARGE_TICK();
+		    goto do_test;
+		}
+	    }
+	    NEXT_OPCODE;
 
+	HANDLER(op_extended)
 	case OP_EXTENDED:
 	    {
 		enum Extended_Opcode eop = (Extended_Opcode)(*bv);
@@ -2611,7 +2888,7 @@ MATCH_TYPE(OBJ, obj)
 		    panic_moo("Unknown extended opcode!");
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 
 	    /* These opcodes account for about 20% of all opcodes executed, so
 	       let's split out the case stmt so the compiler can help us out.
@@ -2622,6 +2899,7 @@ MATCH_TYPE(OBJ, obj)
 #if NUM_READY_VARS != 32
 #error NUM_READY_VARS expected to be 32
 #endif
+	HANDLER(op_push)
 	case OP_PUSH:
 	case OP_PUSH + 1:
 	case OP_PUSH + 2:
@@ -2663,9 +2941,10 @@ MATCH_TYPE(OBJ, obj)
 		} else
 		    PUSH_REF(value);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
 #ifdef BYTECODE_REDUCE_REF
+	HANDLER(op_push_clear)
 	case OP_PUSH_CLEAR:
 	case OP_PUSH_CLEAR + 1:
 	case OP_PUSH_CLEAR + 2:
@@ -2708,9 +2987,10 @@ MATCH_TYPE(OBJ, obj)
 		    vp->type = TYPE_NONE;
 		}
 	    }
-	    break;
+	    NEXT_OPCODE;
 #endif				/* BYTECODE_REDUCE_REF */
 
+	HANDLER(op_put)
 	case OP_PUT:
 	case OP_PUT + 1:
 	case OP_PUT + 2:
@@ -2752,8 +3032,9 @@ MATCH_TYPE(OBJ, obj)
 		} else
 		    *varp = var_ref(TOP_RT_VALUE);
 	    }
-	    break;
+	    NEXT_OPCODE;
 
+	HANDLER(op_default)
 	default:
 	    if (IS_OPTIM_NUM_OPCODE(op)) {
 		Var value;
@@ -2762,7 +3043,7 @@ MATCH_TYPE(OBJ, obj)
 		PUSH(value);
 	    } else
 		panic_moo("Unknown opcode!");
-	    break;
+	    NEXT_OPCODE;
 	}
     }
 }
@@ -2832,10 +3113,14 @@ run_interpreter(char raise, enum error e,
 	total_cputime.type = TYPE_FLOAT;
 
 	interpreter_is_running = 1;
+	if (profiling)
+		profile_resume(activ_stack, top_activ_stack, ticks_remaining);
 	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
 	ret = run(raise, e, result);
 	std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
 	total_cputime.v.fnum = elapsed.count();
+	if (profiling)
+		profile_pause(ticks_remaining);
 	interpreter_is_running = 0;
 
 	args = handler_verb_args;
@@ -3130,6 +3415,9 @@ setup_activ_for_eval(Program * prog)
     RUN_ACTIV.error_pc = 0;
     RUN_ACTIV.temp.type = TYPE_NONE;
 
+    if (profiling)
+	profile_enter(activ_stack, top_activ_stack, ticks_remaining);
+
     return 1;
 }
 
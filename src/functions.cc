@@ -15,6 +15,7 @@
     Pavel@Xerox.Com
  *****************************************************************************/
 
+#include <chrono>
 #include <stdarg.h>
 
 #include "bf_register.h"
@@ -24,12 +25,16 @@
 #include "list.h"
 #include "log.h"
 #include "map.h"
+#ifdef PCRE_FOUND
+#include "pcre_moo.h"
+#endif
 #include "server.h"
 #include "storage.h"
 #include "streams.h"
 #include "structures.h"
 #include "unparse.h"
 #include "utils.h"
+#include "verbs.h"
 
 /*****************************************************************************
  * This is the table of procedures that register MOO built-in functions.  To
@@ -75,7 +80,9 @@ static registry bi_function_registries[] =
     register_argon2,
     register_spellcheck,
     register_curl,
-    register_ansi24
+    register_ansi24,
+    register_profile,
+    register_loop_stats
 };
 
 void
@@ -90,6 +97,18 @@ register_bi_functions()
 
 /*** register ***/
 
+/* Element k of the histogram counts calls that took less than 2^k
+   microseconds (and at least 2^(k-1)); the last counts all the slower ones. */
+#define BF_HISTOGRAM_SIZE	20
+
+struct bft_stats {
+    Num calls;			/* not counting resumptions */
+    Num errors;
+    Num suspends;		/* including background thread hand-offs */
+    long long nanoseconds;
+    Num histogram[BF_HISTOGRAM_SIZE];
+};
+
 struct bft_entry {
     const char *name;
     const char *protect_str;
@@ -101,6 +120,7 @@ struct bft_entry {
     bf_read_type read;
     bf_write_type write;
     int _protected;
+    struct bft_stats stats;
 };
 
 static struct bft_entry bf_table[MAX_FUNC];
@@ -217,6 +237,8 @@ call_bi_func(unsigned n, Var arglist, Byte func_pc,
 	int k, max;
 	Var *args = arglist.v.list;
 
+	f->stats.calls++;
+
 	/*
 	 * Check permissions, if protected
 	 */
@@ -229,6 +251,7 @@ call_bi_func(unsigned n, Var arglist, Byte func_pc,
 
 	    if (e == E_MAXREC || !is_wizard(progr)) {
 		free_var(arglist);
+		f->stats.errors++;
 		return make_error_pack(e == E_MAXREC ? e : E_PERM);
 	    }
 	}
@@ -239,6 +262,7 @@ call_bi_func(unsigned n, Var arglist, Byte func_pc,
 	if (args[0].v.num < f->minargs
 	    || (f->maxargs != -1 && args[0].v.num > f->maxargs)) {
 	    free_var(arglist);
+	    f->stats.errors++;
 	    return make_error_pack(E_ARGS);
 	}
 	/*
@@ -255,6 +279,7 @@ call_bi_func(unsigned n, Var arglist, Byte func_pc,
 						|| arg == TYPE_FLOAT))
 		  || proto == arg)) {
 		free_var(arglist);
+		f->stats.errors++;
 		return make_error_pack(E_TYPE);
 	    }
 	}
@@ -267,8 +292,30 @@ call_bi_func(unsigned n, Var arglist, Byte func_pc,
     /*
      * do the function
      */
-    return (*(f->func)) (arglist, func_pc, vdata, progr);
+#ifdef TIME_BUILTIN_FUNCTIONS
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+#endif
+    package p = (*(f->func)) (arglist, func_pc, vdata, progr);
     /* f->func is responsible for freeing/using up arglist. */
+
+    if (p.kind == package::BI_RAISE)
+	f->stats.errors++;
+    else if (p.kind == package::BI_SUSPEND)
+	f->stats.suspends++;
+
+#ifdef TIME_BUILTIN_FUNCTIONS
+    long long ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - start).count();
+    long long us;
+    int k;
+
+    f->stats.nanoseconds += ns;
+    for (k = 0, us = ns / 1000; us && k < BF_HISTOGRAM_SIZE - 1; k++)
+	us >>= 1;
+    f->stats.histogram[k]++;
+#endif
+
+    return p;
 }
 
 void
@@ -473,6 +520,91 @@ bf_function_info(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(r);
 }
 
+static Var
+function_stats(unsigned n)
+{
+    struct bft_stats *st = &bf_table[n].stats;
+    Var r = new_list(5), h = new_list(BF_HISTOGRAM_SIZE);
+    int k;
+
+    for (k = 0; k < BF_HISTOGRAM_SIZE; k++)
+	h.v.list[k + 1] = Var::new_int(st->histogram[k]);
+
+    r.v.list[1] = Var::new_int(st->calls);
+    r.v.list[2] = Var::new_int(st->errors);
+    r.v.list[3] = Var::new_int(st->suspends);
+    r.v.list[4] = Var::new_float(st->nanoseconds / 1e9);
+    r.v.list[5] = h;
+    return r;
+}
+
+static package
+bf_function_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    Var r;
+    unsigned int i;
+
+    if (!is_wizard(progr)) {
+	free_var(arglist);
+	return make_error_pack(E_PERM);
+    }
+    if (arglist.v.list[0].v.num == 1) {
+	i = number_func_by_name(arglist.v.list[1].v.str);
+	if (i == FUNC_NOT_FOUND) {
+	    free_var(arglist);
+	    return make_error_pack(E_INVARG);
+	}
+	r = function_stats(i);
+    } else {
+	r = new_map();
+	for (i = 0; i < top_bf_table; i++)
+	    if (bf_table[i].stats.calls)
+		r = mapinsert(r, str_dup_to_var(bf_table[i].name),
+			      function_stats(i));
+    }
+
+    free_var(arglist);
+    return make_var_pack(r);
+}
+
+static package
+bf_reset_function_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    unsigned int i;
+
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+	return make_error_pack(E_PERM);
+
+    for (i = 0; i < top_bf_table; i++)
+	memset(&bf_table[i].stats, 0, sizeof(struct bft_stats));
+
+    return no_var_pack();
+}
+
+static package
+bf_cache_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    Var r;
+
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+	return make_error_pack(E_PERM);
+
+    r = new_map();
+#ifdef EVAL_CACHE_BYTES
+    r = mapinsert(r, str_dup_to_var("eval"), eval_cache_stats());
+#endif
+    r = mapinsert(r, str_dup_to_var("match"), match_cache_stats());
+#ifdef PCRE_FOUND
+    r = mapinsert(r, str_dup_to_var("pcre"), pcre_cache_stats());
+#endif
+
+    return make_var_pack(r);
+}
+
 static void
 load_server_protect_function_flags(void)
 {
@@ -530,5 +662,8 @@ void
 register_functions(void)
 {
     register_function("function_info", 0, 1, bf_function_info, TYPE_STR);
+    register_function("function_stats", 0, 1, bf_function_stats, TYPE_STR);
+    register_function("reset_function_stats", 0, 0, bf_reset_function_stats);
+    register_function("cache_stats", 0, 0, bf_cache_stats);
     register_function("load_server_options", 0, 0, bf_load_server_options);
 }
@@ -67,20 +67,11 @@ bool create_ansi24_string (ansi_string &string,
 }
 
 // -----------------------------------------------------------------------------
-// Replace ansi tags with ansi escape sequences
-// or remove ansi tags or ansi escape sequences
+// Remove ansi escape sequences
 
-bool replace_color_tags_with_ansi (char       *replacement,
-                                   size_t     size,
-                                   const char *original);
-
-bool remove_color_tags            (char       *replacement,
-                                   size_t     size,
-                                   const char *original);
-
-bool remove_ansi_sequences        (char       *replacement,
-                                   size_t     size,
-                                   const char *original);
+bool remove_ansi_sequences (char       *replacement,
+                            size_t     size,
+                            const char *original);
 
 // -----------------------------------------------------------------------------
 // Replace or remove a substring
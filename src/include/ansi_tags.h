@@ -0,0 +1,43 @@
+/******************************************************************************
+  Copyright (c) 1992, 1995, 1996 Xerox Corporation.  All rights reserved.
+  Portions of this code were written by Stephen White, aka ghond.
+  Use and copying of this software and preparation of derivative works based
+  upon this software are permitted.  Any distribution of this software or
+  derivative works must comply with all applicable United States export
+  control laws.  This software is made available AS IS, and Xerox Corporation
+  makes no warranty about the software, its performance or its conformity to
+  any specification.  Any person obtaining a copy of this software is requested
+  to send their name and post office or electronic mail address to:
+    Pavel Curtis
+    Xerox PARC
+    3333 Coyote Hill Rd.
+    Palo Alto, CA 94304
+    Pavel@Xerox.Com
+ *****************************************************************************/
+
+#ifndef ANSI_Tags_H
+#define ANSI_Tags_H 1
+
+#include "streams.h"
+
+/* Returns what to put in place of the tag `[NAME]', where NAME is the LENGTH
+ * bytes at NAME, or nullptr if it isn't a tag and should be left alone.
+ */
+typedef const char *(*tag_resolver) (const char *name, int length,
+				     void *data);
+
+/* Appends TEXT to OUT in one pass, replacing each `[NAME]' for which RESOLVE
+ * returns a string.  Names are at most MAX_LENGTH bytes and never contain a
+ * bracket; in `[a[red]' only `[red]' is a candidate.
+ */
+extern void translate_tags(Stream *out, const char *text, int max_length,
+			   tag_resolver resolve, void *data);
+
+/* parse_ansi() and remove_ansi(); OUT should be empty. */
+extern void parse_ansi_tags(Stream *out, const char *text);
+extern void remove_ansi_tags(Stream *out, const char *text);
+
+/* ansi24_replace_tags() and ansi24_remove_tags(), in ansi24.cc */
+extern void translate_color_tags(Stream *out, const char *text, bool remove);
+
+#endif				/* !ANSI_Tags_H */
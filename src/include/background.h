@@ -16,7 +16,7 @@ typedef struct background_waiter {
     void (*callback)(Var, Var*);        // The callback function that does the actual work.
     Var data;                           // Any data the callback function should be aware of.
     bool active;                        // @kill will set active to false and the callback should handle it accordingly.
-    int fd[2];                          // The pipe used to resume the task immediately.
+    struct background_waiter *next;     // Link in the completion queue once the callback has finished.
     Var return_value;                   // The final return value that gets sucked up by the network callback.
     char *human_title;                  // A human readable explanation for the thread's existance.
     threadpool *pool;                   // The thread pool to put this into.
@@ -25,8 +25,24 @@ typedef struct background_waiter {
 // User-visible functions
 extern package background_thread(void (*callback)(Var, Var*), Var* data, char *human_title, threadpool *the_pool = nullptr);
 extern bool can_create_thread();
+extern size_t background_thread_count();
 extern void make_error_map(enum error error_type, const char *msg, Var *ret);
 
+/* Read snapshots. A callback may only read the object database, or take and drop references
+ * to values that the main thread can also see (including its own arguments), between
+ * background_snapshot_begin() and background_snapshot_end(). Nothing changes while a snapshot
+ * is held, so everything read during one snapshot is consistent. Snapshots are exclusive and
+ * the main thread can't resume until the current one ends, so work in short slices
+ * (see SNAPSHOT_SLICE) and copy out anything needed afterwards.
+ * Both calls nest and are no-ops on the main thread (e.g. when threading is disabled). */
+#define SNAPSHOT_SLICE          1000    // Suggested number of objects to examine per snapshot.
+extern void background_snapshot_begin();
+extern void background_snapshot_end();
+
+// Called by the main thread around waiting for network activity, the only time snapshots are granted.
+extern void background_open_snapshots();
+extern void background_close_snapshots();
+
 // Other helper functions
 void deallocate_background_waiter(background_waiter *waiter);
 void initialize_background_waiter(background_waiter *waiter);
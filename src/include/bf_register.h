@@ -45,3 +45,5 @@ extern void register_argon2(void);
 extern void register_spellcheck(void);
 extern void register_curl(void);
 extern void register_ansi24(void);
+extern void register_profile(void);
+extern void register_loop_stats(void);
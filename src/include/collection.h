@@ -18,3 +18,5 @@
 #include "structures.h"
 
 extern int ismember(Var value, Var list, int case_matters);
+extern void free_list_index(void *list);
+extern void drop_list_index(Var list);
@@ -61,6 +61,9 @@
 #cmakedefine01 HAVE_SIGEMPTYSET
 #cmakedefine01 HAVE_SIGRELSE
 #cmakedefine01 HAVE_ACCEPT4
+#cmakedefine01 HAVE_EVENTFD
+#cmakedefine01 HAVE_POSIX_SPAWN
+#cmakedefine01 HAVE_FALLOCATE
 
 #if @HAVE_STRTOIMAX@
 # ifdef HAVE_LONG_LONG
@@ -77,3 +80,4 @@
 #cmakedefine CURL_FOUND
 #cmakedefine PCRE_FOUND
 #cmakedefine SQLITE3_FOUND
+#cmakedefine ZLIB_FOUND
@@ -80,7 +80,24 @@ enum db_flush_type {
 extern int db_flush(enum db_flush_type);
 				/* Flush some amount of the changed portion of
 				 * the database to disk, as indicated by the
-				 * argument.  Returns true on success.
+				 * argument.  Returns true on success.  For
+				 * FLUSH_ALL_NOW, DB_FLUSH_STARTED means the
+				 * server forked and the output goes on in the
+				 * child; DB_FLUSH_FINISHED means it is already
+				 * on disk.
+				 */
+#define DB_FLUSH_STARTED	1
+#define DB_FLUSH_FINISHED	2
+
+extern void db_checkpoint_finished(int success);
+				/* Call when the child started by a
+				 * DB_FLUSH_STARTED flush exits.
+				 */
+
+extern void db_log_changes(void);
+				/* Call at the end of each pass through the
+				 * main loop to append the changes it made to
+				 * the write-ahead log, if there is one.
 				 */
 
 extern Num db_disk_size(void);
@@ -244,6 +261,17 @@ extern int db_for_all_contents(Objid,
 				 *      db_renumber_object()
 				 *      db_change_location()
 				 */
+extern int db_for_all_matching_contents(Objid, const char *prefix,
+					int (*)(void *, Objid, int exact),
+					void *);
+				/* Calls the function for every object in the
+				 * contents of the given one with a name, or a
+				 * string in its `aliases' property, that starts
+				 * with PREFIX (ignoring case).  EXACT is true if
+				 * the name or alias is PREFIX itself.  An object
+				 * can be passed more than once.  Same rules as
+				 * db_for_all_contents().
+				 */
 extern void db_change_location(Objid oid, Objid location, int position);
 
 typedef enum {
@@ -395,6 +423,8 @@ typedef struct {
     enum bi_prop built_in;	/* true iff property is a built-in one */
     void *definer;		/* null iff property is a built-in one */
     void *ptr;			/* null iff property not found */
+    void *object;		/* the object the property was looked up on */
+    bool aliases;		/* true iff property is `aliases' (see match.cc) */
 } db_prop_handle;
 
 extern db_prop_handle db_find_property(Var obj, const char *name,
@@ -72,6 +72,28 @@ extern Program *dbio_read_program(DB_Version version,
 				 * be the required string.
 				 */
 
+extern bool dbio_read_program_text(const char **text, size_t *length);
+				/* Skips over the source of a program, as
+				 * dbio_read_program() would read it, without
+				 * compiling it, and points TEXT at it.  The
+				 * text stays valid as long as the input does.
+				 * Returns false if the file ended first.
+				 */
+
+extern Program *dbio_compile_program(DB_Version version,
+				     const char *text, size_t length,
+				     bool complete, bool quiet,
+				     const char *(*fmtr) (void *), void *data);
+				/* Compiles TEXT, which dbio_read_program_text()
+				 * returned COMPLETE for, exactly as
+				 * dbio_read_program() would have.  It can run
+				 * on several threads at once.  If QUIET, it
+				 * reports nothing and gives up on the first
+				 * error or warning, returning null, so that
+				 * the caller can compile the program again on
+				 * the main thread to report them in order.
+				 */
+
 
 /*********** Output ***********/
 
@@ -97,5 +119,9 @@ extern void dbio_write_string(const char *);
 
 extern void dbio_write_var(Var);
 
+extern void dbio_write_header(Objid oid, int vnum);
+				/* Writes `#OID:VNUM', or just `#OID' if VNUM
+				 * is negative, on a line of its own.
+				 */
 extern void dbio_write_program(Program *);
 extern void dbio_write_forked_program(Program * prog, int f_index);
@@ -22,6 +22,9 @@
 #define DB_PRIVATE_h
 
 #include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "config.h"
 #include "program.h"
@@ -84,7 +87,42 @@ typedef struct Object {
      */
     unsigned int nonce;
 
+    /* Linearized ancestors (not including the object itself), in the
+     * order properties and verbs are inherited.  Only valid while
+     * `ancestors_gen' matches the current hierarchy generation.  Use
+     * `dbpriv_object_ancestors()' rather than reading this directly.
+     */
+    Var ancestors;
+    uint64_t ancestors_gen;
+
+    /* Marks the object as reached during a graph traversal (see
+     * `db_descendants()' and friends).
+     */
+    uint64_t visit_epoch;
+
+    /* Index of this object's own verbdefs by name, used to match
+     * commands (see `db_find_command_verb()').  Built on demand and
+     * rebuilt when anything affecting verb lookup changes.
+     */
+    struct command_index *command_index;
+
+    /* Sorted index of the names and aliases of this object's contents,
+     * used to match object names in commands (see
+     * `db_for_all_matching_contents()').  Built on demand.
+     */
+    struct match_index *match_index;
+
     void *waif_propdefs;
+
+    /* The lists of changed objects this object is in, as a set of
+     * `Dirty_Set' bits (see `dbpriv_mark_dirty()').
+     */
+    unsigned char dirty;
+
+    /* The sets in which its verb programs, or the verbs it has, have
+     * changed (see `dbpriv_mark_programs_dirty()').
+     */
+    unsigned char programs_dirty;
 } Object;
 
 /*
@@ -116,6 +154,9 @@ extern void db_priv_affected_callable_verb_lookup(void);
 #define db_priv_affected_callable_verb_lookup()
 #endif
 
+/* Frees an object's command index, if it has one. */
+extern void dbpriv_free_command_index(Object *);
+
 /*********** Objects ***********/
 
 extern Var db_read_anonymous();
@@ -134,10 +175,29 @@ extern void dbpriv_set_object_name(Object *, const char *);
 				 * reference is to be persistent.
 				 */
 
+extern void dbpriv_invalidate_match_index(Object *);
+				/* Call when the name or aliases of an object
+				 * in the contents of this one may have changed.
+				 */
+extern void dbpriv_clear_match_indexes(void);
+				/* Call when the aliases of any number of
+				 * objects may have changed.
+				 */
+extern void dbpriv_free_match_index(Object *);
+
 extern int dbpriv_object_has_flag(Object *, db_object_flag);
 extern void dbpriv_set_object_flag(Object *, db_object_flag);
 extern void dbpriv_clear_object_flag(Object *, db_object_flag);
 
+extern Var dbpriv_object_ancestors(Object *);
+				/* Returns the linearized ancestors of the
+				 * object, not including the object itself.
+				 * The list is owned by the object and is only
+				 * good until the next change to the object
+				 * hierarchy, so callers that need it for
+				 * longer must var_ref() it.
+				 */
+
 extern Var dbpriv_object_parents(Object *);
 extern Var dbpriv_object_children(Object *);
 extern Var dbpriv_object_location(Object *);
@@ -176,6 +236,87 @@ extern Object *dbpriv_find_object(Objid);
 
 extern void dbpriv_after_load(void);
 
+extern void dbpriv_forget_object(Objid);
+				/* Frees the object, if there is one, without
+				 * regard to its relationships with other
+				 * objects.  Only for applying checkpoint
+				 * deltas while loading, which replace every
+				 * object on both sides of a relationship.
+				 */
+extern Object *dbpriv_replace_object(Objid, bool renonce);
+				/* Like `dbpriv_forget_object()', then creates
+				 * an object with that number and none of its
+				 * fields filled in.  A replaced object keeps
+				 * its nonce unless RENONCE is true.
+				 */
+extern void dbpriv_set_object_count(Num);
+				/* Sets `db_last_used_objid()' to one less. */
+
+/*********** Checkpoint deltas ***********/
+
+/* Every change to a permanent object is recorded here so that a
+ * checkpoint can write just the objects changed since the previous one,
+ * and the write-ahead log just those changed since its last record (see
+ * db_file.cc).  The two are tracked separately.
+ */
+
+enum Dirty_Set {
+    DIRTY_CHECKPOINT = 1, DIRTY_LOG = 2
+};
+#define DIRTY_ALL	(DIRTY_CHECKPOINT | DIRTY_LOG)
+
+extern void dbpriv_mark_dirty(Object *);
+				/* Records a change to the object.  Anonymous
+				 * objects are only written in full
+				 * checkpoints, so a change to one calls for
+				 * another full checkpoint.
+				 */
+extern void dbpriv_mark_value_dirty(Object *, Pval *);
+				/* Records a change to just the value of one
+				 * of the object's properties.  While
+				 * `dbpriv_logging_values' is true, the log
+				 * then needs only the value, not the object.
+				 */
+extern bool dbpriv_logging_values;
+extern void dbpriv_mark_programs_dirty(Object *);
+				/* Records a change to the object that adds,
+				 * removes or reprograms a verb.
+				 */
+extern void dbpriv_mark_dirty_objid(Objid);
+				/* Also works for objects just destroyed. */
+extern void dbpriv_mark_dirty_objids(Var);
+				/* For a `parents', `location' or `contents'
+				 * value: #-1, an object or a list of them.
+				 */
+extern void dbpriv_need_full_checkpoint(void);
+				/* Records a change that only a full
+				 * checkpoint can write.
+				 */
+
+extern bool dbpriv_full_checkpoint_needed(enum Dirty_Set);
+extern const std::vector<Objid> &dbpriv_dirty_objects(enum Dirty_Set);
+				/* Sorted, without duplicates. */
+extern const std::vector<std::pair<Objid, int>> &dbpriv_dirty_values(void);
+				/* The property values changed since the last
+				 * log record of objects not in its dirty set,
+				 * as object numbers and indexes into
+				 * `propval'; sorted, without duplicates.
+				 */
+extern bool dbpriv_layout_changed(Object *, enum Dirty_Set);
+				/* True if the object's nonce has changed
+				 * since the set was last cleared.
+				 */
+extern bool dbpriv_programs_changed(Object *, enum Dirty_Set);
+				/* True if the object's verb programs may
+				 * have changed since the set was last
+				 * cleared.
+				 */
+extern void dbpriv_clear_dirty(int sets);
+				/* Call when a checkpoint (DIRTY_ALL) or a log
+				 * record (DIRTY_LOG) has captured the state
+				 * of every object.
+				 */
+
 /*********** Properties ***********/
 
 extern Propdef dbpriv_new_propdef(const char *);
@@ -228,8 +369,31 @@ public:
 				 * running out of disk space for the dump).
 				 */
 
-extern void dbpriv_set_dbio_input(FILE *);
-extern void dbpriv_set_dbio_output(FILE *);
+extern void dbpriv_set_dbio_input(const char *data, size_t size);
+				/* Input is read from the SIZE bytes at DATA,
+				 * which must stay put until it is finished.
+				 */
+extern const char *dbpriv_dbio_input(size_t *remaining);
+				/* Returns the next unread byte and stores the
+				 * number left in REMAINING.
+				 */
+extern void dbpriv_set_dbio_output(int fd);
+extern void dbpriv_set_dbio_output(std::string *);
+				/* Output is buffered, and goes to FD or is
+				 * appended to the string.
+				 */
+extern void dbpriv_flush_dbio_output(void);
+				/* Writes out what is buffered; raises
+				 * dbpriv_dbio_failed if it can't.
+				 */
+
+extern bool dbpriv_writing_delta;
+				/* Set while writing a checkpoint delta, which
+				 * can't hold anonymous objects or waifs: they
+				 * are written once per checkpoint and referred
+				 * to by index after that.  DBIO fails if it
+				 * meets one.
+				 */
 
 /****/
 
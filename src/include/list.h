@@ -45,6 +45,8 @@ extern Var strrangeset(Var list, int from, int to, Var value);
 extern Var substr(Var str, int lower, int upper);
 extern Var strget(Var str, int i);
 
+extern Var match_cache_stats(void);
+
 extern const char *value2str(Var);
 extern void unparse_value(Stream *, Var);
 
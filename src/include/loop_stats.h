@@ -0,0 +1,45 @@
+/******************************************************************************
+  Copyright (c) 1992, 1995, 1996 Xerox Corporation.  All rights reserved.
+  Portions of this code were written by Stephen White, aka ghond.
+  Use and copying of this software and preparation of derivative works based
+  upon this software are permitted.  Any distribution of this software or
+  derivative works must comply with all applicable United States export
+  control laws.  This software is made available AS IS, and Xerox Corporation
+  makes no warranty about the software, its performance or its conformity to
+  any specification.  Any person obtaining a copy of this software is requested
+  to send their name and post office or electronic mail address to:
+    Pavel Curtis
+    Xerox PARC
+    3333 Coyote Hill Rd.
+    Palo Alto, CA 94304
+    Pavel@Xerox.Com
+ *****************************************************************************/
+
+#ifndef Loop_Stats_H
+#define Loop_Stats_H 1
+
+#include "structures.h"
+
+/* The parts of one pass through the server's main loop.  LOOP_IDLE is the
+ * time spent waiting for network activity, wherever that wait happens.
+ */
+enum loop_phase {
+    LOOP_GC, LOOP_CHECKPOINT, LOOP_RECYCLE, LOOP_NETWORK, LOOP_IDLE,
+    LOOP_TASKS, LOOP_CHILDREN, LOOP_CONNECTIONS, LOOP_LOG,
+    LOOP_PHASES
+};
+
+extern void loop_stats_begin_pass(void);
+				/* called at the top of the main loop */
+extern enum loop_phase loop_stats_phase(enum loop_phase);
+				/* charge the time since the last call to the
+				 * current phase and switch to the new one;
+				 * returns the old one */
+extern void loop_stats_response(double seconds);
+				/* a connection got its first output after
+				 * some input */
+extern void loop_stats_set_file(const char *filename);
+				/* write the statistics to FILENAME every
+				 * LOOP_STATS_INTERVAL seconds */
+
+#endif				/* !Loop_Stats_H */
@@ -38,6 +38,12 @@ typedef struct {		/* Network's handle on a listening point */
     void *ptr;
 } network_listener;
 
+typedef enum {			/* How a listening point's connections talk */
+    LISTEN_LINES,		/* lines of text (and telnet options) */
+    LISTEN_HTTP,		/* HTTP/1.1 requests */
+    LISTEN_WEBSOCKET		/* lines of text in WebSocket messages */
+} listen_mode;
+
 #include "server.h"		/* Include this *after* defining the types */
 
 extern const char *network_protocol_name(void);
@@ -65,7 +71,7 @@ extern int network_initialize(int argc, char **argv,
 extern enum error network_make_listener(server_listener sl, Var desc,
 					network_listener * nl, 
 					const char **name, const char **ip_address,
-					uint16_t *port, bool use_ipv6);
+					uint16_t *port, bool use_ipv6, listen_mode mode);
 				/* DESC is the second argument in a call to the
 				 * built-in MOO function `listen()'; it should
 				 * be used as a specification of a new local
@@ -83,6 +89,19 @@ extern enum error network_make_listener(server_listener sl, Var desc,
 				 * listening point for use in later calls on
 				 * each other.
 				 *
+				 * With MODE LISTEN_HTTP, connections accepted
+				 * on the listening point are read as HTTP/1.1
+				 * requests, which the network passes to
+				 * server_receive_http_request() instead of
+				 * calling server_receive_line().  With
+				 * LISTEN_WEBSOCKET, the network completes the
+				 * WebSocket opening handshake and then calls
+				 * server_receive_line() with an empty line
+				 * (where other connections begin with one
+				 * queued by the server) and with the lines in
+				 * each message received; output is sent as
+				 * one message per call.
+				 *
 				 * NOTE: It is more than okay for the server
 				 * still to be refusing connections.  The
 				 * server's call to network_listen() marks the
@@ -129,6 +148,19 @@ extern int network_send_bytes(network_handle nh,
 				 * fail if FLUSH_OK is false.
 				 */
 
+extern void network_send_http_response(network_handle nh,
+				       const char *header, int header_length,
+				       const char *body, bool close);
+				/* Queue an HTTP response on a connection from
+				 * an HTTP listening point: the first
+				 * HEADER_LENGTH bytes of HEADER, then BODY,
+				 * which is a MOO string the network keeps a
+				 * reference to and writes without copying.
+				 * Nothing is discarded to make room.  If CLOSE
+				 * is true, the connection is closed, as if by
+				 * the other end, once the response is written.
+				 */
+
 extern int network_buffered_output_length(network_handle nh);
 				/* Returns the number of bytes of output
 				 * currently queued up on the given connection.
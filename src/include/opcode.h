@@ -43,11 +43,38 @@ enum Extended_Opcode {
     Last_Extended_Opcode = 255
 };
 
+/* Fused instructions ("superinstructions") for common sequences.  They
+ * are written over the code for the sequence by the optimizer (see
+ * optimize.cc), never by the compiler, and take exactly the same space, so
+ * no pc outside them changes:
+ *
+ *   SUPER PUT_POP+n			PUT n; POP
+ *   SUPER REF+r <push>			<push r>; <push>; REF
+ *   SUPER GET_PROP <push> <lit>	<push>; IMM <lit>; GET_PROP
+ *   SUPER EQ_TEST+c <push> <num> <lab>	<push>; <num>; EQ+c; IF <lab>
+ *
+ * <push> is a PUSH n or PUSH_CLEAR n opcode and r its READY_PUSH_INDEX;
+ * <num> is an OPTIM_NUM opcode or IMM <lit>; c selects EQ, NE, LT, LE, GT
+ * or GE; and IF may equally be EIF, WHILE or IF_QUES.  OP_SUPER costs a
+ * tick, standing for the first tick of its sequence; the second tick of
+ * the *_TEST ops is counted by run() as usual.
+ */
+enum Super_Opcode {
+    SOP_PUT_POP,
+    SOP_REF = SOP_PUT_POP + NUM_READY_VARS,
+    SOP_GET_PROP = SOP_REF + 2 * NUM_READY_VARS,
+    SOP_EQ_TEST, SOP_NE_TEST, SOP_LT_TEST, SOP_LE_TEST, SOP_GT_TEST,
+    SOP_GE_TEST,
+
+    Last_Super_Opcode = 255
+};
+
 enum Opcode {
 
     /* control/statement constructs with 1 tick: */
     OP_IF, OP_WHILE, OP_EIF, OP_FORK, OP_FORK_WITH_ID,
-    OP_FOR_LIST, /* retired */
+    OP_SUPER,			/* fused instructions; this was the
+				   retired OP_FOR_LIST */
     OP_FOR_RANGE,
 
     /* expr-related opcodes with 1 tick: */
@@ -115,6 +142,19 @@ enum Opcode {
 #define PUSH_n_INDEX(o)          ((o) - OP_PUSH)
 #define PUT_n_INDEX(o)           ((o) - OP_PUT)
 
+#ifdef BYTECODE_REDUCE_REF
+#define IS_READY_PUSH(o)         (IS_PUSH_n(o) || IS_PUSH_CLEAR_n(o))
+#define READY_PUSH_INDEX(o)      (IS_PUSH_n(o) ? PUSH_n_INDEX(o)	\
+				  : NUM_READY_VARS + PUSH_CLEAR_n_INDEX(o))
+#define READY_PUSH_OPCODE(r)     ((r) < NUM_READY_VARS ? OP_PUSH + (r)	\
+				  : OP_PUSH_CLEAR + (r) - NUM_READY_VARS)
+#else				/* !BYTECODE_REDUCE_REF */
+#define IS_READY_PUSH(o)         IS_PUSH_n(o)
+#define READY_PUSH_INDEX(o)      PUSH_n_INDEX(o)
+#define READY_PUSH_OPCODE(r)     (OP_PUSH + (r))
+#endif				/* BYTECODE_REDUCE_REF */
+#define READY_PUSH_VAR(o)        (READY_PUSH_INDEX(o) % NUM_READY_VARS)
+
 #define IS_OPTIM_NUM_OPCODE(o)   ((o) >= (unsigned) OPTIM_NUM_START)
 #define OPCODE_TO_OPTIM_NUM(o)   ((Num)(unsigned)(o) - OPTIM_NUM_START + OPTIM_NUM_LOW)
 
@@ -131,5 +171,6 @@ enum Opcode {
 
 typedef enum Opcode Opcode;
 typedef enum Extended_Opcode Extended_Opcode;
+typedef enum Super_Opcode Super_Opcode;
 
 #endif
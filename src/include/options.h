@@ -240,11 +240,21 @@
 /******************************************************************************
  * The server maintains a cache of the most recently used patterns from calls
  * to the match() and rmatch() built-in functions.  PATTERN_CACHE_SIZE controls
- * how many past patterns are remembered by the server.  Do not set it to a
- * number less than 1.
+ * how many past patterns are remembered by the server; cache_stats() shows
+ * how often they are found there.  Do not set it to a number less
+ * than 1.
  */
 
-#define PATTERN_CACHE_SIZE	20
+#define PATTERN_CACHE_SIZE	100
+
+/******************************************************************************
+ * Likewise, the server keeps the PCRE_CACHE_SIZE most recently used patterns
+ * given to pcre_match() and pcre_replace(), compiled (to machine code, if the
+ * PCRE library supports it) and ready to use.  cache_stats() shows how well
+ * it works.  Do not set it to a number less than 1.
+ */
+
+#define PCRE_CACHE_SIZE		500
 
 /******************************************************************************
  * Prior to 1.8.4 property lookups were required on every reference to a
@@ -290,6 +300,42 @@
 
 #define BYTECODE_REDUCE_REF /* */
 
+/******************************************************************************
+ * OPTIMIZE_BYTECODE runs a peephole pass over newly compiled verbs (see
+ * optimize.cc) that folds constant expressions, removes tests of constants
+ * and constants that are immediately discarded, and shortens chains of
+ * jumps.  Programs still decompile exactly as written, and the pass keeps
+ * every instruction that can fail or suspend at its original position, so
+ * this option can be flipped freely, even with suspended tasks in the
+ * database.  Optimized code uses fewer ticks.
+ ******************************************************************************
+ */
+
+#define OPTIMIZE_BYTECODE /* */
+
+/******************************************************************************
+ * With OPTIMIZE_BYTECODE, BYTECODE_SUPERINSTRUCTIONS also has the optimizer
+ * fuse a few common instruction sequences -- a variable's property, a
+ * variable indexed by another, assignment statements, and `if' or `while'
+ * tests comparing a variable with a constant -- into single instructions
+ * (see Super_Opcode in opcode.h).  Tick counts, traceback line numbers and
+ * decompiled code are the same either way.
+ ******************************************************************************
+ */
+
+#define BYTECODE_SUPERINSTRUCTIONS /* */
+
+/******************************************************************************
+ * COMPUTED_GOTO_DISPATCH makes the interpreter loop in execute.cc jump from
+ * each opcode's code directly to the next one's through a table of label
+ * addresses, instead of returning to a single switch every time.  This uses
+ * a GCC extension that clang also supports; with any other compiler the
+ * option is ignored and the switch is used.  Behavior is identical.
+ ******************************************************************************
+ */
+
+#define COMPUTED_GOTO_DISPATCH /* */
+
 /******************************************************************************
  * The server can merge duplicate strings on load to conserve memory.  This
  * involves a rather expensive step at startup to dispose of the table used
@@ -319,6 +365,50 @@
 
 #define MEMO_VALUE_BYTES /* */
 
+/******************************************************************************
+ * Lists of at least LIST_INDEX_THRESHOLD elements that are searched (by `in',
+ * is_member(), setadd() or setremove()) LIST_INDEX_PROBES times get a hidden
+ * hash index of their elements, so later searches don't have to scan them.
+ * The index is discarded as soon as the list is modified.
+ ******************************************************************************
+ */
+
+#define LIST_INDEX_THRESHOLD	1000
+#define LIST_INDEX_PROBES	3
+
+/******************************************************************************
+ * eval() keeps the programs it compiles, keyed by their code, so evaluating
+ * the same code again doesn't parse it again.  EVAL_CACHE_BYTES bounds the
+ * total size of the kept programs and their code; the least recently used
+ * are dropped first.  Wizards can check how well it works with
+ * cache_stats().  Comment it out to compile every eval() afresh.
+ ******************************************************************************
+ */
+
+#define EVAL_CACHE_BYTES	(1024 * 1024)
+
+/******************************************************************************
+ * The server counts the calls, errors and suspensions of every built-in
+ * function for function_stats().  With TIME_BUILTIN_FUNCTIONS it also keeps
+ * their total running time and a histogram of how long each call took, which
+ * costs two clock reads per call -- noticeable for the cheapest functions,
+ * such as length(), in tight loops.  Comment it out to count calls only.
+ ******************************************************************************
+ */
+
+#define TIME_BUILTIN_FUNCTIONS
+
+/******************************************************************************
+ * The server keeps statistics about where the time in its main loop goes,
+ * the lengths of its task queues and how long connections wait for output
+ * after sending input, for loop_stats().  When it's started with `-s FILE',
+ * it also writes them to FILE in the Prometheus text format every
+ * LOOP_STATS_INTERVAL seconds.
+ ******************************************************************************
+ */
+
+#define LOOP_STATS_INTERVAL	15
+
 /******************************************************************************
  * DEFAULT_MAX_STRING_CONCAT,      if set to a positive value, is the length
  *                                 of the largest constructible string.
@@ -431,9 +521,11 @@
 /* #define OWNERSHIP_QUOTA */
 
 /******************************************************************************
- * Cache ancestor lists until a parent changes. This is a quick and dirty solution
- * that will allow loops performing property lookups to happen much faster. Its
- * use in other applications is minimal, as the cache is invalidated often.
+ * Cache each object's linearized ancestor list until the object hierarchy
+ * changes.  Property lookups, verb lookups, pass() and isa() then become
+ * simple scans of the cached list.  Any chparents() invalidates every cached
+ * list at once; each is rebuilt (from its parents' cached lists) the next
+ * time it is needed.
  ******************************************************************************
 */
 #define USE_ANCESTOR_CACHE
@@ -506,6 +598,38 @@
 #define TOTAL_BACKGROUND_THREADS    2
 #define DEFAULT_THREAD_MODE         true
 
+/******************************************************************************
+ * sort() and all_members() split lists of at least PARALLEL_LIST_THRESHOLD
+ * elements across PARALLEL_LIST_THREADS helper threads (in addition to the
+ * background thread running the function). Set PARALLEL_LIST_THREADS to 1 to
+ * always use a single thread.
+ * NOTE: The number of threads can be controlled in the database by setting
+ *       $server_options.parallel_list_threads and calling load_server_options().
+ ******************************************************************************
+ */
+
+#define PARALLEL_LIST_THREADS       4
+#define PARALLEL_LIST_THRESHOLD     100000
+
+/******************************************************************************
+ * While loading the database, the server compiles verb programs on
+ * LOAD_THREADS threads at once, alongside the main thread reading them.  Set
+ * LOAD_THREADS to 0 to use one thread per processor, or to 1 to compile them
+ * one at a time on the main thread.
+ ******************************************************************************
+ */
+
+#define LOAD_THREADS                0
+
+/******************************************************************************
+ * Checkpoints, deltas and write-ahead log records are written through a buffer
+ * of DB_OUTPUT_BUFFER_SIZE bytes, so that the server makes one write() call
+ * per buffer rather than one per line.
+ ******************************************************************************
+ */
+
+#define DB_OUTPUT_BUFFER_SIZE       (1024 * 1024)
+
 /******************************************************************************
  * By default, the server will resolve DNS hostnames from IP addresses for all
  * connections. If you intend to use in-database threaded DNS lookups, or just
@@ -13,17 +13,25 @@
 #define RETURN_GROUPS       4
 #define FIND_ALL            8
 
-/* A misnomer, since we don't have a cache anymore. But I'm leaving
- * this struct around just in case we want to go back to caching
- * in the future, which we might with studying. */
+/* A compiled pattern for pcre_match(), or a compiled substitution for
+ * pcre_replace(), kept in the cache in pcre_moo.cc.  If compiling failed,
+ * ERROR says why. */
 struct pcre_cache_entry {
+    char *string;		/* the pattern or s/// command */
+    unsigned char options;
+    bool replace;		/* compiled for pcre_replace() */
+    unsigned hash;
     char *error;
     pcre *re;
     pcre_extra *extra;
     int captures;
+    struct PCRS_JOB *job;
+    struct pcre_cache_entry *next;	/* in the same bucket */
+    struct pcre_cache_entry *newer, *older;
 };
 
 void free_entry(pcre_cache_entry *);
 Var result_indices(int ovector[], int n);
+Var pcre_cache_stats(void);
 
 #endif /* EXTENSION_PCRE_H */
@@ -0,0 +1,41 @@
+/******************************************************************************
+  Copyright (c) 1992, 1995, 1996 Xerox Corporation.  All rights reserved.
+  Portions of this code were written by Stephen White, aka ghond.
+  Use and copying of this software and preparation of derivative works based
+  upon this software are permitted.  Any distribution of this software or
+  derivative works must comply with all applicable United States export
+  control laws.  This software is made available AS IS, and Xerox Corporation
+  makes no warranty about the software, its performance or its conformity to
+  any specification.  Any person obtaining a copy of this software is requested
+  to send their name and post office or electronic mail address to:
+    Pavel Curtis
+    Xerox PARC
+    3333 Coyote Hill Rd.
+    Palo Alto, CA 94304
+    Pavel@Xerox.Com
+ *****************************************************************************/
+
+#ifndef Profile_H
+#define Profile_H 1
+
+#include "execute.h"
+
+/* True between start_profiler() and stop_profiler().  The VM calls the
+ * functions below only while it is set.
+ */
+extern bool profiling;
+
+/* TICKS is always the running task's ticks_remaining.  STACK and TOP are
+ * activ_stack and top_activ_stack as they are after the change.
+ */
+extern void profile_resume(activation *stack, unsigned top, int ticks);
+						/* a task starts running */
+extern void profile_pause(int ticks);		/* ... and stops */
+extern void profile_enter(activation *stack, unsigned top, int ticks);
+						/* STACK[TOP] was just pushed */
+extern void profile_return(activation *stack, unsigned top, int ticks);
+						/* STACK[TOP] runs again */
+extern void profile_builtin(activation *stack, unsigned top, int ticks,
+			    unsigned func_id);	/* a built-in is called */
+
+#endif				/* !Profile_H */
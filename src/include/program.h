@@ -27,6 +27,8 @@ typedef struct {
     Byte numbytes_label, numbytes_literal, numbytes_fork, numbytes_var_name,
      numbytes_stack;
     Byte *vector;
+    Byte *unoptimized;		/* code as generated, if the optimizer
+				 * changed it; see optimize.cc */
     unsigned size;
     unsigned max_stack;
 } Bytecodes;
@@ -54,6 +56,15 @@ typedef struct {
 
 #define MAIN_VECTOR 	-1	/* As opposed to an index into fork_vectors */
 
+/* The code as generated, which is what the decompiler understands. */
+static inline Bytecodes
+unoptimized_bytecodes(Bytecodes bc)
+{
+    if (bc.unoptimized)
+	bc.vector = bc.unoptimized;
+    return bc;
+}
+
 extern Program *new_program(void);
 extern Program *null_program(void);
 extern Program *program_ref(Program *);
@@ -77,6 +77,19 @@ extern void server_receive_line(server_handle h, const char *line, bool out_of_b
 				 * whitespace ASCII characters.
 				 */
 
+extern void server_receive_http_request(server_handle h, Var request,
+					bool keep_alive);
+				/* A complete request has been read on a
+				 * connection from an HTTP listening point.
+				 * REQUEST is a map like the one read_http()
+				 * returns, or the integer status (e.g. 400)
+				 * to answer input that couldn't be parsed;
+				 * the server takes ownership of it.  Every
+				 * request gets exactly one response, in the
+				 * order received; if KEEP_ALIVE is false, the
+				 * connection should be closed after it.
+				 */
+
 extern void server_close(server_handle h);
 				/* The specified connection has been broken
 				 * for some reason not in the server's control.
@@ -162,6 +175,12 @@ extern void queue_anonymous_object(Var v);
 extern void write_values_pending_finalization(void);
 extern int read_values_pending_finalization(void);
 
+extern Var connection_response_times(void);
+				/* Returns a map from each connection that
+				 * has been sent output after input to
+				 * {responses, total seconds, longest}.
+				 */
+
 /*
  * These procedures represent my frustration with the separation
  * of the server module from the network implementation.
@@ -226,6 +245,20 @@ int proxy_connected(Objid connection, char *command);
 	   }))							\
 								\
   DEFINE( SVO_MAX_CONCAT_CATCHABLE, max_concat_catchable,	\
+	  flag, 0, /* already canonical */			\
+	  )							\
+								\
+  DEFINE( SVO_PARALLEL_LIST_THREADS, parallel_list_threads,	\
+								\
+	  int, PARALLEL_LIST_THREADS,				\
+	 _STATEMENT({						\
+	     if (value < 1)					\
+		 value = 1;					\
+	     else if (value > 64)				\
+		 value = 64;					\
+	   }))							\
+								\
+  DEFINE( SVO_WRITE_AHEAD_LOG, write_ahead_log,			\
 	  flag, 0, /* already canonical */			\
 	  )
 
@@ -272,6 +305,13 @@ extern void player_connected(Objid old_id, Objid new_id,
 			     int is_newly_created);
 extern int is_player_connected(Objid player);
 extern void notify(Objid player, const char *message);
+extern void send_http_response(Objid connection, Var response,
+			       bool keep_alive);
+				/* RESPONSE is a string body, a map with
+				 * optional "status", "headers" and "body"
+				 * keys, or an integer status; anything else
+				 * sends a 500 response.
+				 */
 extern void boot_player(Objid player);
 
 extern void write_active_connections(void);
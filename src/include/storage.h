@@ -42,6 +42,26 @@ typedef struct reference_overhead {
     GC_Color color:3;
 } reference_overhead;
 
+/* Lists also keep a pointer to their membership index (see collection.cc)
+ * at the very start of their allocation, ahead of the reference count.
+ */
+#define LIST_INDEX_OVERHEAD \
+    (sizeof(void *) > sizeof(double) ? sizeof(void *) : sizeof(double))
+#ifdef MEMO_VALUE_BYTES
+#define LIST_REFCOUNT_OVERHEAD	(LIST_INDEX_OVERHEAD + sizeof(int) * 2)
+#else
+#define LIST_REFCOUNT_OVERHEAD \
+    (LIST_INDEX_OVERHEAD + (sizeof(void *) > sizeof(int) ? sizeof(void *) : sizeof(int)))
+#endif /* MEMO_VALUE_BYTES */
+
+struct list_index;
+
+static inline struct list_index **
+list_index_slot(const void *ptr)
+{
+    return (struct list_index **)((char *)ptr - LIST_REFCOUNT_OVERHEAD);
+}
+
 static inline int
 addref(const void *ptr)
 {
@@ -116,7 +136,17 @@ typedef enum Memory_Type {
 
 } Memory_Type;
 
+/* True on background threads (see background.h).  They are never handed
+ * the shared empty string, list or map, whose reference counts may only
+ * be touched by the main thread.
+ */
+extern thread_local bool in_background_thread;
+
+/* Calls to mymalloc() on the main thread so far. */
+extern unsigned long allocations_made;
+
 extern char *str_dup(const char *);
+extern char *str_dup(const char *, size_t len);
 extern const char *str_ref(const char *);
 
 extern void myfree(void *where, Memory_Type type);
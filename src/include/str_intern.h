@@ -14,6 +14,8 @@
 #ifndef Str_Intern_h
 #define Str_Intern_h
 
+#include <stddef.h>
+
 /* 0 for a default size */
 extern void str_intern_open(int table_size);
 extern void str_intern_close(void);
@@ -22,4 +24,8 @@ extern void str_intern_close(void);
    possibly share storage. */
 extern const char *str_intern(const char *s);
 
+/* The same, for the LEN characters at S, which needn't be followed by a
+   null. */
+extern const char *str_intern(const char *s, size_t len);
+
 #endif
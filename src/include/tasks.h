@@ -36,6 +36,7 @@ extern int tasks_set_connection_option(task_queue, const char *,
 				       Var);
 
 extern void new_input_task(task_queue, const char *, int, bool);
+extern void new_http_task(task_queue, Var request, bool keep_alive);
 extern void task_suspend_input(task_queue);
 extern enum error enqueue_forked_task2(activation a, int f_index,
 			       double after_seconds, int vid);
@@ -98,14 +99,28 @@ extern enum outcome run_server_program_task(Objid _this, const char *verb,
 
 extern Var current_local;
 extern int current_task_id;
+extern bool suspension_forbidden;
+				/* True while the server waits on a task for
+				 * its value (to answer an HTTP request); the
+				 * task gets E_PERM from anything that would
+				 * suspend it, and its threaded builtins run
+				 * in the main thread.
+				 */
 extern bool threading_active;
 extern int last_input_task_id(Objid player);
+extern Var input_queue_lengths(Num *total, Num *longest);
+extern int waiting_task_count(void);
 #ifdef SAVE_FINISHED_TASKS
 extern Var finished_tasks;
 #endif
 
 extern void write_task_queue(void);
 extern int read_task_queue(void);
+extern void discard_task_queue(void);
+				/* Frees the tasks read by `read_task_queue()',
+				 * for when a checkpoint delta replaces them.
+				 * Only valid before `main_loop()' starts.
+				 */
 
 extern db_verb_handle find_verb_for_programming(Objid player,
 						const char *verbref,
@@ -34,6 +34,7 @@
 extern int verbcasecmp(const char *verb, const char *word);
 
 extern unsigned str_hash(const char *);
+extern unsigned str_hash(const char *, size_t len);
 
 extern void complex_free_var(Var);
 extern Var complex_var_ref(Var);
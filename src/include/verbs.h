@@ -20,3 +20,6 @@
 
 extern enum error validate_verb_descriptor(Var desc);
 extern db_verb_handle find_described_verb(Var obj, Var desc);
+#ifdef EVAL_CACHE_BYTES
+extern Var eval_cache_stats(void);
+#endif
@@ -20,6 +20,9 @@
 #include <algorithm> // std::sort
 #include "dependencies/strnatcmp.c" // natural sorting
 #include <vector>
+#include <string>
+#include <thread>
+#include <system_error>
 
 #include <ctype.h>
 #include <string.h>
@@ -43,6 +46,7 @@
 #include "background.h"   // Threads
 #include "random.h"
 #include "ansi24.h"
+#include "ansi_tags.h"
 
 /* Bandaid: Something is killing all of our references to the
  * empty list, which is causing the server to crash. So this is
@@ -55,7 +59,7 @@ new_list(int size)
     Var list;
     Var *ptr;
 
-    if (size == 0) {
+    if (size == 0 && !in_background_thread) {
 
 	if (emptylist.v.list == nullptr) {
 	    if ((ptr = (Var *)mymalloc(1 * sizeof(Var), M_LIST)) == nullptr)
@@ -178,6 +182,7 @@ listset(Var list, Var value, int pos)
     ((int *)(_new.v.list))[-2] = 0;
 #endif
 
+    drop_list_index(_new);
     free_var(_new.v.list[pos]);
     _new.v.list[pos] = value;
 
@@ -202,6 +207,7 @@ doinsert(Var list, Var value, int pos)
 	/* reset the memoized size */
 	((int *)(list.v.list))[-2] = 0;
 #endif
+	drop_list_index(list);
 	list.v.list[0].v.num = size;
 	list.v.list[pos] = value;
 
@@ -923,7 +929,44 @@ bf_slice(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(ret);
 }
 
+/* How many pieces to split a list of the given length into for sort() and all_members(). */
+static int
+parallel_list_pieces(Num length)
+{
+    if (length < PARALLEL_LIST_THRESHOLD)
+        return 1;
+
+    return server_int_option_cached(SVO_PARALLEL_LIST_THREADS);
+}
+
+/* Call work(0) .. work(pieces - 1), each on its own thread except for the first,
+ * which runs on the calling thread. Returns once they've all finished. */
+template <typename F>
+static void
+run_pieces(int pieces, F work)
+{
+    std::vector<std::thread> helpers;
+
+    for (int piece = 1; piece < pieces; piece++) {
+        try {
+            helpers.emplace_back([&work, piece]() {
+                in_background_thread = true;
+                work(piece);
+            });
+        } catch (const std::system_error &) {
+            work(piece);
+        }
+    }
+
+    work(0);
+
+    for (auto &helper : helpers)
+        helper.join();
+}
+
 /* Sorts various MOO types using std::sort.
+ * Strings are case-folded once up front rather than on every comparison, and
+ * large lists are sorted in pieces on several threads and then merged.
  * Args: LIST <values to sort>, [LIST <values to sort by>], [INT <natural sort ordering?>], [INT <reverse?>] */
 void sort_callback(Var arglist, Var *ret)
 {
@@ -958,45 +1001,98 @@ void sort_callback(Var arglist, Var *ret)
         s[count-1] = count;
     }
 
+    const int pieces = parallel_list_pieces(list_length);
+    std::vector<size_t> bounds(pieces + 1);
+    for (int piece = 0; piece <= pieces; piece++)
+        bounds[piece] = list_length * piece / pieces;
+
+    /* Case-fold strings once. strcasecmp() folds to lower case and strnatcasecmp() to upper case,
+     * so do the same and compare the keys with their case-sensitive counterparts. */
+    std::vector<std::string> keys;
+    if (type_to_sort == TYPE_STR) {
+        const Var *values = arglist.v.list[list_to_sort].v.list;
+        keys.resize(list_length + 1);
+        run_pieces(pieces, [&](int piece) {
+            for (size_t x = bounds[piece]; x < bounds[piece + 1]; x++) {
+                std::string &key = keys[x + 1];
+                key = values[x + 1].v.str;
+                for (auto &c : key)
+                    c = natural ? toupper((unsigned char)c) : tolower((unsigned char)c);
+            }
+        });
+    }
+
+    /* Equal values are ordered by position, which makes the result the same no matter how the work was split up. */
     struct VarCompare {
-        VarCompare(const Var *Arglist, const bool Natural) : m_Arglist(Arglist), m_Natural(Natural) {}
+        VarCompare(const Var *Arglist, const std::vector<std::string> &Keys, const bool Natural) : m_Arglist(Arglist), m_Keys(Keys), m_Natural(Natural) {}
 
         bool operator()(const size_t a, const size_t b) const
         {
-            Var lhs = m_Arglist[a];
-            Var rhs = m_Arglist[b];
+            const Var &lhs = m_Arglist[a];
+            const Var &rhs = m_Arglist[b];
 
             switch (rhs.type) {
                 case TYPE_INT:
-                    return lhs.v.num < rhs.v.num;
+                    if (lhs.v.num != rhs.v.num)
+                        return lhs.v.num < rhs.v.num;
+                    break;
                 case TYPE_FLOAT:
-                    return lhs.v.fnum < rhs.v.fnum;
+                    if (lhs.v.fnum != rhs.v.fnum)
+                        return lhs.v.fnum < rhs.v.fnum;
+                    break;
                 case TYPE_OBJ:
-                    return lhs.v.obj < rhs.v.obj;
+                    if (lhs.v.obj != rhs.v.obj)
+                        return lhs.v.obj < rhs.v.obj;
+                    break;
                 case TYPE_ERR:
-                    return ((int) lhs.v.err) < ((int) rhs.v.err);
-                case TYPE_STR:
-                    return (m_Natural ? strnatcasecmp(lhs.v.str, rhs.v.str) : strcasecmp(lhs.v.str, rhs.v.str)) < 0;
+                    if (lhs.v.err != rhs.v.err)
+                        return ((int) lhs.v.err) < ((int) rhs.v.err);
+                    break;
+                case TYPE_STR: {
+                    const int result = (m_Natural ? strnatcmp(m_Keys[a].c_str(), m_Keys[b].c_str()) : m_Keys[a].compare(m_Keys[b]));
+                    if (result != 0)
+                        return result < 0;
+                    break;
+                }
                 default:
                     errlog("Unknown type in sort compare: %d\n", rhs.type);
                     return 0;
             }
+            return a < b;
         }
         const Var *m_Arglist;
+        const std::vector<std::string> &m_Keys;
         const bool m_Natural;
     };
 
-    std::sort(s.begin(), s.end(), VarCompare(arglist.v.list[list_to_sort].v.list, natural));
+    const VarCompare compare(arglist.v.list[list_to_sort].v.list, keys, natural);
+
+    // Sort each piece, then merge neighbouring pieces pairwise until there's only one left.
+    run_pieces(pieces, [&](int piece) {
+        std::sort(s.begin() + bounds[piece], s.begin() + bounds[piece + 1], compare);
+    });
+
+    for (int width = 1; width < pieces; width *= 2) {
+        run_pieces((pieces + 2 * width - 1) / (2 * width), [&](int merge) {
+            const int first = merge * 2 * width;
+            if (first + width < pieces)
+                std::inplace_merge(s.begin() + bounds[first], s.begin() + bounds[first + width],
+                                   s.begin() + bounds[std::min(first + 2 * width, pieces)], compare);
+        });
+    }
 
     *ret = new_list(s.size());
 
     if (reverse)
         std::reverse(std::begin(s), std::end(s));
 
+    /* The elements are shared with the main thread, so take our references inside a snapshot. */
+    background_snapshot_begin();
     int moo_list_pos = 0;
     for (const auto &it:s) {
         ret->v.list[++moo_list_pos] = var_ref(arglist.v.list[1].v.list[it]);
     }
+    background_snapshot_end();
 }
 
     static package
@@ -1008,15 +1104,34 @@ bf_sort(Var arglist, Byte next, void *vdata, Objid progr)
     return background_thread(sort_callback, &arglist, human_string);
 }
 
+/* Large lists are scanned in pieces on several threads. Each piece collects its own
+ * matches, which are then copied into a list allocated once at the end. */
 void all_members_thread_callback(Var arglist, Var *ret)
 {
-    *ret = new_list(0);
     Var data = arglist.v.list[1];
     Var *thelist = arglist.v.list[2].v.list;
+    const Num list_size = arglist.v.list[2].v.list[0].v.num;
+
+    const int pieces = parallel_list_pieces(list_size);
+    std::vector<std::vector<Num>> matches(pieces);
+
+    run_pieces(pieces, [&](int piece) {
+        const Num first = list_size * piece / pieces + 1;
+        const Num last = list_size * (piece + 1) / pieces;
+        for (Num x = first; x <= last; x++)
+            if (equality(data, thelist[x], 0))
+                matches[piece].push_back(x);
+    });
+
+    size_t total = 0;
+    for (const auto &piece : matches)
+        total += piece.size();
 
-    for (int x = 1, list_size = arglist.v.list[2].v.list[0].v.num; x <= list_size; x++)
-        if (equality(data, thelist[x], 0))
-            *ret = listappend(*ret, Var::new_int(x));
+    *ret = new_list(total);
+    int pos = 0;
+    for (const auto &piece : matches)
+        for (const auto &x : piece)
+            ret->v.list[++pos] = Var::new_int(x);
 }
 
 /* Return the indices of all elements of a value in a list. */
@@ -1149,6 +1264,7 @@ bf_tostr(Var arglist, Byte next, void *vdata, Objid progr)
 {
     package p;
     Stream *s = new_stream(100);
+    Stream *t = new_stream(100);
 
     TRY_STREAM;
     try {
@@ -1158,21 +1274,17 @@ bf_tostr(Var arglist, Byte next, void *vdata, Objid progr)
 	for (i = 1; i <= arglist.v.list[0].v.num; i++) {
 	    stream_add_tostr(s, arglist.v.list[i]);
 	}
-
-    size_t size       = strlen(stream_contents(s)) * 2 + 1; // esc sequences can be longer than tags
-    char *replacement = (char *) mymalloc((uint) size, M_STRING);
-    replace_color_tags_with_ansi(replacement, size, stream_contents(s));
+	translate_color_tags(t, stream_contents(s), false);
 
 	r.type = TYPE_STR;
-	r.v.str = str_dup(replacement);
+	r.v.str = str_dup(stream_contents(t));
 	p = make_var_pack(r);
-
-        free_str(replacement);
     }
     catch (stream_too_big& exception) {
 	p = make_space_pack();
     }
     ENDTRY_STREAM;
+    free_stream(t);
     free_stream(s);
     free_var(arglist);
     return p;
@@ -1202,15 +1314,52 @@ bf_toliteral(Var arglist, Byte next, void *vdata, Objid progr)
     return p;
 }
 
+/* The patterns most recently given to match() and rmatch(), chained by hash
+ * and linked in order of use.  A new pattern takes the place of the least
+ * recently used one; patterns that fail to compile aren't kept.
+ */
+
+#define PAT_CACHE_BUCKETS	(PATTERN_CACHE_SIZE * 2 + 1)
+
 struct pat_cache_entry {
-    char *string;
+    char *string;		/* null if the entry is unused */
     int case_matters;
+    unsigned hash;
     Pattern pattern;
-    struct pat_cache_entry *next;
+    struct pat_cache_entry *next;	/* in the same bucket */
+    struct pat_cache_entry *newer, *older;
 };
 
-static struct pat_cache_entry *pat_cache;
 static struct pat_cache_entry pat_cache_entries[PATTERN_CACHE_SIZE];
+static struct pat_cache_entry *pat_table[PAT_CACHE_BUCKETS];
+static struct pat_cache_entry *pat_newest, *pat_oldest;
+static Num pat_cache_hits = 0, pat_cache_misses = 0;
+static Num pat_cache_evictions = 0;
+
+static void
+pat_unlink(struct pat_cache_entry *entry)
+{
+    if (entry->newer)
+	entry->newer->older = entry->older;
+    else
+	pat_newest = entry->older;
+    if (entry->older)
+	entry->older->newer = entry->newer;
+    else
+	pat_oldest = entry->newer;
+}
+
+static void
+pat_link_newest(struct pat_cache_entry *entry)
+{
+    entry->newer = nullptr;
+    entry->older = pat_newest;
+    if (pat_newest)
+	pat_newest->newer = entry;
+    else
+	pat_oldest = entry;
+    pat_newest = entry;
+}
 
 static void
 setup_pattern_cache()
@@ -1220,57 +1369,75 @@ setup_pattern_cache()
     for (i = 0; i < PATTERN_CACHE_SIZE; i++) {
 	pat_cache_entries[i].string = nullptr;
 	pat_cache_entries[i].pattern.ptr = nullptr;
+	pat_link_newest(&pat_cache_entries[i]);
     }
-
-    for (i = 0; i < PATTERN_CACHE_SIZE - 1; i++)
-	pat_cache_entries[i].next = &(pat_cache_entries[i + 1]);
-    pat_cache_entries[PATTERN_CACHE_SIZE - 1].next = nullptr;
-
-    pat_cache = &(pat_cache_entries[0]);
 }
 
 static Pattern
 get_pattern(const char *string, int case_matters)
 {
-    struct pat_cache_entry *entry, **entry_ptr;
+    unsigned hash = str_hash(string);
+    struct pat_cache_entry *entry, **pp;
+
+    for (entry = pat_table[hash % PAT_CACHE_BUCKETS]; entry; entry = entry->next)
+	if (entry->hash == hash && case_matters == entry->case_matters
+	    && !strcmp(string, entry->string)) {
+	    pat_unlink(entry);
+	    pat_link_newest(entry);
+	    pat_cache_hits++;
+	    return entry->pattern;
+	}
 
-    entry = pat_cache;
-    entry_ptr = &pat_cache;
+    /* A cache miss; reuse the least recently used entry for this pattern,
+     * moving it to the front of the cache iff the compilation succeeds.
+     */
+    pat_cache_misses++;
+    entry = pat_oldest;
+    if (entry->string) {
+	for (pp = &pat_table[entry->hash % PAT_CACHE_BUCKETS]; *pp != entry;
+	     pp = &(*pp)->next)
+	    ;
+	*pp = entry->next;
+	free_str(entry->string);
+	free_pattern(entry->pattern);
+	entry->string = nullptr;
+	pat_cache_evictions++;
+    }
 
-    while (1) {
-	if (entry->string && !strcmp(string, entry->string)
-	    && case_matters == entry->case_matters) {
-	    /* A cache hit; move this entry to the front of the cache. */
-	    break;
-	} else if (!entry->next) {
-	    /* A cache miss; this is the last entry in the cache, so reuse that
-	     * one for this pattern, moving it to the front of the cache iff
-	     * the compilation succeeds.
-	     */
-	    if (entry->string) {
-		free_str(entry->string);
-		free_pattern(entry->pattern);
-	    }
-	    entry->pattern = new_pattern(string, case_matters);
-	    entry->case_matters = case_matters;
-	    if (!entry->pattern.ptr)
-		entry->string = nullptr;
-	    else
-		entry->string = str_dup(string);
-	    break;
-	} else {
-	    /* not done searching the cache... */
-	    entry_ptr = &(entry->next);
-	    entry = entry->next;
-	}
+    entry->pattern = new_pattern(string, case_matters);
+    if (entry->pattern.ptr) {
+	entry->string = str_dup(string);
+	entry->case_matters = case_matters;
+	entry->hash = hash;
+	entry->next = pat_table[hash % PAT_CACHE_BUCKETS];
+	pat_table[hash % PAT_CACHE_BUCKETS] = entry;
+	pat_unlink(entry);
+	pat_link_newest(entry);
     }
 
-    *entry_ptr = entry->next;
-    entry->next = pat_cache;
-    pat_cache = entry;
     return entry->pattern;
 }
 
+Var
+match_cache_stats(void)
+{
+    Var r;
+    int i, entries = 0;
+
+    for (i = 0; i < PATTERN_CACHE_SIZE; i++)
+	if (pat_cache_entries[i].string)
+	    entries++;
+
+    r = new_map();
+    r = mapinsert(r, str_dup_to_var("hits"), Var::new_int(pat_cache_hits));
+    r = mapinsert(r, str_dup_to_var("misses"), Var::new_int(pat_cache_misses));
+    r = mapinsert(r, str_dup_to_var("evictions"),
+		  Var::new_int(pat_cache_evictions));
+    r = mapinsert(r, str_dup_to_var("entries"), Var::new_int(entries));
+
+    return r;
+}
+
 Var
 do_match(Var arglist, int reverse)
 {
@@ -1619,130 +1786,33 @@ bf_chr(Var arglist, Byte next, void *vdata, Objid progr)
     static package
 bf_parse_ansi(Var arglist, Byte next, void *vdata, Objid progr)
 {
-#define ANSI_TAG_TO_CODE(tag, code, case_matters)			\
-    {									\
-        stream_add_strsub(str, reset_stream(tmp), tag, code, case_matters); \
-        stream_add_string(tmp, reset_stream(str));				\
-    }
-
     Var r;
-    r.type = TYPE_STR;
+    Stream *s = new_stream(memo_strlen(arglist.v.list[1].v.str) + 16);
 
-    Stream *str = new_stream(50);
-    Stream *tmp = new_stream(50);
-    const char *random_codes[] = {"\e[31m", "\e[32m", "\e[33m", "\e[34m", "\e[35m", "\e[35m", "\e[36m"};
-
-    stream_add_string(tmp, arglist.v.list[1].v.str);
+    parse_ansi_tags(s, arglist.v.list[1].v.str);
     free_var(arglist);
 
-    ANSI_TAG_TO_CODE("[red]",        "\e[31m",   0);
-    ANSI_TAG_TO_CODE("[green]",      "\e[32m",   0);
-    ANSI_TAG_TO_CODE("[yellow]",     "\e[33m",   0);
-    ANSI_TAG_TO_CODE("[blue]",       "\e[34m",   0);
-    ANSI_TAG_TO_CODE("[purple]",     "\e[35m",   0);
-    ANSI_TAG_TO_CODE("[cyan]",       "\e[36m",   0);
-    ANSI_TAG_TO_CODE("[normal]",     "\e[0m",    0);
-    ANSI_TAG_TO_CODE("[inverse]",    "\e[7m",    0);
-    ANSI_TAG_TO_CODE("[underline]",  "\e[4m",    0);
-    ANSI_TAG_TO_CODE("[bold]",       "\e[1m",    0);
-    ANSI_TAG_TO_CODE("[bright]",     "\e[1m",    0);
-    ANSI_TAG_TO_CODE("[unbold]",     "\e[22m",   0);
-    ANSI_TAG_TO_CODE("[blink]",      "\e[5m",    0);
-    ANSI_TAG_TO_CODE("[unblink]",    "\e[25m",   0);
-    ANSI_TAG_TO_CODE("[magenta]",    "\e[35m",   0);
-    ANSI_TAG_TO_CODE("[unbright]",   "\e[22m",   0);
-    ANSI_TAG_TO_CODE("[white]",      "\e[37m",   0);
-    ANSI_TAG_TO_CODE("[gray]",       "\e[1;30m", 0);
-    ANSI_TAG_TO_CODE("[grey]",       "\e[1;30m", 0);
-    ANSI_TAG_TO_CODE("[beep]",       "\a",       0);
-    ANSI_TAG_TO_CODE("[black]",      "\e[30m",   0);
-    ANSI_TAG_TO_CODE("[b:black]",   "\e[40m",   0);
-    ANSI_TAG_TO_CODE("[b:red]",     "\e[41m",   0);
-    ANSI_TAG_TO_CODE("[b:green]",   "\e[42m",   0);
-    ANSI_TAG_TO_CODE("[b:yellow]",  "\e[43m",   0);
-    ANSI_TAG_TO_CODE("[b:blue]",    "\e[44m",   0);
-    ANSI_TAG_TO_CODE("[b:magenta]", "\e[45m",   0);
-    ANSI_TAG_TO_CODE("[b:purple]",  "\e[45m",   0);
-    ANSI_TAG_TO_CODE("[b:cyan]",    "\e[46m",   0);
-    ANSI_TAG_TO_CODE("[b:white]",   "\e[47m",   0);
-
-    char *t = reset_stream(tmp);
-    while (*t) {
-        if (!strncasecmp(t, "[random]", 8)) {
-            stream_add_string(str, random_codes[RANDOM() % 6]);
-            t += 8;
-        } else
-            stream_add_char(str, *t++);
-    }
-
-    stream_add_strsub(tmp, reset_stream(str), "[null]", "", 0);
-
-    ANSI_TAG_TO_CODE("[null]", "", 0);
-
-    r.v.str = str_dup(reset_stream(tmp));
+    r.type = TYPE_STR;
+    r.v.str = str_dup(stream_contents(s));
 
-    free_stream(tmp);
-    free_stream(str);
+    free_stream(s);
     return make_var_pack(r);
-
-#undef ANSI_TAG_TO_CODE
 }
 
     static package
 bf_remove_ansi(Var arglist, Byte next, void *vdata, Objid progr)
 {
-
-#define MARK_FOR_REMOVAL(tag)					\
-    {								\
-        stream_add_strsub(tmp, reset_stream(tmp), tag, "", 0);	\
-    }
     Var r;
-    Stream *tmp;
+    Stream *s = new_stream(memo_strlen(arglist.v.list[1].v.str) + 1);
 
-    tmp = new_stream(50);
-    stream_add_string(tmp, arglist.v.list[1].v.str);
+    remove_ansi_tags(s, arglist.v.list[1].v.str);
     free_var(arglist);
 
-    MARK_FOR_REMOVAL("[red]");
-    MARK_FOR_REMOVAL("[green]");
-    MARK_FOR_REMOVAL("[yellow]");
-    MARK_FOR_REMOVAL("[blue]");
-    MARK_FOR_REMOVAL("[purple]");
-    MARK_FOR_REMOVAL("[cyan]");
-    MARK_FOR_REMOVAL("[normal]");
-    MARK_FOR_REMOVAL("[inverse]");
-    MARK_FOR_REMOVAL("[underline]");
-    MARK_FOR_REMOVAL("[bold]");
-    MARK_FOR_REMOVAL("[bright]");
-    MARK_FOR_REMOVAL("[unbold]");
-    MARK_FOR_REMOVAL("[blink]");
-    MARK_FOR_REMOVAL("[unblink]");
-    MARK_FOR_REMOVAL("[magenta]");
-    MARK_FOR_REMOVAL("[unbright]");
-    MARK_FOR_REMOVAL("[white]");
-    MARK_FOR_REMOVAL("[gray]");
-    MARK_FOR_REMOVAL("[grey]");
-    MARK_FOR_REMOVAL("[beep]");
-    MARK_FOR_REMOVAL("[black]");
-    MARK_FOR_REMOVAL("[b:black]");
-    MARK_FOR_REMOVAL("[b:red]");
-    MARK_FOR_REMOVAL("[b:green]");
-    MARK_FOR_REMOVAL("[b:yellow]");
-    MARK_FOR_REMOVAL("[b:blue]");
-    MARK_FOR_REMOVAL("[b:magenta]");
-    MARK_FOR_REMOVAL("[b:purple]");
-    MARK_FOR_REMOVAL("[b:cyan]");
-    MARK_FOR_REMOVAL("[b:white]");
-    MARK_FOR_REMOVAL("[random]");
-    MARK_FOR_REMOVAL("[null]");
-
     r.type = TYPE_STR;
-    r.v.str = str_dup(reset_stream(tmp));
+    r.v.str = str_dup(stream_contents(s));
 
-    free_stream(tmp);
+    free_stream(s);
     return make_var_pack(r);
-
-#undef MARK_FOR_REMOVAL
 }
 
 void
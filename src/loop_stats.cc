@@ -0,0 +1,270 @@
+/******************************************************************************
+  Copyright (c) 1992, 1995, 1996 Xerox Corporation.  All rights reserved.
+  Portions of this code were written by Stephen White, aka ghond.
+  Use and copying of this software and preparation of derivative works based
+  upon this software are permitted.  Any distribution of this software or
+  derivative works must comply with all applicable United States export
+  control laws.  This software is made available AS IS, and Xerox Corporation
+  makes no warranty about the software, its performance or its conformity to
+  any specification.  Any person obtaining a copy of this software is requested
+  to send their name and post office or electronic mail address to:
+    Pavel Curtis
+    Xerox PARC
+    3333 Coyote Hill Rd.
+    Palo Alto, CA 94304
+    Pavel@Xerox.Com
+ *****************************************************************************/
+
+/* Main-loop statistics.
+ *
+ * The main loop calls loop_stats_phase() as it moves from one part of its
+ * work to the next, and the time in between is charged to the part it was
+ * doing.  At the top of each pass, the time the last pass spent in each part
+ * is added to a histogram for that part, so a pass that ran tasks for half a
+ * second stands out rather than disappearing into an average.  The server
+ * also records how long connections wait between sending a line and getting
+ * their first output after it.
+ *
+ * loop_stats() returns all of this along with the current lengths of the
+ * task queues.  If the server was started with `-s', the same numbers are
+ * written to a file every LOOP_STATS_INTERVAL seconds in the Prometheus text
+ * format, for a local scraper to pick up.
+ */
+
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+#include <time.h>
+
+#include "background.h"
+#include "bf_register.h"
+#include "functions.h"
+#include "list.h"
+#include "log.h"
+#include "loop_stats.h"
+#include "map.h"
+#include "options.h"
+#include "server.h"
+#include "tasks.h"
+#include "utils.h"
+
+#define LOOP_HISTOGRAM_SIZE	24	/* element k counts times under 2^k
+					 * microseconds; the last counts the
+					 * rest */
+
+struct histogram {
+    Num count;
+    double seconds;
+    Num buckets[LOOP_HISTOGRAM_SIZE];
+};
+
+static const char *phase_names[LOOP_PHASES] = {
+    "gc", "checkpoint", "recycle", "network", "idle",
+    "tasks", "children", "connections", "log"
+};
+
+static struct histogram phases[LOOP_PHASES];
+static struct histogram responses;
+static Num passes = 0;
+
+static double this_pass[LOOP_PHASES];	/* seconds so far in each phase */
+static enum loop_phase current = LOOP_GC;
+static std::chrono::steady_clock::time_point mark;
+static bool started = false;
+
+static const char *stats_file = nullptr;
+static time_t next_write = 0;
+
+static void
+add_sample(struct histogram *h, double seconds)
+{
+    long long usec = (long long) (seconds * 1000000.0);
+    int k;
+
+    for (k = 0; usec && k < LOOP_HISTOGRAM_SIZE - 1; k++)
+	usec >>= 1;
+    h->buckets[k]++;
+    h->count++;
+    h->seconds += seconds;
+}
+
+enum loop_phase
+loop_stats_phase(enum loop_phase p)
+{
+    enum loop_phase old = current;
+
+    if (started) {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+	this_pass[current] += std::chrono::duration<double>(now - mark).count();
+	mark = now;
+    }
+    current = p;
+
+    return old;
+}
+
+void
+loop_stats_response(double seconds)
+{
+    add_sample(&responses, seconds);
+}
+
+void
+loop_stats_set_file(const char *filename)
+{
+    stats_file = filename;
+}
+
+static void
+write_histogram(FILE *f, const char *name, const char *label,
+		const struct histogram *h)
+{
+    const char *sep = *label ? "," : "";
+    Num cumulative = 0;
+    int k;
+
+    for (k = 0; k < LOOP_HISTOGRAM_SIZE - 1; k++) {
+	cumulative += h->buckets[k];
+	fprintf(f, "%s_bucket{%s%sle=\"%.7g\"} %" PRIdN "\n",
+		name, label, sep, ldexp(0.000001, k), cumulative);
+    }
+    fprintf(f, "%s_bucket{%s%sle=\"+Inf\"} %" PRIdN "\n",
+	    name, label, sep, h->count);
+    if (*label) {
+	fprintf(f, "%s_sum{%s} %.9f\n", name, label, h->seconds);
+	fprintf(f, "%s_count{%s} %" PRIdN "\n", name, label, h->count);
+    } else {
+	fprintf(f, "%s_sum %.9f\n", name, h->seconds);
+	fprintf(f, "%s_count %" PRIdN "\n", name, h->count);
+    }
+}
+
+static void
+write_stats_file(void)
+{
+    std::string temp = std::string(stats_file) + ".new";
+    FILE *f = fopen(temp.c_str(), "w");
+    Num input_tasks, longest_queue;
+    char label[64];
+    int i;
+
+    if (!f) {
+	log_perror("LOOP STATS: Can't write statistics file");
+	return;
+    }
+
+    free_var(input_queue_lengths(&input_tasks, &longest_queue));
+
+    fprintf(f, "# HELP moo_loop_passes_total Passes through the server's main loop.\n");
+    fprintf(f, "# TYPE moo_loop_passes_total counter\n");
+    fprintf(f, "moo_loop_passes_total %" PRIdN "\n", passes);
+
+    fprintf(f, "# HELP moo_loop_phase_seconds Time each pass through the main loop spent in each phase.\n");
+    fprintf(f, "# TYPE moo_loop_phase_seconds histogram\n");
+    for (i = 0; i < LOOP_PHASES; i++) {
+	snprintf(label, sizeof(label), "phase=\"%s\"", phase_names[i]);
+	write_histogram(f, "moo_loop_phase_seconds", label, &phases[i]);
+    }
+
+    fprintf(f, "# HELP moo_input_tasks Input tasks waiting to run.\n");
+    fprintf(f, "# TYPE moo_input_tasks gauge\n");
+    fprintf(f, "moo_input_tasks %" PRIdN "\n", input_tasks);
+    fprintf(f, "# HELP moo_input_tasks_longest_queue Input tasks waiting in the longest queue.\n");
+    fprintf(f, "# TYPE moo_input_tasks_longest_queue gauge\n");
+    fprintf(f, "moo_input_tasks_longest_queue %" PRIdN "\n", longest_queue);
+    fprintf(f, "# HELP moo_waiting_tasks Forked and suspended tasks.\n");
+    fprintf(f, "# TYPE moo_waiting_tasks gauge\n");
+    fprintf(f, "moo_waiting_tasks %d\n", waiting_task_count());
+    fprintf(f, "# HELP moo_background_threads Built-in functions running in background threads.\n");
+    fprintf(f, "# TYPE moo_background_threads gauge\n");
+    fprintf(f, "moo_background_threads %zu\n", background_thread_count());
+
+    fprintf(f, "# HELP moo_response_seconds Time from a line of input to the first output after it.\n");
+    fprintf(f, "# TYPE moo_response_seconds histogram\n");
+    write_histogram(f, "moo_response_seconds", "", &responses);
+
+    /* Rename into place so a scraper never reads half a file. */
+    if (fclose(f) != 0 || rename(temp.c_str(), stats_file) != 0)
+	log_perror("LOOP STATS: Can't write statistics file");
+}
+
+void
+loop_stats_begin_pass(void)
+{
+    int i;
+
+    if (started) {
+	loop_stats_phase(LOOP_GC);
+	for (i = 0; i < LOOP_PHASES; i++) {
+	    add_sample(&phases[i], this_pass[i]);
+	    this_pass[i] = 0.0;
+	}
+	passes++;
+    } else {
+	mark = std::chrono::steady_clock::now();
+	current = LOOP_GC;
+	started = true;
+    }
+
+    if (stats_file && time(nullptr) >= next_write) {
+	write_stats_file();
+	next_write = time(nullptr) + LOOP_STATS_INTERVAL;
+    }
+}
+
+static Var
+histogram_var(const struct histogram *h)
+{
+    Var r = new_list(3), buckets = new_list(LOOP_HISTOGRAM_SIZE);
+    int k;
+
+    for (k = 0; k < LOOP_HISTOGRAM_SIZE; k++)
+	buckets.v.list[k + 1] = Var::new_int(h->buckets[k]);
+
+    r.v.list[1] = Var::new_int(h->count);
+    r.v.list[2] = Var::new_float(h->seconds);
+    r.v.list[3] = buckets;
+    return r;
+}
+
+static package
+bf_loop_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    Var r, v;
+    Num input_tasks, longest_queue;
+    int i;
+
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+	return make_error_pack(E_PERM);
+
+    r = new_map();
+    r = mapinsert(r, str_dup_to_var("passes"), Var::new_int(passes));
+
+    v = new_map();
+    for (i = 0; i < LOOP_PHASES; i++)
+	v = mapinsert(v, str_dup_to_var(phase_names[i]),
+		      histogram_var(&phases[i]));
+    r = mapinsert(r, str_dup_to_var("phases"), v);
+
+    r = mapinsert(r, str_dup_to_var("input_queues"),
+		  input_queue_lengths(&input_tasks, &longest_queue));
+    r = mapinsert(r, str_dup_to_var("waiting_tasks"),
+		  Var::new_int(waiting_task_count()));
+    r = mapinsert(r, str_dup_to_var("background_threads"),
+		  Var::new_int(background_thread_count()));
+    r = mapinsert(r, str_dup_to_var("responses"), histogram_var(&responses));
+    r = mapinsert(r, str_dup_to_var("connections"),
+		  connection_response_times());
+
+    return make_var_pack(r);
+}
+
+void
+register_loop_stats(void)
+{
+    register_function("loop_stats", 0, 0, bf_loop_stats);
+}
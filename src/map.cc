@@ -599,6 +599,9 @@ new_map(void)
 {
     static Var map;
 
+    if (in_background_thread)
+	return empty_map();
+
     if (map.v.tree == nullptr)
 	map = empty_map();
 
@@ -27,55 +27,25 @@
 #include "unparse.h"
 #include "utils.h"
 
-static Var *
-aliases(Objid oid)
-{
-    Var value;
-    db_prop_handle h;
-
-    h = db_find_property(Var::new_obj(oid), "aliases", &value);
-    if (!h.ptr || value.type != TYPE_LIST) {
-	/* Simulate a pointer to an empty list */
-	return &zero;
-    } else
-	return value.v.list;
-}
-
 struct match_data {
-    int lname;
-    const char *name;
     Objid exact, partial;
 };
 
 static int
-match_proc(void *data, Objid oid)
+match_proc(void *data, Objid oid, int exact)
 {
     struct match_data *d = (struct match_data *)data;
-    Var *names = aliases(oid);
-    int i;
-    const char *name;
 
-    for (i = 0; i <= names[0].v.num; i++) {
-	if (i == 0)
-	    name = db_object_name(oid);
-	else if (names[i].type != TYPE_STR)
-	    continue;
+    if (exact) {
+	if (d->exact == NOTHING || d->exact == oid)
+	    d->exact = oid;
 	else
-	    name = names[i].v.str;
-
-	if (!strncasecmp(name, d->name, d->lname)) {
-	    if (name[d->lname] == '\0') {	/* exact match */
-		if (d->exact == NOTHING || d->exact == oid)
-		    d->exact = oid;
-		else
-		    return 1;
-	    } else {		/* partial match */
-		if (d->partial == FAILED_MATCH || d->partial == oid)
-		    d->partial = oid;
-		else
-		    d->partial = AMBIGUOUS;
-	    }
-	}
+	    return 1;
+    } else {
+	if (d->partial == FAILED_MATCH || d->partial == oid)
+	    d->partial = oid;
+	else
+	    d->partial = AMBIGUOUS;
     }
 
     return 0;
@@ -89,8 +59,6 @@ match_contents(Objid player, const char *name)
     Objid oid;
     struct match_data d;
 
-    d.lname = strlen(name);
-    d.name = name;
     d.exact = NOTHING;
     d.partial = FAILED_MATCH;
 
@@ -101,7 +69,7 @@ match_contents(Objid player, const char *name)
     for (oid = player, step = 0; step < 2; oid = loc, step++) {
 	if (!valid(oid))
 	    continue;
-	if (db_for_all_contents(oid, match_proc, &d))
+	if (db_for_all_matching_contents(oid, name, match_proc, &d))
 	    /* We only abort the enumeration for exact ambiguous matches... */
 	    return AMBIGUOUS;
     }
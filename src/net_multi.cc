@@ -19,6 +19,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -28,10 +29,16 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <pthread.h>
+#include <nettle/base64.h>
+#include <nettle/sha1.h>
 
 #include "config.h"
+#include "background.h"
+#include "http_parser.h"
 #include "list.h"
 #include "log.h"
+#include "loop_stats.h"
+#include "map.h"
 #include "net_mplex.h"
 #include "net_multi.h"
 #include "net_proto.h"
@@ -44,6 +51,10 @@
 #include "timers.h"
 #include "utils.h"
 
+#ifdef ZLIB_FOUND
+#include <zlib.h>
+#endif
+
 static struct proto proto;
 static int eol_length;		/* == strlen(proto.eol_out_string) */
 
@@ -59,6 +70,8 @@ static int ewouldblock = EWOULDBLOCK;
 static int ewouldblock = -1;
 #endif
 
+#define OUTPUT_IOVECS	64	/* text blocks handed to each writev() */
+
 static int *pocket_descriptors = nullptr;	/* fds we keep around in case we need
 						 * one and no others are left... */
 
@@ -67,8 +80,39 @@ typedef struct text_block {
 	int length;
 	char *buffer;
 	char *start;
+	const char *string;	/* if non-null, a MOO string we hold a reference
+				 * to instead of owning `buffer' */
+	bool keep;		/* never discarded to make room: it is partly
+				 * written or is an overflow notice */
 } text_block;
 
+typedef struct http_input {	/* Parsing state of an HTTP connection */
+	http_parser parser;	/* parser.data is the nhandle */
+	Stream *uri;
+	Stream *field;		/* the header being read */
+	Stream *value;
+	Stream *body;
+	bool in_value;		/* the last header bytes seen were a value */
+	bool has_body;
+	bool done;		/* no more requests will be read */
+	Var headers;
+} http_input;
+
+typedef struct ws_state {	/* State of a WebSocket connection */
+	bool open;		/* the opening handshake is done */
+	bool closing;		/* a Close frame has been sent */
+	bool deflate;		/* permessage-deflate was negotiated */
+	char *in;		/* bytes received but not yet framed */
+	int in_length, in_size;
+	int opcode;		/* of the message being received, or 0 */
+	bool compressed;	/* ... and whether it is */
+	Stream *message;	/* its payload so far */
+	Stream *inflated;
+#ifdef ZLIB_FOUND
+	z_stream inflater, deflater;
+#endif
+} ws_state;
+
 typedef struct nhandle {
 	struct nhandle *next, **prev;
 	server_handle shandle;
@@ -82,6 +126,9 @@ typedef struct nhandle {
 	int output_length;
 	int output_lines_flushed;
 	int outbound, binary;
+	http_input *http;		// non-null while reading HTTP requests
+	ws_state *ws;			// non-null if the listener speaks WebSocket
+	bool close_after_output;	// close once the output queue drains
 #if NETWORK_PROTOCOL == NP_TCP
 	bool client_echo;
 	uint16_t source_port;          // port on server
@@ -103,6 +150,7 @@ typedef struct nlistener {
 	const char *name;				// resolved hostname
 	const char *ip_addr;			// 'raw' IP address
 	uint16_t port;					// listening port
+	listen_mode mode;
 } nlistener;
 
 static nlistener *all_nlisteners = nullptr;
@@ -197,10 +245,70 @@ check_registered_fds(void)
 static void
 free_text_block(text_block * b)
 {
-	myfree(b->buffer, M_NETWORK);
+	if (b->string)
+		free_str(b->string);
+	else
+		myfree(b->buffer, M_NETWORK);
 	myfree(b, M_NETWORK);
 }
 
+static void
+append_text_block(nhandle * h, text_block * block)
+{
+	block->next = nullptr;
+	*(h->output_tail) = block;
+	h->output_tail = &(block->next);
+	h->output_length += block->length;
+}
+
+static void
+append_bytes(nhandle * h, const char *data, int length)
+{
+	text_block *block = (text_block *) mymalloc(sizeof(text_block), M_NETWORK);
+
+	block->buffer = block->start = (char *)mymalloc(length, M_NETWORK);
+	memcpy(block->buffer, data, length);
+	block->length = length;
+	block->string = nullptr;
+	block->keep = false;
+	append_text_block(h, block);
+}
+
+/* WebSocket frames (RFC 6455) */
+
+#define WS_CONTINUATION	0x0
+#define WS_TEXT		0x1
+#define WS_BINARY	0x2
+#define WS_CLOSE	0x8
+#define WS_PING		0x9
+#define WS_PONG		0xA
+
+#define WS_MAX_HEADER	10	/* bytes in the longest unmasked header */
+#define WS_DEFLATE_MIN	64	/* shorter messages are sent uncompressed */
+
+static char *
+ws_put_header(char *payload, int opcode, bool compressed, uint64_t length)
+{
+	/* Writes an unmasked frame header just before PAYLOAD and returns
+	 * where it starts. */
+	int n = length < 126 ? 2 : length < 65536 ? 4 : 10;
+	unsigned char *p = (unsigned char *)payload - n;
+
+	p[0] = 0x80 | (compressed ? 0x40 : 0) | opcode;
+	if (n == 2)
+		p[1] = length;
+	else if (n == 4) {
+		p[1] = 126;
+		p[2] = length >> 8;
+		p[3] = length;
+	} else {
+		p[1] = 127;
+		for (int i = 0; i < 8; i++)
+			p[2 + i] = length >> (56 - 8 * i);
+	}
+	return (char *)p;
+}
+
 #ifndef HAVE_ACCEPT4
 int
 network_set_nonblocking(int fd)
@@ -226,40 +334,107 @@ network_set_nonblocking(int fd)
 }
 #endif
 
+static text_block *
+ws_frame(nhandle * h, int opcode, const char *data, int length)
+{
+	ws_state *ws = h->ws;
+	text_block *block = (text_block *) mymalloc(sizeof(text_block), M_NETWORK);
+	char *payload = nullptr;
+	int payload_length = length;
+	bool compressed = false;
+
+#ifdef ZLIB_FOUND
+	if (ws->deflate && opcode < WS_CLOSE && length >= WS_DEFLATE_MIN) {
+		z_stream *z = &ws->deflater;
+		int size = deflateBound(z, length) + 16;
+
+		block->buffer = (char *)mymalloc(WS_MAX_HEADER + size, M_NETWORK);
+		payload = block->buffer + WS_MAX_HEADER;
+		deflateReset(z);	/* server_no_context_takeover */
+		z->next_in = (Bytef *) data;
+		z->avail_in = length;
+		z->next_out = (Bytef *) payload;
+		z->avail_out = size;
+		if (deflate(z, Z_SYNC_FLUSH) == Z_OK && z->avail_in == 0 && z->avail_out > 0) {
+			/* Leave off the 00 00 FF FF that ends the flush. */
+			payload_length = size - z->avail_out - 4;
+			compressed = true;
+		} else
+			myfree(block->buffer, M_NETWORK);
+	}
+#endif
+	if (!compressed) {
+		block->buffer = (char *)mymalloc(WS_MAX_HEADER + length, M_NETWORK);
+		payload = block->buffer + WS_MAX_HEADER;
+		memcpy(payload, data, length);
+	}
+	block->start = ws_put_header(payload, opcode, compressed, payload_length);
+	block->length = payload + payload_length - block->start;
+	block->string = nullptr;
+	block->keep = false;
+
+	return block;
+}
+
 static int
 push_output(nhandle * h)
 {
 	text_block *b;
 	int count;
 
-	if (h->output_lines_flushed > 0) {
+	if (h->output_lines_flushed > 0
+	    && !(h->output_head && h->output_head->keep)) {
+		/* Goes out next, unless a block has been begun, and is then
+		 * written like any other. */
+		const char *eol = h->ws ? "" : proto.eol_out_string;
 		char buf[100];
 		int length;
 
 		sprintf(buf,
 			"%s>> Network buffer overflow: %u line%s of output to you %s been lost <<%s",
-			proto.eol_out_string,
-			h->output_lines_flushed,
+			eol, h->output_lines_flushed,
 			h->output_lines_flushed == 1 ? "" : "s",
-			h->output_lines_flushed == 1 ? "has" : "have", proto.eol_out_string);
+			h->output_lines_flushed == 1 ? "has" : "have", eol);
 		length = strlen(buf);
-		count = write(h->wfd, buf, length);
-		if (count == length)
-			h->output_lines_flushed = 0;
-		else
-			return count >= 0 || errno == eagain || errno == ewouldblock;
-	}
-	while ((b = h->output_head) != nullptr) {
-		count = write(h->wfd, b->start, b->length);
+		if (h->ws)
+			b = ws_frame(h, WS_TEXT, buf, length);
+		else {
+			b = (text_block *) mymalloc(sizeof(text_block), M_NETWORK);
+			b->buffer = b->start = (char *)mymalloc(length, M_NETWORK);
+			memcpy(b->buffer, buf, length);
+			b->length = length;
+			b->string = nullptr;
+		}
+		b->keep = true;
+		b->next = h->output_head;
+		if (!h->output_head)
+			h->output_tail = &(b->next);
+		h->output_head = b;
+		h->output_length += b->length;
+		h->output_lines_flushed = 0;
+	}
+	while (h->output_head != nullptr) {
+		struct iovec iov[OUTPUT_IOVECS];
+		int n = 0;
+
+		for (b = h->output_head; b && n < OUTPUT_IOVECS; b = b->next, n++) {
+			iov[n].iov_base = b->start;
+			iov[n].iov_len = b->length;
+		}
+		count = writev(h->wfd, iov, n);
 		if (count < 0)
 			return (errno == eagain || errno == ewouldblock);
 		h->output_length -= count;
-		if (count == b->length) {
+		while ((b = h->output_head) != nullptr && count >= b->length) {
+			count -= b->length;
 			h->output_head = b->next;
 			free_text_block(b);
-		} else {
+		}
+		if (count > 0) {	/* the socket is full */
 			b->start += count;
 			b->length -= count;
+			b->keep = true;
+			break;
 		}
 	}
 	if (h->output_head == nullptr)
@@ -267,6 +442,467 @@ push_output(nhandle * h)
 	return 1;
 }
 
+static void
+ws_close(nhandle * h, int status)
+{
+	char code[2] = { (char)(status >> 8), (char)status };
+
+	if (!h->ws->closing) {
+		append_text_block(h, ws_frame(h, WS_CLOSE, code, 2));
+		h->ws->closing = true;
+	}
+	h->close_after_output = true;
+}
+
+#ifdef ZLIB_FOUND
+static bool
+ws_inflate(ws_state * ws)
+{
+	static const char tail[4] = { 0, 0, (char)0xFF, (char)0xFF };
+	z_stream *z = &ws->inflater;
+	char chunk[16384];
+	int status;
+
+	inflateReset(z);	/* client_no_context_takeover */
+	stream_add_bytes(ws->message, tail, sizeof(tail));
+	z->next_in = (Bytef *) stream_contents(ws->message);
+	z->avail_in = stream_length(ws->message);
+	do {
+		z->next_out = (Bytef *) chunk;
+		z->avail_out = sizeof(chunk);
+		status = inflate(z, Z_SYNC_FLUSH);
+		if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+			return false;
+		stream_add_bytes(ws->inflated, chunk, sizeof(chunk) - z->avail_out);
+		if (stream_length(ws->inflated) > MAX_LINE_BYTES)
+			return false;
+	} while (z->avail_out == 0 && status != Z_STREAM_END);
+
+	return true;
+}
+#endif
+
+static void
+ws_deliver(nhandle * h, const char *data, int length)
+{
+	Stream *s = h->input;
+	bool last_was_CR = false;
+	int i;
+
+	if (h->binary) {
+		stream_add_raw_bytes_to_binary(s, data, length);
+		server_receive_line(h->shandle, reset_stream(s), false);
+		return;
+	}
+
+	/* Filtered and split into lines like telnet input, except that the
+	 * end of the message also ends a line. */
+	for (i = 0; i < length; i++) {
+		unsigned char c = data[i];
+
+		if (isgraph(c) || c == ' ' || c == '\t')
+			stream_add_char(s, c);
+		else if (c == '\r' || (c == '\n' && !last_was_CR))
+			server_receive_line(h->shandle, reset_stream(s), false);
+		last_was_CR = (c == '\r');
+	}
+	if (length == 0 || (data[length - 1] != '\r' && data[length - 1] != '\n'))
+		server_receive_line(h->shandle, reset_stream(s), false);
+}
+
+static void
+ws_frame_received(nhandle * h, unsigned char flags, const char *payload, int length)
+{
+	ws_state *ws = h->ws;
+	int opcode = flags & 0x0F;
+	bool fin = flags & 0x80;
+	bool compressed = flags & 0x40;
+
+	if ((flags & 0x30)
+	    || (compressed && (!ws->deflate || opcode == WS_CONTINUATION || opcode >= WS_CLOSE))
+	    || (opcode >= WS_CLOSE && (!fin || length > 125))) {
+		ws_close(h, 1002);	/* protocol error */
+		return;
+	}
+
+	switch (opcode) {
+	case WS_CLOSE:
+		ws_close(h, length >= 2
+			 ? ((unsigned char)payload[0] << 8) | (unsigned char)payload[1]
+			 : 1000);
+		return;
+	case WS_PING:
+		append_text_block(h, ws_frame(h, WS_PONG, payload, length));
+		return;
+	case WS_PONG:
+		return;
+	case WS_TEXT:
+	case WS_BINARY:
+		if (ws->opcode) {
+			ws_close(h, 1002);
+			return;
+		}
+		ws->opcode = opcode;
+		ws->compressed = compressed;
+		break;
+	case WS_CONTINUATION:
+		if (!ws->opcode) {
+			ws_close(h, 1002);
+			return;
+		}
+		break;
+	default:
+		ws_close(h, 1002);
+		return;
+	}
+
+	if (stream_length(ws->message) + length > MAX_LINE_BYTES) {
+		ws_close(h, 1009);	/* message too big */
+		return;
+	}
+	stream_add_bytes(ws->message, payload, length);
+	if (!fin)
+		return;
+
+	if (!ws->compressed)
+		ws_deliver(h, stream_contents(ws->message), stream_length(ws->message));
+#ifdef ZLIB_FOUND
+	else if (ws_inflate(ws))
+		ws_deliver(h, stream_contents(ws->inflated), stream_length(ws->inflated));
+#endif
+	else
+		ws_close(h, 1007);	/* bad data */
+	reset_stream(ws->message);
+	reset_stream(ws->inflated);
+	ws->opcode = 0;
+}
+
+static void
+ws_input(nhandle * h, const char *data, int length)
+{
+	ws_state *ws = h->ws;
+	int pos = 0;
+
+	if (ws->in_length + length > ws->in_size) {
+		ws->in_size = ws->in_length + length > 2 * ws->in_size
+			? ws->in_length + length : 2 * ws->in_size;
+		ws->in = (char *)myrealloc(ws->in, ws->in_size, M_NETWORK);
+	}
+	memcpy(ws->in + ws->in_length, data, length);
+	ws->in_length += length;
+
+	while (!ws->closing) {
+		unsigned char *p = (unsigned char *)ws->in + pos;
+		int available = ws->in_length - pos;
+		int header = 2, i;
+		uint64_t payload;
+
+		if (available < 2)
+			break;
+		payload = p[1] & 0x7F;
+		if (payload == 126)
+			header = 4;
+		else if (payload == 127)
+			header = 10;
+		if (p[1] & 0x80)
+			header += 4;	/* masking key */
+		if (available < header)
+			break;
+		if (payload == 126)
+			payload = (p[2] << 8) | p[3];
+		else if (payload == 127)
+			for (payload = 0, i = 2; i < 10; i++)
+				payload = (payload << 8) | p[i];
+		if (payload > MAX_LINE_BYTES) {
+			ws_close(h, 1009);
+			break;
+		}
+		if ((uint64_t) (available - header) < payload)
+			break;
+		if (p[1] & 0x80) {
+			unsigned char *mask = p + header - 4;
+
+			for (i = 0; i < (int)payload; i++)
+				p[header + i] ^= mask[i & 3];
+		}
+		pos += header + payload;
+		ws_frame_received(h, p[0], (char *)p + header, payload);
+	}
+
+	if (ws->closing)
+		ws->in_length = 0;
+	else {
+		memmove(ws->in, ws->in + pos, ws->in_length - pos);
+		ws->in_length -= pos;
+	}
+}
+
+static void
+ws_refuse(nhandle * h)
+{
+	static const char response[] =
+		"HTTP/1.1 400 Bad Request\r\n"
+		"Sec-WebSocket-Version: 13\r\n"
+		"Content-Length: 0\r\n"
+		"Connection: close\r\n\r\n";
+
+	append_bytes(h, response, sizeof(response) - 1);
+	h->close_after_output = true;
+}
+
+static void
+websocket_handshake(nhandle * h)
+{
+	static const Var UPGRADE = str_dup_to_var("Upgrade");
+	static const Var KEY = str_dup_to_var("Sec-WebSocket-Key");
+	static const Var VERSION = str_dup_to_var("Sec-WebSocket-Version");
+	static const Var EXTENSIONS = str_dup_to_var("Sec-WebSocket-Extensions");
+	static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+	http_input *http = h->http;
+	ws_state *ws = h->ws;
+	Var upgrade, key, version, extensions;
+	struct sha1_ctx ctx;
+	uint8_t digest[SHA1_DIGEST_SIZE];
+	char accept[BASE64_ENCODE_RAW_LENGTH(SHA1_DIGEST_SIZE) + 1];
+	Stream *s;
+
+	if (http->parser.method != HTTP_GET || !http->parser.upgrade
+	    || !maplookup(http->headers, UPGRADE, &upgrade, 0)
+	    || !strcasestr(upgrade.v.str, "websocket")
+	    || !maplookup(http->headers, KEY, &key, 0)
+	    || !maplookup(http->headers, VERSION, &version, 0)
+	    || strcmp(version.v.str, "13")) {
+		ws_refuse(h);
+		return;
+	}
+
+	sha1_init(&ctx);
+	sha1_update(&ctx, memo_strlen(key.v.str), (const uint8_t *)key.v.str);
+	sha1_update(&ctx, sizeof(guid) - 1, (const uint8_t *)guid);
+	sha1_digest(&ctx, SHA1_DIGEST_SIZE, digest);
+	base64_encode_raw(accept, SHA1_DIGEST_SIZE, digest);
+	accept[sizeof(accept) - 1] = '\0';
+
+	s = new_stream(200);
+	stream_printf(s, "HTTP/1.1 101 Switching Protocols\r\n"
+		      "Upgrade: websocket\r\n"
+		      "Connection: Upgrade\r\n"
+		      "Sec-WebSocket-Accept: %s\r\n", accept);
+#ifdef ZLIB_FOUND
+	/* Without context takeover each message is compressed on its own,
+	 * so nothing is kept between messages.  Offers that limit our
+	 * window are declined. */
+	if (maplookup(http->headers, EXTENSIONS, &extensions, 0)
+	    && strstr(extensions.v.str, "permessage-deflate")
+	    && !strstr(extensions.v.str, "server_max_window_bits")
+	    && deflateInit2(&ws->deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			    -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+		if (inflateInit2(&ws->inflater, -MAX_WBITS) == Z_OK) {
+			ws->deflate = true;
+			stream_add_string(s, "Sec-WebSocket-Extensions: permessage-deflate; "
+					  "server_no_context_takeover; client_no_context_takeover\r\n");
+		} else
+			deflateEnd(&ws->deflater);
+	}
+#endif
+	stream_add_string(s, "\r\n");
+	append_bytes(h, stream_contents(s), stream_length(s));
+	free_stream(s);
+
+	ws->open = true;
+	/* What other connections start with */
+	server_receive_line(h->shandle, "", false);
+}
+
+static int
+add_http_bytes(Stream * s, const char *at, size_t length)
+{
+	if (stream_length(s) + length > MAX_LINE_BYTES)
+		return 1;	/* makes the parser fail */
+	stream_add_raw_bytes_to_binary(s, at, length);
+	return 0;
+}
+
+static void
+complete_http_header(http_input * http)
+{
+	if (http->in_value) {
+		Var field = str_dup_to_var(reset_stream(http->field));
+
+		http->headers = mapinsert(http->headers, field,
+					  str_dup_to_var(reset_stream(http->value)));
+		http->in_value = false;
+	}
+}
+
+static int
+on_http_message_begin(http_parser * parser)
+{
+	http_input *http = ((nhandle *) parser->data)->http;
+
+	reset_stream(http->uri);
+	reset_stream(http->field);
+	reset_stream(http->value);
+	reset_stream(http->body);
+	http->in_value = false;
+	http->has_body = false;
+	free_var(http->headers);
+	http->headers = new_map();
+	return 0;
+}
+
+static int
+on_http_url(http_parser * parser, const char *at, size_t length)
+{
+	return add_http_bytes(((nhandle *) parser->data)->http->uri, at, length);
+}
+
+static int
+on_http_header_field(http_parser * parser, const char *at, size_t length)
+{
+	http_input *http = ((nhandle *) parser->data)->http;
+
+	complete_http_header(http);
+	return add_http_bytes(http->field, at, length);
+}
+
+static int
+on_http_header_value(http_parser * parser, const char *at, size_t length)
+{
+	http_input *http = ((nhandle *) parser->data)->http;
+
+	http->in_value = true;
+	return add_http_bytes(http->value, at, length);
+}
+
+static int
+on_http_headers_complete(http_parser * parser)
+{
+	complete_http_header(((nhandle *) parser->data)->http);
+	return 0;
+}
+
+static int
+on_http_body(http_parser * parser, const char *at, size_t length)
+{
+	http_input *http = ((nhandle *) parser->data)->http;
+
+	http->has_body = true;
+	return add_http_bytes(http->body, at, length);
+}
+
+static int
+on_http_message_complete(http_parser * parser)
+{
+	static const Var METHOD = str_dup_to_var("method");
+	static const Var URI = str_dup_to_var("uri");
+	static const Var HEADERS = str_dup_to_var("headers");
+	static const Var BODY = str_dup_to_var("body");
+	static const Var UPGRADE = str_dup_to_var("upgrade");
+
+	nhandle *h = (nhandle *) parser->data;
+	http_input *http = h->http;
+	Var request = new_map();
+	bool keep_alive = http_should_keep_alive(parser) && !parser->upgrade;
+
+	if (h->ws) {
+		free_var(request);
+		http->done = true;
+		websocket_handshake(h);
+		/* Stop the parser at the first frame, or at a refused request. */
+		return h->ws->open ? 0 : 1;
+	}
+
+	/* Same shape as the value read_http() returns. */
+	request = mapinsert(request, var_ref(METHOD),
+			    str_dup_to_var(http_method_str((http_method) parser->method)));
+	request = mapinsert(request, var_ref(URI), str_dup_to_var(reset_stream(http->uri)));
+	request = mapinsert(request, var_ref(HEADERS), http->headers);
+	http->headers = new_map();
+	if (http->has_body)
+		request = mapinsert(request, var_ref(BODY),
+				    str_dup_to_var(reset_stream(http->body)));
+	if (parser->upgrade)
+		request = mapinsert(request, var_ref(UPGRADE), Var::new_int(1));
+
+	if (!keep_alive)
+		http->done = true;
+	server_receive_http_request(h->shandle, request, keep_alive);
+	return 0;
+}
+
+static const http_parser_settings http_settings = {
+	on_http_message_begin,
+	on_http_url,
+	on_http_header_field,
+	on_http_header_value,
+	on_http_headers_complete,
+	on_http_body,
+	on_http_message_complete
+};
+
+static void
+free_http_input(nhandle * h)
+{
+	free_stream(h->http->uri);
+	free_stream(h->http->field);
+	free_stream(h->http->value);
+	free_stream(h->http->body);
+	free_var(h->http->headers);
+	myfree(h->http, M_NETWORK);
+	h->http = nullptr;
+}
+
+static int
+pull_http_input(nhandle * h)
+{
+	http_input *http = h->http;
+	char buffer[16384];
+	int count;
+
+	if ((count = read(h->rfd, buffer, sizeof(buffer))) > 0) {
+		if (!http->done) {
+			size_t parsed = http_parser_execute(&http->parser, &http_settings,
+							    buffer, count);
+
+			if (!http->done && (HTTP_PARSER_ERRNO(&http->parser) != HPE_OK
+					    || parsed != (size_t) count)) {
+				/* Not HTTP we understand; answer it in turn and
+				 * hang up. */
+				http->done = true;
+				if (h->ws)
+					ws_refuse(h);
+				else
+					server_receive_http_request(h->shandle, Var::new_int(400), false);
+			}
+			if (h->ws && h->ws->open) {
+				/* Anything after the handshake is already frames. */
+				free_http_input(h);
+				if (parsed < (size_t) count)
+					ws_input(h, buffer + parsed, count - parsed);
+			}
+		}
+		return 1;
+	} else
+		return (count == 0 && !proto.believe_eof)
+			|| (count < 0 && (errno == eagain || errno == ewouldblock));
+}
+
+static int
+pull_ws_input(nhandle * h)
+{
+	char buffer[16384];
+	int count;
+
+	if ((count = read(h->rfd, buffer, sizeof(buffer))) > 0) {
+		ws_input(h, buffer, count);
+		return 1;
+	} else
+		return (count == 0 && !proto.believe_eof)
+			|| (count < 0 && (errno == eagain || errno == ewouldblock));
+}
+
 static int
 pull_input(nhandle * h)
 {
@@ -279,6 +915,11 @@ pull_input(nhandle * h)
 
 	Stream *s = h->input;
 
+	if (h->ws && h->ws->open)
+		return pull_ws_input(h);
+	if (h->http)
+		return pull_http_input(h);
+
 	if (stream_length(s) >= MAX_LINE_BYTES) {
 		errlog("Connection `%s` closed for exceeding MAX_LINE_BYTES! (%" PRIdN " /%" PRIdN ")\n", h->name,
 		       stream_length(s), MAX_LINE_BYTES);
@@ -377,6 +1018,9 @@ new_nhandle(const int rfd, const int wfd, const int outbound, uint16_t listen_po
 	h->output_lines_flushed = 0;
 	h->outbound = outbound;
 	h->binary = 0;
+	h->http = nullptr;
+	h->ws = nullptr;
+	h->close_after_output = false;
 	h->name = local_hostname;	// already malloced by a get_network* function
 #if NETWORK_PROTOCOL == NP_TCP
 	h->client_echo = 1;
@@ -398,6 +1042,8 @@ close_nhandle(nhandle * h)
 {
 	text_block *b, *bb;
 
+	if (h->ws && h->ws->open)
+		ws_close(h, 1000);
 	(void)push_output(h);
 	*(h->prev) = h->next;
 	if (h->next)
@@ -409,6 +1055,21 @@ close_nhandle(nhandle * h)
 		b = bb;
 	}
 	free_stream(h->input);
+	if (h->http)
+		free_http_input(h);
+	if (h->ws) {
+		if (h->ws->in)
+			myfree(h->ws->in, M_NETWORK);
+		free_stream(h->ws->message);
+		free_stream(h->ws->inflated);
+#ifdef ZLIB_FOUND
+		if (h->ws->deflate) {
+			inflateEnd(&h->ws->inflater);
+			deflateEnd(&h->ws->deflater);
+		}
+#endif
+		myfree(h->ws, M_NETWORK);
+	}
 	proto_close_connection(h->rfd, h->wfd);
 	free_str(h->name);
 #if NETWORK_PROTOCOL == NP_TCP
@@ -433,18 +1094,62 @@ close_nlistener(nlistener * l)
 	myfree(l, M_NETWORK);
 }
 
+static void
+start_http_input(nhandle * h)
+{
+	http_input *http = (http_input *) mymalloc(sizeof(http_input), M_NETWORK);
+
+	http_parser_init(&http->parser, HTTP_REQUEST);
+	http->parser.data = h;
+	http->uri = new_stream(100);
+	http->field = new_stream(100);
+	http->value = new_stream(100);
+	http->body = new_stream(100);
+	http->in_value = false;
+	http->has_body = false;
+	http->done = false;
+	http->headers = new_map();
+	h->http = http;
+}
+
+static void
+start_websocket(nhandle * h)
+{
+	ws_state *ws = (ws_state *) mymalloc(sizeof(ws_state), M_NETWORK);
+
+	ws->open = ws->closing = ws->deflate = false;
+	ws->in = nullptr;
+	ws->in_length = ws->in_size = 0;
+	ws->opcode = 0;
+	ws->compressed = false;
+	ws->message = new_stream(100);
+	ws->inflated = new_stream(100);
+#ifdef ZLIB_FOUND
+	ws->inflater.zalloc = ws->deflater.zalloc = Z_NULL;
+	ws->inflater.zfree = ws->deflater.zfree = Z_NULL;
+	ws->inflater.opaque = ws->deflater.opaque = Z_NULL;
+	ws->inflater.next_in = Z_NULL;
+	ws->inflater.avail_in = 0;
+#endif
+	h->ws = ws;
+}
+
 static void
 make_new_connection(server_listener sl, int rfd, int wfd, int outbound,
 					uint16_t listen_port, const char *listen_hostname,
 					const char *listen_ipaddr, uint16_t local_port,
 					const char *local_hostname, const char *local_ipaddr,
-					sa_family_t protocol)
+					sa_family_t protocol, listen_mode mode)
 {
 	nhandle *h;
 	network_handle nh;
 
 	nh.ptr = h = new_nhandle(rfd, wfd, outbound, listen_port, listen_hostname, 
 							listen_ipaddr, local_port, local_hostname, local_ipaddr, protocol);
+	if (mode != LISTEN_LINES)
+		start_http_input(h);
+	if (mode == LISTEN_WEBSOCKET)
+		start_websocket(h);
 	h->shandle = server_new_connection(sl, nh, outbound);
 }
 
@@ -478,7 +1183,7 @@ accept_new_connection(nlistener * l)
 
 	switch (proto_accept_connection(l->fd, &rfd, &wfd, &name, &ip_addr, &port, &protocol)) {
 	    case PA_OKAY:
-		    make_new_connection(l->slistener, rfd, wfd, 0, l->port, l->name, l->ip_addr, port, name, ip_addr, protocol);
+		    make_new_connection(l->slistener, rfd, wfd, 0, l->port, l->name, l->ip_addr, port, name, ip_addr, protocol, l->mode);
 		    break;
 	    case PA_FULL:
 		    for (i = 0; i < proto.pocket_size; i++)
@@ -506,23 +1211,41 @@ enqueue_output(network_handle nh, const char *line, int line_length, int add_eol
 	char *buffer;
 	text_block *block;
 
+	if (h->ws && (!h->ws->open || h->ws->closing))
+		return 1;	/* nowhere for it to go */
+	if (h->http)
+		return 1;	/* only responses are written on HTTP */
+
 	if (h->output_length != 0 && h->output_length + length > MAX_QUEUED_OUTPUT) {	/* must flush... */
 		int to_flush;
-		text_block *b;
+		text_block *b, **bp = &(h->output_head);
 
 		(void)push_output(h);
 		to_flush = h->output_length + length - MAX_QUEUED_OUTPUT;
 		if (to_flush > 0 && !flush_ok)
 			return 0;
-		while (to_flush > 0 && (b = h->output_head)) {
+		/* Oldest first, but cutting a block short or losing a
+		 * WebSocket control frame (Close, Ping or Pong) would break
+		 * the stream. */
+		while (to_flush > 0 && (b = *bp)) {
+			if (b->keep || (h->ws && (b->start[0] & 0x08))) {
+				bp = &(b->next);
+				continue;
+			}
 			h->output_length -= b->length;
 			to_flush -= b->length;
 			h->output_lines_flushed++;
-			h->output_head = b->next;
+			*bp = b->next;
 			free_text_block(b);
 		}
-		if (h->output_head == nullptr)
-			h->output_tail = &(h->output_head);
+		if (*bp == nullptr)
+			h->output_tail = bp;
+	}
+	if (h->ws) {
+		/* Each line is a message of its own; the frame ends it. */
+		append_text_block(h, ws_frame(h, h->binary ? WS_BINARY : WS_TEXT,
+					      line, line_length));
+		return 1;
 	}
 	buffer = (char *)mymalloc(length * sizeof(char), M_NETWORK);
 	block = (text_block *) mymalloc(sizeof(text_block), M_NETWORK);
@@ -531,10 +1254,9 @@ enqueue_output(network_handle nh, const char *line, int line_length, int add_eol
 		memcpy(buffer + line_length, proto.eol_out_string, eol_length);
 	block->buffer = block->start = buffer;
 	block->length = length;
-	block->next = nullptr;
-	*(h->output_tail) = block;
-	h->output_tail = &(block->next);
-	h->output_length += length;
+	block->string = nullptr;
+	block->keep = false;
+	append_text_block(h, block);
 
 	return 1;
 }
@@ -574,7 +1296,7 @@ network_initialize(int argc, char **argv, Var * desc)
 enum error
 network_make_listener(server_listener sl, Var desc, network_listener * nl,
 					  const char **name, const char **ip_address,
-					  uint16_t *port, bool use_ipv6)
+					  uint16_t *port, bool use_ipv6, listen_mode mode)
 {
 	int fd;
 	enum error e = proto_make_listener(desc, &fd, name, ip_address, port, use_ipv6);
@@ -587,6 +1309,7 @@ network_make_listener(server_listener sl, Var desc, network_listener * nl,
 		listener->name = str_dup(*name);
 		listener->ip_addr = str_dup(*ip_address);
 		listener->port = *port;
+		listener->mode = mode;
 		if (all_nlisteners)
 			all_nlisteners->prev = &(listener->next);
 		listener->next = all_nlisteners;
@@ -619,6 +1342,31 @@ network_send_bytes(network_handle nh, const char *buffer, int buflen, int flush_
 	return enqueue_output(nh, buffer, buflen, 0, flush_ok);
 }
 
+void
+network_send_http_response(network_handle nh, const char *header, int header_length,
+						   const char *body, bool close)
+{
+	nhandle *h = (nhandle *) nh.ptr;
+	text_block *block;
+
+	/* Responses are never discarded to make room; instead, input stops
+	 * while too much output is queued.  The body is written straight
+	 * from the MOO string. */
+	append_bytes(h, header, header_length);
+
+	if (*body) {
+		block = (text_block *) mymalloc(sizeof(text_block), M_NETWORK);
+		block->string = str_ref(body);
+		block->buffer = block->start = (char *)block->string;
+		block->length = memo_strlen(body);
+		block->keep = false;
+		append_text_block(h, block);
+	}
+
+	if (close)
+		h->close_after_output = true;
+}
+
 int
 network_buffered_output_length(network_handle nh)
 {
@@ -653,14 +1401,23 @@ network_process_io(int timeout)
 	for (l = all_nlisteners; l; l = l->next)
 		mplex_add_reader(l->fd);
 	for (h = all_nhandles; h; h = h->next) {
-		if (!h->input_suspended)
+		if (!h->input_suspended
+		    && !(h->http && (h->http->done || h->output_length > MAX_QUEUED_OUTPUT))
+		    && !(h->ws && h->ws->closing))
 			mplex_add_reader(h->rfd);
-		if (h->output_head)
+		if (h->output_head || h->output_lines_flushed)
 			mplex_add_writer(h->wfd);
 	}
 	add_registered_fds();
 
-	if (mplex_wait(timeout))
+	/* Background threads may read the database while we're waiting. */
+	background_open_snapshots();
+	enum loop_phase phase = loop_stats_phase(LOOP_IDLE);
+	int timed_out = mplex_wait(timeout);
+	loop_stats_phase(phase);
+	background_close_snapshots();
+
+	if (timed_out)
 		return 0;
 	else {
 		for (l = all_nlisteners; l; l = l->next)
@@ -669,7 +1426,8 @@ network_process_io(int timeout)
 		for (h = all_nhandles; h; h = hnext) {
 			hnext = h->next;
 			if ((mplex_is_readable(h->rfd) && !pull_input(h))
-			    || (mplex_is_writable(h->wfd) && !push_output(h))) {
+			    || (mplex_is_writable(h->wfd) && !push_output(h))
+			    || (h->close_after_output && !h->output_head)) {
 				server_close(h->shandle);
 				close_nhandle(h);
 			}
@@ -880,6 +1638,8 @@ network_set_client_echo(network_handle nh, int is_on)
 	static char telnet_cmd[4] = { (char)TN_IAC, (char)0, (char)TN_ECHO, (char)0 };
 
 	h->client_echo = is_on;
+	if (h->ws)
+		return;		/* no telnet to negotiate with */
 	if (is_on)
 		telnet_cmd[1] = (char)TN_WONT;
 	else
@@ -908,7 +1668,7 @@ network_open_connection(Var arglist, server_listener sl, bool use_ipv6)
 	
 	e = proto_open_connection(arglist, &rfd, &wfd, &name, &ip_addr, &port, &protocol, use_ipv6);
 	if (e == E_NONE)
-		make_new_connection(sl, rfd, wfd, 1, 0, nullptr, nullptr, port, name, ip_addr, protocol);
+		make_new_connection(sl, rfd, wfd, 1, 0, nullptr, nullptr, port, name, ip_addr, protocol, LISTEN_LINES);
 
 	return e;
 }
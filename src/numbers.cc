@@ -289,7 +289,7 @@ do_modulus(Var a, Var b)
 	ans.v.err = E_DIV;
     } else if (a.type == TYPE_INT) {
 	ans.type = TYPE_INT;
-	if (a.v.num == MININT && b.v.num == -1)
+	if (a.v.num <= MININT && b.v.num == -1)
 	    ans.v.num = 0;
 	else
 	    ans.v.num = a.v.num % b.v.num;
@@ -320,8 +320,8 @@ do_divide(Var a, Var b)
 	ans.v.err = E_DIV;
     } else if (a.type == TYPE_INT) {
 	ans.type = TYPE_INT;
-	if (a.v.num == MININT && b.v.num == -1)
-	    ans.v.num = MININT;
+	if (a.v.num <= MININT && b.v.num == -1)
+	    ans.v.num = a.v.num;
 	else
 	    ans.v.num = a.v.num / b.v.num;
     } else { // must be float
@@ -1035,7 +1035,8 @@ bf_isa(Var arglist, Byte next, void *vdata, Objid progr)
 
 /* Locate an object in the database by name more quickly than is possible in-DB.
  * To avoid numerous list reallocations, we put everything in a vector and then
- * transfer it over to a list when we know how many values we have. */
+ * transfer it over to a list when we know how many values we have.
+ * The scan runs in a background thread, so it reads the database in snapshot slices. */
 void locate_by_name_thread_callback(Var arglist, Var *ret)
 {
     Var name, object;
@@ -1045,9 +1046,16 @@ void locate_by_name_thread_callback(Var arglist, Var *ret)
     const int case_matters = arglist.v.list[0].v.num < 2 ? 0 : is_true(arglist.v.list[2]);
     const int string_length = memo_strlen(arglist.v.list[1].v.str);
 
+    background_snapshot_begin();
+
     const Objid last_objid = db_last_used_objid();
     for (int x = 1; x < last_objid; x++)
     {
+        if (x % SNAPSHOT_SLICE == 0) {
+            background_snapshot_end();
+            background_snapshot_begin();
+        }
+
         if (!valid(x))
             continue;
 
@@ -1057,6 +1065,8 @@ void locate_by_name_thread_callback(Var arglist, Var *ret)
             tmp.push_back(x);
     }
 
+    background_snapshot_end();
+
     *ret = new_list(tmp.size());
     const auto vector_size = tmp.size();
     for (size_t x = 0; x < vector_size; x++) {
@@ -1223,31 +1233,49 @@ bf_next_recycled_object(Var arglist, Byte next, void *vdata, Objid progr)
     return ret;
 }
 
-/* Return a list of all objects in the database owned by who. */
-    static package
-bf_owned_objects(Var arglist, Byte next, void *vdata, Objid progr)
+/* Return a list of all objects in the database owned by who.
+ * The scan runs in a background thread, so it reads the database in snapshot slices. */
+void owned_objects_thread_callback(Var arglist, Var *ret)
 {
-    Objid who = arglist.v.list[1].v.obj;
-    free_var(arglist);
-
-    if (!valid(who))
-        return make_error_pack(E_INVIND);
-
+    const Objid who = arglist.v.list[1].v.obj;
     std::vector<Objid> tmp;
-    Objid max_obj = db_last_used_objid();
 
+    background_snapshot_begin();
+
+    const Objid max_obj = db_last_used_objid();
     for (Objid x = 0; x <= max_obj; x++) {
+        if (x > 0 && x % SNAPSHOT_SLICE == 0) {
+            background_snapshot_end();
+            background_snapshot_begin();
+        }
+
         if (valid(x) && who == db_object_owner(x))
             tmp.push_back(x);
     }
 
-    Var ret = new_list(tmp.size());
+    background_snapshot_end();
+
+    *ret = new_list(tmp.size());
     for (size_t x = 1; x <= tmp.size(); x++) {
-        ret.v.list[x].type = TYPE_OBJ;
-        ret.v.list[x].v.obj = tmp[x-1];
+        ret->v.list[x].type = TYPE_OBJ;
+        ret->v.list[x].v.obj = tmp[x-1];
     }
+}
 
-    return make_var_pack(ret);
+    static package
+bf_owned_objects(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    Objid who = arglist.v.list[1].v.obj;
+
+    if (!valid(who)) {
+        free_var(arglist);
+        return make_error_pack(E_INVIND);
+    }
+
+    char *human_string = nullptr;
+    asprintf(&human_string, "owned_objects: #%" PRIdN, who);
+
+    return background_thread(owned_objects_thread_callback, &arglist, human_string);
 }
 
 Var nothing;		/* useful constant */
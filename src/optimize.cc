@@ -0,0 +1,870 @@
+/******************************************************************************
+  Copyright (c) 1992, 1995, 1996 Xerox Corporation.  All rights reserved.
+  Portions of this code were written by Stephen White, aka ghond.
+  Use and copying of this software and preparation of derivative works based
+  upon this software are permitted.  Any distribution of this software or
+  derivative works must comply with all applicable United States export
+  control laws.  This software is made available AS IS, and Xerox Corporation
+  makes no warranty about the software, its performance or its conformity to
+  any specification.  Any person obtaining a copy of this software is requested
+  to send their name and post office or electronic mail address to:
+    Pavel Curtis
+    Xerox PARC
+    3333 Coyote Hill Rd.
+    Palo Alto, CA 94304
+    Pavel@Xerox.Com
+ *****************************************************************************/
+
+/* Peephole optimizer for generated bytecode.
+ *
+ * Suspended tasks, tracebacks and find_line_number() all identify code by
+ * its pc, so the optimizer never moves an instruction.  A stretch of code
+ * whose effect is known at compile time is rewritten in place instead: it
+ * starts with whatever is left to do (a push of the folded value or a
+ * jump) and the remaining bytes become padding: a JUMP over them, the
+ * rest filled with DONE, which is never reached.  A stretch too short to
+ * pad is left alone; there is deliberately no NOP opcode, since adding one
+ * would shift the OPTIM_NUM range and so change the code for some integer
+ * literals.  Code the optimizer makes unreachable stays where it is.  The code as
+ * generated is kept in Bytecodes.unoptimized for the decompiler, so
+ * verb_code() and the database see the program as written.
+ *
+ * Within each basic block the optimizer
+ *   - folds arithmetic, comparisons, `in', `!', unary minus, string
+ *     concatenation and list construction on constant operands, leaving
+ *     anything that would raise an error to fail at run time as before;
+ *   - replaces `if', `elseif', `? |', `&&' and `||' tests of constants with
+ *     a jump, or removes them;
+ *   - removes constants that are pushed only to be popped.
+ * Afterwards, runs of padding are collapsed into one JUMP and jumps that
+ * land on a JUMP or on padding are sent straight to their final target.
+ * `while' and `for' are left alone so that every loop iteration still
+ * costs a tick.  Finally, with BYTECODE_SUPERINSTRUCTIONS, common sequences
+ * that no jump lands inside are fused into the OP_SUPER instructions
+ * described in opcode.h.
+ */
+
+#include <string.h>
+#include <vector>
+
+#include "collection.h"
+#include "list.h"
+#include "numbers.h"
+#include "opcode.h"
+#include "optimize.h"
+#include "options.h"
+#include "program.h"
+#include "storage.h"
+#include "structures.h"
+#include "utils.h"
+
+struct insn {
+    unsigned length;
+    bool extended;
+    unsigned op;		/* the extended opcode if `extended' */
+    std::vector<unsigned> labels;	/* offsets of label operands */
+};
+
+struct constant {
+    Var value;
+    unsigned start;		/* first byte of the code that pushes it */
+    bool folded;		/* that code must be rewritten to push it */
+};
+
+struct opt_state {
+    Program *prog;
+    Bytecodes *bc;
+    std::vector<char> target;	/* pc is the target of some label */
+    std::vector<char> pad;	/* pc is part of the padding */
+};
+
+static unsigned
+read_operand(const Byte * p, unsigned nb)
+{
+    unsigned value = 0;
+
+    while (nb--)
+	value = (value << 8) + *p++;
+    return value;
+}
+
+static void
+write_operand(Byte * p, unsigned nb, unsigned value)
+{
+    while (nb--) {
+	p[nb] = value & 0xff;
+	value >>= 8;
+    }
+}
+
+static unsigned
+decode(const Bytecodes * bc, unsigned pc, insn * in)
+{
+    const Byte *v = bc->vector;
+    unsigned p = pc + 1;
+    unsigned op = v[pc];
+
+#   define LABEL()	(in->labels.push_back(p - pc), p += bc->numbytes_label)
+
+    in->labels.clear();
+    in->extended = false;
+    in->op = op;
+
+    if (IS_OPTIM_NUM_OPCODE(op) || IS_PUSH_n(op) || IS_PUT_n(op)
+#ifdef BYTECODE_REDUCE_REF
+	|| IS_PUSH_CLEAR_n(op)
+#endif /* BYTECODE_REDUCE_REF */
+	)
+	;
+    else if (op == OP_EXTENDED) {
+	in->extended = true;
+	in->op = v[p++];
+	switch ((Extended_Opcode) in->op) {
+	case EOP_WHILE_ID:
+	case EOP_FOR_LIST_1:
+	    p += bc->numbytes_var_name;
+	    LABEL();
+	    break;
+	case EOP_FOR_LIST_2:
+	    p += 2 * bc->numbytes_var_name;
+	    LABEL();
+	    break;
+	case EOP_EXIT_ID:
+	    p += bc->numbytes_var_name;
+	    /* fall thru */
+	case EOP_EXIT:
+	    p += bc->numbytes_stack;
+	    LABEL();
+	    break;
+	case EOP_PUSH_LABEL:
+	case EOP_END_CATCH:
+	case EOP_END_EXCEPT:
+	case EOP_TRY_FINALLY:
+	    LABEL();
+	    break;
+	case EOP_TRY_EXCEPT:
+	    p += 1;
+	    break;
+	case EOP_FIRST:
+	case EOP_LAST:
+	    p += bc->numbytes_stack;
+	    break;
+	case EOP_SCATTER:
+	    {
+		int i, nargs = v[p];
+
+		p += 3;
+		for (i = 0; i < nargs; i++) {
+		    p += bc->numbytes_var_name;
+		    LABEL();
+		}
+		LABEL();
+	    }
+	    break;
+	default:
+	    break;
+	}
+    } else
+	switch ((Opcode) op) {
+	case OP_IF:
+	case OP_IF_QUES:
+	case OP_EIF:
+	case OP_AND:
+	case OP_OR:
+	case OP_JUMP:
+	case OP_WHILE:
+	    LABEL();
+	    break;
+	case OP_FORK:
+	    p += bc->numbytes_fork;
+	    break;
+	case OP_FORK_WITH_ID:
+	    p += bc->numbytes_fork + bc->numbytes_var_name;
+	    break;
+	case OP_FOR_RANGE:
+	    p += bc->numbytes_var_name;
+	    LABEL();
+	    break;
+	case OP_SUPER:
+	    {
+		unsigned sop = v[p++];
+
+		if (sop >= SOP_REF && sop < SOP_GET_PROP)
+		    p += 1;
+		else if (sop == SOP_GET_PROP)
+		    p += 1 + bc->numbytes_literal;
+		else if (sop >= SOP_EQ_TEST) {
+		    p += 1;
+		    p += (v[p] == OP_IMM ? 1 + bc->numbytes_literal : 1);
+		    LABEL();
+		}
+	    }
+	    break;
+	case OP_G_PUSH:
+#ifdef BYTECODE_REDUCE_REF
+	case OP_G_PUSH_CLEAR:
+#endif /* BYTECODE_REDUCE_REF */
+	case OP_G_PUT:
+	    p += bc->numbytes_var_name;
+	    break;
+	case OP_IMM:
+	    p += bc->numbytes_literal;
+	    break;
+	case OP_BI_FUNC_CALL:
+	    p += 1;
+	    break;
+	default:
+	    break;
+	}
+
+#   undef LABEL
+
+    return in->length = p - pc;
+}
+
+static void
+find_targets(opt_state * st)
+{
+    const Bytecodes *bc = st->bc;
+    insn in;
+    unsigned pc;
+
+    st->target.assign(bc->size + 1, 0);
+    for (pc = 0; pc < bc->size; pc += in.length) {
+	decode(bc, pc, &in);
+	for (unsigned offset : in.labels) {
+	    unsigned label = read_operand(bc->vector + pc + offset,
+					  bc->numbytes_label);
+	    if (label <= bc->size)
+		st->target[label] = 1;
+	}
+    }
+}
+
+/* Index of `v' in the program's literals, adding it if needed; -1 if the
+ * index would not fit in the vector's literal operands.
+ */
+static int
+literal_index(opt_state * st, Var v)
+{
+    Program *prog = st->prog;
+    unsigned i, nb = st->bc->numbytes_literal;
+
+    for (i = 0; i < prog->num_literals; i++)
+	if (v.type == prog->literals[i].type	/* no int/float coercion here */
+	    && equality(v, prog->literals[i], 1))
+	    return i;
+
+    if (nb < 4 && i >= 1u << (8 * nb))
+	return -1;
+
+    if (prog->literals)
+	prog->literals = (Var *) myrealloc(prog->literals,
+					   sizeof(Var) * (i + 1), M_LIT_LIST);
+    else
+	prog->literals = (Var *) mymalloc(sizeof(Var), M_LIT_LIST);
+    prog->literals[i] = var_ref(v);
+    prog->num_literals++;
+
+    return i;
+}
+
+/* Fills [from, to), which nothing executes, with DONE. */
+static void
+fill_dead(opt_state * st, unsigned from, unsigned to)
+{
+    for (unsigned pc = from; pc < to; pc++) {
+	st->bc->vector[pc] = OP_DONE;
+	st->pad[pc] = 1;
+    }
+}
+
+/* Can [from, to) be turned into padding? */
+static bool
+paddable(const opt_state * st, unsigned from, unsigned to)
+{
+    return to == from || to - from >= 1u + st->bc->numbytes_label;
+}
+
+/* Turns [from, to) into a JUMP to `to' followed by dead bytes.  Fails,
+ * leaving the code alone, if there isn't room for the JUMP.
+ */
+static bool
+fill_padding(opt_state * st, unsigned from, unsigned to)
+{
+    Bytecodes *bc = st->bc;
+
+    if (!paddable(st, from, to))
+	return false;
+    if (to == from)
+	return true;
+    bc->vector[from] = OP_JUMP;
+    write_operand(bc->vector + from + 1, bc->numbytes_label, to);
+    for (unsigned pc = from; pc < to; pc++)
+	st->pad[pc] = 1;
+    fill_dead(st, from + 1 + bc->numbytes_label, to);
+    return true;
+}
+
+/* Rewrites [from, to) to push `value'.  Fails, leaving the code alone, if
+ * the push and the padding after it don't fit.
+ */
+static bool
+emit_push(opt_state * st, unsigned from, unsigned to, Var value)
+{
+    Bytecodes *bc = st->bc;
+    unsigned length = 1 + bc->numbytes_literal;
+    int index;
+
+    if (value.type == TYPE_INT && IN_OPTIM_NUM_RANGE(value.v.num)
+	&& paddable(st, from + 1, to))
+	bc->vector[from] = OPTIM_NUM_TO_OPCODE(value.v.num), length = 1;
+    else if (from + length <= to && paddable(st, from + length, to)
+	     && (index = literal_index(st, value)) >= 0) {
+	bc->vector[from] = OP_IMM;
+	write_operand(bc->vector + from + 1, bc->numbytes_literal, index);
+    } else
+	return false;
+
+    for (unsigned pc = from; pc < from + length; pc++)
+	st->pad[pc] = 0;
+    fill_padding(st, from + length, to);
+
+    return true;
+}
+
+/* Materializes the folded constants on the stack, the last of which is
+ * pushed by code ending at `end', and forgets them all.
+ */
+static void
+flush_constants(opt_state * st, std::vector<constant> &stack, unsigned end)
+{
+    size_t i;
+
+    for (i = 0; i < stack.size(); i++) {
+	unsigned to = i + 1 < stack.size() ? stack[i + 1].start : end;
+
+	if (stack[i].folded)
+	    emit_push(st, stack[i].start, to, stack[i].value);
+	free_var(stack[i].value);
+    }
+    stack.clear();
+}
+
+static bool
+fold_comparison(unsigned op, Var lhs, Var rhs, Var * ans)
+{
+    int comparison;
+
+    if ((lhs.type == TYPE_INT || lhs.type == TYPE_FLOAT)
+	&& (rhs.type == TYPE_INT || rhs.type == TYPE_FLOAT)) {
+	Var c = compare_numbers(lhs, rhs);
+
+	if (c.type == TYPE_ERR)
+	    return false;
+	comparison = c.v.num;
+    } else if (rhs.type != lhs.type)
+	return false;
+    else
+	switch (rhs.type) {
+	case TYPE_INT:
+	    comparison = compare_integers(lhs.v.num, rhs.v.num);
+	    break;
+	case TYPE_OBJ:
+	    comparison = compare_integers(lhs.v.obj, rhs.v.obj);
+	    break;
+	case TYPE_ERR:
+	    comparison = ((int) lhs.v.err) - ((int) rhs.v.err);
+	    break;
+	case TYPE_STR:
+	    comparison = strcasecmp(lhs.v.str, rhs.v.str);
+	    break;
+	default:
+	    return false;
+	}
+
+    ans->type = TYPE_INT;
+    switch (op) {
+    case OP_LT:
+	ans->v.num = (comparison < 0);
+	break;
+    case OP_LE:
+	ans->v.num = (comparison <= 0);
+	break;
+    case OP_GT:
+	ans->v.num = (comparison > 0);
+	break;
+    default:
+	ans->v.num = (comparison >= 0);
+	break;
+    }
+    return true;
+}
+
+/* Computes `lhs op rhs' the way run() would, returning false if that
+ * would raise an error (or might, depending on server options).
+ */
+static bool
+fold_binary(unsigned op, Var lhs, Var rhs, Var * ans)
+{
+    bool numeric = ((lhs.type == TYPE_INT || lhs.type == TYPE_FLOAT)
+		    && (rhs.type == TYPE_INT || rhs.type == TYPE_FLOAT));
+
+    switch (op) {
+    case OP_ADD:
+	if (numeric)
+	    *ans = do_add(lhs, rhs);
+	else if (lhs.type == TYPE_STR && rhs.type == TYPE_STR) {
+	    int llen = memo_strlen(lhs.v.str);
+	    int flen = llen + memo_strlen(rhs.v.str);
+	    char *str;
+
+	    if (flen > MIN_STRING_CONCAT_LIMIT)
+		return false;
+	    str = (char *) mymalloc(flen + 1, M_STRING);
+	    strcpy(str, lhs.v.str);
+	    strcpy(str + llen, rhs.v.str);
+	    ans->type = TYPE_STR;
+	    ans->v.str = str;
+	} else
+	    return false;
+	break;
+    case OP_MULT:
+    case OP_MINUS:
+    case OP_DIV:
+    case OP_MOD:
+	if (!numeric)
+	    return false;
+	/* The most negative integer divided by -1 traps on most machines;
+	 * the folder has no business finding out, so leave it to run(). */
+	if ((op == OP_DIV || op == OP_MOD)
+	    && rhs.type == TYPE_INT && rhs.v.num == -1)
+	    return false;
+	*ans = (op == OP_MULT ? do_multiply(lhs, rhs)
+		: op == OP_MINUS ? do_subtract(lhs, rhs)
+		: op == OP_DIV ? do_divide(lhs, rhs)
+		: do_modulus(lhs, rhs));
+	break;
+    case OP_EQ:
+    case OP_NE:
+	ans->type = TYPE_INT;
+	ans->v.num = (op == OP_EQ
+		      ? equality(rhs, lhs, 0)
+		      : !equality(rhs, lhs, 0));
+	break;
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+	return fold_comparison(op, lhs, rhs, ans);
+    case OP_IN:
+	ans->type = TYPE_INT;
+	if (lhs.type == TYPE_STR && rhs.type == TYPE_STR)
+	    ans->v.num = strindex(rhs.v.str, memo_strlen(rhs.v.str),
+				  lhs.v.str, memo_strlen(lhs.v.str), 0);
+	else if (rhs.type == TYPE_LIST)
+	    ans->v.num = ismember(lhs, rhs, 0);
+	else
+	    return false;
+	break;
+    case OP_LIST_ADD_TAIL:
+    case OP_LIST_APPEND:
+	if (lhs.type != TYPE_LIST
+	    || (op == OP_LIST_APPEND && rhs.type != TYPE_LIST))
+	    return false;
+	*ans = (op == OP_LIST_ADD_TAIL
+		? listappend(var_ref(lhs), var_ref(rhs))
+		: listconcat(var_ref(lhs), var_ref(rhs)));
+	if (value_bytes(*ans) > MIN_LIST_VALUE_BYTES_LIMIT) {
+	    free_var(*ans);
+	    return false;
+	}
+	break;
+    default:
+	return false;
+    }
+
+    return ans->type != TYPE_ERR;
+}
+
+static void
+fold_constants(opt_state * st)
+{
+    Bytecodes *bc = st->bc;
+    std::vector<constant> stack;
+    insn in;
+    unsigned pc, next;
+
+    for (pc = 0; pc < bc->size; pc = next) {
+	next = pc + decode(bc, pc, &in);
+
+	if (st->target[pc])
+	    flush_constants(st, stack, pc);
+
+	if (in.extended) {
+	    flush_constants(st, stack, pc);
+	    continue;
+	}
+
+	unsigned op = in.op;
+	size_t n = stack.size();
+	Var ans;
+
+	if (IS_OPTIM_NUM_OPCODE(op)) {
+	    stack.push_back({Var::new_int(OPCODE_TO_OPTIM_NUM(op)), pc, false});
+	    continue;
+	}
+
+	switch (op) {
+	case OP_IMM:
+	    {
+		unsigned slot = read_operand(bc->vector + pc + 1,
+					     bc->numbytes_literal);
+
+		stack.push_back({var_ref(st->prog->literals[slot]), pc, false});
+	    }
+	    break;
+
+	case OP_MAKE_EMPTY_LIST:
+	    stack.push_back({new_list(0), pc, false});
+	    break;
+
+	case OP_MAKE_SINGLETON_LIST:
+	    if (n < 1) {
+		flush_constants(st, stack, pc);
+		break;
+	    }
+	    ans = new_list(1);
+	    ans.v.list[1] = stack[n - 1].value;
+	    stack[n - 1].value = ans;
+	    stack[n - 1].folded = true;
+	    break;
+
+	case OP_CHECK_LIST_FOR_SPLICE:
+	    /* a no-op on a list; the code stays part of the constant's */
+	    if (n < 1 || stack[n - 1].value.type != TYPE_LIST)
+		flush_constants(st, stack, pc);
+	    break;
+
+	case OP_NOT:
+	case OP_UNARY_MINUS:
+	    if (n < 1)
+		ans.type = TYPE_NONE;
+	    else if (op == OP_NOT)
+		ans = Var::new_int(!is_true(stack[n - 1].value));
+	    else if (stack[n - 1].value.type == TYPE_INT)
+		ans = Var::new_int(-stack[n - 1].value.v.num);
+	    else if (stack[n - 1].value.type == TYPE_FLOAT)
+		ans = Var::new_float(-stack[n - 1].value.v.fnum);
+	    else
+		ans.type = TYPE_NONE;
+	    if (ans.type == TYPE_NONE) {
+		flush_constants(st, stack, pc);
+		break;
+	    }
+	    free_var(stack[n - 1].value);
+	    stack[n - 1].value = ans;
+	    stack[n - 1].folded = true;
+	    break;
+
+	case OP_ADD:
+	case OP_MULT:
+	case OP_MINUS:
+	case OP_DIV:
+	case OP_MOD:
+	case OP_EQ:
+	case OP_NE:
+	case OP_LT:
+	case OP_LE:
+	case OP_GT:
+	case OP_GE:
+	case OP_IN:
+	case OP_LIST_ADD_TAIL:
+	case OP_LIST_APPEND:
+	    if (n < 2
+		|| !fold_binary(op, stack[n - 2].value, stack[n - 1].value,
+				&ans)) {
+		flush_constants(st, stack, pc);
+		break;
+	    }
+	    free_var(stack[n - 1].value);
+	    free_var(stack[n - 2].value);
+	    stack.pop_back();
+	    stack[n - 2].value = ans;
+	    stack[n - 2].folded = true;
+	    break;
+
+	case OP_POP:
+	    if (n < 1 || !fill_padding(st, stack[n - 1].start, next)) {
+		flush_constants(st, stack, pc);
+		break;
+	    }
+	    free_var(stack[n - 1].value);
+	    stack.pop_back();
+	    break;
+
+	case OP_IF:
+	case OP_EIF:
+	case OP_IF_QUES:
+	    if (n < 1) {
+		flush_constants(st, stack, pc);
+		break;
+	    } else {
+		unsigned start = stack[n - 1].start;
+		unsigned label = read_operand(bc->vector + pc + 1,
+					      bc->numbytes_label);
+
+		if (is_true(stack[n - 1].value))
+		    fill_padding(st, start, next);
+		else {
+		    bc->vector[start] = OP_JUMP;
+		    write_operand(bc->vector + start + 1,
+				  bc->numbytes_label, label);
+		    st->pad[start] = 0;
+		    fill_dead(st, start + 1 + bc->numbytes_label, next);
+		}
+		free_var(stack[n - 1].value);
+		stack.pop_back();
+		flush_constants(st, stack, start);
+	    }
+	    break;
+
+	case OP_AND:
+	case OP_OR:
+	    if (n < 1) {
+		flush_constants(st, stack, pc);
+		break;
+	    } else if ((op == OP_AND) == !is_true(stack[n - 1].value)) {
+		/* short-circuits: the value stays and we always jump */
+		flush_constants(st, stack, pc);
+		bc->vector[pc] = OP_JUMP;
+	    } else {
+		unsigned start = stack[n - 1].start;
+
+		fill_padding(st, start, next);
+		free_var(stack[n - 1].value);
+		stack.pop_back();
+		flush_constants(st, stack, start);
+	    }
+	    break;
+
+	default:
+	    flush_constants(st, stack, pc);
+	    break;
+	}
+    }
+
+    flush_constants(st, stack, bc->size);
+}
+
+/* Turns the first instruction of each run of padding into a JUMP past the
+ * whole run, wherever there is room for one.  Runs are split at label
+ * targets so that no jump can land in the middle of the new JUMP.
+ */
+static void
+collapse_padding(opt_state * st)
+{
+    Bytecodes *bc = st->bc;
+    unsigned jump_len = 1 + bc->numbytes_label;
+    insn in;
+    unsigned pc = 0, end;
+
+    while (pc < bc->size) {
+	if (!st->pad[pc]) {
+	    pc += decode(bc, pc, &in);
+	    continue;
+	}
+
+	for (end = pc; end < bc->size && st->pad[end];)
+	    end += decode(bc, end, &in);
+
+	while (pc < end) {
+	    unsigned stop = pc + 1;
+
+	    while (stop < end && !st->target[stop])
+		stop++;
+	    if (stop - pc >= jump_len) {
+		fill_padding(st, pc, stop);
+		write_operand(bc->vector + pc + 1, bc->numbytes_label, end);
+	    }
+	    pc = stop;
+	}
+    }
+}
+
+static void
+thread_jumps(opt_state * st)
+{
+    Bytecodes *bc = st->bc;
+    insn in;
+    unsigned pc;
+
+    for (pc = 0; pc < bc->size; pc += in.length) {
+	decode(bc, pc, &in);
+	if (in.extended)
+	    continue;
+	switch (in.op) {
+	case OP_IF:
+	case OP_IF_QUES:
+	case OP_EIF:
+	case OP_AND:
+	case OP_OR:
+	case OP_JUMP:
+	case OP_WHILE:
+	    break;
+	default:
+	    continue;
+	}
+
+	Byte *operand = bc->vector + pc + 1;
+	unsigned label = read_operand(operand, bc->numbytes_label);
+	unsigned dest = label, steps = 0;
+
+	while (dest < bc->size && steps++ <= bc->size) {
+	    if (bc->vector[dest] == OP_JUMP)
+		dest = read_operand(bc->vector + dest + 1, bc->numbytes_label);
+	    else
+		break;
+	}
+	if (steps <= bc->size && dest != label)
+	    write_operand(operand, bc->numbytes_label, dest);
+    }
+}
+
+#ifdef BYTECODE_SUPERINSTRUCTIONS
+
+/* Decodes up to `max' instructions starting at `pc', stopping early at the
+ * end of the vector or at a label target.  Returns how many it decoded.
+ */
+static unsigned
+decode_sequence(const opt_state * st, unsigned pc, insn * ins, unsigned max)
+{
+    const Bytecodes *bc = st->bc;
+    unsigned n;
+
+    for (n = 0; n < max && pc < bc->size; n++) {
+	if (n > 0 && st->target[pc])
+	    break;
+	pc += decode(bc, pc, &ins[n]);
+    }
+    return n;
+}
+
+static bool
+is_plain(const insn & in, unsigned op)
+{
+    return !in.extended && in.op == op;
+}
+
+static bool
+is_test(const insn & in)
+{
+    return !in.extended && (in.op == OP_IF || in.op == OP_EIF
+			    || in.op == OP_WHILE || in.op == OP_IF_QUES);
+}
+
+/* Writes OP_SUPER `sop' and its `n' operand bytes at `v'. */
+static void
+emit_super(Byte * v, unsigned sop, const Byte * operands, unsigned n)
+{
+    v[0] = OP_SUPER;
+    v[1] = sop;
+    memcpy(v + 2, operands, n);
+}
+
+static void
+fuse_instructions(opt_state * st)
+{
+    Bytecodes *bc = st->bc;
+    insn ins[4];
+    unsigned pc, n, length;
+    Byte operands[16];
+
+    find_targets(st);
+    for (pc = 0; pc < bc->size; pc += length) {
+	Byte *v = bc->vector + pc;
+
+	n = decode_sequence(st, pc, ins, 4);
+	length = ins[0].length;
+
+	if (ins[0].extended || n < 2)
+	    continue;
+
+	if (IS_PUT_n(ins[0].op) && is_plain(ins[1], OP_POP)) {
+	    length = 2;
+	    emit_super(v, SOP_PUT_POP + PUT_n_INDEX(ins[0].op),
+		       operands, 0);
+	} else if (!IS_READY_PUSH(ins[0].op) || n < 3)
+	    continue;
+	else if (n == 4 && !ins[1].extended
+		 && (IS_OPTIM_NUM_OPCODE(ins[1].op) || ins[1].op == OP_IMM)
+		 && !ins[2].extended && ins[2].op >= OP_EQ
+		 && ins[2].op <= OP_GE && is_test(ins[3])) {
+	    /* <push> <num> <lab> */
+	    unsigned num = ins[1].length, lab = bc->numbytes_label;
+
+	    length = 1 + num + 1 + ins[3].length;
+	    operands[0] = v[0];
+	    memcpy(operands + 1, v + 1, num);
+	    memcpy(operands + 1 + num, v + length - lab, lab);
+	    emit_super(v, SOP_EQ_TEST + ins[2].op - OP_EQ,
+		       operands, 1 + num + lab);
+	} else if (is_plain(ins[1], OP_IMM) && is_plain(ins[2], OP_GET_PROP)) {
+	    /* <push> <lit> */
+	    length = 1 + ins[1].length + 1;
+	    operands[0] = v[0];
+	    memcpy(operands + 1, v + 2, bc->numbytes_literal);
+	    emit_super(v, SOP_GET_PROP,
+		       operands, 1 + bc->numbytes_literal);
+	} else if (!ins[1].extended && IS_READY_PUSH(ins[1].op)
+		   && is_plain(ins[2], OP_REF)) {
+	    /* <push> */
+	    length = 3;
+	    operands[0] = v[1];
+	    emit_super(v, SOP_REF + READY_PUSH_INDEX(ins[0].op),
+		       operands, 1);
+	}
+    }
+}
+
+#endif				/* BYTECODE_SUPERINSTRUCTIONS */
+
+static void
+optimize_vector(Program * prog, Bytecodes * bc)
+{
+    opt_state st;
+    Byte *original;
+
+    if (bc->size == 0)
+	return;
+
+    original = (Byte *) mymalloc(bc->size, M_BYTECODES);
+    memcpy(original, bc->vector, bc->size);
+
+    st.prog = prog;
+    st.bc = bc;
+    st.pad.assign(bc->size, 0);
+    find_targets(&st);
+
+    fold_constants(&st);
+    collapse_padding(&st);
+    thread_jumps(&st);
+#ifdef BYTECODE_SUPERINSTRUCTIONS
+    fuse_instructions(&st);
+#endif
+
+    if (memcmp(original, bc->vector, bc->size))
+	bc->unoptimized = original;
+    else
+	myfree(original, M_BYTECODES);
+}
+
+void
+optimize_program(Program * prog)
+{
+    unsigned i;
+
+    optimize_vector(prog, &prog->main_vector);
+    for (i = 0; i < prog->fork_vectors_size; i++)
+	optimize_vector(prog, &prog->fork_vectors[i]);
+}
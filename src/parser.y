@@ -43,15 +43,17 @@
 #include "utils.h"
 #include "version.h"
 
-static Stmt            *prog_start;
-static int              dollars_ok;
-static DB_Version       language_version;
+/* The parser's state is per thread, so that the database loader can
+ * compile verb programs on several threads at once.
+ */
+static thread_local Stmt        *prog_start;
+static thread_local int          dollars_ok;
+static thread_local DB_Version   language_version;
 
 static void     error(const char *, const char *);
 static void     warning(const char *, const char *);
 static int      find_id(char *name);
 static void     yyerror(const char *s);
-static int      yylex(void);
 static Scatter *scatter_from_arglist(Arg_List *);
 static Scatter *add_scatter_item(Scatter *, Scatter *);
 static void     vet_scatter(Scatter *);
@@ -65,6 +67,8 @@ enum loop_exit_kind { LOOP_BREAK, LOOP_CONTINUE };
 static void     check_loop_name(const char *, enum loop_exit_kind);
 %}
 
+%define api.pure full
+
 %union {
   Stmt         *stmt;
   Expr         *expr;
@@ -80,6 +84,10 @@ static void     check_loop_name(const char *, enum loop_exit_kind);
   Scatter      *scatter;
 }
 
+%{
+static int      yylex(YYSTYPE *);
+%}
+
 %type   <stmt>   statements statement elsepart
 %type   <arm>    elseifs
 %type   <expr>   expr default
@@ -777,10 +785,10 @@ scatter_item:
 
 %%
 
-static int              lineno, nerrors, must_rename_keywords;
-static Parser_Client    client;
-static void            *client_data;
-static Names           *local_names;
+static thread_local int              lineno, nerrors, must_rename_keywords;
+static thread_local Parser_Client    client;
+static thread_local void            *client_data;
+static thread_local Names           *local_names;
 
 static int
 find_id(char *name)
@@ -800,7 +808,7 @@ yyerror(const char *s)
 static const char *
 fmt_error(const char *s, const char *t)
 {
-    static Stream      *str = 0;
+    static thread_local Stream *str = 0;
 
     if (str == 0)
 	str = new_stream(100);
@@ -827,7 +835,7 @@ warning(const char *s, const char *t)
 	error(s, t);
 }
 
-static int unget_buffer[5], unget_count;
+static thread_local int unget_buffer[5], unget_count;
 
 static int
 lex_getc(void)
@@ -867,10 +875,10 @@ check_two_dots(void)     /* look ahead for .. but don't consume */
     return c1 == '.' && c2 == '.';
 }
 
-static Stream  *token_stream = 0;
+static thread_local Stream  *token_stream = 0;
 
 static int
-yylex(void)
+yylex(YYSTYPE *lvalp)
 {
     int c;
 
@@ -924,7 +932,7 @@ start_over:
 	} while (isdigit(c));
 	lex_ungetc(c);
 
-	yylval.object = negative ? -oid : oid;
+	lvalp->object = negative ? -oid : oid;
 	return tOBJECT;
     }
 
@@ -983,7 +991,7 @@ start_over:
 	lex_ungetc(c);
 
 	if (type == tINTEGER)
-	    yylval.integer = n;
+	    lvalp->integer = n;
 	else {
 	    double	d;
 	    
@@ -992,7 +1000,7 @@ start_over:
 		yyerror("Floating-point literal out of range");
 		d = 0.0;
 	    }
-	    yylval.real = d; 
+	    lvalp->real = d; 
 	}
 	return type;
     }
@@ -1013,7 +1021,7 @@ start_over:
 		int	t = k->token;
 
 		if (t == tERROR)
-		    yylval.error = k->error;
+		    lvalp->error = k->error;
 		return t;
 	    } else {  /* New keyword being used as an identifier */
 		if (!must_rename_keywords)
@@ -1022,7 +1030,7 @@ start_over:
 	    }
 	}
 	
-	yylval.string = alloc_string(buf);
+	lvalp->string = alloc_string(buf);
 	return tID;
     }
 
@@ -1039,7 +1047,7 @@ start_over:
 	    }
 	    stream_add_char(token_stream, c);
 	}
-	yylval.string = alloc_string(reset_stream(token_stream));
+	lvalp->string = alloc_string(reset_stream(token_stream));
 	return tSTRING;
     }
 
@@ -1124,7 +1132,7 @@ struct loop_entry {
     int                 is_barrier;
 };
 
-static struct loop_entry *loop_stack;
+static thread_local struct loop_entry *loop_stack;
 
 static void
 push_loop_name(const char *name)
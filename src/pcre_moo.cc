@@ -11,33 +11,152 @@
 #include "log.h"
 #include "server.h"
 #include "map.h"
+#include "storage.h"
 #include "dependencies/pcrs.h"
 #include "dependencies/xtrapbits.h"
 
-static struct pcre_cache_entry *
-get_pcre(const char *string, unsigned char options) {
+/* Compiled patterns are kept by (pattern, options), chained by hash and
+ * linked in order of use.  Once PCRE_CACHE_SIZE of them are kept, the least
+ * recently used one is dropped to make room.  Patterns that don't compile
+ * are kept too, so the error doesn't have to be found again.  Where PCRE
+ * supports it, patterns for pcre_match() are compiled to machine code.
+ */
+
+#define PCRE_CACHE_BUCKETS  (PCRE_CACHE_SIZE * 2 + 1)
+
+static pcre_cache_entry *pcre_table[PCRE_CACHE_BUCKETS];
+static pcre_cache_entry *pcre_newest, *pcre_oldest;
+static int pcre_cache_entries = 0;
+static Num pcre_cache_hits = 0, pcre_cache_misses = 0;
+static Num pcre_cache_evictions = 0;
+
+#ifdef PCRE_CONFIG_JIT
+static pcre_jit_stack *jit_stack = nullptr;
+#endif
+
+static void
+pcre_unlink(pcre_cache_entry *entry)
+{
+    if (entry->newer)
+        entry->newer->older = entry->older;
+    else
+        pcre_newest = entry->older;
+    if (entry->older)
+        entry->older->newer = entry->newer;
+    else
+        pcre_oldest = entry->newer;
+}
+
+static void
+pcre_link_newest(pcre_cache_entry *entry)
+{
+    entry->newer = nullptr;
+    entry->older = pcre_newest;
+    if (pcre_newest)
+        pcre_newest->newer = entry;
+    else
+        pcre_oldest = entry;
+    pcre_newest = entry;
+}
+
+static void
+pcre_cache_drop(pcre_cache_entry *entry)
+{
+    pcre_cache_entry **pp = &pcre_table[entry->hash % PCRE_CACHE_BUCKETS];
+
+    while (*pp != entry)
+        pp = &(*pp)->next;
+    *pp = entry->next;
+    pcre_unlink(entry);
+
+    pcre_cache_entries--;
+    free_entry(entry);
+}
+
+static void
+compile_pattern(pcre_cache_entry *entry)
+{
     const char *err;
     int eos; /* Error offset */
     char buf[256];
 
-    pcre_cache_entry *entry = (pcre_cache_entry*)malloc(sizeof(pcre_cache_entry));
-    entry->error = nullptr;
-    entry->re = nullptr;
-    entry->captures = 0;
-    entry->extra = nullptr;
-
-    entry->re = pcre_compile(string, options, &err, &eos, nullptr);
+    entry->re = pcre_compile(entry->string, entry->options, &err, &eos, nullptr);
     if (entry->re == nullptr) {
         sprintf(buf, "PCRE compile error at offset %d: %s", eos, err);
         entry->error = str_dup(buf);
     } else {
         const char *error = nullptr;
+#ifdef PCRE_CONFIG_JIT
+        entry->extra = pcre_study(entry->re, PCRE_STUDY_JIT_COMPILE, &error);
+        if (entry->extra != nullptr) {
+            /* The default 32K isn't enough for some patterns. */
+            if (jit_stack == nullptr)
+                jit_stack = pcre_jit_stack_alloc(32 * 1024, 1024 * 1024);
+            pcre_assign_jit_stack(entry->extra, nullptr, jit_stack);
+        }
+#else
         entry->extra = pcre_study(entry->re, 0, &error);
+#endif
         if (error != nullptr)
             entry->error = str_dup(error);
         else 
             (void)pcre_fullinfo(entry->re, nullptr, PCRE_INFO_CAPTURECOUNT, &(entry->captures));
     }
+}
+
+static void
+compile_substitution(pcre_cache_entry *entry)
+{
+    int err;
+    char buf[256];
+
+    entry->job = pcrs_compile_command(entry->string, &err);
+    if (entry->job == nullptr) {
+        sprintf(buf, "Compile error:  %s (%d)", pcrs_strerror(err), err);
+        entry->error = str_dup(buf);
+    }
+}
+
+static struct pcre_cache_entry *
+get_pcre(const char *string, unsigned char options, bool replace) {
+    unsigned hash = str_hash(string) * 31 + options * 2 + replace;
+    pcre_cache_entry *entry;
+
+    for (entry = pcre_table[hash % PCRE_CACHE_BUCKETS]; entry; entry = entry->next)
+        if (entry->hash == hash && entry->options == options
+            && entry->replace == replace && !strcmp(entry->string, string)) {
+            pcre_unlink(entry);
+            pcre_link_newest(entry);
+            pcre_cache_hits++;
+            return entry;
+        }
+
+    pcre_cache_misses++;
+    if (pcre_cache_entries >= PCRE_CACHE_SIZE) {
+        pcre_cache_drop(pcre_oldest);
+        pcre_cache_evictions++;
+    }
+
+    entry = (pcre_cache_entry*)mymalloc(sizeof(pcre_cache_entry), M_STRUCT);
+    entry->string = str_dup(string);
+    entry->options = options;
+    entry->replace = replace;
+    entry->hash = hash;
+    entry->error = nullptr;
+    entry->re = nullptr;
+    entry->captures = 0;
+    entry->extra = nullptr;
+    entry->job = nullptr;
+
+    if (replace)
+        compile_substitution(entry);
+    else
+        compile_pattern(entry);
+
+    entry->next = pcre_table[hash % PCRE_CACHE_BUCKETS];
+    pcre_table[hash % PCRE_CACHE_BUCKETS] = entry;
+    pcre_link_newest(entry);
+    pcre_cache_entries++;
 
     return entry;
 }
@@ -68,12 +187,11 @@ bf_pcre_match(Var arglist, Byte next, void *vdata, Objid progr) {
     }
 
     /* Compile the pattern */
-    struct pcre_cache_entry *entry = get_pcre(pattern, options);
+    struct pcre_cache_entry *entry = get_pcre(pattern, options, false);
 
     if (entry->error != nullptr)
     {
         package r = make_raise_pack(E_INVARG, entry->error, var_ref(zero));
-        free_entry(entry);
         free_var(arglist);
         return r;
     }
@@ -108,14 +226,12 @@ bf_pcre_match(Var arglist, Byte next, void *vdata, Objid progr) {
         if (rc < 0 && rc != PCRE_ERROR_NOMATCH)
         {
             /* We've encountered some funky error. Back out and let them know what it is. */
-            free_entry(entry);
             free_var(arglist);
             sprintf(err, "pcre_exec returned error: %d", rc);
             return make_raise_pack(E_INVARG, err, var_ref(zero));
         } else if (rc == 0) {
             /* We don't have enough room to store all of these substrings. */
             sprintf(err, "pcre_exec only has room for %d substrings", entry->captures);
-            free_entry(entry);
             free_var(arglist);
             return make_raise_pack(E_QUOTA, err, var_ref(zero));
         } else if (rc == PCRE_ERROR_NOMATCH) {
@@ -123,7 +239,6 @@ bf_pcre_match(Var arglist, Byte next, void *vdata, Objid progr) {
             break;
         } else if (loops >= total_loops) {
             /* The loop has iterated beyond the maximum limit, probably locking the server. Kill it. */
-            free_entry(entry);
             free_var(arglist);
             sprintf(err, "Too many iterations of matching loop: %d", loops);
             return make_raise_pack(E_MAXREC, err, var_ref(zero));
@@ -203,7 +318,6 @@ bf_pcre_match(Var arglist, Byte next, void *vdata, Objid progr) {
             break;
     }
 
-    free_entry(entry);
     free_var(arglist);
     return make_var_pack(ret);
 }
@@ -224,7 +338,11 @@ void free_entry(pcre_cache_entry *entry)
 #endif
     }
 
-    free(entry);
+    if (entry->job != nullptr)
+        pcrs_free_job(entry->job);
+
+    free_str(entry->string);
+    myfree(entry, M_STRUCT);
 }
 
 /* Create a two element list with the substring indices. */
@@ -245,16 +363,16 @@ bf_pcre_replace(Var arglist, Byte next, void *vdata, Objid progr) {
     const char *pattern = arglist.v.list[2].v.str;
 
     int err;
-    pcrs_job *job = pcrs_compile_command(pattern, &err);
+    struct pcre_cache_entry *entry = get_pcre(pattern, 0, true);
 
-    if (job == nullptr)
+    if (entry->error != nullptr)
     {
+        package r = make_raise_pack(E_INVARG, entry->error, var_ref(zero));
         free_var(arglist);
-        char error_msg[255];
-        sprintf(error_msg, "Compile error:  %s (%d)", pcrs_strerror(err), err);
-        return make_raise_pack(E_INVARG, error_msg, var_ref(zero));
+        return r;
     }
 
+    pcrs_job *job = entry->job;
     char *result;
     size_t length = memo_strlen(linebuf);
 
@@ -275,7 +393,6 @@ bf_pcre_replace(Var arglist, Byte next, void *vdata, Objid progr) {
         ret.v.str = str_dup(result);
 
         free_var(arglist);
-        pcrs_free_job(job);
         free(result);
 
         return make_var_pack(ret);
@@ -287,6 +404,38 @@ bf_pcre_replace(Var arglist, Byte next, void *vdata, Objid progr) {
     }
 }
 
+Var
+pcre_cache_stats(void)
+{
+    Num jit = 0;
+
+#ifdef PCRE_CONFIG_JIT
+    for (pcre_cache_entry *entry = pcre_newest; entry; entry = entry->older) {
+        int compiled = 0;
+
+        if (entry->re != nullptr && entry->extra != nullptr
+            && pcre_fullinfo(entry->re, entry->extra, PCRE_INFO_JIT, &compiled) == 0
+            && compiled)
+            jit++;
+    }
+#endif
+
+    Var r = new_map();
+
+#define PACK_STAT(name, value)                                  \
+    r = mapinsert(r, str_dup_to_var(#name), Var::new_int(value))
+
+    PACK_STAT(hits, pcre_cache_hits);
+    PACK_STAT(misses, pcre_cache_misses);
+    PACK_STAT(evictions, pcre_cache_evictions);
+    PACK_STAT(entries, pcre_cache_entries);
+    PACK_STAT(jit, jit);
+
+#undef PACK_STAT
+
+    return r;
+}
+
 void
 register_pcre() {
     oklog("REGISTER_PCRE: v%s (PCRE Library v%s)\n", EXT_PCRE_VERSION, pcre_version());
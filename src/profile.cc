@@ -0,0 +1,414 @@
+/******************************************************************************
+  Copyright (c) 1992, 1995, 1996 Xerox Corporation.  All rights reserved.
+  Portions of this code were written by Stephen White, aka ghond.
+  Use and copying of this software and preparation of derivative works based
+  upon this software are permitted.  Any distribution of this software or
+  derivative works must comply with all applicable United States export
+  control laws.  This software is made available AS IS, and Xerox Corporation
+  makes no warranty about the software, its performance or its conformity to
+  any specification.  Any person obtaining a copy of this software is requested
+  to send their name and post office or electronic mail address to:
+    Pavel Curtis
+    Xerox PARC
+    3333 Coyote Hill Rd.
+    Palo Alto, CA 94304
+    Pavel@Xerox.Com
+ *****************************************************************************/
+
+/* Per-verb profiler.
+ *
+ * While profiling, every call path seen on the activation stack gets a node
+ * in a tree: a root frame per task, a child for each verb it calls, and so
+ * on, with built-in functions as leaves.  Whenever the running activation
+ * changes, the ticks, wall-clock time and mymalloc() calls used since the
+ * last change are charged to the node that was running, so each node holds
+ * only its own costs, exclusive of its callees.  That is the shape
+ * flamegraph tools want from a collapsed-stack file.
+ *
+ * The VM tells us about changes through the hooks in profile.h; the node for
+ * each level of the running stack is kept in stack_nodes[] so a call or
+ * return costs one short search of a child list.  When a task stops running,
+ * stack_nodes[] is marked stale and rebuilt from the stack at the next hook,
+ * which copes with tasks that are started from inside other tasks and with
+ * profiling that starts in the middle of one.
+ */
+
+#include <chrono>
+#include <string.h>
+
+#include "bf_register.h"
+#include "db.h"
+#include "functions.h"
+#include "list.h"
+#include "profile.h"
+#include "storage.h"
+#include "streams.h"
+#include "utils.h"
+
+#define MAX_PROFILE_NODES	100000	/* new call paths past this are charged
+					 * to the caller */
+
+typedef struct prof_node prof_node;
+
+struct prof_node {
+    prof_node *parent;
+    prof_node *children;	/* most recently entered first */
+    prof_node *sibling;
+    bool builtin;
+    Objid vloc;			/* where the verb is defined */
+    const char *name;		/* the verb's names (a MOO string), or the
+				 * built-in function's name */
+    Num calls, ticks, allocations;
+    double seconds;
+};
+
+bool profiling = false;
+
+static prof_node root;
+static int node_count = 0;
+
+static prof_node **stack_nodes = nullptr;	/* for each level of the stack */
+static unsigned stack_nodes_size = 0;
+static bool stale = true;	/* stack_nodes[] needs rebuilding */
+
+static prof_node *current = nullptr;	/* being charged, if anything */
+static std::chrono::steady_clock::time_point mark_time;
+static int mark_ticks;
+static unsigned long mark_allocations;
+
+static void
+charge(int ticks)
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+    if (current) {
+	current->ticks += mark_ticks - ticks;
+	current->seconds += std::chrono::duration<double>(now - mark_time).count();
+	current->allocations += allocations_made - mark_allocations;
+    }
+    mark_time = now;
+    mark_ticks = ticks;
+    mark_allocations = allocations_made;
+}
+
+static prof_node *
+child_node(prof_node *parent, bool builtin, Objid vloc, const char *name)
+{
+    prof_node *n, **pp;
+
+    for (pp = &parent->children; (n = *pp); pp = &n->sibling)
+	if (n->builtin == builtin && n->vloc == vloc
+	    && (n->name == name || !strcmp(n->name, name))) {
+	    *pp = n->sibling;
+	    n->sibling = parent->children;
+	    parent->children = n;
+	    return n;
+	}
+
+    if (node_count >= MAX_PROFILE_NODES)
+	return parent;
+
+    n = (prof_node *)mymalloc(sizeof(prof_node), M_STRUCT);
+    n->parent = parent;
+    n->children = nullptr;
+    n->sibling = parent->children;
+    parent->children = n;
+    n->builtin = builtin;
+    n->vloc = vloc;
+    n->name = builtin ? name : str_ref(name);
+    n->calls = n->ticks = n->allocations = 0;
+    n->seconds = 0.0;
+    node_count++;
+
+    return n;
+}
+
+static prof_node *
+verb_node(activation *stack, unsigned i)
+{
+    activation *a = &stack[i];
+
+    return child_node(i == 0 ? &root : stack_nodes[i - 1], false,
+		      a->vloc.type == TYPE_OBJ ? a->vloc.v.obj : NOTHING,
+		      a->verbname);
+}
+
+static void
+rebuild(activation *stack, unsigned top)
+{
+    unsigned i;
+
+    if (top >= stack_nodes_size) {
+	stack_nodes_size = top + 16;
+	stack_nodes = (prof_node **)myrealloc(stack_nodes,
+					      stack_nodes_size * sizeof(prof_node *),
+					      M_STRUCT);
+    }
+    for (i = 0; i <= top; i++)
+	stack_nodes[i] = verb_node(stack, i);
+    stale = false;
+}
+
+void
+profile_resume(activation *stack, unsigned top, int ticks)
+{
+    charge(ticks);
+    rebuild(stack, top);
+    current = stack_nodes[top];
+    /* A new task's root activation hasn't run yet; a resumed one has. */
+    if (top == 0 && stack[0].pc == 0)
+	current->calls++;
+}
+
+void
+profile_pause(int ticks)
+{
+    charge(ticks);
+    current = nullptr;
+    stale = true;
+}
+
+void
+profile_enter(activation *stack, unsigned top, int ticks)
+{
+    charge(ticks);
+    if (stale)
+	rebuild(stack, top);
+    else {
+	if (top >= stack_nodes_size)
+	    rebuild(stack, top);
+	stack_nodes[top] = verb_node(stack, top);
+    }
+    current = stack_nodes[top];
+    current->calls++;
+}
+
+void
+profile_return(activation *stack, unsigned top, int ticks)
+{
+    charge(ticks);
+    if (stale)
+	rebuild(stack, top);
+    current = stack_nodes[top];
+}
+
+void
+profile_builtin(activation *stack, unsigned top, int ticks, unsigned func_id)
+{
+    charge(ticks);
+    if (stale)
+	rebuild(stack, top);
+    current = child_node(stack_nodes[top], true, NOTHING,
+			 name_func_by_num(func_id));
+    current->calls++;
+}
+
+static void
+free_nodes(prof_node *parent)
+{
+    prof_node *n, *next;
+
+    for (n = parent->children; n; n = next) {
+	next = n->sibling;
+	free_nodes(n);
+	if (!n->builtin)
+	    free_str(n->name);
+	myfree(n, M_STRUCT);
+    }
+    parent->children = nullptr;
+}
+
+static Var
+node_frame(prof_node *n)
+{
+    Var frame;
+
+    if (n->builtin)
+	return str_dup_to_var(n->name);
+
+    frame = new_list(2);
+    frame.v.list[1] = Var::new_obj(n->vloc);
+    frame.v.list[2] = str_ref_to_var(n->name);
+    return frame;
+}
+
+static Var
+node_stack(prof_node *n)
+{
+    Var r;
+    int depth = 0;
+    prof_node *p;
+
+    for (p = n; p != &root; p = p->parent)
+	depth++;
+    r = new_list(depth);
+    for (p = n; p != &root; p = p->parent)
+	r.v.list[depth--] = node_frame(p);
+
+    return r;
+}
+
+static Var
+profile_data(prof_node *parent, Var r)
+{
+    prof_node *n, *c;
+
+    for (n = parent->children; n; n = n->sibling) {
+	if (n->calls || n->ticks || n->seconds > 0.0) {
+	    Var entry = new_list(6);
+	    double builtin_seconds = 0.0;
+
+	    for (c = n->children; c; c = c->sibling)
+		if (c->builtin)
+		    builtin_seconds += c->seconds;
+
+	    entry.v.list[1] = node_stack(n);
+	    entry.v.list[2] = Var::new_int(n->calls);
+	    entry.v.list[3] = Var::new_int(n->ticks);
+	    entry.v.list[4] = Var::new_float(n->seconds);
+	    entry.v.list[5] = Var::new_float(builtin_seconds);
+	    entry.v.list[6] = Var::new_int(n->allocations);
+	    r = listappend(r, entry);
+	}
+	r = profile_data(n, r);
+    }
+
+    return r;
+}
+
+enum metric {
+    METRIC_TICKS, METRIC_USEC, METRIC_ALLOCATIONS, METRIC_CALLS
+};
+
+static void
+add_frames(Stream *s, prof_node *n)
+{
+    const char *c;
+
+    if (n->parent != &root) {
+	add_frames(s, n->parent);
+	stream_add_char(s, ';');
+    }
+    if (n->builtin)
+	stream_printf(s, "%s()", n->name);
+    else {
+	stream_printf(s, "#%" PRIdN ":", n->vloc);
+	/* `;' separates frames */
+	for (c = n->name; *c; c++)
+	    stream_add_char(s, *c == ';' ? ',' : *c);
+    }
+}
+
+static Var
+collapsed_stacks(prof_node *parent, enum metric m, Stream *s, Var r)
+{
+    prof_node *n;
+    Num value;
+
+    for (n = parent->children; n; n = n->sibling) {
+	switch (m) {
+	case METRIC_TICKS:
+	    value = n->ticks;
+	    break;
+	case METRIC_USEC:
+	    value = (Num) (n->seconds * 1000000.0);
+	    break;
+	case METRIC_ALLOCATIONS:
+	    value = n->allocations;
+	    break;
+	case METRIC_CALLS:
+	default:
+	    value = n->calls;
+	    break;
+	}
+	if (value > 0) {
+	    add_frames(s, n);
+	    stream_printf(s, " %" PRIdN, value);
+	    r = listappend(r, str_dup_to_var(reset_stream(s)));
+	}
+	r = collapsed_stacks(n, m, s, r);
+    }
+
+    return r;
+}
+
+static package
+bf_start_profiler(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+	return make_error_pack(E_PERM);
+
+    free_nodes(&root);
+    node_count = 0;
+    current = nullptr;
+    stale = true;
+    profiling = true;
+
+    return no_var_pack();
+}
+
+static package
+bf_stop_profiler(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    free_var(arglist);
+
+    if (!is_wizard(progr))
+	return make_error_pack(E_PERM);
+
+    profiling = false;
+    current = nullptr;
+    stale = true;
+
+    return no_var_pack();
+}
+
+/* With no arguments, a list of records; given a metric, the lines of a
+ * collapsed-stack file. */
+static package
+bf_profiler_data(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    enum metric m;
+    Stream *s;
+    Var r;
+
+    if (!is_wizard(progr)) {
+	free_var(arglist);
+	return make_error_pack(E_PERM);
+    }
+    if (arglist.v.list[0].v.num == 0) {
+	free_var(arglist);
+	return make_var_pack(profile_data(&root, new_list(0)));
+    }
+
+    const char *name = arglist.v.list[1].v.str;
+
+    if (!strcasecmp(name, "ticks"))
+	m = METRIC_TICKS;
+    else if (!strcasecmp(name, "usec"))
+	m = METRIC_USEC;
+    else if (!strcasecmp(name, "allocations"))
+	m = METRIC_ALLOCATIONS;
+    else if (!strcasecmp(name, "calls"))
+	m = METRIC_CALLS;
+    else {
+	free_var(arglist);
+	return make_error_pack(E_INVARG);
+    }
+    free_var(arglist);
+
+    s = new_stream(100);
+    r = collapsed_stacks(&root, m, s, new_list(0));
+    free_stream(s);
+
+    return make_var_pack(r);
+}
+
+void
+register_profile(void)
+{
+    register_function("start_profiler", 0, 0, bf_start_profiler);
+    register_function("stop_profiler", 0, 0, bf_stop_profiler);
+    register_function("profiler_data", 0, 1, bf_profiler_data, TYPE_STR);
+}
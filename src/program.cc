@@ -69,13 +69,16 @@ program_bytes(Program * p)
 
     count = sizeof(Program);
     count += p->main_vector.size;
+    if (p->main_vector.unoptimized)
+	count += p->main_vector.size;
 
     for (i = 0; i < p->num_literals; i++)
 	count += value_bytes(p->literals[i]);
 
     count += sizeof(Bytecodes) * p->fork_vectors_size;
     for (i = 0; i < p->fork_vectors_size; i++)
-	count += p->fork_vectors[i].size;
+	count += p->fork_vectors[i].size
+	    * (p->fork_vectors[i].unoptimized ? 2 : 1);
 
     count += sizeof(const char *) * p->num_var_names;
     for (i = 0; i < p->num_var_names; i++)
@@ -93,13 +96,16 @@ free_program(Program * p)
     if (p->ref_count == 0) {
 
 	for (i = 0; i < p->num_literals; i++)
-	    /* can't be a list--strings and floats need to be freed, though. */
+	    /* strings, floats and (folded by the optimizer) lists */
 	    free_var(p->literals[i]);
 	if (p->literals)
 	    myfree(p->literals, M_LIT_LIST);
 
-	for (i = 0; i < p->fork_vectors_size; i++)
+	for (i = 0; i < p->fork_vectors_size; i++) {
 	    myfree(p->fork_vectors[i].vector, M_BYTECODES);
+	    if (p->fork_vectors[i].unoptimized)
+		myfree(p->fork_vectors[i].unoptimized, M_BYTECODES);
+	}
 	if (p->fork_vectors_size)
 	    myfree(p->fork_vectors, M_FORK_VECTORS);
 
@@ -108,6 +114,8 @@ free_program(Program * p)
 	myfree(p->var_names, M_NAMES);
 
 	myfree(p->main_vector.vector, M_BYTECODES);
+	if (p->main_vector.unoptimized)
+	    myfree(p->main_vector.unoptimized, M_BYTECODES);
 
 	myfree(p, M_PROGRAM);
     }
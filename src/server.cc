@@ -29,6 +29,7 @@
 #include <sys/sysctl.h>
 #endif
 
+#include <chrono>
 #include <string>
 #include <sstream>
 #include <fstream>
@@ -54,6 +55,7 @@
 #include "garbage.h"
 #include "list.h"
 #include "log.h"
+#include "loop_stats.h"
 #include "map.h"
 #include <nettle/sha2.h>
 #include "network.h"
@@ -77,6 +79,7 @@
 #include "background.h"
 #include "map.h"
 #include "ansi24.h"
+#include "ansi_tags.h"
 
 extern "C" {
 #include "dependencies/linenoise.h"
@@ -117,6 +120,11 @@ typedef struct shandle {
     Objid switched;
     int outbound, binary;
     int print_messages;
+    bool awaiting_output;	/* input arrived at input_time and nothing
+				 * has been sent since */
+    std::chrono::steady_clock::time_point input_time;
+    Num responses;
+    double response_seconds, max_response_seconds;
 } shandle;
 
 static shandle *all_shandles = nullptr;
@@ -124,10 +132,11 @@ static shandle *all_shandles = nullptr;
 typedef struct slistener {
     struct slistener *next, **prev;
     network_listener nlistener;
-    Objid oid;			/* listen(OID, DESC, PRINT_MESSAGES, IPV6) */
+    Objid oid;			/* listen(OID, DESC, PRINT_MESSAGES, IPV6, MODE) */
     Var desc;
     int print_messages;
     bool ipv6;
+    listen_mode mode;
     const char *name;           // resolved hostname
     const char *ip_addr;        // 'raw' IP address
     uint16_t port;             // listening port
@@ -163,7 +172,8 @@ free_shandle(shandle * h)
 }
 
 static slistener *
-new_slistener(Objid oid, Var desc, int print_messages, enum error *ee, bool use_ipv6)
+new_slistener(Objid oid, Var desc, int print_messages, enum error *ee, bool use_ipv6,
+	      listen_mode mode)
 {
     slistener *listener = (slistener *)mymalloc(sizeof(slistener), M_NETWORK);
     server_listener sl;
@@ -172,7 +182,7 @@ new_slistener(Objid oid, Var desc, int print_messages, enum error *ee, bool use_
     uint16_t port;
 
     sl.ptr = listener;
-    e = network_make_listener(sl, desc, &(listener->nlistener), &name, &ip_address, &port, use_ipv6);
+    e = network_make_listener(sl, desc, &(listener->nlistener), &name, &ip_address, &port, use_ipv6, mode);
 
     if (ee)
         *ee = e;
@@ -186,6 +196,7 @@ new_slistener(Objid oid, Var desc, int print_messages, enum error *ee, bool use_
     listener->print_messages = print_messages;
     listener->name = name;                      // original copy
     listener->ipv6 = use_ipv6;
+    listener->mode = mode;
     listener->ip_addr = ip_address;             // original copy
     listener->port = port;
     listener->desc = var_ref(desc);
@@ -506,6 +517,22 @@ send_message(Objid listener, network_handle nh, const char *msg_name,...)
     va_end(args);
 }
 
+static void
+note_output(shandle * h)
+{
+    if (h->awaiting_output) {
+	double seconds = std::chrono::duration<double>(
+			    std::chrono::steady_clock::now() - h->input_time).count();
+
+	h->awaiting_output = false;
+	h->responses++;
+	h->response_seconds += seconds;
+	if (seconds > h->max_response_seconds)
+	    h->max_response_seconds = seconds;
+	loop_stats_response(seconds);
+    }
+}
+
 /* Queue an anonymous object for eventual recycling.  This is the
  * entry-point for anonymous objects that lose all references (see
  * utils.c), and for anonymous objects that the garbage collector
@@ -718,6 +745,8 @@ main_loop(void)
 	int useconds_left = task_useconds < 0 ? 1000000 : task_useconds;
 	shandle *h, *nexth;
 
+	loop_stats_begin_pass();
+
 #ifdef ENABLE_GC
 	if (gc_run_called || gc_roots_count > GC_ROOTS_LIMIT
 	    || checkpoint_requested != CHKPT_OFF)
@@ -740,6 +769,7 @@ main_loop(void)
         }
     }
 
+	loop_stats_phase(LOOP_CHECKPOINT);
 	if (checkpoint_requested != CHKPT_OFF) {
 	    if (checkpoint_requested == CHKPT_SIGNAL)
 		oklog("CHECKPOINTING due to remote request signal.\n");
@@ -748,30 +778,42 @@ main_loop(void)
 			    new_list(0), "", nullptr);
 	    network_process_io(0);
 #ifdef UNFORKED_CHECKPOINTS
-	    call_checkpoint_notifier(db_flush(FLUSH_ALL_NOW));
+	    call_checkpoint_notifier(db_flush(FLUSH_ALL_NOW) != 0);
 #else
-	    if (!db_flush(FLUSH_ALL_NOW))
+	    switch (db_flush(FLUSH_ALL_NOW)) {
+	    case 0:
 		call_checkpoint_notifier(0);
+		break;
+	    case DB_FLUSH_FINISHED:
+		call_checkpoint_notifier(1);
+		break;
+	    }
 #endif
 	    set_checkpoint_timer(0);
 	}
 #ifndef UNFORKED_CHECKPOINTS
 	if (checkpoint_finished) {
+	    db_checkpoint_finished(checkpoint_finished - 1);
 	    call_checkpoint_notifier(checkpoint_finished - 1);
 	    checkpoint_finished = 0;
 	}
 #endif
 
+	loop_stats_phase(LOOP_RECYCLE);
 	recycle_anonymous_objects();
     recycle_waifs();
 
+	loop_stats_phase(LOOP_NETWORK);
 	network_process_io(useconds_left);
 
+	loop_stats_phase(LOOP_TASKS);
 	run_ready_tasks();
 
 	/* If a exec'd child process exited, deal with it here */
+	loop_stats_phase(LOOP_CHILDREN);
 	deal_with_child_exit();
 
+	loop_stats_phase(LOOP_CONNECTIONS);
 	{			/* Get rid of old un-logged-in or useless connections */
 	    int now = time(nullptr);
 
@@ -825,6 +867,9 @@ main_loop(void)
         }
 	    }
 	}
+
+	loop_stats_phase(LOOP_LOG);
+	db_log_changes();
     }
 
     applog(LOG_WARNING, "SHUTDOWN: %s\n", shutdown_message.str().c_str());
@@ -1384,9 +1429,17 @@ server_new_connection(server_listener sl, network_handle nh, int outbound)
     h->disconnect_me = 0;
     h->outbound = outbound;
     h->binary = 0;
-    h->print_messages = l ? l->print_messages : !outbound;
-
-    if (l || !outbound) {
+    h->print_messages = (l ? l->print_messages && l->mode != LISTEN_HTTP
+			 : !outbound);
+    h->awaiting_output = false;
+    h->responses = 0;
+    h->response_seconds = h->max_response_seconds = 0.0;
+
+    /* HTTP connections never log in; their requests go straight to
+     * the listener's do_http_request verb.  WebSocket connections get
+     * their first line from the network once the handshake is done.
+     */
+    if (l ? l->mode == LISTEN_LINES : !outbound) {
 	new_input_task(h->tasks, "", 0, 0);
 	/*
 	 * Suspend input at the network level until the above input task
@@ -1432,9 +1485,26 @@ server_receive_line(server_handle sh, const char *line, bool out_of_band)
     shandle *h = (shandle *) sh.ptr;
 
     h->last_activity_time = time(nullptr);
+    if (!h->awaiting_output) {
+	h->awaiting_output = true;
+	h->input_time = std::chrono::steady_clock::now();
+    }
     new_input_task(h->tasks, line, h->binary, out_of_band);
 }
 
+void
+server_receive_http_request(server_handle sh, Var request, bool keep_alive)
+{
+    shandle *h = (shandle *) sh.ptr;
+
+    h->last_activity_time = time(nullptr);
+    if (!h->awaiting_output) {
+	h->awaiting_output = true;
+	h->input_time = std::chrono::steady_clock::now();
+    }
+    new_http_task(h->tasks, request, keep_alive);
+}
+
 void
 server_close(server_handle sh)
 {
@@ -1578,9 +1648,11 @@ player_connected(Objid old_id, Objid new_id, int is_newly_created)
 	    send_message(existing_listener, existing_h->nhandle,
 			 "redirect_from_msg",
 			 "*** Redirecting connection to new port ***", 0);
-	if (new_h->print_messages)
+	if (new_h->print_messages) {
+	    note_output(new_h);
 	    send_message(new_h->listener, new_h->nhandle, "redirect_to_msg",
 			 "*** Redirecting old connection to this port ***", 0);
+	}
 	network_close(existing_h->nhandle);
 	free_shandle(existing_h);
 	if (existing_listener == new_h->listener)
@@ -1600,6 +1672,7 @@ player_connected(Objid old_id, Objid new_id, int is_newly_created)
 	      full_conn_name);
           free(full_conn_name);
 	if (new_h->print_messages) {
+	    note_output(new_h);
 	    if (is_newly_created)
 		send_message(new_h->listener, new_h->nhandle, "create_msg",
 			     "*** Created ***", 0);
@@ -1619,17 +1692,157 @@ is_player_connected(Objid player)
     return !h || h->disconnect_me ? 0 : 1;
 }
 
+Var
+connection_response_times(void)
+{
+    shandle *h;
+    Var r = new_map();
+
+    for (h = all_shandles; h; h = h->next)
+	if (h->responses > 0) {
+	    Var v = new_list(3);
+
+	    v.v.list[1] = Var::new_int(h->responses);
+	    v.v.list[2] = Var::new_float(h->response_seconds);
+	    v.v.list[3] = Var::new_float(h->max_response_seconds);
+	    r = mapinsert(r, Var::new_obj(h->player), v);
+	}
+
+    return r;
+}
+
 void
 notify(Objid player, const char *message)
 {
     shandle *h = find_shandle(player);
 
-    if (h && !h->disconnect_me)
+    if (h && !h->disconnect_me) {
+	note_output(h);
 	network_send_line(h->nhandle, message, 1, 1);
+    }
     else if (in_emergency_mode)
 	emergency_notify(player, message);
 }
 
+static const char *
+http_reason(int status)
+{
+    switch (status) {
+    case 200:	return "OK";
+    case 201:	return "Created";
+    case 204:	return "No Content";
+    case 301:	return "Moved Permanently";
+    case 302:	return "Found";
+    case 303:	return "See Other";
+    case 304:	return "Not Modified";
+    case 400:	return "Bad Request";
+    case 401:	return "Unauthorized";
+    case 403:	return "Forbidden";
+    case 404:	return "Not Found";
+    case 405:	return "Method Not Allowed";
+    case 500:	return "Internal Server Error";
+    case 503:	return "Service Unavailable";
+    default:	return "Status";
+    }
+}
+
+struct http_header_state {
+    Stream *s;
+    bool has_length;
+    bool has_connection;
+    bool close;
+};
+
+static int
+add_http_header(Var name, Var value, void *data, int first)
+{
+    struct http_header_state *hs = (struct http_header_state *)data;
+
+    /* Anything that could split the response is dropped. */
+    if (name.type != TYPE_STR || value.type != TYPE_STR
+	|| !*name.v.str || strpbrk(name.v.str, "\r\n:")
+	|| strpbrk(value.v.str, "\r\n"))
+	return 0;
+
+    if (!strcasecmp(name.v.str, "Content-Length"))
+	hs->has_length = true;
+    else if (!strcasecmp(name.v.str, "Connection")) {
+	hs->has_connection = true;
+	if (!strcasecmp(value.v.str, "close"))
+	    hs->close = true;
+    }
+    stream_printf(hs->s, "%s: %s\r\n", name.v.str, value.v.str);
+    return 0;
+}
+
+void
+send_http_response(Objid connection, Var response, bool keep_alive)
+{
+    static const Var STATUS = str_dup_to_var("status");
+    static const Var HEADERS = str_dup_to_var("headers");
+    static const Var BODY = str_dup_to_var("body");
+
+    shandle *h = find_shandle(connection);
+    Num status = 500;
+    Var headers, v;
+    const char *body = "";
+    struct http_header_state hs;
+
+    if (!h || h->disconnect_me)
+	return;
+
+    headers.type = TYPE_NONE;
+    if (response.type == TYPE_STR) {
+	status = 200;
+	body = response.v.str;
+    } else if (response.type == TYPE_INT)
+	status = response.v.num;
+    else if (response.type == TYPE_MAP) {
+	status = 200;
+	if (maplookup(response, STATUS, &v, 0))
+	    status = v.type == TYPE_INT ? v.v.num : 500;
+	if (maplookup(response, HEADERS, &v, 0))
+	    headers = v;
+	if (maplookup(response, BODY, &v, 0)) {
+	    if (v.type == TYPE_STR)
+		body = v.v.str;
+	    else
+		status = 500;
+	}
+    }
+    if (status < 100 || status > 999) {
+	status = 500;
+	headers.type = TYPE_NONE;
+	body = "";
+    }
+
+    hs.s = new_stream(256);
+    hs.has_length = hs.has_connection = hs.close = false;
+    stream_printf(hs.s, "HTTP/1.1 %d %s\r\n", (int)status, http_reason(status));
+    if (headers.type == TYPE_MAP)
+	mapforeach(headers, add_http_header, &hs);
+    else if (headers.type == TYPE_LIST) {	/* {{name, value}, ...} */
+	for (int i = 1; i <= headers.v.list[0].v.num; i++) {
+	    Var pair = headers.v.list[i];
+
+	    if (pair.type == TYPE_LIST && pair.v.list[0].v.num == 2)
+		add_http_header(pair.v.list[1], pair.v.list[2], &hs, 0);
+	}
+    }
+    if (!hs.has_length && status >= 200 && status != 204 && status != 304)
+	stream_printf(hs.s, "Content-Length: %d\r\n", *body ? (int)memo_strlen(body) : 0);
+    if (hs.close)
+	keep_alive = false;
+    else if (!keep_alive && !hs.has_connection)
+	stream_add_string(hs.s, "Connection: close\r\n");
+    stream_add_string(hs.s, "\r\n");
+
+    note_output(h);
+    network_send_http_response(h->nhandle, stream_contents(hs.s), stream_length(hs.s),
+			       body, !keep_alive);
+    free_stream(hs.s);
+}
+
 void
 boot_player(Objid player)
 {
@@ -1660,6 +1873,9 @@ read_active_connections(void)
     int count, i, have_listeners = 0;
     char c;
 
+    /* A checkpoint delta replaces the list read from the database. */
+    free_var(checkpointed_connections);
+
     i = dbio_scanf("%d active connections%c", &count, &c);
     if (i == EOF) {		/* older database format */
 	checkpointed_connections = new_list(0);
@@ -1780,6 +1996,14 @@ main(int argc, char **argv)
 	case 'm':		/* clear last move */
         clear_last_move = true;
 	    break;
+	case 's':		/* Specified statistics file */
+	    if (argc > 1) {
+		loop_stats_set_file(argv[1]);
+		argc--;
+		argv++;
+	    } else
+		argc = 0;
+	    break;
     default:
 	    argc = 0;		/* Provoke usage message below */
 	}
@@ -1810,7 +2034,7 @@ main(int argc, char **argv)
     if ((emergency && (script_file || script_line))
 	|| !db_initialize(&argc, &argv)
 	|| !network_initialize(argc, argv, &desc)) {
-	fprintf(stderr, "Usage: %s [-e] [-f script-file] [-c script-line] [-l log-file] [-m] [-w waif-type] %s %s\n",
+	fprintf(stderr, "Usage: %s [-e] [-f script-file] [-c script-line] [-l log-file] [-m] [-s stats-file] [-w waif-type] %s %s\n",
 		this_program, db_usage_string(), network_usage_string());
 	fprintf(stderr, "Options:\n");
     fprintf(stderr, "\t-v\t\tcurrent version\n");
@@ -1819,6 +2043,7 @@ main(int argc, char **argv)
 	fprintf(stderr, "\t-c\t\tline to pass to `#0:do_start_script()'\n");
 	fprintf(stderr, "\t-l\t\toptional log file\n");
     fprintf(stderr, "\t-m\t\tclear the last_move builtin property on all objects\n");
+    fprintf(stderr, "\t-s\t\tfile to write main loop statistics to every %d seconds\n", LOOP_STATS_INTERVAL);
     fprintf(stderr, "\t-w\t\tconvert waifs from the specified type to the proper type (check with typeof(waif) in your MOO)\n\n");
 	fprintf(stderr, "The emergency mode switch (-e) may not be used with either the file (-f) or line (-c) options.\n\n");
 	fprintf(stderr, "Both the file and line options may be specified. Their order on the command line determines the order of their invocation.\n\n");
@@ -1847,10 +2072,10 @@ main(int argc, char **argv)
     register_bi_functions();
 
     // Listen on both IPv4 and IPv6
-    if ((lv4 = new_slistener(SYSTEM_OBJECT, desc, 1, nullptr, false)) == nullptr)
+    if ((lv4 = new_slistener(SYSTEM_OBJECT, desc, 1, nullptr, false, LISTEN_LINES)) == nullptr)
         errlog("Error creating IPv4 listener.\n");
 
-    if ((lv6 = new_slistener(SYSTEM_OBJECT, desc, 1, nullptr, true)) == nullptr)
+    if ((lv6 = new_slistener(SYSTEM_OBJECT, desc, 1, nullptr, true, LISTEN_LINES)) == nullptr)
         errlog("Error creating IPv6 listener.\n");
         
     if (!lv4 && !lv6) {
@@ -2383,18 +2608,19 @@ notify_and_msg_implementation(Var arglist, Byte next, void *vdata, Objid progr,
 	return make_error_pack(E_PERM);
     }
 
-    size_t size       = strlen(line) * 2 + 1;   // esc sequences can be longer than tags
-    char *replacement = (char *) mymalloc((uint) size, M_STRING);
+    char *replacement;
     if (is_msg) {
-        replace_color_tags_with_ansi(replacement, size, line);
-    }
-    else {
-        strncpy(replacement, line, size);
-        replacement[size - 1] = 0;
+        Stream *s = new_stream(strlen(line) * 2 + 1);   // esc sequences can be longer than tags
+        translate_color_tags(s, line, false);
+        replacement = str_dup(stream_contents(s));
+        free_stream(s);
     }
+    else
+        replacement = str_dup(line);
 
     r.type = TYPE_INT;
     if (h && !h->disconnect_me) {
+	note_output(h);
 	if (h->binary) {
 	    int length;
 
@@ -2556,20 +2782,30 @@ find_slistener(Var desc, bool use_ipv6)
 
 static package
 bf_listen(Var arglist, Byte next, void *vdata, Objid progr)
-{				/* (oid, desc) */
+{				/* (oid, desc [, print_messages, ipv6, mode]) */
     Objid oid = arglist.v.list[1].v.obj;
     Var desc = arglist.v.list[2];
     int nargs = arglist.v.list[0].v.num;
     int print_messages = nargs >= 3 && is_true(arglist.v.list[3]);
     bool ipv6 = nargs >= 4 && is_true(arglist.v.list[4]);
+    listen_mode mode = LISTEN_LINES;
     enum error e;
     slistener *l = nullptr;
 
+    if (nargs >= 5) {
+	Var m = arglist.v.list[5];
+
+	if (m.type == TYPE_STR && !strcasecmp(m.v.str, "websocket"))
+	    mode = LISTEN_WEBSOCKET;
+	else if (is_true(m))
+	    mode = LISTEN_HTTP;
+    }
+
     if (!is_wizard(progr))
 	e = E_PERM;
     else if (!valid(oid) || find_slistener(desc, ipv6))
 	e = E_INVARG;
-    else if (!(l = new_slistener(oid, desc, print_messages, &e, ipv6)));	/* Do nothing; e is already set */
+    else if (!(l = new_slistener(oid, desc, print_messages, &e, ipv6, mode)));	/* Do nothing; e is already set */
     else if (!start_listener(l))
 	e = E_QUOTA;
 
@@ -2615,6 +2851,8 @@ bf_listeners(Var arglist, Byte next, void *vdata, Objid progr)
     static const Var port = str_dup_to_var("port");
     static const Var print = str_dup_to_var("print_messages");
     static const Var ipv6 = str_dup_to_var("ipv6");
+    static const Var http = str_dup_to_var("http");
+    static const Var websocket = str_dup_to_var("websocket");
 
     for (l = all_slisteners; l; l = l->next) {
     if (!find_listener || equality(find, (find.type == TYPE_OBJ) ? Var::new_obj(l->oid) : l->desc, 0)) {
@@ -2623,6 +2861,8 @@ bf_listeners(Var arglist, Byte next, void *vdata, Objid progr)
 	entry = mapinsert(entry, var_ref(port), var_ref(l->desc));
 	entry = mapinsert(entry, var_ref(print), Var::new_int(l->print_messages));
 	entry = mapinsert(entry, var_ref(ipv6), Var::new_int(l->ipv6));
+	entry = mapinsert(entry, var_ref(http), Var::new_int(l->mode == LISTEN_HTTP));
+	entry = mapinsert(entry, var_ref(websocket), Var::new_int(l->mode == LISTEN_WEBSOCKET));
 	list = listappend(list, entry);
     }
     }
@@ -2704,7 +2944,7 @@ register_server(void)
 		      TYPE_OBJ, TYPE_STR);
     register_function("connection_info", 1, 1, bf_connection_info, TYPE_OBJ);
     register_function("connection_name_lookup", 1, 2, bf_name_lookup, TYPE_OBJ, TYPE_ANY);
-    register_function("listen", 2, 4, bf_listen, TYPE_OBJ, TYPE_ANY, TYPE_ANY, TYPE_ANY);
+    register_function("listen", 2, 5, bf_listen, TYPE_OBJ, TYPE_ANY, TYPE_ANY, TYPE_ANY, TYPE_ANY);
     register_function("unlisten", 1, 2, bf_unlisten, TYPE_ANY, TYPE_ANY);
     register_function("listeners", 0, 1, bf_listeners, TYPE_ANY);
     register_function("buffered_output_length", 0, 1,
@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "collection.h"
 #include "config.h"
 #include "list.h"
 #include "options.h"
@@ -27,6 +28,7 @@
 #include "utils.h"
 
 static unsigned alloc_num[Sizeof_Memory_Type];
+unsigned long allocations_made = 0;
 
 static inline int
 refcount_overhead(Memory_Type type)
@@ -38,11 +40,7 @@ refcount_overhead(Memory_Type type)
     switch (type) {
     /* deal with systems with picky alignment issues */
     case M_LIST:
-#ifdef MEMO_VALUE_BYTES
-	return MAX(sizeof(int), sizeof(Var *)) * 2;
-#else
-	return MAX(sizeof(int), sizeof(Var *));
-#endif /* MEMO_VALUE_BYTES */
+	return LIST_REFCOUNT_OVERHEAD;
     case M_TREE:
 #ifdef MEMO_VALUE_BYTES
 	return MAX(sizeof(int), sizeof(rbtree *)) * 2;
@@ -83,6 +81,8 @@ mymalloc(unsigned size, Memory_Type type)
 	panic_moo(msg);
     }
     alloc_num[type]++;
+    if (!in_background_thread)
+	allocations_made++;
 
     if (offs) {
 	memptr += offs;
@@ -101,6 +101,8 @@ mymalloc(unsigned size, Memory_Type type)
 	if (type == M_TREE)
 	    ((int *) memptr)[-2] = 0;
 #endif /* MEMO_VALUE_BYTES */
+	if (type == M_LIST)
+	    *list_index_slot(memptr) = nullptr;
     }
     return memptr;
 }
@@ -117,7 +119,7 @@ str_dup(const char *s)
 {
     char *r;
 
-    if (s == nullptr || *s == '\0') {
+    if ((s == nullptr || *s == '\0') && !in_background_thread) {
 	static char *emptystring;
 
 	if (!emptystring) {
@@ -127,12 +129,28 @@ str_dup(const char *s)
 	addref(emptystring);
 	return emptystring;
     } else {
+	s = s ? s : "";
 	r = (char *) mymalloc(strlen(s) + 1, M_STRING);	/* NO MEMO HERE */
 	strcpy(r, s);
     }
     return r;
 }
 
+/* A copy of the LEN characters at S, which needn't be followed by a null. */
+char *
+str_dup(const char *s, size_t len)
+{
+    char *r;
+
+    if (len == 0)
+	return str_dup("");
+    r = (char *) mymalloc(len + 1, M_STRING);
+    memcpy(r, s, len);
+    r[len] = '\0';
+
+    return r;
+}
+
 void *
 myrealloc(void *ptr, unsigned size, Memory_Type type)
 {
@@ -153,6 +171,9 @@ myfree(void *ptr, Memory_Type type)
 {
     alloc_num[type]--;
 
+    if (type == M_LIST)
+	free_list_index(ptr);
+
     free((char *) ptr - refcount_overhead(type));
 }
 
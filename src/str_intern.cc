@@ -152,14 +152,14 @@ str_intern_close(void)
 }
 
 static struct intern_entry *
-find_interned_string(const char *s, unsigned hash)
+find_interned_string(const char *s, size_t len, unsigned hash)
 {
     int bucket = hash % intern_table_size;
     struct intern_entry *p;
     
     for (p = intern_table[bucket]; p; p = p->next) {
         if (hash == p->hash) {
-            if (!strcmp(s, p->s)) {
+            if ((size_t) memo_strlen(p->s) == len && !memcmp(s, p->s, len)) {
                 return p;
             }
         }
@@ -224,23 +224,31 @@ intern_rehash(int new_size) {
    possibly share storage. */
 const char *
 str_intern(const char *s)
+{
+    return str_intern(s, s ? strlen(s) : 0);
+}
+
+/* The same, for the LEN characters at S, which needn't be followed by a
+   null. */
+const char *
+str_intern(const char *s, size_t len)
 {
     struct intern_entry *e;
     unsigned hash;
-    const char *r;
+    char *r;
     
-    if (s == nullptr || *s == '\0') {
+    if (len == 0) {
         /* str_dup already has a canonical empty string */
-        return str_dup(s);
+        return str_dup("");
     }
     
-    if (intern_table == nullptr) {
-        return str_dup(s);
+    if (intern_table == nullptr || in_background_thread) {
+        return str_dup(s, len);
     }
     
-    hash = str_hash(s);
+    hash = str_hash(s, len);
     
-    e = find_interned_string(s, hash);
+    e = find_interned_string(s, len, hash);
     
     if (e != nullptr) {
         intern_allocations_saved++;
@@ -252,8 +260,8 @@ str_intern(const char *s)
         intern_rehash(intern_table_size * 2);
     }
     
-    r = str_dup(s);
-    r = str_ref(r);
+    r = str_dup(s, len);
+    str_ref(r);
     add_interned_string(r, hash);
     
     return r;
@@ -267,6 +275,12 @@ str_intern(const char *s)
 	return str_dup(s);
 }
 
+const char *
+str_intern(const char *s, size_t len)
+{
+	return str_dup(s, len);
+}
+
 void
 str_intern_close(void)
 {
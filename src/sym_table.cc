@@ -71,15 +71,30 @@ first_user_slot(DB_Version version)
     return count;
 }
 
+/* The built-in names for each DB version, made on first use.  There is a
+ * set per thread, since copy_names() adds references to the names, and it
+ * is freed when the thread exits (the verb compilers started while loading
+ * the database come and go).
+ */
+struct builtin_names_table {
+    Names *versions[Num_DB_Versions];
+
+    ~builtin_names_table() {
+	for (Names *names : versions)
+	    if (names)
+		free_names(names);
+    }
+};
+
+static thread_local builtin_names_table builtins;
+
 Names *
 new_builtin_names(DB_Version version)
 {
-    static Names *builtins[Num_DB_Versions];
-
-    if (builtins[version] == nullptr) {
+    if (builtins.versions[version] == nullptr) {
 	Names *bi = new_names(first_user_slot(version));
 
-	builtins[version] = bi;
+	builtins.versions[version] = bi;
 	bi->size = bi->max_size;
 
 	bi->names[SLOT_NUM] = str_dup("NUM");
@@ -113,7 +128,7 @@ new_builtin_names(DB_Version version)
             bi->names[SLOT_WAIF] = str_dup("WAIF");
         }
     }
-    return copy_names(builtins[version]);
+    return copy_names(builtins.versions[version]);
 }
 
 int
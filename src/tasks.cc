@@ -58,6 +58,7 @@ typedef enum {
     TASK_OOB,		/* out-of-band unless disable_oob */
     TASK_QUOTED,	/* in-band; needs unquote unless disable-oob */
     TASK_BINARY,	/* in-band; binary mode string */
+    TASK_HTTP,		/* in-band; request from an HTTP listener */
     /* Background Tasks */
     TASK_FORKED,
     TASK_SUSPENDED,
@@ -79,9 +80,11 @@ typedef struct suspended_task {
 } suspended_task;
 
 typedef struct {
-    char *string;
+    char *string;		/* null for TASK_HTTP */
     int length;
     struct task *next_itail;	/* see tqueue.first_itail */
+    Var request;		/* TASK_HTTP: see server_receive_http_request() */
+    bool keep_alive;		/* TASK_HTTP */
 } input_task;
 
 typedef struct task {
@@ -230,6 +233,7 @@ typedef struct ext_queue {
 
 Var current_local;
 int current_task_id;
+bool suspension_forbidden = false;
 static tqueue *idle_tqueues = nullptr, *active_tqueues = nullptr;
 static task *waiting_tasks = nullptr;	/* forked and suspended tasks */
 static ext_queue *external_queues = nullptr;
@@ -606,6 +610,9 @@ free_task(task * t, int strong)
     case TASK_OOB:
 	free_str(t->t.input.string);
 	break;
+    case TASK_HTTP:
+	free_var(t->t.input.request);
+	break;
     case TASK_FORKED:
 	if (strong) {
 	    free_rt_env(t->t.forked.rt_env,
@@ -968,6 +975,33 @@ do_out_of_band_command(tqueue * tq, char *command)
 		    parse_into_wordlist(command), command, nullptr);
 }
 
+static void
+do_http_task(tqueue * tq, task * t)
+{
+    Var result;
+
+    result.type = TYPE_INT;	/* for free_var() if task isn't DONE */
+    if (t->t.input.request.type != TYPE_MAP)
+	result = var_ref(t->t.input.request);
+    else {
+	Var args = new_list(1);
+
+	args.v.list[1] = var_ref(t->t.input.request);
+	/* The response is the verb's value, so it has to have one now:
+	 * anything that would suspend it raises E_PERM instead, and
+	 * threaded builtins run on this thread. */
+	suspension_forbidden = true;
+	if (run_server_task(tq->player, Var::new_obj(tq->handler), "do_http_request",
+			    args, "", &result) != OUTCOME_DONE) {
+	    result.type = TYPE_INT;
+	    result.v.num = 500;
+	}
+	suspension_forbidden = false;
+    }
+    send_http_response(tq->player, result, t->t.input.keep_alive);
+    free_var(result);
+}
+
 static int
 is_out_of_input(tqueue * tq)
 {
@@ -1067,28 +1101,8 @@ tasks_connection_options(task_queue q, Var list)
 #undef TASK_CO_TABLE
 
 static void
-enqueue_input_task(tqueue * tq, const char *input, int at_front, int binary, bool is_telnet)
+queue_input_task(tqueue * tq, task * t, int at_front)
 {
-    static char oob_prefix[] = OUT_OF_BAND_PREFIX;
-    task *t;
-
-    t = (task *)mymalloc(sizeof(task), M_TASK);
-    if (binary)
-	t->kind = TASK_BINARY;
-    else if (is_telnet)
-        t->kind = TASK_OOB;
-    else if (oob_quote_prefix_length > 0
-	     && strncmp(oob_quote_prefix, input, oob_quote_prefix_length) == 0)
-	t->kind = TASK_QUOTED;
-    else if (sizeof(oob_prefix) > 1
-	     && strncmp(oob_prefix, input, sizeof(oob_prefix) - 1) == 0)
-	t->kind = TASK_OOB;
-    else
-	t->kind = TASK_INBAND;
-
-    t->t.input.string = str_dup(input);
-    tq->total_input_length += (t->t.input.length = strlen(input));
-
     t->t.input.next_itail = nullptr;
     if (at_front && tq->first_input) {	/* if nothing there, front == back */
 	if ((tq->first_input->kind == TASK_OOB) != (t->kind == TASK_OOB)) {
@@ -1124,6 +1138,31 @@ enqueue_input_task(tqueue * tq, const char *input, int at_front, int binary, boo
     }
 }
 
+static void
+enqueue_input_task(tqueue * tq, const char *input, int at_front, int binary, bool is_telnet)
+{
+    static char oob_prefix[] = OUT_OF_BAND_PREFIX;
+    task *t;
+
+    t = (task *)mymalloc(sizeof(task), M_TASK);
+    if (binary)
+	t->kind = TASK_BINARY;
+    else if (is_telnet)
+        t->kind = TASK_OOB;
+    else if (oob_quote_prefix_length > 0
+	     && strncmp(oob_quote_prefix, input, oob_quote_prefix_length) == 0)
+	t->kind = TASK_QUOTED;
+    else if (sizeof(oob_prefix) > 1
+	     && strncmp(oob_prefix, input, sizeof(oob_prefix) - 1) == 0)
+	t->kind = TASK_OOB;
+    else
+	t->kind = TASK_INBAND;
+
+    t->t.input.string = str_dup(input);
+    tq->total_input_length += (t->t.input.length = strlen(input));
+    queue_input_task(tq, t, at_front);
+}
+
 void
 task_suspend_input(task_queue q)
 {
@@ -1149,7 +1188,9 @@ flush_input(tqueue * tq, int show_messages)
 	while ((t = dequeue_input_task(tq, DQ_FIRST)) != nullptr) {
 	    /* TODO*** flush only non-TASK_OOB tasks ??? */
 	    if (show_messages) {
-		stream_printf(s, ">>     %s", t->t.input.string);
+		stream_printf(s, ">>     %s", (t->kind == TASK_HTTP
+						 ? "(HTTP request)"
+						 : t->t.input.string));
 		notify(tq->player, reset_stream(s));
 	    }
 	    free_task(t, 1);
@@ -1174,6 +1215,20 @@ new_input_task(task_queue q, const char *input, int binary, bool out_of_band)
     enqueue_input_task(tq, input, 0/*at-rear*/, binary, out_of_band);
 }
 
+void
+new_http_task(task_queue q, Var request, bool keep_alive)
+{
+    tqueue *tq = (tqueue *)q.ptr;
+    task *t = (task *)mymalloc(sizeof(task), M_TASK);
+
+    t->kind = TASK_HTTP;
+    t->t.input.string = nullptr;
+    t->t.input.request = request;
+    t->t.input.keep_alive = keep_alive;
+    tq->total_input_length += (t->t.input.length = value_bytes(request));
+    queue_input_task(tq, t, 0/*at-rear*/);
+}
+
 static void
 enqueue_waiting(task * t)
 {				/* either FORKED or SUSPENDED */
@@ -1293,6 +1348,9 @@ enqueue_suspended_task(vm the_vm, void *data)
     struct timeval when;
     task *t;
 
+    if (suspension_forbidden)
+	return E_PERM;
+
     if (data) {
 	double after_seconds = *((double *) data);
 
@@ -1345,6 +1403,9 @@ read_input_now(Objid connection)
     } else if (!(t = dequeue_input_task(tq, DQ_INBAND))) {
 	r.type = TYPE_INT;
 	r.v.num = 0;
+    } else if (t->kind == TASK_HTTP) {
+	r = t->t.input.request;
+	myfree(t, M_TASK);
     } else {
 	r.type = TYPE_STR;
 	r.v.str = t->t.input.string;
@@ -1360,6 +1421,8 @@ make_reading_task(vm the_vm, void *data)
     Objid player = *((Objid *) data);
     tqueue *tq = find_tqueue(player, 0);
 
+    if (suspension_forbidden)
+	return E_PERM;
     if (!tq || tq->reading || is_out_of_input(tq))
 	return E_INVARG;
     else {
@@ -1381,6 +1444,8 @@ make_http_task(vm the_vm, Objid player, int request)
 {
     tqueue *tq = find_tqueue(player, 0);
 
+    if (suspension_forbidden)
+	return E_PERM;
     if (!tq || tq->reading || is_out_of_input(tq))
 	return E_INVARG;
     else {
@@ -1424,6 +1489,46 @@ last_input_task_id(Objid player)
     return tq ? tq->last_input_task_id : 0;
 }
 
+Var
+input_queue_lengths(Num *total, Num *longest)
+{
+    /* Returns a map from the player of each task queue with input waiting to
+     * the number of input tasks in it.
+     */
+    tqueue *tq, *lists[2] = {active_tqueues, idle_tqueues};
+    task *t;
+    Var r = new_map();
+    Num n;
+    int i;
+
+    *total = *longest = 0;
+    for (i = 0; i < 2; i++)
+	for (tq = lists[i]; tq; tq = tq->next) {
+	    for (n = 0, t = tq->first_input; t; t = t->next)
+		n++;
+	    if (n > 0) {
+		r = mapinsert(r, Var::new_obj(tq->player), Var::new_int(n));
+		*total += n;
+		if (n > *longest)
+		    *longest = n;
+	    }
+	}
+
+    return r;
+}
+
+int
+waiting_task_count(void)
+{
+    task *t;
+    int n = 0;
+
+    for (t = waiting_tasks; t; t = t->next)
+	n++;
+
+    return n;
+}
+
 int
 next_task_start(void)
 {
@@ -1683,6 +1788,10 @@ run_ready_tasks(void)
 		    do_out_of_band_command(tq, t->t.input.string);
 		    did_one = 1;
 		    break;
+		case TASK_HTTP:
+		    do_http_task(tq, t);
+		    did_one = 1;
+		    break;
 		case TASK_BINARY:
 		case TASK_INBAND:
 		    if (tq->reading && tq->parsing) {
@@ -2148,6 +2257,26 @@ read_task_queue(void)
     return 1;
 }
 
+void
+discard_task_queue(void)
+{
+    task *t;
+
+    while ((t = waiting_tasks)) {
+	Objid progr = (t->kind == TASK_FORKED
+		       ? t->t.forked.a.progr
+		       : progr_of_cur_verb(t->t.suspended.the_vm));
+	tqueue *tq = find_tqueue(progr, 0);
+
+	if (tq)
+	    tq->num_bg_tasks--;
+	waiting_tasks = t->next;
+	if (t->kind == TASK_SUSPENDED)
+	    free_var(t->t.suspended.value);
+	free_task(t, 1);
+    }
+}
+
 /* Used in emergency mode and when handling the `.program' intrinsic
  * command.  Is only capable of finding verbs defined on permanent
  * objects (relies on `Objid' internally).
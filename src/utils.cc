@@ -118,6 +118,17 @@ str_hash(const char *s)
     return ans;
 }
 
+unsigned
+str_hash(const char *s, size_t len)
+{
+    unsigned ans = 0;
+
+    while (len--) {
+	ans = (ans << 3) + (ans >> 28) + cmap[(unsigned char) *s++];
+    }
+    return ans;
+}
+
 /* Used by the cyclic garbage collector to free values that entered
  * the buffer of possible roots, but subsequently had their refcount
  * drop to zero.  Roughly corresponds to `Free' in Bacon and Rajan.
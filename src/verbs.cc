@@ -23,6 +23,7 @@
 #include "functions.h"
 #include "list.h"
 #include "log.h"
+#include "map.h"
 #include "match.h"
 #include "parse_cmd.h"
 #include "parser.h"
@@ -600,6 +601,176 @@ all_strings(Var arglist)
     return 1;
 }
 
+#ifdef EVAL_CACHE_BYTES
+
+/* Programs compiled by eval(), kept by their code so that evaluating the
+ * same code again skips the parser.  Entries are chained by hash and also
+ * linked in order of use; the least recently used are dropped when the
+ * total size would exceed EVAL_CACHE_BYTES.  A program is shared by all
+ * the activations running it, each holding its own reference.
+ */
+
+#define EVAL_CACHE_BUCKETS	509
+
+typedef struct eval_entry eval_entry;
+
+struct eval_entry {
+    Var code;			/* the list of strings given to eval() */
+    unsigned hash;
+    Program *program;
+    int bytes;
+    eval_entry *next;		/* in the same bucket */
+    eval_entry *newer, *older;
+};
+
+static eval_entry *eval_table[EVAL_CACHE_BUCKETS];
+static eval_entry *eval_newest, *eval_oldest;
+static int eval_cache_entries = 0, eval_cache_bytes = 0;
+static Num eval_cache_hits = 0, eval_cache_misses = 0;
+static Num eval_cache_evictions = 0;
+
+static unsigned
+eval_code_hash(Var code)
+{
+    Var line;
+    int i, c;
+    unsigned h = code.v.list[0].v.num;
+
+    FOR_EACH (line, code, i, c)
+	h = h * 31 + str_hash(line.v.str);
+
+    return h;
+}
+
+/* Case matters here, unlike in str_hash(). */
+static int
+eval_code_equal(Var a, Var b)
+{
+    int i;
+
+    if (a.v.list == b.v.list)
+	return 1;
+    if (a.v.list[0].v.num != b.v.list[0].v.num)
+	return 0;
+    for (i = 1; i <= a.v.list[0].v.num; i++) {
+	const char *x = a.v.list[i].v.str, *y = b.v.list[i].v.str;
+
+	if (x != y && (memo_strlen(x) != memo_strlen(y) || strcmp(x, y)))
+	    return 0;
+    }
+
+    return 1;
+}
+
+static void
+eval_unlink(eval_entry *e)
+{
+    if (e->newer)
+	e->newer->older = e->older;
+    else
+	eval_newest = e->older;
+    if (e->older)
+	e->older->newer = e->newer;
+    else
+	eval_oldest = e->newer;
+}
+
+static void
+eval_link_newest(eval_entry *e)
+{
+    e->newer = nullptr;
+    e->older = eval_newest;
+    if (eval_newest)
+	eval_newest->newer = e;
+    else
+	eval_oldest = e;
+    eval_newest = e;
+}
+
+static void
+eval_cache_drop(eval_entry *e)
+{
+    eval_entry **pp = &eval_table[e->hash % EVAL_CACHE_BUCKETS];
+
+    while (*pp != e)
+	pp = &(*pp)->next;
+    *pp = e->next;
+    eval_unlink(e);
+
+    eval_cache_entries--;
+    eval_cache_bytes -= e->bytes;
+    free_var(e->code);
+    free_program(e->program);
+    myfree(e, M_STRUCT);
+}
+
+/* Returns a new reference to the cached program for CODE, if any. */
+static Program *
+eval_cache_lookup(Var code, unsigned hash)
+{
+    eval_entry *e;
+
+    for (e = eval_table[hash % EVAL_CACHE_BUCKETS]; e; e = e->next)
+	if (e->hash == hash && e->program->version == current_db_version
+	    && eval_code_equal(e->code, code)) {
+	    eval_unlink(e);
+	    eval_link_newest(e);
+	    eval_cache_hits++;
+	    return program_ref(e->program);
+	}
+
+    eval_cache_misses++;
+    return nullptr;
+}
+
+static void
+eval_cache_insert(Var code, unsigned hash, Program *program)
+{
+    eval_entry *e;
+    int bytes = value_bytes(code) + program_bytes(program)
+	+ sizeof(eval_entry);
+
+    if (bytes > EVAL_CACHE_BYTES)
+	return;
+    while (eval_cache_bytes + bytes > EVAL_CACHE_BYTES) {
+	eval_cache_drop(eval_oldest);
+	eval_cache_evictions++;
+    }
+
+    e = (eval_entry *)mymalloc(sizeof(eval_entry), M_STRUCT);
+    e->code = var_ref(code);
+    e->hash = hash;
+    e->program = program_ref(program);
+    e->bytes = bytes;
+    e->next = eval_table[hash % EVAL_CACHE_BUCKETS];
+    eval_table[hash % EVAL_CACHE_BUCKETS] = e;
+    eval_link_newest(e);
+
+    eval_cache_entries++;
+    eval_cache_bytes += bytes;
+}
+
+Var
+eval_cache_stats(void)
+{
+    Var r = new_map();
+
+#define PACK_STAT(name, value)					\
+    r = mapinsert(r, str_dup_to_var(#name), Var::new_int(value))
+
+    PACK_STAT(hits, eval_cache_hits);
+    PACK_STAT(misses, eval_cache_misses);
+    PACK_STAT(evictions, eval_cache_evictions);
+    PACK_STAT(entries, eval_cache_entries);
+    PACK_STAT(bytes, eval_cache_bytes);
+
+#undef PACK_STAT
+
+    return r;
+}
+
+#endif				/* EVAL_CACHE_BYTES */
+
 static package
 bf_eval(Var arglist, Byte next, void *data, Objid progr)
 {
@@ -614,7 +785,18 @@ bf_eval(Var arglist, Byte next, void *data, Objid progr)
 	    p = make_error_pack(E_TYPE);
 	} else {
 	    Var errors;
-	    Program *program = parse_list_as_program(arglist, &errors);
+	    Program *program;
+
+#ifdef EVAL_CACHE_BYTES
+	    unsigned hash = eval_code_hash(arglist);
+
+	    if ((program = eval_cache_lookup(arglist, hash)))
+		errors = new_list(0);
+	    else if ((program = parse_list_as_program(arglist, &errors)))
+		eval_cache_insert(arglist, hash, program);
+#else
+	    program = parse_list_as_program(arglist, &errors);
+#endif
 
             #ifdef LOG_EVALS
             oklog("CODE_EVAL: %s (#%" PRIdN ") evaluated: %s\n", db_object_name(progr), progr, arglist.v.list[1]);
@@ -791,6 +791,9 @@ waif_put_prop(Waif *w, const char *name, Var val, Objid progr)
 			return E_RECMOVE;
 	}
 
+	/* Waifs are only written in full checkpoints. */
+	dbpriv_need_full_checkpoint();
+
 	if (dest) {
 		/* This is the easy case, there's already a slot for it.
 		 * Just fill it in.
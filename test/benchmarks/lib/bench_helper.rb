@@ -0,0 +1,48 @@
+require 'socket'
+require 'yaml'
+
+# A minimal client for timing builtins on a running server. Unlike the
+# tests, it only needs the Ruby standard library.
+module BenchHelper
+
+  MARKER = '-=!-bench-!=-'
+
+  raise '"./test.yml" configuration file not found' unless File.exist?('./test.yml')
+
+  OPTIONS = YAML.load(File.open('./test.yml'))
+
+  class Session
+
+    def initialize(player = 'wizard')
+      @sock = TCPSocket.open OPTIONS['host'], OPTIONS['port']
+      @sock.puts "connect #{player}"
+    end
+
+    # Run MOO code in a forked task (so it's free to suspend, which threaded
+    # builtins do) and return the literal value it leaves in `report'.
+    def run(code)
+      @sock.puts %Q|; fork (0) report = 0; #{code} notify(player, "#{MARKER} " + toliteral(report)); endfork|
+      loop do
+        line = @sock.gets or raise 'connection closed'
+        line = line.chomp
+        return line[MARKER.length + 1..-1] if line.start_with?(MARKER)
+      end
+    end
+
+    # Run MOO code and return how long it took, in seconds.
+    def time(code)
+      run(%Q|start = ftime(1); #{code} report = ftime(1) - start;|).to_f
+    end
+
+    # Set (creating it if needed) an integer $server_options property and reload the options.
+    def server_option(name, value)
+      run(%Q|if (!("#{name}" in properties($server_options))) add_property($server_options, "#{name}", 0, {player, "r"}); endif $server_options.#{name} = #{value}; load_server_options();|)
+    end
+
+    def close
+      @sock.close
+    end
+
+  end
+
+end
@@ -0,0 +1,51 @@
+# Replays the verb calls recorded in benchmarks/verb_calls.yml and reports
+# the time and ticks each call takes.  The calls exercise the instruction
+# sequences that the bytecode optimizer fuses, so comparing the output for
+# servers built with and without BYTECODE_SUPERINSTRUCTIONS (options.h)
+# measures what fusing gains; the tick counts should be identical.
+#
+# Start the server as described in README.tests, then from this directory:
+#   ruby -Ibenchmarks/lib benchmarks/replay.rb [repetitions] [calls.yml]
+
+require 'bench_helper'
+
+repetitions = (ARGV[0] || 20000).to_i
+recording = YAML.load(File.read(ARGV[1] || 'benchmarks/verb_calls.yml'))
+
+def moo_string(s)
+  '"' + s.gsub(/[\\"]/) { |c| '\\' + c } + '"'
+end
+
+session = BenchHelper::Session.new
+
+session.run(%Q|if (!("bench_replay" in properties(#0))) add_property(#0, "bench_replay", create(#-1), {player, "r"}); endif o = #0.bench_replay; if (!("data" in properties(o))) add_property(o, "data", {}, {player, "r"}); endif o.data = {}; for i in [1..100] o.data = {@o.data, i}; endfor|)
+
+recording.each do |entry|
+  verb = entry['verb']
+  code = '{' + entry['code'].lines.map { |l| moo_string(l.chomp) }.join(', ') + '}'
+  session.run(%Q|o = #0.bench_replay; while (`verb_info(o, "#{verb}") ! ANY => 0') delete_verb(o, "#{verb}"); endwhile add_verb(o, {player, "rxd", "#{verb}"}, {"this", "none", "this"}); report = set_verb_code(o, "#{verb}", #{code});|)
+end
+
+# Times `repetitions' calls in one task, leaving out the time it spends
+# suspended to refill its ticks and seconds, then counts the ticks one more
+# call takes.  Returns {seconds, ticks}.
+def replay(session, repetitions, call)
+  session.run(%Q|o = #0.bench_replay; elapsed = 0.0; start = ftime(1); for r in [1..#{repetitions}] if (ticks_left() < 100000 \|\| seconds_left() < 2) elapsed = elapsed + ftime(1) - start; suspend(0); start = ftime(1); endif #{call}; endfor elapsed = elapsed + ftime(1) - start; t = ticks_left(); #{call}; report = {elapsed, t - ticks_left()};|)
+    .delete('{}').split(',').map(&:to_f)
+end
+
+# The loop itself, with a call that does nothing, is subtracted from the results.
+empty_time, empty_ticks = replay(session, repetitions, '0')
+
+puts "#{repetitions} repetitions"
+puts format('%-16s %-6s %12s %12s', 'verb', 'call', 'usec/call', 'ticks/call')
+recording.each do |entry|
+  entry['calls'].each_with_index do |args, i|
+    time, ticks = replay(session, repetitions, %Q|o:#{entry['verb']}(@#{args})|)
+    puts format('%-16s %-6d %12.2f %12d', entry['verb'], i + 1,
+                (time - empty_time) * 1_000_000 / repetitions,
+                ticks - empty_ticks)
+  end
+end
+
+session.close
@@ -0,0 +1,31 @@
+# Times sort() and all_members() on large lists with different numbers of
+# threads ($server_options.parallel_list_threads).
+#
+# Start the server as described in README.tests, then from this directory:
+#   ruby -Ibenchmarks/lib benchmarks/sort.rb [length] [threads,threads,...]
+
+require 'bench_helper'
+
+length = (ARGV[0] || 1_000_000).to_i
+thread_counts = (ARGV[1] || '1,2,4,8').split(',').map(&:to_i)
+
+session = BenchHelper::Session.new
+
+# Build the lists a thousand elements at a time; appending one element at a time is quadratic.
+['bench_ints', 'bench_strings'].each do |name|
+  session.run(%Q|if (!("#{name}" in properties(#0))) add_property(#0, "#{name}", {}, {player, "r"}); endif|)
+end
+session.run(%Q|ints = strings = {}; while (length(ints) < #{length}) i = s = {}; for x in [1..min(1000, #{length} - length(ints))] i = {@i, random()}; s = {@s, tostr(chr(65 + random(26)), "Item ", random(100000))}; endfor ints = {@ints, @i}; strings = {@strings, @s}; if (ticks_left() < 100000 \|\| seconds_left() < 2) suspend(0); endif endwhile #0.bench_ints = ints; #0.bench_strings = strings;|)
+
+puts "#{length} elements"
+puts format('%8s %12s %12s %12s %12s', 'threads', 'ints', 'strings', 'natural', 'all_members')
+thread_counts.each do |threads|
+  session.server_option('parallel_list_threads', threads)
+  ints = session.time('sort(#0.bench_ints);')
+  strings = session.time('sort(#0.bench_strings);')
+  natural = session.time('sort(#0.bench_strings, {}, 1);')
+  members = session.time('all_members(#0.bench_strings[1], #0.bench_strings);')
+  puts format('%8d %11.3fs %11.3fs %11.3fs %11.3fs', threads, ints, strings, natural, members)
+end
+
+session.close
@@ -1,4 +1,5 @@
 require 'open3'
+require 'timeout'
 
 require 'test_helper'
 
@@ -35,6 +36,211 @@ class TestCannedDbs < Test::Unit::TestCase
     [log.readlines.map(&:chomp), diff.readlines.map(&:chomp)]
   end
 
+  # Writes a database like Anon3.db whose #0 has a verb for each of
+  # PROGRAMS (more than enough to compile them on several threads) and a
+  # server_started verb running STARTED.
+  def write_db_with_programs(path, programs, started)
+    verbs = programs.each_index.map { |i| "v#{i + 1}\n3\n173\n-1\n" }.join
+    code = programs.each_with_index.map { |p, i| "#0:#{i + 1}\n#{p}\n." }.join("\n")
+    File.write(path, <<~DB)
+      ** LambdaMOO Database, Format Version 16 **
+      1
+      3
+      0 values pending finalization
+      0 clocks
+      0 queued tasks
+      0 suspended tasks
+      0 interrupted tasks
+      0 active connections with listeners
+      4
+      #0
+      System Object
+      16
+      3
+      1
+      -1
+      0
+      0
+      4
+      0
+      1
+      1
+      4
+      0
+      #{programs.length + 1}
+      server_started
+      3
+      173
+      -1
+      #{verbs}0
+      0
+      #1
+      Root Class
+      16
+      3
+      1
+      -1
+      0
+      0
+      4
+      0
+      1
+      -1
+      4
+      3
+      1
+      0
+      1
+      2
+      1
+      3
+      0
+      0
+      0
+      #2
+      The First Room
+      0
+      3
+      1
+      -1
+      0
+      0
+      4
+      1
+      1
+      3
+      1
+      1
+      4
+      0
+      0
+      0
+      0
+      #3
+      Wizard
+      7
+      3
+      1
+      2
+      0
+      0
+      4
+      0
+      1
+      1
+      4
+      0
+      0
+      0
+      0
+      0
+      #{programs.length + 1}
+      #0:0
+      #{started}
+      .
+      #{code}
+    DB
+  end
+
+  # Runs the server until it logs a line matching PATTERN, then kills it
+  # the way a crash would, and returns its log.
+  def log_until_killed(original, backup, pattern)
+    _, _, log, wait = Open3.popen3 %[./moo #{original} #{backup} 9899]
+    lines = []
+    Timeout.timeout(60) do
+      while (line = log.gets)
+        lines << line.chomp
+        break if line =~ pattern
+      end
+    end
+    lines
+  ensure
+    Process.kill('KILL', wait.pid) rescue nil
+    wait.value
+  end
+
+  def remove_db_files(path)
+    Dir["#{path}*"].each { |f| File.delete(f) }
+  end
+
+  # Writes PATH, whose server_started verb reports the state of the
+  # database if it has been started before, and otherwise turns on
+  # checkpoint deltas, makes changes in three steps with a checkpoint
+  # after each, makes one more change and logs "ready".
+  def write_db_with_deltas(path)
+    remove_db_files(path)
+    write_db_with_programs(path, [], <<~STARTED.chomp)
+      if ("stage" in properties(#0))
+        server_log(toliteral({#2.name, $kept.name, $kept.value, $kept:answer(), valid($gone), $stage}));
+        shutdown();
+        return;
+      endif
+      add_property(#0, "stage", 1, {#3, "rw"});
+      add_property(#0, "server_options", create(#1), {#3, "r"});
+      add_property($server_options, "checkpoint_deltas", 5, {#3, "r"});
+      load_server_options();
+      add_property(#0, "kept", create(#1), {#3, "r"});
+      add_property(#0, "gone", create(#1), {#3, "r"});
+      fork (0)
+        #2.name = "Renamed";
+        dump_database();
+        suspend(0);
+        add_property($kept, "value", {1, "two", 3.0, ["four" -> 4]}, {#3, "r"});
+        add_verb($kept, {#3, "rxd", "answer"}, {"this", "none", "this"});
+        set_verb_code($kept, "answer", {"return 42;"});
+        recycle($gone);
+        dump_database();
+        suspend(0);
+        $kept.name = "Kept";
+        $stage = 3;
+        dump_database();
+        suspend(0);
+        $kept.name = "Lost";
+        server_log("ready");
+      endfork
+    STARTED
+  end
+
+  # Writes PATH, whose server_started verb logs the value of REPORT if
+  # it has been started before.  Otherwise it turns on the write-ahead
+  # log and runs each of STEPS in a later pass through the main loop, in
+  # a forked task that then logs "ready".  #0:v1() makes waifs.
+  def write_db_with_log(path, report, steps)
+    remove_db_files(path)
+    write_db_with_programs(path, ['return new_waif();'], <<~STARTED.chomp)
+      if ("stage" in properties(#0))
+        server_log(toliteral(#{report}));
+        shutdown();
+        return;
+      endif
+      add_property(#0, "stage", 1, {#3, "rw"});
+      add_property(#0, "server_options", create(#1), {#3, "r"});
+      add_property($server_options, "write_ahead_log", 1, {#3, "r"});
+      load_server_options();
+      add_property(#0, ":x", 0, {#3, "rw"});
+      add_property(#0, "held", 0, {#3, "rw"});
+      add_property(#0, "kept", create(#1), {#3, "r"});
+      add_property($kept, "value", 0, {#3, "rw"});
+      fork (0)
+        #{steps.map { |step| "suspend(0);\n#{step}" }.join("\n")}
+        suspend(0);
+        server_log("ready");
+      endfork
+    STARTED
+  end
+
+  # Returns the records of the write-ahead log at PATH.
+  def log_records(path)
+    data = File.binread(path)
+    data = data[(data.index("\n") + 1)..-1]
+    records = []
+    while (m = data.match(/\A(\d+) ([0-9a-f]{8})\n/))
+      records << data[m[0].length, m[1].to_i]
+      data = data[(m[0].length + m[1].to_i)..-1]
+    end
+    records
+  end
+
   public
 
   def test_that_creating_garbage_and_then_shutting_down_leaves_a_pending_anonymous_object
@@ -210,4 +416,181 @@ class TestCannedDbs < Test::Unit::TestCase
     assert log.any? { |l| l =~ /#2 not in it's content's \(#3\) location/ }
   end
 
+  def test_that_a_database_with_many_programs_loads_and_writes_them_back_in_order
+    programs = (1..300).map { |i| "return #{i};" }
+    write_db_with_programs('/tmp/Programs.db', programs, 'server_log(toliteral({this:v1(), this:v150(), this:v300()}));
+shutdown();')
+    log, diff = log_and_diff('/tmp/Programs.db', '/tmp/Foo.db')
+
+    assert log.any? { |l| l =~ /\{1, 150, 300\}/ }
+    assert_equal [], diff
+  end
+
+  def test_that_a_program_with_errors_is_reported_when_loading_many_programs
+    programs = (1..300).map { |i| i == 200 ? 'return 1 +;' : "return #{i};" }
+    write_db_with_programs('/tmp/Programs.db', programs, 'shutdown();')
+    log, _ = log_and_diff('/tmp/Programs.db', '/dev/null')
+
+    assert log.one? { |l| l =~ /PARSER: Error in / }
+    assert log.any? { |l| l =~ /PARSER: Error in #0:v200:/ }
+    assert log.any? { |l| l =~ /Line 1:  syntax error/ }
+    assert log.any? { |l| l =~ /Unparsable program #0:200\./ }
+  end
+
+
+  def test_that_checkpoint_deltas_are_applied_on_restart
+    write_db_with_deltas('/tmp/Delta.db')
+    log1 = log_until_killed('/tmp/Delta.db', '/tmp/Delta.db', /ready/)
+
+    assert_equal 3, log1.count { |l| l =~ /CHECKPOINTING changes on \/tmp\/Delta\.db\.delta\.\d+ finished/ }
+    assert log1.none? { |l| l =~ /CHECKPOINTING on/ }
+    assert_equal ['/tmp/Delta.db.delta.1', '/tmp/Delta.db.delta.2', '/tmp/Delta.db.delta.3'], Dir['/tmp/Delta.db.delta.*'].sort
+
+    log2, _ = log_and_diff('/tmp/Delta.db', '/tmp/Foo.db')
+    applied = log2.grep(/LOADING: Applying/).map { |l| l[/\S+ \.\.\.$/] }
+
+    assert_equal ['/tmp/Delta.db.delta.1 ...', '/tmp/Delta.db.delta.2 ...', '/tmp/Delta.db.delta.3 ...'], applied
+    assert log2.any? { |l| l.end_with? '{"Renamed", "Kept", {1, "two", 3.0, ["four" -> 4]}, 42, 0, 3}' }
+  end
+
+  def test_that_a_missing_checkpoint_delta_stops_the_load
+    write_db_with_deltas('/tmp/Delta.db')
+    log_until_killed('/tmp/Delta.db', '/tmp/Delta.db', /ready/)
+    File.delete('/tmp/Delta.db.delta.2')
+    remove_db_files('/tmp/Foo.db')
+
+    log, _ = log_and_diff('/tmp/Delta.db', '/tmp/Foo.db')
+
+    assert log.any? { |l| l =~ /READ_DB_DELTAS: \/tmp\/Delta\.db\.delta\.2 is missing/ }
+    assert log.any? { |l| l =~ /DB_LOAD: Cannot apply checkpoint deltas!/ }
+    assert log.none? { |l| l =~ /Renamed/ }
+    assert_false File.exist?('/tmp/Foo.db')
+  end
+
+  def test_that_a_truncated_checkpoint_delta_stops_the_load
+    write_db_with_deltas('/tmp/Delta.db')
+    log_until_killed('/tmp/Delta.db', '/tmp/Delta.db', /ready/)
+    contents = File.read('/tmp/Delta.db.delta.3')
+
+    # Cut it short at the end of each line in turn.
+    contents.lines[0...-1].each_with_index do |_, i|
+      File.write('/tmp/Delta.db.delta.3', contents.lines[0..i].join)
+      log, _ = log_and_diff('/tmp/Delta.db', '/tmp/Foo.db')
+
+      assert log.any? { |l| l =~ /DB_LOAD: Cannot apply checkpoint deltas!/ }, "cut after line #{i + 1}"
+    end
+  end
+
+  def test_that_a_change_to_a_waif_forces_a_full_checkpoint
+    remove_db_files('/tmp/Waif.db')
+    write_db_with_programs('/tmp/Waif.db', ['return new_waif();'], <<~STARTED.chomp)
+      if ("stage" in properties(#0))
+        server_log(toliteral({#2.name, $held.x}));
+        shutdown();
+        return;
+      endif
+      add_property(#0, "stage", 1, {#3, "rw"});
+      add_property(#0, "server_options", create(#1), {#3, "r"});
+      add_property($server_options, "checkpoint_deltas", 5, {#3, "r"});
+      load_server_options();
+      add_property(#0, ":x", 0, {#3, "rw"});
+      add_property(#0, "held", 0, {#3, "rw"});
+      add_property(#2, "checkpoints", 0, {#3, "rw"});
+      add_verb(#0, {#3, "rxd", "checkpoint_finished"}, {"this", "none", "this"});
+      set_verb_code(#0, "checkpoint_finished", {"#2.checkpoints = #2.checkpoints + 1;"});
+      fork (0)
+        dump_database();
+        suspend(0);
+        $held = this:v1();
+        $held.x = 1;
+        dump_database();
+        while (#2.checkpoints < 2)
+          suspend(0.1);
+        endwhile
+        #2.name = "After";
+        dump_database();
+        suspend(0);
+        server_log("ready");
+      endfork
+    STARTED
+    log1 = log_until_killed('/tmp/Waif.db', '/tmp/Waif.db', /ready/)
+
+    assert log1.any? { |l| l =~ /CHECKPOINTING changes on \/tmp\/Waif\.db\.delta\.1 finished/ }
+    assert log1.any? { |l| l =~ /CHECKPOINTING on \/tmp\/Waif\.db\.#\d+# finished/ }
+    assert log1.any? { |l| l =~ /CHECKPOINTING changes on \/tmp\/Waif\.db\.delta\.2 finished/ }
+    assert_equal ['/tmp/Waif.db.delta.2'], Dir['/tmp/Waif.db.delta.*']
+
+    log2, _ = log_and_diff('/tmp/Waif.db', '/tmp/Foo.db')
+
+    assert log2.any? { |l| l.end_with? '{"After", 1}' }
+  end
+
+
+  def test_that_the_write_ahead_log_is_replayed_after_a_crash
+    steps = [
+      'add_property($kept, "big", "0123456789", {#3, "r"}); for i in [1..10] $kept.big = $kept.big + $kept.big; endfor',
+      '$kept.value = {1, "two"};',
+      '$kept.name = "Kept"; add_verb($kept, {#3, "rxd", "answer"}, {"this", "none", "this"}); set_verb_code($kept, "answer", {"return 42;"});',
+      '$kept.value = {$kept.value, 3};'
+    ]
+    write_db_with_log('/tmp/Log.db', '{$kept.name, $kept.value, $kept:answer(), length($kept.big)}', steps)
+    log1 = log_until_killed('/tmp/Log.db', '/tmp/Log.db', /ready/)
+
+    assert log1.any? { |l| l =~ /LOGGING changes on \/tmp\/Log\.db\.delta\.1/ }
+    assert log1.none? { |l| l =~ /CHECKPOINTING/ }
+    assert_equal ['/tmp/Log.db.delta.1'], Dir['/tmp/Log.db.delta.*']
+
+    # Changing only a property value logs just that value.
+    records = log_records('/tmp/Log.db.delta.1')
+    assert_equal 5, records.length
+    assert records[1].length > 10000
+    assert records[2].length < 200
+    assert records[4].length < 200
+
+    log2, _ = log_and_diff('/tmp/Log.db', '/tmp/Foo.db')
+
+    assert log2.any? { |l| l =~ /LOADING: Applying \/tmp\/Log\.db\.delta\.1/ }
+    assert log2.none? { |l| l =~ /Ignoring an incomplete record/ }
+    assert log2.any? { |l| l.end_with? '{"Kept", {{1, "two"}, 3}, 42, 10240}' }
+  end
+
+  def test_that_a_torn_or_corrupt_last_record_is_ignored
+    steps = [
+      '$kept.value = {1, "two"};',
+      '$kept.value = {$kept.value, 3};'
+    ]
+    write_db_with_log('/tmp/Log.db', '$kept.value', steps)
+    log_until_killed('/tmp/Log.db', '/tmp/Log.db', /ready/)
+    contents = File.binread('/tmp/Log.db.delta.1')
+
+    File.binwrite('/tmp/Log.db.delta.1', contents + "123 00000000\n1\n")
+    log1, _ = log_and_diff('/tmp/Log.db', '/tmp/Foo.db')
+
+    assert log1.any? { |l| l =~ /LOADING: Ignoring an incomplete record at the end of \/tmp\/Log\.db\.delta\.1/ }
+    assert log1.any? { |l| l.end_with? '{{1, "two"}, 3}' }
+
+    contents[-3] = contents[-3] == '1' ? '2' : '1'
+    File.binwrite('/tmp/Log.db.delta.1', contents)
+    log2, _ = log_and_diff('/tmp/Log.db', '/tmp/Foo.db')
+
+    assert log2.any? { |l| l =~ /LOADING: Ignoring an incomplete record at the end of \/tmp\/Log\.db\.delta\.1/ }
+    assert log2.any? { |l| l.end_with? '{1, "two"}' }
+  end
+
+  def test_that_logging_stops_at_a_change_to_a_waif
+    steps = [
+      '$kept.value = "before";',
+      '$held = this:v1(); $held.x = 1; $kept.value = "during";',
+      '$kept.value = "after";'
+    ]
+    write_db_with_log('/tmp/Log.db', '{$kept.value, $held}', steps)
+    log1 = log_until_killed('/tmp/Log.db', '/tmp/Log.db', /ready/)
+
+    assert log1.one? { |l| l =~ /LOGGING: Can't log changes; anonymous objects, waifs or disk space\?/ }
+
+    log2, _ = log_and_diff('/tmp/Log.db', '/tmp/Foo.db')
+
+    assert log2.any? { |l| l.end_with? '{"before", 0}' }
+  end
+
 end
@@ -190,4 +190,50 @@ class TestCollectionImprovements < Test::Unit::TestCase
     end
   end
 
+  def test_that_membership_in_large_lists_survives_changes
+    run_test_as('programmer') do
+      o = create(:nothing)
+      add_verb(o, [player, 'xd', 'foobar'], ['this', 'none', 'this'])
+      set_verb_code(o, 'foobar') do |vc|
+        vc << 'x = {};'
+        vc << 'for i in [1..2000]'
+        vc << 'x = {@x, tostr("s", i)};'
+        vc << 'endfor'
+        vc << 'for i in [1..5]'
+        vc << '"S1" in x;'
+        vc << 'is_member("s1", x);'
+        vc << 'endfor'
+        vc << 'y = x;'
+        vc << 'x[1] = "new";'
+        vc << 'x = setadd(x, "last");'
+        vc << 'x = setremove(x, "s2");'
+        vc << 'return {"S1" in x, "new" in x, "NEW" in x, is_member("NEW", x), "last" in x, "s3" in x, "S1" in y, is_member("S1", y), is_member("s1", y)};'
+      end
+      assert_equal [0, 1, 1, 0, 2000, 2, 1, 0, 1], call(o, 'foobar')
+    end
+  end
+
+  def test_that_membership_in_large_children_and_contents_survives_renumber
+    run_test_as('wizard') do
+      o = create(:nothing)
+      add_verb(o, [player, 'xd', 'foobar'], ['this', 'none', 'this'])
+      set_verb_code(o, 'foobar') do |vc|
+        vc << 'g = create($nothing);'
+        vc << 'p = create($nothing);'
+        vc << 'for i in [1..1100]'
+        vc << 'x = create(p);'
+        vc << 'move(x, p);'
+        vc << 'endfor'
+        vc << 'recycle(g);'
+        vc << 'for i in [1..5]'
+        vc << 'x in children(p);'
+        vc << 'x in p.contents;'
+        vc << 'endfor'
+        vc << 'n = renumber(x);'
+        vc << 'return {n == g, n in children(p), x in children(p), n in p.contents, x in p.contents};'
+      end
+      assert_equal [1, 1100, 0, 1100, 0], call(o, 'foobar')
+    end
+  end
+
 end
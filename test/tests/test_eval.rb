@@ -36,4 +36,18 @@ class TestEval < Test::Unit::TestCase
     end
   end
 
+  def test_that_eval_reuses_programs_for_the_same_code
+    run_test_as('wizard') do
+      assert_equal [[1, 'A'], [1, 'a'], [1, 'A'], [1, 'a']], simplify(command(%Q|; return {eval("return \\"A\\";"), eval("return \\"a\\";"), eval("return \\"A\\";"), eval("return \\"a\\";")};|))
+      assert_equal [[0, ['Line 1:  syntax error']], [0, ['Line 1:  syntax error']]], simplify(command(%Q|; return {eval("retur 1"), eval("retur 1")};|))
+      assert_equal [2, 1], simplify(command(%Q|; s = cache_stats()["eval"]; for i in [1..3] eval("return #{rand(1 << 30)};"); endfor t = cache_stats()["eval"]; return {t["hits"] - s["hits"], t["entries"] - s["entries"]};|))
+    end
+  end
+
+  def test_that_cache_stats_requires_a_wizard
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return cache_stats();|))
+    end
+  end
+
 end
@@ -363,6 +363,97 @@ class TestHttp < Test::Unit::TestCase
     end
   end
 
+  def test_that_an_http_listener_answers_pipelined_requests_in_order
+    with_http_listener(['return args[1]["uri"];']) do |sock|
+      sock.write "GET /a HTTP/1.1\r\nHost: localhost\r\n\r\n" \
+                 "GET /bc HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+      assert_equal "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/a" \
+                   "HTTP/1.1 200 OK\r\nContent-Length: 3\r\nConnection: close\r\n\r\n/bc", sock.read
+    end
+  end
+
+  def test_that_an_http_listener_keeps_the_connection_open_between_requests
+    with_http_listener(['return args[1]["uri"];']) do |sock|
+      sock.write "GET /a HTTP/1.1\r\nHost: localhost\r\n\r\n"
+      assert_equal "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/a", read_response(sock)
+      sock.write "GET /b HTTP/1.1\r\nHost: localhost\r\n\r\n"
+      assert_equal "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/b", read_response(sock)
+      sock.write "GET /c HTTP/1.0\r\n\r\n"
+      assert_equal "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nConnection: close\r\n\r\n/c", sock.read
+    end
+  end
+
+  def test_that_an_http_listener_answers_malformed_input_with_a_400_and_closes
+    with_http_listener(['return args[1]["uri"];']) do |sock|
+      sock.write "GET /a HTTP/1.1\r\nHost: localhost\r\n\r\n" \
+                 "foobar\r\n\r\n" \
+                 "GET /b HTTP/1.1\r\nHost: localhost\r\n\r\n"
+      assert_equal "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\n/a" \
+                   "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", sock.read
+    end
+  end
+
+  def test_that_an_http_request_handler_can_not_suspend
+    code = [
+      'notify(player, "leaked");',
+      'if (args[1]["uri"] == "/suspend")',
+      '  try',
+      '    suspend(0);',
+      '    return "suspended";',
+      '  except e (ANY)',
+      '    return toliteral(e[1]);',
+      '  endtry',
+      'elseif (args[1]["uri"] == "/read")',
+      '  try',
+      '    read(player);',
+      '    return "read";',
+      '  except e (ANY)',
+      '    return toliteral(e[1]);',
+      '  endtry',
+      'elseif (args[1]["uri"] == "/sort")',
+      '  return toliteral(sort({3, 1, 2}));',
+      'else',
+      '  suspend(0);',
+      '  return "suspended";',
+      'endif'
+    ]
+    with_http_listener(code) do |sock|
+      sock.write "GET /suspend HTTP/1.1\r\nHost: localhost\r\n\r\n" \
+                 "GET /read HTTP/1.1\r\nHost: localhost\r\n\r\n" \
+                 "GET /sort HTTP/1.1\r\nHost: localhost\r\n\r\n" \
+                 "GET /uncaught HTTP/1.1\r\nHost: localhost\r\n\r\n" \
+                 "GET /suspend HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"
+      assert_equal "HTTP/1.1 200 OK\r\nContent-Length: 6\r\n\r\nE_PERM" \
+                   "HTTP/1.1 200 OK\r\nContent-Length: 6\r\n\r\nE_PERM" \
+                   "HTTP/1.1 200 OK\r\nContent-Length: 9\r\n\r\n{1, 2, 3}" \
+                   "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n" \
+                   "HTTP/1.1 200 OK\r\nContent-Length: 6\r\nConnection: close\r\n\r\nE_PERM", sock.read
+    end
+  end
+
+  def with_http_listener(code)
+    run_test_as('wizard') do
+      o = create(:nothing)
+      add_verb(o, [player, 'xd', 'do_http_request'], ['this', 'none', 'this'])
+      set_verb_code(o, 'do_http_request', code)
+      port = options['port'] + 2
+      assert_equal port, simplify(command(%Q|; return listen(#{obj_ref(o)}, #{port}, 0, 0, 1);|))
+      begin
+        sock = TCPSocket.open(options['host'], port)
+        yield sock
+        sock.close
+      ensure
+        command("; unlisten(#{port});")
+      end
+    end
+  end
+
+  def read_response(sock)
+    response = sock.readline("\r\n\r\n")
+    length = response[/^Content-Length: (\d+)\r$/, 1].to_i
+    response + sock.read(length)
+  end
+
   def parse(type)
     message = []
     yield message
@@ -293,4 +293,49 @@ class TestMoocodeParsing < Test::Unit::TestCase
     end
   end
 
+  def test_that_optimized_code_decompiles_as_written
+    run_test_as('programmer') do
+      o = create(:nothing)
+      add_verb(o, [player, 'xd', 'folded'], ['this', 'none', 'this'])
+      code = ['"comment";', 'x = 60 * 60 * 24;', 'if (0)', '  x = 0;', 'endif', 'return {x, "a" + "b", {1, 2} == {1, 2}};']
+      set_verb_code(o, 'folded', code)
+      assert_equal code, verb_code(o, 'folded')
+      assert_equal [86400, 'ab', 1], call(o, 'folded')
+    end
+  end
+
+  def test_that_errors_in_constant_expressions_are_still_raised
+    run_test_as('programmer') do
+      o = create(:nothing)
+      add_verb(o, [player, 'xd', 'errors'], ['this', 'none', 'this'])
+      set_verb_code(o, 'errors', ['x = 1 + 2;', 'return {`1 / 0 ! ANY\', `"a" + 1 ! ANY\', `-"a" ! ANY\'};'])
+      assert_equal [E_DIV, E_TYPE, E_TYPE], call(o, 'errors')
+    end
+  end
+
+  def test_that_dividing_the_most_negative_integer_by_minus_one_does_not_crash
+    run_test_as('programmer') do
+      minint = @@options['64bit'] ? '(-9223372036854775807 - 1)' : '(-2147483647 - 1)'
+      assert_equal 6, simplify(command("; if (0) return #{minint} / -1; endif return 6;"))
+      assert_equal 6, simplify(command("; if (0) return #{minint} % -1; endif return 6;"))
+      assert_equal [1, 0], simplify(command("; return {#{minint} / -1 == #{minint}, #{minint} % -1};"))
+      assert_equal [1, 0], simplify(command("; x = -1; return {#{minint} / x == #{minint}, #{minint} % x};"))
+    end
+  end
+
+  def test_that_fused_instructions_keep_results_and_line_numbers
+    run_test_as('programmer') do
+      o = create(:nothing)
+      set(o, 'name', 'fused')
+      add_verb(o, [player, 'xd', 'fused'], ['this', 'none', 'this'])
+      code = ['l = args[1];', 'n = 0;', 'for i in [1..length(l)]', '  if (l[i] == 3)', '    n = n + 1;', '  endif', 'endfor', 'x = l[1];', 'if (x < 3)', '  return {n, this.name};', 'endif', 'return n;']
+      set_verb_code(o, 'fused', code)
+      assert_equal code, verb_code(o, 'fused')
+      assert_equal [2, 'fused'], call(o, 'fused', [1, 3, 3])
+      assert_equal 1, call(o, 'fused', [5, 3])
+      assert_equal [E_TYPE, 9], simplify(command(%Q|; try #{obj_ref(o)}:fused({"a"}); except e (ANY) return {e[1], e[4][1][6]}; endtry|))
+      assert_equal [E_RANGE, 8], simplify(command(%Q|; try #{obj_ref(o)}:fused({}); except e (ANY) return {e[1], e[4][1][6]}; endtry|))
+    end
+  end
+
 end
@@ -151,4 +151,80 @@ class TestStringOperations < Test::Unit::TestCase
     end
   end
 
+  def test_that_match_keeps_working_as_patterns_are_cached_and_evicted
+    run_test_as('wizard') do
+      r = simplify command %Q|; for i in [1..250] if (!match("x" + tostr(i), "x" + tostr(i) + "$")) return i; endif endfor; return {match("ABC", "b", 1), match("ABC", "b")[1..2]};|
+      assert_equal [[], [2, 2]], r
+    end
+  end
+
+  def test_that_matching_the_same_pattern_twice_is_a_cache_hit
+    run_test_as('wizard') do
+      r = simplify command %Q|; match("abc", "cache-hit-test"); s = cache_stats()["match"]; match("abc", "cache-hit-test"); t = cache_stats()["match"]; return {t["hits"] - s["hits"], t["misses"] - s["misses"]};|
+      assert_equal [1, 0], r
+    end
+  end
+
+  def test_that_pcre_match_and_pcre_replace_reuse_compiled_patterns
+    run_test_as('wizard') do
+      p = "cache-hit-#{rand(1 << 30)}"
+      r = simplify command %Q|; pcre_match("x", "#{p}"); pcre_replace("x", "s/#{p}/y/"); s = cache_stats()["pcre"]; pcre_match("x", "#{p}"); pcre_replace("x", "s/#{p}/y/"); t = cache_stats()["pcre"]; return {t["hits"] - s["hits"], t["misses"] - s["misses"]};|
+      assert_equal [2, 0], r
+    end
+  end
+
+  def test_that_pcre_match_and_pcre_replace_cache_the_same_string_separately
+    run_test_as('wizard') do
+      p = "s/a#{rand(1 << 30)}/b/"
+      r = simplify command %Q|; s = cache_stats()["pcre"]; pcre_replace("a", "#{p}"); pcre_match("a", "#{p}"); t = cache_stats()["pcre"]; pcre_replace("a", "#{p}"); pcre_match("a", "#{p}"); u = cache_stats()["pcre"]; return {t["misses"] - s["misses"], t["hits"] - s["hits"], u["hits"] - t["hits"]};|
+      assert_equal [2, 0, 2], r
+    end
+  end
+
+  def test_that_the_pcre_cache_evicts_the_oldest_pattern_when_full
+    run_test_as('wizard') do
+      # More patterns than the default PCRE_CACHE_SIZE, to fill the cache.
+      n = rand(1 << 30)
+      r = simplify command %Q|; for i in [1..1000] pcre_match("x", "fill#{n}-" + tostr(i)); endfor s = cache_stats()["pcre"]; for i in [1..10] pcre_match("x", "more#{n}-" + tostr(i)); endfor t = cache_stats()["pcre"]; pcre_match("x", "fill#{n}-1"); u = cache_stats()["pcre"]; pcre_match("x", "more#{n}-10"); v = cache_stats()["pcre"]; return {t["evictions"] - s["evictions"], t["entries"] - s["entries"], u["misses"] - t["misses"], v["hits"] - u["hits"]};|
+      assert_equal [10, 0, 1, 1], r
+    end
+  end
+
+  def test_that_parse_ansi_translates_tags_in_any_case_and_leaves_unknown_tags
+    run_test_as('programmer') do
+      assert_equal [27, '[31ma', 27, '[0mb[nosuch]c[red'], simplify(command(%Q|; return decode_binary(parse_ansi("[RED]a[Normal]b[nosuch]c[red"));|))
+      assert_equal [27, '[44m', 7], simplify(command(%Q|; return decode_binary(parse_ansi("[b:Blue][BEEP]"));|))
+    end
+  end
+
+  def test_that_parse_ansi_picks_a_random_colour_other_than_cyan
+    run_test_as('programmer') do
+      codes = ['[31m', '[32m', '[33m', '[34m', '[35m']
+      seen = simplify(command(%Q|; s = {}; for i in [1..100] s = setadd(s, decode_binary(parse_ansi("[Random]"))); endfor; return s;|))
+      assert seen.all? { |c| c.length == 2 && c[0] == 27 && codes.include?(c[1]) }
+    end
+  end
+
+  def test_that_parse_ansi_removes_nested_null_tags
+    run_test_as('programmer') do
+      assert_equal 'xy', simplify(command(%Q|; return parse_ansi("x[nu[null]ll]y");|))
+      assert_equal 'x[null]y', simplify(command(%Q|; return parse_ansi("x[nu[nu[null]ll]ll]y");|))
+    end
+  end
+
+  def test_that_remove_ansi_removes_tags_in_any_case_and_leaves_unknown_tags
+    run_test_as('programmer') do
+      assert_equal 'ab[nosuch]c[red', simplify(command(%Q|; return remove_ansi("[RED]a[b:Blue]b[nosuch]c[Random][NULL][red");|))
+      # Unlike parse_ansi(), remove_ansi() takes `[null]' out only once.
+      assert_equal 'x[null]y', simplify(command(%Q|; return remove_ansi("x[nu[null]ll]y");|))
+    end
+  end
+
+  def test_that_ansi24_tag_functions_handle_long_strings
+    run_test_as('programmer') do
+      r = simplify command %Q|; s = t = u = ""; for i in [1..100] s = s + "[Red]ab[nosuch]"; t = t + ansi24_named_sequence("red") + "ab[nosuch]"; u = u + "ab[nosuch]"; endfor; return {length(s), ansi24_replace_tags(s) == t, ansi24_remove_tags(s) == u};|
+      assert_equal [1500, 1, 1], r
+    end
+  end
+
 end
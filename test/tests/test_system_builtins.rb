@@ -32,4 +32,57 @@ class TestSystemBuiltins < Test::Unit::TestCase
     end
   end
 
+  def test_that_the_profiler_charges_each_call_path_separately
+    run_test_as('wizard') do
+      o = create(:nothing)
+      add_verb(o, ['player', 'xd', 'outer'], ['this', 'none', 'this'])
+      set_verb_code(o, 'outer') do |vc|
+        vc << %Q|for i in [1..10]|
+        vc << %Q|  this:inner(i);|
+        vc << %Q|endfor|
+      end
+      add_verb(o, ['player', 'xd', 'inner'], ['this', 'none', 'this'])
+      set_verb_code(o, 'inner') do |vc|
+        vc << %Q|return tostr(args[1]);|
+      end
+      simplify command %Q|; start_profiler();|
+      call(o, 'outer')
+      simplify command %Q|; stop_profiler();|
+      data = simplify command %Q|; return profiler_data();|
+      assert data.any? { |stack, calls| stack.last == 'tostr' && stack[-2] == [o, 'inner'] && calls == 10 }
+      calls = simplify command %Q|; return profiler_data("calls");|
+      assert calls.any? { |l| l.end_with?(";#{obj_ref(o)}:outer;#{obj_ref(o)}:inner 10") }
+      assert calls.any? { |l| l.end_with?(";#{obj_ref(o)}:outer;#{obj_ref(o)}:inner;tostr() 10") }
+      assert_equal E_INVARG, simplify(command(%Q|; return profiler_data("bogus");|))
+    end
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return start_profiler();|))
+      assert_equal E_PERM, simplify(command(%Q|; return profiler_data();|))
+    end
+  end
+
+  def test_that_function_stats_counts_calls_and_errors
+    run_test_as('wizard') do
+      stats = simplify command %Q|; reset_function_stats(); for i in [1..5] tostr(i); endfor; `length(1) ! ANY'; return {function_stats("tostr"), function_stats("length")};|
+      assert_equal [5, 0, 0], stats[0][0..2]
+      assert_equal [1, 1, 0], stats[1][0..2]
+      assert_equal 20, stats[0][4].length
+      assert_equal E_INVARG, simplify(command(%Q|; return function_stats("xyzzy");|))
+    end
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return function_stats();|))
+      assert_equal E_PERM, simplify(command(%Q|; return reset_function_stats();|))
+    end
+  end
+
+  def test_that_loop_stats_describes_the_main_loop
+    run_test_as('wizard') do
+      stats = simplify command %Q|; x = loop_stats(); return {x["passes"] > 0, mapkeys(x["phases"]), length(x["phases"]["tasks"][3]), typeof(x["input_queues"]) == MAP, typeof(x["waiting_tasks"]) == INT};|
+      assert_equal [1, ['checkpoint', 'children', 'connections', 'gc', 'idle', 'log', 'network', 'recycle', 'tasks'], 24, 1, 1], stats
+    end
+    run_test_as('programmer') do
+      assert_equal E_PERM, simplify(command(%Q|; return loop_stats();|))
+    end
+  end
+
 end
@@ -0,0 +1,186 @@
+require 'test_helper'
+require 'base64'
+require 'digest/sha1'
+require 'zlib'
+
+class TestWebsocket < Test::Unit::TestCase
+
+  def test_that_a_websocket_listener_refuses_requests_that_are_not_handshakes
+    with_websocket_listener do |port|
+      sock = TCPSocket.open(options['host'], port)
+      sock.write "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+      response = sock.read
+      assert_match %r{\AHTTP/1.1 400 }, response
+      assert_match %r{^Sec-WebSocket-Version: 13\r$}, response
+      sock.close
+    end
+  end
+
+  def test_that_a_websocket_connection_logs_in_and_runs_commands
+    with_websocket_listener do |port|
+      sock = websocket_connect(port)
+      sock.write websocket_frame(0x1, 'connect wizard')
+      sock.write websocket_frame(0x1, '; return 1 + 1;')
+      assert_equal [[0x1, '-=!-^-!=-'], [0x1, '{1, 2}'], [0x1, '-=!-v-!=-']], websocket_read(sock, 3)
+      # Each line of a message is a line of input.
+      sock.write websocket_frame(0x1, "; return 3;\n; return 4;")
+      assert_equal ['{1, 3}', '{1, 4}'], websocket_read(sock, 6).map { |f| f[1] }.reject { |m| m.start_with?('-=!-') }
+      sock.close
+    end
+  end
+
+  def test_that_fragmented_messages_are_reassembled_around_pings
+    with_websocket_listener do |port|
+      sock = websocket_connect(port)
+      sock.write websocket_frame(0x1, 'connect wizard')
+      sock.write websocket_frame(0x1, '; return ', false)
+      sock.write websocket_frame(0x9, 'ping')
+      sock.write websocket_frame(0x0, '"frag', false)
+      sock.write websocket_frame(0x0, 'ment";')
+      assert_equal [[0xA, 'ping'], [0x1, '-=!-^-!=-'], [0x1, '{1, "fragment"}'], [0x1, '-=!-v-!=-']], websocket_read(sock, 4)
+      sock.close
+    end
+  end
+
+  def test_that_a_close_frame_is_echoed_and_the_connection_closed
+    with_websocket_listener do |port|
+      sock = websocket_connect(port)
+      sock.write websocket_frame(0x1, 'connect wizard')
+      sock.write websocket_frame(0x8, [1000].pack('n'))
+      assert_equal [[0x8, [1000].pack('n')]], websocket_read(sock, 1)
+      assert_equal '', sock.read
+      sock.close
+    end
+  end
+
+  def test_that_protocol_errors_close_the_connection
+    with_websocket_listener do |port|
+      sock = websocket_connect(port)
+      # A control frame may not be fragmented.
+      sock.write websocket_frame(0x9, 'ping', false)
+      assert_equal [[0x8, [1002].pack('n')]], websocket_read(sock, 1)
+      assert_equal '', sock.read
+      sock.close
+    end
+  end
+
+  def test_that_permessage_deflate_compresses_messages_both_ways
+    with_websocket_listener do |port|
+      sock = websocket_connect(port, 'permessage-deflate; client_max_window_bits')
+      sock.write websocket_frame(0x1, deflate('connect wizard'), true, true)
+      long = 'x' * 100
+      sock.write websocket_frame(0x1, deflate(%Q|; return "#{long}";|), true, true)
+      assert_equal [[0x1, '-=!-^-!=-', false], [0x1, %Q|{1, "#{long}"}|, true], [0x1, '-=!-v-!=-', false]], websocket_read(sock, 3, true)
+      # A compressed message may be split across frames; only the first is marked.
+      message = deflate('; return "fragment";')
+      sock.write websocket_frame(0x1, message[0, 5], false, true)
+      sock.write websocket_frame(0x0, message[5..-1])
+      assert_equal [[0x1, '-=!-^-!=-'], [0x1, '{1, "fragment"}'], [0x1, '-=!-v-!=-']], websocket_read(sock, 3)
+      sock.close
+    end
+  end
+
+  def test_that_compressed_frames_are_refused_unless_negotiated
+    with_websocket_listener do |port|
+      sock = websocket_connect(port)
+      sock.write websocket_frame(0x1, deflate('connect wizard'), true, true)
+      assert_equal [[0x8, [1002].pack('n')]], websocket_read(sock, 1)
+      assert_equal '', sock.read
+      sock.close
+    end
+  end
+
+  def test_that_an_oversized_frame_closes_the_connection_with_1009
+    with_websocket_listener do |port|
+      sock = websocket_connect(port)
+      sock.write websocket_frame(0x1, 'connect wizard')
+      # Only the header is sent; the length alone is too much.
+      sock.write [0x81, 0x80 | 127, 5 * 1024 * 1024 + 1].pack('CCQ>') + Random.new.bytes(4)
+      assert_equal [[0x8, [1009].pack('n')]], websocket_read(sock, 1)
+      assert_equal '', sock.read
+      sock.close
+    end
+  end
+
+  private
+
+  def with_websocket_listener
+    run_test_as('wizard') do
+      port = options['port'] + 1
+      assert_equal port, simplify(command(%Q|; return listen(#0, #{port}, 0, 0, "websocket");|))
+      begin
+        yield port
+      ensure
+        command("; unlisten(#{port});")
+      end
+    end
+  end
+
+  def websocket_connect(port, extensions = nil)
+    key = Base64.strict_encode64(Random.new.bytes(16))
+    sock = TCPSocket.open(options['host'], port)
+    sock.write "GET /chat HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n" \
+               "Sec-WebSocket-Key: #{key}\r\nSec-WebSocket-Version: 13\r\n" \
+               "#{extensions ? "Sec-WebSocket-Extensions: #{extensions}\r\n" : ''}\r\n"
+    response = ''
+    response << sock.readpartial(1) until response.end_with?("\r\n\r\n")
+    accept = Base64.strict_encode64(Digest::SHA1.digest(key + '258EAFA5-E914-47DA-95CA-C5AB0DC85B11'))
+    assert_match %r{\AHTTP/1.1 101 }, response
+    assert_match %r{^Sec-WebSocket-Accept: #{Regexp.escape(accept)}\r$}, response
+    if extensions
+      assert_match %r{^Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover; client_no_context_takeover\r$}, response
+    else
+      assert_no_match %r{^Sec-WebSocket-Extensions:}, response
+    end
+    sock
+  end
+
+  # A message compressed as permessage-deflate sends it: the final empty
+  # block of a sync flush is left off.
+  def deflate(message)
+    z = Zlib::Deflate.new(Zlib::DEFAULT_COMPRESSION, -Zlib::MAX_WBITS)
+    data = z.deflate(message, Zlib::SYNC_FLUSH)
+    z.close
+    data[0...-4]
+  end
+
+  def inflate(data)
+    z = Zlib::Inflate.new(-Zlib::MAX_WBITS)
+    message = z.inflate(data + "\x00\x00\xff\xff".b)
+    z.close
+    message
+  end
+
+  # Frames sent by a client are always masked.
+  def websocket_frame(opcode, payload, fin = true, compressed = false)
+    payload = payload.b
+    mask = Random.new.bytes(4)
+    frame = [(fin ? 0x80 : 0) | (compressed ? 0x40 : 0) | opcode].pack('C')
+    if payload.length < 126
+      frame << [0x80 | payload.length].pack('C')
+    elsif payload.length < 65536
+      frame << [0x80 | 126, payload.length].pack('Cn')
+    else
+      frame << [0x80 | 127, payload.length].pack('CQ>')
+    end
+    frame << mask
+    frame << payload.bytes.each_with_index.map { |b, i| b ^ mask.getbyte(i % 4) }.pack('C*')
+  end
+
+  # Returns COUNT frames as [opcode, payload] pairs, with compressed
+  # payloads inflated; if FLAGS, whether each was compressed is added.
+  def websocket_read(sock, count, flags = false)
+    (1..count).map do
+      b0, b1 = sock.read(2).unpack('CC')
+      assert_equal 0, b1 & 0x80, 'frames sent by the server are not masked'
+      length = b1 & 0x7F
+      length = sock.read(2).unpack('n')[0] if length == 126
+      length = sock.read(8).unpack('Q>')[0] if length == 127
+      payload = sock.read(length)
+      compressed = b0 & 0x40 != 0
+      payload = inflate(payload) if compressed
+      flags ? [b0 & 0x0F, payload, compressed] : [b0 & 0x0F, payload]
+    end
+  end
+
+end